@@ -94,6 +94,7 @@ stage1Packages = do
              , containers
              , deepseq
              , directory
+             , eventlogDecode
              , filepath
              , ghc
              , ghcCompact
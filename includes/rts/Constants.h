@@ -307,6 +307,13 @@
  */
 #define TSO_ALLOC_LIMIT 256
 
+/*
+ * Set by the non-threaded RTS I/O backend (posix/Select.c) when it has
+ * told the kernel about the descriptor a thread in the blocked queue is
+ * waiting on.  Cleared by waitRead#/waitWrite#.
+ */
+#define TSO_IO_REGISTERED 512
+
 /*
  * The number of times we spin in a spin lock before yielding (see
  * #3758).  To tune this value, use the benchmark in #3758: run the
@@ -181,12 +181,22 @@
 
 #define EVENT_USER_BINARY_MSG              181
 
+#define EVENT_STM_COUNTERS                 182 /* (starts, commits,
+                                                   conflict, invalid,
+                                                   exception, retries,
+                                                   tvars, wakeups) */
+
+#define EVENT_GC_WORK_STATS                183 /* (blocks_stolen,
+                                                   objs_shared,
+                                                   objs_stolen,
+                                                   idle_time) */
+
 /*
  * The highest event code +1 that ghc itself emits. Note that some event
  * ranges higher than this are reserved but not currently emitted by ghc.
  * This must match the size of the EventDesc[] array in EventLog.c
  */
-#define NUM_GHC_EVENT_TAGS        182
+#define NUM_GHC_EVENT_TAGS        184
 
 #if 0  /* DEPRECATED EVENTS: */
 /* we don't actually need to record the thread, it's implicit */
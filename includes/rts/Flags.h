@@ -37,6 +37,9 @@ typedef struct _GC_FLAGS {
 #define SUMMARY_GC_STATS 3
 #define VERBOSE_GC_STATS 4
 
+/* The largest value of --gc-prefetch, see rts/sm/Scav.c */
+#define GC_PREFETCH_MAX  32
+
     uint32_t     maxStkSize;         /* in *words* */
     uint32_t     initialStkSize;     /* in *words* */
     uint32_t     stkChunkSize;       /* in *words* */
@@ -60,6 +63,8 @@ typedef struct _GC_FLAGS {
 
     bool sweep;		/* use "mostly mark-sweep" instead of copying
                                  * for the oldest generation */
+    uint32_t prefetchDepth;     /* fields the scavenger prefetches ahead,
+                                 * 0 <=> no prefetching */
     bool ringBell;
 
     Time    idleGCDelayTime;    /* units: TIME_RESOLUTION */
@@ -85,6 +90,8 @@ typedef struct _GC_FLAGS {
 
     bool numa;                   /* Use NUMA */
     StgWord numaMask;
+
+    StgWord hugePageSize;        /* in bytes, 0 <=> no huge pages */
 } GC_FLAGS;
 
 /* See Note [Synchronization of flags and base APIs] */
@@ -155,6 +162,9 @@ typedef struct _PROFILING_FLAGS {
     const char*         retainerSelector;
     const char*         bioSelector;
 
+    StgWord64   heapSampleBytes;  /* sample the allocation, one byte in this
+                                     many, instead of taking censuses
+                                     (0 = off) */
 } PROFILING_FLAGS;
 
 #define TRACE_NONE      0
@@ -171,6 +181,10 @@ typedef struct _TRACE_FLAGS {
     bool sparks_full;    /* trace spark events 100% accurately */
     bool user;           /* trace user events (emitted from Haskell code) */
     char *trace_output;  /* output filename for eventlog */
+    bool drop_events;    /* drop events when the eventlog writer lags */
+    char *eventlog_socket; /* stream the eventlog to this Unix socket */
+    Time flush_interval; /* units: TIME_RESOLUTION, 0 = only when full */
+    bool compact;        /* write the compact encoding of the eventlog */
 } TRACE_FLAGS;
 
 /* See Note [Synchronization of flags and base APIs] */
@@ -211,6 +225,11 @@ typedef struct _MISC_FLAGS {
     bool linkerAlwaysPic;        /* Assume the object code is always PIC */
     StgWord linkerMemBase;       /* address to ask the OS for memory
                                   * for the linker, NULL ==> off */
+    uint32_t linkerThreads;      /* threads the linker resolves objects on,
+                                  * 0 ==> number of processors */
+    char *linkerIndexCache;      /* directory to cache archive indices in,
+                                  * NULL ==> off */
+    bool linkerLazyArchives;     /* read archive members only when needed */
 } MISC_FLAGS;
 
 /* See Note [Synchronization of flags and base APIs] */
@@ -153,6 +153,8 @@ typedef struct bdescr_ {
 #define BF_SWEPT     256
 /* Block is part of a Compact */
 #define BF_COMPACT   512
+/* Block is mapped from a file (see Note [Compacts in files]) */
+#define BF_MAPPED    1024
 /* Maximum flag value (do not define anything higher than this!) */
 #define BF_FLAG_MAX  (1 << 15)
 
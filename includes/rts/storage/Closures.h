@@ -358,6 +358,8 @@ struct StgTRecHeader_ {
   StgHeader                  header;
   struct StgTRecHeader_     *enclosing_trec;
   StgTRecChunk              *current_chunk;
+  StgArrBytes               *index;  /* see Note [TRec index] in STM.c */
+  StgWord                    read_version; /* Note [STM version clock] */
   TRecState                  state;
 };
 
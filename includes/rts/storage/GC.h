@@ -214,6 +214,24 @@ extern W_ large_alloc_lim;
 void performGC(void);
 void performMajorGC(void);
 
+/* -----------------------------------------------------------------------------
+   Compact regions in files
+
+   compactWriteFile writes the compact whose first block is given, with
+   its root, to a file.  Returns 0, or -1 with errno set on failure.
+
+   compactMapFile maps such a file back into the heap.  It returns the
+   first block of the new compact and sets *root to the root at its old
+   address; both must then be passed to compactFixupPointers#.  Returns
+   NULL with errno set on failure.
+
+   See Note [Compacts in files] in rts/sm/CNF.c.
+   -------------------------------------------------------------------------- */
+
+int compactWriteFile (StgCompactNFDataBlock *first, StgClosure *root,
+                      const char *path);
+StgCompactNFDataBlock *compactMapFile (const char *path, StgClosure **root);
+
 /* -----------------------------------------------------------------------------
    The CAF table - used to let us revert CAFs in GHCi
    -------------------------------------------------------------------------- */
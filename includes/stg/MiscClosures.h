@@ -148,6 +148,7 @@ RTS_ENTRY(stg_TREC_HEADER);
 RTS_ENTRY(stg_END_STM_WATCH_QUEUE);
 RTS_ENTRY(stg_END_STM_CHUNK_LIST);
 RTS_ENTRY(stg_NO_TREC);
+RTS_ENTRY(stg_NO_TREC_INDEX);
 RTS_ENTRY(stg_COMPACT_NFDATA_CLEAN);
 RTS_ENTRY(stg_COMPACT_NFDATA_DIRTY);
 RTS_ENTRY(stg_SRT_1);
@@ -178,6 +179,7 @@ RTS_CLOSURE(stg_forceIO_closure);
 RTS_CLOSURE(stg_END_STM_WATCH_QUEUE_closure);
 RTS_CLOSURE(stg_END_STM_CHUNK_LIST_closure);
 RTS_CLOSURE(stg_NO_TREC_closure);
+RTS_CLOSURE(stg_NO_TREC_INDEX_closure);
 
 RTS_ENTRY(stg_NO_FINALIZER_entry);
 
@@ -24,6 +24,8 @@ module GHC.Compact.Serialized(
   withSerializedCompact,
   importCompact,
   importCompactByteStrings,
+  writeCompactFile,
+  importCompactFile,
 ) where
 
 import GHC.Prim
@@ -38,6 +40,11 @@ import Data.ByteString.Internal(toForeignPtr)
 import Data.IORef(newIORef, readIORef, writeIORef)
 import Foreign.ForeignPtr(withForeignPtr)
 import Foreign.Marshal.Utils(copyBytes)
+import Foreign.Marshal.Alloc(alloca)
+import Foreign.Storable(peek)
+import Foreign.C.Error(throwErrnoPathIfMinus1_, throwErrnoPathIfNull)
+import Foreign.C.String(CString, withCString)
+import Foreign.C.Types(CInt(..))
 
 import GHC.Compact
 
@@ -208,3 +215,35 @@ importCompactByteStrings serialized stringList =
             copyBytes to (from `plusPtr` off) (fromIntegral size)
           writeIORef state rest
     importCompact serialized filler
+
+foreign import ccall unsafe "compactWriteFile"
+  c_compactWriteFile :: Ptr a -> Ptr a -> CString -> IO CInt
+
+foreign import ccall unsafe "compactMapFile"
+  c_compactMapFile :: CString -> Ptr (Ptr a) -> IO (Ptr a)
+
+-- | Write the 'Compact' to a file, in a layout that 'importCompactFile'
+-- can map straight back into memory.  As with 'importCompact', the file
+-- can only be imported by the same binary that wrote it.
+writeCompactFile :: FilePath -> Compact a -> IO ()
+writeCompactFile path c = withSerializedCompact c $ \sc ->
+  case serializedCompactBlockList sc of
+    [] -> return ()
+    ((firstBlock, _):_) ->
+      withCString path $ \cpath ->
+        throwErrnoPathIfMinus1_ "writeCompactFile" path $
+          c_compactWriteFile firstBlock (serializedCompactRoot sc) cpath
+
+-- | Import a 'Compact' written by 'writeCompactFile'.  Where possible the
+-- blocks of the file are mapped into memory copy-on-write rather than
+-- read, so pages of the 'Compact' that are never written to are loaded
+-- on demand, and shared with any other process that imports the same
+-- file.  Throws an 'IOError' if the file can't be read or is not a
+-- 'Compact', and returns 'Nothing' if its pointers could not be adjusted.
+importCompactFile :: FilePath -> IO (Maybe (Compact a))
+importCompactFile path =
+  withCString path $ \cpath -> alloca $ \proot -> do
+    Ptr firstBlock <- throwErrnoPathIfNull "importCompactFile" path $
+                        c_compactMapFile cpath proot
+    Ptr rootAddr <- peek proot
+    IO (fixupPointers firstBlock rootAddr)
@@ -0,0 +1,56 @@
+module Main where
+
+import Control.Exception
+import System.Mem
+
+import Data.Array
+import qualified Data.Array.Unboxed as U
+
+import GHC.Compact
+import GHC.Compact.Serialized
+
+assertFail :: String -> IO ()
+assertFail msg = throwIO $ AssertionFailed msg
+
+assertEquals :: (Eq a, Show a) => a -> a -> IO ()
+assertEquals expected actual =
+  if expected == actual then return ()
+  else assertFail $ "expected " ++ (show expected)
+       ++ ", got " ++ (show actual)
+
+main = do
+  let val = [ (i, show i) | i <- [1..50000] ] :: [(Int, String)]
+
+  -- big blocks, so that they get mapped rather than read
+  cnf <- compactSized (1024 * 1024) True val
+  writeCompactFile "compact_file.cnf" cnf
+  performMajorGC
+
+  -- the original is still alive, so the import has to be fixed up
+  mcnf <- importCompactFile "compact_file.cnf"
+  case mcnf of
+    Nothing -> assertFail "import failed"
+    Just cnf' -> assertEquals val (getCompact cnf')
+  assertEquals (length val) (length (getCompact cnf))
+
+  -- the copy is freed (and unmapped) with everything else
+  performMajorGC
+
+  -- arrays of several megabytes get blocks bigger than a megablock
+  let big = ( U.listArray (1, 1000000) [1..] :: U.UArray Int Int
+            , listArray (1, 1000000) [1..] :: Array Int Int )
+  bigcnf <- compact big
+  writeCompactFile "compact_file_big.cnf" bigcnf
+  performMajorGC
+
+  mbig <- importCompactFile "compact_file_big.cnf"
+  case mbig of
+    Nothing -> assertFail "import of big arrays failed"
+    Just big' -> assertEquals big (getCompact big')
+  assertEquals (bounds (snd big)) (bounds (snd (getCompact bigcnf)))
+  performMajorGC
+
+  r <- try (importCompactFile "compact_file.hs") :: IO (Either IOError (Maybe (Compact ())))
+  case r of
+    Left _ -> return ()
+    Right _ -> assertFail "imported a file that is not a compact"
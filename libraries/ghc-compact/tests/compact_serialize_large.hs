@@ -0,0 +1,50 @@
+module Main where
+
+import Control.Exception
+import Control.Monad
+import System.Mem
+
+import Data.IORef
+import Data.ByteString (ByteString, packCStringLen)
+import Foreign.Ptr
+
+import GHC.Compact
+import GHC.Compact.Serialized
+
+-- Like compact_serialize, but the compact is big enough for the fixup
+-- to be split across several threads, and the original is kept alive
+-- so that the import can't land at the same address.
+
+assertFail :: String -> IO ()
+assertFail msg = throwIO $ AssertionFailed msg
+
+assertEquals :: (Eq a, Show a) => a -> a -> IO ()
+assertEquals expected actual =
+  if expected == actual then return ()
+  else assertFail $ "expected " ++ (show expected)
+       ++ ", got " ++ (show actual)
+
+main = do
+  let val = [ (i, Just (show i)) | i <- [1..100000] ] :: [(Int, Maybe String)]
+
+  cnf <- compactSized 4096 True val
+
+  bytestrref <- newIORef undefined
+  scref <- newIORef undefined
+  withSerializedCompact cnf $ \sc -> do
+    writeIORef scref sc
+    bytestrs <- forM (serializedCompactBlockList sc) $ \(ptr, size) -> do
+      packCStringLen (castPtr ptr, fromIntegral size)
+    writeIORef bytestrref bytestrs
+
+  bytestrs <- readIORef bytestrref
+  sc <- readIORef scref
+  performMajorGC
+
+  mcnf <- importCompactByteStrings sc bytestrs
+  case mcnf of
+    Nothing -> assertFail "import failed"
+    Just cnf' -> assertEquals val (getCompact cnf')
+
+  -- keep the original alive until the copy has been checked
+  assertEquals (length val) (length (getCompact cnf))
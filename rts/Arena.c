@@ -23,6 +23,7 @@
 
 #include "RtsUtils.h"
 #include "Arena.h"
+#include "sm/Storage.h"
 
 // Each arena struct is allocated using malloc().
 struct _Arena {
@@ -32,7 +33,8 @@ struct _Arena {
 };
 
 // We like to keep track of how many blocks we've allocated for
-// Storage.c:memInventory().
+// Storage.c:memInventory().  Protected by sm_mutex, because arenas are
+// used on several GC threads at once in a parallel heap census.
 static long arena_blocks = 0;
 
 // Begin a new arena
@@ -42,11 +44,13 @@ newArena( void )
     Arena *arena;
 
     arena = stgMallocBytes(sizeof(Arena), "newArena");
-    arena->current = allocBlock_lock();
+    ACQUIRE_SM_LOCK;
+    arena->current = allocBlock();
+    arena_blocks++;
+    RELEASE_SM_LOCK;
     arena->current->link = NULL;
     arena->free = arena->current->start;
     arena->lim  = arena->current->start + BLOCK_SIZE_W;
-    arena_blocks++;
 
     return arena;
 }
@@ -81,8 +85,10 @@ arenaAlloc( Arena *arena, size_t size )
     } else {
         // allocate a fresh block...
         req_blocks =  (W_)BLOCK_ROUND_UP(size) / BLOCK_SIZE;
-        bd = allocGroup_lock(req_blocks);
+        ACQUIRE_SM_LOCK;
+        bd = allocGroup(req_blocks);
         arena_blocks += req_blocks;
+        RELEASE_SM_LOCK;
 
         bd->gen_no  = 0;
         bd->gen     = NULL;
@@ -103,12 +109,14 @@ arenaFree( Arena *arena )
 {
     bdescr *bd, *next;
 
+    ACQUIRE_SM_LOCK;
     for (bd = arena->current; bd != NULL; bd = next) {
         next = bd->link;
         arena_blocks -= bd->blocks;
         ASSERT(arena_blocks >= 0);
-        freeGroup_lock(bd);
+        freeGroup(bd);
     }
+    RELEASE_SM_LOCK;
     stgFree(arena);
 }
 
@@ -18,4 +18,30 @@
  */
 RTS_PRIVATE void awaitEvent(bool wait);  /* In posix/Select.c or
                                           * win32/AwaitEvent.c */
+
+#if !defined(mingw32_HOST_OS)
+/* resetAwaitEvent()
+ *
+ * Discards the kernel state of the I/O backend in the child of
+ * forkProcess#.
+ *
+ * Called from STG :  NO
+ * Locks assumed   :  sched_mutex
+ */
+RTS_PRIVATE void resetAwaitEvent(void);  /* In posix/Select.c */
+
+/* markAwaitEvent(evac, user), removeAwaitingIO(tso)
+ *
+ * The epoll backend takes the threads blocked on I/O off blocked_queue
+ * and keeps them itself, flagged TSO_IO_REGISTERED (see
+ * posix/await/Epoll.c).  markAwaitEvent() evacuates them as roots for
+ * the GC, and removeAwaitingIO() takes one off when it gets an
+ * exception.
+ *
+ * Called from STG :  NO
+ * Locks assumed   :  sched_mutex
+ */
+RTS_PRIVATE void markAwaitEvent(evac_fn evac, void *user);
+RTS_PRIVATE void removeAwaitingIO(StgTSO *tso);
+#endif
 #endif
@@ -91,13 +91,106 @@ globalWorkToDo (void)
 #endif
 
 #if defined(THREADED_RTS)
+/* The most sparks that findSpark steals in one go */
+#define MAX_STOLEN_SPARKS 32
+
+/* A xorshift generator: good enough to spread the thieves out */
+STATIC_INLINE uint32_t
+stealRandom (Capability *cap)
+{
+    uint32_t x = cap->steal_seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    cap->steal_seed = x;
+    return x;
+}
+
+/* Steal a spark from the other capabilities on the NUMA node of cap, or
+ * from those on the other nodes if !local.  We take half of the victim's
+ * sparks: one to run, and the rest go into our own pool.  Sets *retry if
+ * we lost a race for a spark, and *seen if any of the spark pools had
+ * sparks. */
+static StgClosurePtr
+stealSpark (Capability *cap, bool local, bool *retry, bool *seen)
+{
+  Capability *robbed;
+  StgClosurePtr spark, stolen[MAX_STOLEN_SPARKS];
+  uint32_t i, j, n, start, max;
+  long room;
+
+  if (seen != NULL) {
+      *seen = false;
+  }
+
+  // Everything but the spark we run must fit in our own pool, which only
+  // we can add to.
+  room = (long)cap->sparks->size - 1 - sparkPoolSize(cap->sparks);
+  max = (uint32_t)stg_max(1, stg_min(room + 1, MAX_STOLEN_SPARKS));
+
+  /* visit the other capabilities in sequence, from a random place so that
+     idle capabilities don't all go for the same victim, until a theft
+     succeeds. */
+  start = stealRandom(cap) % n_capabilities;
+  for ( j=0 ; j < n_capabilities ; j++ ) {
+      robbed = capabilities[(start + j) % n_capabilities];
+      if (cap == robbed)  // ourselves...
+          continue;
+
+      if ((robbed->node == cap->node) != local)
+          continue;
+
+      if (emptySparkPoolCap(robbed)) // nothing to steal here
+          continue;
+
+      if (seen != NULL) {
+          *seen = true;
+      }
+
+      spark = NULL;
+      do {
+          n = tryStealSparks(robbed->sparks, stolen, max);
+          if (local) {
+              cap->migration_stats.sparks_local += n;
+          } else {
+              cap->migration_stats.sparks_remote += n;
+          }
+          for (i = 0; i < n; i++) {
+              if (fizzledSpark(stolen[i])) {
+                  cap->spark_stats.fizzled++;
+                  traceEventSparkFizzle(cap);
+              } else if (spark == NULL) {
+                  spark = stolen[i];
+              } else {
+                  // there is room, see above
+                  pushWSDeque(cap->sparks, stolen[i]);
+              }
+          }
+          // if they all fizzled, go back for more
+      } while (spark == NULL && n > 0);
+
+      if (spark == NULL && !emptySparkPoolCap(robbed)) {
+          // we conflicted with another thread while trying to steal;
+          // try again later.
+          *retry = true;
+      }
+
+      if (spark != NULL) {
+          cap->spark_stats.converted++;
+          traceEventSparkSteal(cap, robbed->no);
+
+          return spark;
+      }
+      // otherwise: no success, try next one
+  }
+  return NULL;
+}
+
 StgClosure *
 findSpark (Capability *cap)
 {
-  Capability *robbed;
   StgClosurePtr spark;
-  bool retry;
-  uint32_t i = 0;
+  bool retry, local_sparks;
 
   if (!emptyRunQueue(cap) || cap->n_returning_tasks != 0) {
       // If there are other threads, don't try to run any new
@@ -139,35 +232,15 @@ findSpark (Capability *cap)
                  "cap %d: Trying to steal work from other capabilities",
                  cap->no);
 
-      /* visit cap.s 0..n-1 in sequence until a theft succeeds. We could
-      start at a random place instead of 0 as well.  */
-      for ( i=0 ; i < n_capabilities ; i++ ) {
-          robbed = capabilities[i];
-          if (cap == robbed)  // ourselves...
-              continue;
-
-          if (emptySparkPoolCap(robbed)) // nothing to steal here
-              continue;
-
-          spark = tryStealSpark(robbed->sparks);
-          while (spark != NULL && fizzledSpark(spark)) {
-              cap->spark_stats.fizzled++;
-              traceEventSparkFizzle(cap);
-              spark = tryStealSpark(robbed->sparks);
-          }
-          if (spark == NULL && !emptySparkPoolCap(robbed)) {
-              // we conflicted with another thread while trying to steal;
-              // try again later.
-              retry = true;
-          }
-
-          if (spark != NULL) {
-              cap->spark_stats.converted++;
-              traceEventSparkSteal(cap, robbed->no);
-
-              return spark;
-          }
-          // otherwise: no success, try next one
+      // Only steal from another NUMA node when there is nothing to
+      // steal on ours: see Note [NUMA-aware work stealing] in Schedule.c
+      spark = stealSpark(cap, true, &retry, &local_sparks);
+      if (spark == NULL && !local_sparks && emptySparkPoolCap(cap)
+          && n_numa_nodes > 1) {
+          spark = stealSpark(cap, false, &retry, NULL);
+      }
+      if (spark != NULL) {
+          return spark;
       }
   } while (retry);
 
@@ -274,6 +347,9 @@ initCapability (Capability *cap, uint32_t i)
     cap->spark_stats.converted  = 0;
     cap->spark_stats.gcd        = 0;
     cap->spark_stats.fizzled    = 0;
+    memset(&cap->migration_stats, 0, sizeof(MigrationCounters));
+    cap->steal_seed = (i + 1) * 2654435761U; // never 0
+    cap->n_stable_ptr_free = 0;
 #if !defined(mingw32_HOST_OS)
     cap->io_manager_control_wr_fd = -1;
 #endif
@@ -301,6 +377,7 @@ initCapability (Capability *cap, uint32_t i)
     cap->free_trec_chunks = END_STM_CHUNK_LIST;
     cap->free_trec_headers = NO_TREC;
     cap->transaction_tokens = 0;
+    memset(&cap->stm_stats, 0, sizeof(StmCounters));
     cap->context_switch = 0;
     cap->pinned_object_block = NULL;
     cap->pinned_object_blocks = NULL;
@@ -861,6 +938,7 @@ yieldCapability (Capability** pCap, Task *task, bool gcAllowed)
                 gcWorkerThread(cap);
                 traceEventGcEnd(cap);
                 traceSparkCounters(cap);
+                traceStmCounters(cap);
                 // See Note [migrated bound threads 2]
                 if (task->cap == cap) {
                     return true;
@@ -1128,6 +1206,7 @@ freeCapability (Capability *cap)
 #if defined(THREADED_RTS)
     freeSparkPool(cap->sparks);
 #endif
+    traceStmCounters(cap);
     traceCapsetRemoveCap(CAPSET_OSPROCESS_DEFAULT, cap->no);
     traceCapsetRemoveCap(CAPSET_CLOCKDOMAIN_DEFAULT, cap->no);
     traceCapDelete(cap);
@@ -23,9 +23,20 @@
 #include "sm/GC.h" // for evac_fn
 #include "Task.h"
 #include "Sparks.h"
+#include "STM.h"
+#include "StablePtr.h"
 
 #include "BeginPrivate.h"
 
+/* Stats on work that moved between capabilities, on the same NUMA node
+ * and across nodes (see Note [NUMA-aware work stealing] in Schedule.c) */
+typedef struct {
+    StgWord threads_local;   // threads given away by schedulePushWork
+    StgWord threads_remote;
+    StgWord sparks_local;    // sparks stolen by findSpark
+    StgWord sparks_remote;
+} MigrationCounters;
+
 struct Capability_ {
     // State required by the STG virtual machine when running Haskell
     // code.  During STG execution, the BaseReg register always points
@@ -146,6 +157,18 @@ struct Capability_ {
 
     // Stats on spark creation/conversion
     SparkCounters spark_stats;
+
+    // Stats on threads and sparks moved between capabilities
+    MigrationCounters migration_stats;
+
+    // State of the random number generator that findSpark uses to
+    // choose where to steal from
+    uint32_t steal_seed;
+
+    // Free entries of the stable pointer table owned by this capability
+    // (see Note [Per-capability stable pointers] in StablePtr.c)
+    StgWord stable_ptr_free[STABLE_PTR_CACHE_SIZE];
+    uint32_t n_stable_ptr_free;
 #if !defined(mingw32_HOST_OS)
     // IO manager for this cap
     int io_manager_control_wr_fd;
@@ -157,6 +180,7 @@ struct Capability_ {
     StgTRecChunk *free_trec_chunks;
     StgTRecHeader *free_trec_headers;
     uint32_t transaction_tokens;
+    StmCounters stm_stats;
 } // typedef Capability is defined in RtsAPI.h
   // We never want a Capability to overlap a cache line with anything
   // else, so round it up to a cache line size:
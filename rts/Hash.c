@@ -1,11 +1,25 @@
 /*-----------------------------------------------------------------------------
  *
  * (c) The AQUA Project, Glasgow University, 1995-1998
- * (c) The GHC Team, 1999
+ * (c) The GHC Team, 1999-2019
  *
- * Dynamically expanding linear hash tables, as described in
- * Per-\AAke Larson, ``Dynamic Hash Tables,'' CACM 31(4), April 1988,
- * pp. 446 -- 457.
+ * Open-addressing hash tables.
+ *
+ * The table is an array of slots holding (key, data) pairs, divided into
+ * groups of HGROUPSIZE slots, plus one control byte per slot.  A control
+ * byte is either CTRL_EMPTY, CTRL_DELETED (a tombstone), or the low 7
+ * bits of the hash of the key in the slot.  A lookup hashes the key
+ * once, and then compares the 7-bit tag against all the control bytes
+ * of a group at once (with SSE2 where available), so it only touches a
+ * slot when its tag matches, and usually only one group.  This is the
+ * scheme of Google's SwissTable / Abseil flat_hash_map.
+ *
+ * Groups are probed in triangular order (+1, +2, +3, ... groups), which
+ * visits every group when the number of groups is a power of 2.  A probe
+ * stops at the first group containing an empty slot, so removal can only
+ * mark a slot empty if its group already contains an empty slot;
+ * otherwise it leaves a tombstone.  Tombstones are discarded when the
+ * table is rehashed.
  * -------------------------------------------------------------------------- */
 
 #include "PosixSource.h"
@@ -17,84 +31,69 @@
 
 #include <string.h>
 
-#define HSEGSIZE    1024    /* Size of a single hash table segment */
-                            /* Also the minimum size of a hash table */
-#define HDIRSIZE    1024    /* Size of the segment directory */
-                            /* Maximum hash table size is HSEGSIZE * HDIRSIZE */
-#define HLOAD       5       /* Maximum average load of a single hash bucket */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define HGROUPSIZE  16      /* Number of slots in a group */
+#define HMINSIZE    64      /* Minimum (and initial) number of slots */
 
-#define HCHUNK      (1024 * sizeof(W_) / sizeof(HashList))
-                            /* Number of HashList cells to allocate in one go */
+/* We rehash when more than 7/8 of the slots are full or tombstones */
+#define HMAXLOAD(capacity) ((capacity) - (capacity) / 8)
 
+#define CTRL_EMPTY   ((uint8_t)0x80)
+#define CTRL_DELETED ((uint8_t)0xfe)
+/* A full slot has the 7-bit tag of the hash of its key, 0x00 - 0x7f */
+#define CTRL_IS_FULL(c) (((c) & 0x80) == 0)
 
-/* Linked list of (key, data) pairs for separate chaining */
-typedef struct hashlist {
+typedef struct hashslot {
     StgWord key;
     const void *data;
-    struct hashlist *next;  /* Next cell in bucket chain (same hash value) */
-} HashList;
-
-typedef struct chunklist {
-  HashList *chunk;
-  struct chunklist *next;
-} HashListChunk;
+} HashSlot;
 
 struct hashtable {
-    int split;              /* Next bucket to split when expanding */
-    int max;                /* Max bucket of smaller table */
-    int mask1;              /* Mask for doing the mod of h_1 (smaller table) */
-    int mask2;              /* Mask for doing the mod of h_2 (larger table) */
-    int kcount;             /* Number of keys */
-    int bcount;             /* Number of buckets */
-    HashList **dir[HDIRSIZE];   /* Directory of segments */
-    HashList *freeList;         /* free list of HashLists */
-    HashListChunk *chunks;
+    uint8_t *ctrl;              /* Control bytes, one per slot */
+    HashSlot *slots;            /* The (key, data) pairs */
+    StgWord mask;               /* Number of groups - 1 */
+    StgWord capacity;           /* Number of slots, a power of 2 */
+    StgWord growth_left;        /* Empty slots we can fill before rehashing */
+    int kcount;                 /* Number of keys */
     HashFunction *hash;         /* hash function */
     CompareFunction *compare;   /* key comparison function */
 };
 
 /* -----------------------------------------------------------------------------
- * Hash first using the smaller table.  If the bucket is less than the
- * next bucket to be split, re-hash using the larger table.
+ * Hash functions.  These return a full hash of the key: the table uses
+ * the low 7 bits as the tag of the slot and the rest to pick the group.
  * -------------------------------------------------------------------------- */
 
-int
-hashWord(const HashTable *table, StgWord key)
+StgWord
+hashWord(const HashTable *table STG_UNUSED, StgWord key)
 {
-    int bucket;
+    StgWord h;
 
     /* Strip the boring zero bits */
     key /= sizeof(StgWord);
 
-    /* Mod the size of the hash table (a power of 2) */
-    bucket = key & table->mask1;
-
-    if (bucket < table->split) {
-        /* Mod the size of the expanded hash table (also a power of 2) */
-        bucket = key & table->mask2;
-    }
-    return bucket;
+    /* Fibonacci hashing, folding the well-mixed high bits down */
+#if SIZEOF_VOID_P == 8
+    h = key * UINT64_C(0x9e3779b97f4a7c15);
+    return h ^ (h >> 32);
+#else
+    h = key * 0x9e3779b9U;
+    return h ^ (h >> 16);
+#endif
 }
 
-int
-hashStr(const HashTable *table, StgWord w)
+StgWord
+hashStr(const HashTable *table STG_UNUSED, StgWord w)
 {
     const char *key = (char*) w;
 #ifdef x86_64_HOST_ARCH
-    StgWord h = XXH64 (key, strlen(key), 1048583);
+    return XXH64 (key, strlen(key), 1048583);
 #else
-    StgWord h = XXH32 (key, strlen(key), 1048583);
+    return XXH32 (key, strlen(key), 1048583);
 #endif
-
-    /* Mod the size of the hash table (a power of 2) */
-    int bucket = h & table->mask1;
-
-    if (bucket < table->split) {
-        /* Mod the size of the expanded hash table (also a power of 2) */
-        bucket = h & table->mask2;
-    }
-
-    return bucket;
 }
 
 static int
@@ -109,101 +108,189 @@ compareStr(StgWord key1, StgWord key2)
     return (strcmp((char *)key1, (char *)key2) == 0);
 }
 
+#define HASH_TAG(h)   ((uint8_t)((h) & 0x7f))
+#define HASH_GROUP(h) ((h) >> 7)
 
 /* -----------------------------------------------------------------------------
- * Allocate a new segment of the dynamically growing hash table.
+ * Matching the control bytes of a group.  Each function returns a
+ * bitmask with bit i set if slot i of the group matches.
  * -------------------------------------------------------------------------- */
 
-static void
-allocSegment(HashTable *table, int segment)
+#if defined(__SSE2__)
+
+STATIC_INLINE uint32_t
+matchByte(const uint8_t *group, uint8_t c)
+{
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)c)));
+}
+
+STATIC_INLINE uint32_t
+matchEmptyOrDeleted(const uint8_t *group)
+{
+    /* Only CTRL_EMPTY and CTRL_DELETED have the top bit set */
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return _mm_movemask_epi8(ctrl);
+}
+
+#else
+
+STATIC_INLINE uint32_t
+matchByte(const uint8_t *group, uint8_t c)
+{
+    uint32_t m = 0;
+    int i;
+    for (i = 0; i < HGROUPSIZE; i++) {
+        m |= (uint32_t)(group[i] == c) << i;
+    }
+    return m;
+}
+
+STATIC_INLINE uint32_t
+matchEmptyOrDeleted(const uint8_t *group)
 {
-    table->dir[segment] = stgMallocBytes(HSEGSIZE * sizeof(HashList *),
-                                         "allocSegment");
+    uint32_t m = 0;
+    int i;
+    for (i = 0; i < HGROUPSIZE; i++) {
+        m |= (uint32_t)(group[i] >> 7) << i;
+    }
+    return m;
 }
 
+#endif
+
+STATIC_INLINE uint32_t
+matchEmpty(const uint8_t *group)
+{
+    return matchByte(group, CTRL_EMPTY);
+}
+
+/* Index of the lowest set bit of a non-zero match mask */
+STATIC_INLINE int
+firstMatch(uint32_t m)
+{
+    return __builtin_ctz(m);
+}
 
 /* -----------------------------------------------------------------------------
- * Expand the larger hash table by one bucket, and split one bucket
- * from the smaller table into two parts.  Only the bucket referenced
- * by @table->split@ is affected by the expansion.
+ * Allocating the slots of a table
  * -------------------------------------------------------------------------- */
 
 static void
-expand(HashTable *table)
+allocSlots(HashTable *table, StgWord capacity)
 {
-    int oldsegment;
-    int oldindex;
-    int newbucket;
-    int newsegment;
-    int newindex;
-    HashList *hl;
-    HashList *next;
-    HashList *old, *new;
-
-    if (table->split + table->max >= HDIRSIZE * HSEGSIZE)
-        /* Wow!  That's big.  Too big, so don't expand. */
-        return;
+    /* The control bytes go first: the slots then stay word-aligned,
+     * because the capacity is a multiple of HGROUPSIZE. */
+    uint8_t *block = stgMallocBytes(capacity * (sizeof(HashSlot) + 1),
+                                    "allocSlots");
+
+    table->ctrl = block;
+    table->slots = (HashSlot *)(block + capacity);
+    table->capacity = capacity;
+    table->mask = capacity / HGROUPSIZE - 1;
+    table->growth_left = HMAXLOAD(capacity);
+    memset(table->ctrl, CTRL_EMPTY, capacity);
+}
 
-    /* Calculate indices of bucket to split */
-    oldsegment = table->split / HSEGSIZE;
-    oldindex = table->split % HSEGSIZE;
+/* Find an empty or deleted slot for a key with hash h, which must not
+ * be in the table. */
+static StgWord
+findFreeSlot(const HashTable *table, StgWord h)
+{
+    StgWord group = HASH_GROUP(h) & table->mask;
+    StgWord step = 0;
+    uint32_t m;
+
+    for (;;) {
+        m = matchEmptyOrDeleted(&table->ctrl[group * HGROUPSIZE]);
+        if (m != 0) {
+            return group * HGROUPSIZE + firstMatch(m);
+        }
+        step++;
+        group = (group + step) & table->mask;
+    }
+}
 
-    newbucket = table->max + table->split;
+/* -----------------------------------------------------------------------------
+ * Rehash the table into 'capacity' slots, dropping the tombstones.
+ * -------------------------------------------------------------------------- */
 
-    /* And the indices of the new bucket */
-    newsegment = newbucket / HSEGSIZE;
-    newindex = newbucket % HSEGSIZE;
+static void
+resize(HashTable *table, StgWord capacity)
+{
+    uint8_t *old_ctrl = table->ctrl;
+    HashSlot *old_slots = table->slots;
+    StgWord old_capacity = table->capacity;
+    StgWord i, j;
+
+    allocSlots(table, capacity);
+
+    for (i = 0; i < old_capacity; i++) {
+        if (CTRL_IS_FULL(old_ctrl[i])) {
+            StgWord h = table->hash(table, old_slots[i].key);
+            j = findFreeSlot(table, h);
+            table->ctrl[j] = HASH_TAG(h);
+            table->slots[j] = old_slots[i];
+        }
+    }
+    table->growth_left -= table->kcount;
 
-    if (newindex == 0)
-        allocSegment(table, newsegment);
+    stgFree(old_ctrl);
+}
 
-    if (++table->split == table->max) {
-        table->split = 0;
-        table->max *= 2;
-        table->mask1 = table->mask2;
-        table->mask2 = table->mask2 << 1 | 1;
+static void
+expand(HashTable *table)
+{
+    /* If at least half of the used slots are tombstones, rehashing in
+     * place is enough; otherwise double the size. */
+    if ((StgWord)table->kcount <= HMAXLOAD(table->capacity) / 2) {
+        resize(table, table->capacity);
+    } else {
+        resize(table, table->capacity * 2);
     }
-    table->bcount++;
-
-    /* Split the bucket, paying no attention to the original order */
-
-    old = new = NULL;
-    for (hl = table->dir[oldsegment][oldindex]; hl != NULL; hl = next) {
-        next = hl->next;
-        if (table->hash(table, hl->key) == newbucket) {
-            hl->next = new;
-            new = hl;
-        } else {
-            hl->next = old;
-            old = hl;
+}
+
+/* -----------------------------------------------------------------------------
+ * Lookup, insertion and removal
+ * -------------------------------------------------------------------------- */
+
+/* Returns the index of the slot holding the key, or -1 */
+STATIC_INLINE StgInt
+findSlot(const HashTable *table, StgWord key, StgWord h)
+{
+    CompareFunction *cmp = table->compare;
+    uint8_t tag = HASH_TAG(h);
+    StgWord group = HASH_GROUP(h) & table->mask;
+    StgWord step = 0;
+    const uint8_t *ctrl;
+    uint32_t m;
+
+    for (;;) {
+        ctrl = &table->ctrl[group * HGROUPSIZE];
+        for (m = matchByte(ctrl, tag); m != 0; m &= m - 1) {
+            StgWord i = group * HGROUPSIZE + firstMatch(m);
+            if (cmp(table->slots[i].key, key)) {
+                return (StgInt)i;
+            }
+        }
+        if (matchEmpty(ctrl) != 0) {
+            /* It's not there */
+            return -1;
         }
+        step++;
+        group = (group + step) & table->mask;
     }
-    table->dir[oldsegment][oldindex] = old;
-    table->dir[newsegment][newindex] = new;
-
-    return;
 }
 
 void *
 lookupHashTable(const HashTable *table, StgWord key)
 {
-    int bucket;
-    int segment;
-    int index;
-    HashList *hl;
+    StgInt i = findSlot(table, key, table->hash(table, key));
 
-    bucket = table->hash(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
-
-    CompareFunction *cmp = table->compare;
-    for (hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-        if (cmp(hl->key, key))
-            return (void *) hl->data;
+    if (i < 0) {
+        return NULL;
     }
-
-    /* It's not there */
-    return NULL;
+    return (void *) table->slots[i].data;
 }
 
 // Puts up to szKeys keys of the hash table into the given array. Returns the
@@ -212,125 +299,71 @@ lookupHashTable(const HashTable *table, StgWord key)
 // If the table is modified concurrently, the function behavior is undefined.
 //
 int keysHashTable(HashTable *table, StgWord keys[], int szKeys) {
-    int segment, index;
+    StgWord i;
     int k = 0;
-    HashList *hl;
 
-
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    segment = (table->max + table->split - 1) / HSEGSIZE;
-    index = (table->max + table->split - 1) % HSEGSIZE;
-
-    while (segment >= 0 && k < szKeys) {
-        while (index >= 0 && k < szKeys) {
-            hl = table->dir[segment][index];
-            while (hl && k < szKeys) {
-                keys[k] = hl->key;
-                k += 1;
-                hl = hl->next;
-            }
-            index--;
+    for (i = 0; i < table->capacity && k < szKeys; i++) {
+        if (CTRL_IS_FULL(table->ctrl[i])) {
+            keys[k] = table->slots[i].key;
+            k += 1;
         }
-        segment--;
-        index = HSEGSIZE - 1;
     }
     return k;
 }
 
-/* -----------------------------------------------------------------------------
- * We allocate the hashlist cells in large chunks to cut down on malloc
- * overhead.  Although we keep a free list of hashlist cells, we make
- * no effort to actually return the space to the malloc arena.
- * -------------------------------------------------------------------------- */
-
-static HashList *
-allocHashList (HashTable *table)
-{
-    HashList *hl, *p;
-    HashListChunk *cl;
-
-    if ((hl = table->freeList) != NULL) {
-        table->freeList = hl->next;
-    } else {
-        hl = stgMallocBytes(HCHUNK * sizeof(HashList), "allocHashList");
-        cl = stgMallocBytes(sizeof (*cl), "allocHashList: chunkList");
-        cl->chunk = hl;
-        cl->next = table->chunks;
-        table->chunks = cl;
-
-        table->freeList = hl + 1;
-        for (p = table->freeList; p < hl + HCHUNK - 1; p++)
-            p->next = p + 1;
-        p->next = NULL;
-    }
-    return hl;
-}
-
-static void
-freeHashList (HashTable *table, HashList *hl)
-{
-    hl->next = table->freeList;
-    table->freeList = hl;
-}
-
 void
 insertHashTable(HashTable *table, StgWord key, const void *data)
 {
-    int bucket;
-    int segment;
-    int index;
-    HashList *hl;
-
-    // Disable this assert; sometimes it's useful to be able to
-    // overwrite entries in the hash table.
-    // ASSERT(lookupHashTable(table, key) == NULL);
+    StgWord h = table->hash(table, key);
+    StgInt i;
+
+    // Sometimes it's useful to be able to overwrite entries in the hash
+    // table: inserting a key that is already present replaces its data.
+    i = findSlot(table, key, h);
+    if (i >= 0) {
+        table->slots[i].data = data;
+        return;
+    }
 
-    /* When the average load gets too high, we expand the table */
-    if (++table->kcount >= HLOAD * table->bcount)
+    i = findFreeSlot(table, h);
+    if (table->growth_left == 0 && table->ctrl[i] == CTRL_EMPTY) {
+        /* When the load gets too high, we expand the table */
         expand(table);
+        i = findFreeSlot(table, h);
+    }
 
-    bucket = table->hash(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
-
-    hl = allocHashList(table);
-
-    hl->key = key;
-    hl->data = data;
-    hl->next = table->dir[segment][index];
-    table->dir[segment][index] = hl;
-
+    if (table->ctrl[i] == CTRL_EMPTY) {
+        table->growth_left--;
+    }
+    table->ctrl[i] = HASH_TAG(h);
+    table->slots[i].key = key;
+    table->slots[i].data = data;
+    table->kcount++;
 }
 
 void *
 removeHashTable(HashTable *table, StgWord key, const void *data)
 {
-    int bucket;
-    int segment;
-    int index;
-    HashList *hl;
-    HashList *prev = NULL;
-
-    bucket = table->hash(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
-
-    for (hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-        if (table->compare(hl->key,key) && (data == NULL || hl->data == data)) {
-            if (prev == NULL)
-                table->dir[segment][index] = hl->next;
-            else
-                prev->next = hl->next;
-            freeHashList(table,hl);
-            table->kcount--;
-            return (void *) hl->data;
-        }
-        prev = hl;
+    StgInt i = findSlot(table, key, table->hash(table, key));
+    StgWord group;
+
+    if (i < 0 || (data != NULL && table->slots[i].data != data)) {
+        /* It's not there */
+        ASSERT(data == NULL);
+        return NULL;
     }
 
-    /* It's not there */
-    ASSERT(data == NULL);
-    return NULL;
+    /* No probe sequence has gone past a group with an empty slot, so we
+     * can empty this slot too; otherwise we need a tombstone. */
+    group = (StgWord)i / HGROUPSIZE;
+    if (matchEmpty(&table->ctrl[group * HGROUPSIZE]) != 0) {
+        table->ctrl[i] = CTRL_EMPTY;
+        table->growth_left++;
+    } else {
+        table->ctrl[i] = CTRL_DELETED;
+    }
+    table->kcount--;
+    return (void *) table->slots[i].data;
 }
 
 /* -----------------------------------------------------------------------------
@@ -342,34 +375,16 @@ removeHashTable(HashTable *table, StgWord key, const void *data)
 void
 freeHashTable(HashTable *table, void (*freeDataFun)(void *) )
 {
-    long segment;
-    long index;
-    HashList *hl;
-    HashList *next;
-    HashListChunk *cl, *cl_next;
-
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    segment = (table->max + table->split - 1) / HSEGSIZE;
-    index = (table->max + table->split - 1) % HSEGSIZE;
-
-    while (segment >= 0) {
-        while (index >= 0) {
-            for (hl = table->dir[segment][index]; hl != NULL; hl = next) {
-                next = hl->next;
-                if (freeDataFun != NULL)
-                    (*freeDataFun)((void *) hl->data);
+    StgWord i;
+
+    if (freeDataFun != NULL) {
+        for (i = 0; i < table->capacity; i++) {
+            if (CTRL_IS_FULL(table->ctrl[i])) {
+                (*freeDataFun)((void *) table->slots[i].data);
             }
-            index--;
         }
-        stgFree(table->dir[segment]);
-        segment--;
-        index = HSEGSIZE - 1;
-    }
-    for (cl = table->chunks; cl != NULL; cl = cl_next) {
-        cl_next = cl->next;
-        stgFree(cl->chunk);
-        stgFree(cl);
     }
+    stgFree(table->ctrl);
     stgFree(table);
 }
 
@@ -380,52 +395,29 @@ freeHashTable(HashTable *table, void (*freeDataFun)(void *) )
 void
 mapHashTable(HashTable *table, void *data, MapHashFn fn)
 {
-    long segment;
-    long index;
-    HashList *hl;
-
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    segment = (table->max + table->split - 1) / HSEGSIZE;
-    index = (table->max + table->split - 1) % HSEGSIZE;
-
-    while (segment >= 0) {
-        while (index >= 0) {
-            for (hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-                fn(data, hl->key, hl->data);
-            }
-            index--;
+    StgWord i;
+
+    for (i = 0; i < table->capacity; i++) {
+        if (CTRL_IS_FULL(table->ctrl[i])) {
+            fn(data, table->slots[i].key, table->slots[i].data);
         }
-        segment--;
-        index = HSEGSIZE - 1;
     }
 }
 
 /* -----------------------------------------------------------------------------
- * When we initialize a hash table, we set up the first segment as well,
- * initializing all of the first segment's hash buckets to NULL.
+ * When we initialize a hash table, we allocate HMINSIZE empty slots.
  * -------------------------------------------------------------------------- */
 
 HashTable *
 allocHashTable_(HashFunction *hash, CompareFunction *compare)
 {
     HashTable *table;
-    HashList **hb;
 
     table = stgMallocBytes(sizeof(HashTable),"allocHashTable");
 
-    allocSegment(table, 0);
-
-    for (hb = table->dir[0]; hb < table->dir[0] + HSEGSIZE; hb++)
-        *hb = NULL;
+    allocSlots(table, HMINSIZE);
 
-    table->split = 0;
-    table->max = HSEGSIZE;
-    table->mask1 = HSEGSIZE - 1;
-    table->mask2 = 2 * HSEGSIZE - 1;
     table->kcount = 0;
-    table->bcount = HSEGSIZE;
-    table->freeList = NULL;
-    table->chunks = NULL;
     table->hash = hash;
     table->compare = compare;
 
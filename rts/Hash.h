@@ -51,12 +51,15 @@ HashTable * allocStrHashTable ( void );
 #define removeStrHashTable(table, key, data) \
    (removeHashTable(table, (StgWord)key, data))
 
-/* Hash tables for arbitrary keys */
-typedef int HashFunction(const HashTable *table, StgWord key);
+/* Hash tables for arbitrary keys.  A HashFunction returns a hash of the
+ * whole key, all bits of which should be well mixed: the table picks
+ * both the group to probe and a 7-bit tag from it.
+ */
+typedef StgWord HashFunction(const HashTable *table, StgWord key);
 typedef int CompareFunction(StgWord key1, StgWord key2);
 HashTable * allocHashTable_(HashFunction *hash, CompareFunction *compare);
-int hashWord(const HashTable *table, StgWord key);
-int hashStr(const HashTable *table, StgWord key);
+StgWord hashWord(const HashTable *table, StgWord key);
+StgWord hashStr(const HashTable *table, StgWord key);
 
 /* Freeing hash tables
  */
@@ -125,6 +125,10 @@
      This phase will produce ObjectCode with status `OBJECT_NEEDED` if the
      previous status was `OBJECT_LOADED`.
 
+     On most ELF platforms the ObjectCodes to be loaded are found before
+     any of them is relocated, so that the relocations can be done on
+     several threads. See Note [Resolving objects in parallel].
+
    * During resolve we attempt to resolve all the symbols needed for the
      initial link. This essentially means, that for any ObjectCode given
      directly to the command-line we perform lookupSymbols on the required
@@ -182,6 +186,19 @@ Mutex linker_unloaded_mutex;
 /* Generic wrapper function to try and Resolve and RunInit oc files */
 int ocTryLoad( ObjectCode* oc );
 
+static int ocLoadLazyMember( ObjectCode* oc );
+static int ocLoadLazyDefinition( ObjectCode* oc, SymbolName *lbl,
+                                 RtsSymbolInfo **pinfo );
+
+/* See Note [Resolving objects in parallel] */
+#if defined(OBJFORMAT_ELF) && defined(ELF_EXTERNAL_REFS_PREDICT_RESOLVE)
+#define RESOLVE_IN_BATCHES 1
+static int ocTryLoadBatch( ObjectCode **roots, uint32_t n_roots );
+
+/* Set while ocResolve runs on several threads */
+static bool resolving_in_parallel = false;
+#endif
+
 /* Link objects into the lower 2Gb on x86_64.  GHC assumes the
  * small memory model on this architecture (see gcc docs,
  * -mcmodel=small).
@@ -372,10 +389,12 @@ HsBool ghciLookupSymbolInfo(HashTable *table,
         *result = NULL;
         return HS_BOOL_FALSE;
     }
-    if (pinfo->weak)
+    /* Once it's looked up, it can no longer be overridden.  Only write
+       the flag when it changes: see Note [Resolving objects in parallel] */
+    if (pinfo->weak) {
         IF_DEBUG(linker, debugBelch("lookupSymbolInfo: promoting %s\n", key));
-    /* Once it's looked up, it can no longer be overridden */
-    pinfo->weak = HS_BOOL_FALSE;
+        pinfo->weak = HS_BOOL_FALSE;
+    }
 
     *result = pinfo;
     return HS_BOOL_TRUE;
@@ -874,6 +893,24 @@ SymbolAddr* loadSymbol(SymbolName *lbl, RtsSymbolInfo *pinfo) {
     /* Symbol can be found during linking, but hasn't been relocated. Do so now.
         See Note [runtime-linker-phases] */
     if (oc && lbl && oc->status == OBJECT_LOADED) {
+#if defined(RESOLVE_IN_BATCHES)
+        if (resolving_in_parallel) {
+            // ocTryLoadBatch should have loaded it up front
+            errorBelch("%s: symbol `%s' is in an object that was not loaded "
+                       "before resolving", oc->fileName, lbl);
+            return NULL;
+        }
+#endif
+        if (oc->lazyImagePath != NULL) {
+            // loading the image replaces the entry of the symbol, and
+            // may hand it to another member
+            if (!ocLoadLazyDefinition(oc, lbl, &pinfo)) {
+                return NULL;
+            }
+            oc = pinfo->owner;
+        }
+    }
+    if (oc && lbl && oc->status == OBJECT_LOADED) {
         oc->status = OBJECT_NEEDED;
         IF_DEBUG(linker, debugBelch("lookupSymbol: on-demand "
                                     "loading symbol '%s'\n", lbl));
@@ -1221,6 +1258,8 @@ void freeObjectCode (ObjectCode *oc)
 
     stgFree(oc->fileName);
     stgFree(oc->archiveMemberName);
+    stgFree(oc->lazyImagePath);
+    stgFree(oc->lazyNames);
 
     stgFree(oc);
 }
@@ -1293,6 +1332,9 @@ mkOc( pathchar *path, char *image, int imageSize,
 
    oc->misalignment      = misalignment;
    oc->extraInfos        = NULL;
+   oc->lazyImagePath     = NULL;
+   oc->lazyImageOffset   = 0;
+   oc->lazyNames         = NULL;
 
    /* chain it onto the list of objects */
    oc->next              = NULL;
@@ -1568,17 +1610,130 @@ HsInt loadOc (ObjectCode* oc)
 }
 
 /* -----------------------------------------------------------------------------
-* try to load and initialize an ObjectCode into memory
+* read and load the image of an archive member that loadArchive only put in
+* the symbol table.  See Note [Lazy archive members] in LoadArchive.c.
 *
 * Returns: 1 if ok, 0 on error.
 */
-int ocTryLoad (ObjectCode* oc) {
-    int r;
+static int ocLoadLazyMember (ObjectCode* oc) {
+    char *image;
 
-    if (oc->status != OBJECT_NEEDED) {
-        return 1;
+    IF_DEBUG(linker, debugBelch("ocLoadLazyMember: %s\n",
+                                oc->archiveMemberName));
+
+    image = readLazyArchiveMember(oc);
+    if (image == NULL) {
+        return 0;
+    }
+
+    // Drop the placeholders, loadOc will insert the real symbols.  We
+    // keep their names: entries that other objects took over still use
+    // them as keys.
+    removeOcSymbols(oc);
+    stgFree(oc->lazyImagePath);
+    oc->lazyImagePath = NULL;
+    oc->image = image;
+
+#if defined(OBJFORMAT_ELF)
+    ocInit_ELF(oc);
+#endif
+    if (!loadOc(oc)) {
+        return 0;
     }
 
+    archive_member_counts.demanded++;
+    return 1;
+}
+
+/* Does `oc` have a placeholder for `lbl` that it hasn't loaded yet? */
+static bool lazyMemberDefines (ObjectCode *oc, SymbolName *lbl)
+{
+    int i;
+
+    if (oc->lazyImagePath == NULL) {
+        return false;
+    }
+    for (i = 0; i < oc->n_symbols; i++) {
+        if (strcmp(oc->symbols[i].name, lbl) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* -----------------------------------------------------------------------------
+* load the lazy archive member `oc` for its placeholder of `lbl`, and look
+* `lbl` up again.  If `oc` turns out to define `lbl` weakly, the first other
+* lazy member with a strong definition takes over, as it would have if the
+* archives had been read eagerly.  See Note [Lazy archive members] in
+* LoadArchive.c.
+*
+* Returns: 1 if ok, 0 on error.
+*/
+static int ocLoadLazyDefinition (ObjectCode* oc, SymbolName *lbl,
+                                 RtsSymbolInfo **pinfo)
+{
+    ObjectCode *other, **candidates;
+    RtsSymbolInfo *entry;
+    uint32_t n_candidates = 0, i;
+    int r = 1;
+
+    // Look the entry up without ghciLookupSymbolInfo until the search is
+    // over: that promotes a weak entry, and a strong definition could
+    // then no longer take it over.
+    if (!ocLoadLazyMember(oc)) {
+        return 0;
+    }
+    entry = lookupStrHashTable(symhash, lbl);
+    if (entry == NULL) {
+        return 0;
+    }
+    if (!entry->weak) {
+        return ghciLookupSymbolInfo(symhash, lbl, pinfo);
+    }
+
+    for (other = objects; other != NULL; other = other->next) {
+        if (lazyMemberDefines(other, lbl)) {
+            n_candidates++;
+        }
+    }
+    if (n_candidates == 0) {
+        return ghciLookupSymbolInfo(symhash, lbl, pinfo);
+    }
+
+    // `objects` is newest first, put the candidates in archive order
+    candidates = stgMallocBytes(n_candidates * sizeof(ObjectCode *),
+                                "ocLoadLazyDefinition");
+    i = n_candidates;
+    for (other = objects; other != NULL; other = other->next) {
+        if (lazyMemberDefines(other, lbl)) {
+            candidates[--i] = other;
+        }
+    }
+
+    // a strong definition replaces the weak one when it is inserted
+    for (i = 0; i < n_candidates; i++) {
+        if (!ocLoadLazyMember(candidates[i])) {
+            r = 0;
+            break;
+        }
+        entry = lookupStrHashTable(symhash, lbl);
+        if (!entry->weak) {
+            break;
+        }
+    }
+
+    stgFree(candidates);
+    return r && ghciLookupSymbolInfo(symhash, lbl, pinfo);
+}
+
+/* -----------------------------------------------------------------------------
+* insert the symbols of an ObjectCode that is about to be resolved into
+* `symhash`.
+*
+* Returns: 1 if ok, 0 on error.
+*/
+static int ocInsertSymbols (ObjectCode* oc) {
     /*  Check for duplicate symbols by looking into `symhash`.
         Duplicate symbols are any symbols which exist
         in different ObjectCodes that have both been loaded, or
@@ -1603,19 +1758,24 @@ int ocTryLoad (ObjectCode* oc) {
             return 0;
         }
     }
+    return 1;
+}
 
+static int ocResolve (ObjectCode* oc) {
 #   if defined(OBJFORMAT_ELF)
-    r = ocResolve_ELF ( oc );
+    return ocResolve_ELF ( oc );
 #   elif defined(OBJFORMAT_PEi386)
-    r = ocResolve_PEi386 ( oc );
+    return ocResolve_PEi386 ( oc );
 #   elif defined(OBJFORMAT_MACHO)
-    r = ocResolve_MachO ( oc );
+    return ocResolve_MachO ( oc );
 #   else
     barf("ocTryLoad: not implemented on this platform");
 #   endif
-    if (!r) { return r; }
+}
 
-    // run init/init_array/ctors/mod_init_func
+/* run init/init_array/ctors/mod_init_func */
+static int ocRunInit (ObjectCode* oc) {
+    int r;
 
     IF_DEBUG(linker, debugBelch("ocTryLoad: ocRunInit start\n"));
 
@@ -1631,13 +1791,281 @@ int ocTryLoad (ObjectCode* oc) {
 #endif
     loading_obj = NULL;
 
+    return r;
+}
+
+/* -----------------------------------------------------------------------------
+* try to load and initialize an ObjectCode into memory
+*
+* Returns: 1 if ok, 0 on error.
+*/
+int ocTryLoad (ObjectCode* oc) {
+    int r;
+
+    if (oc->status != OBJECT_NEEDED) {
+        return 1;
+    }
+
+#if defined(RESOLVE_IN_BATCHES)
+    r = ocTryLoadBatch(&oc, 1);
+#else
+    r = ocInsertSymbols(oc);
+    if (!r) { return r; }
+
+    r = ocResolve(oc);
+    if (!r) { return r; }
+
+    r = ocRunInit(oc);
     if (!r) { return r; }
 
     oc->status = OBJECT_RESOLVED;
+#endif
+
+    return r;
+}
 
+#if defined(RESOLVE_IN_BATCHES)
+/*
+   Note [Resolving objects in parallel]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   Resolving the relocations of an ObjectCode (ocResolve) is where the
+   linker spends most of its time when it loads a large session, and,
+   apart from the symbol lookups, every ObjectCode can be resolved
+   independently.  What keeps us from simply resolving several of them
+   at once is that a lookup may demand-load another ObjectCode (see
+   Note [runtime-linker-phases]), which inserts into `symhash`.
+
+   On ELF we know up front which symbols ocResolve will look up: the
+   non-local symbols referred to by relocations, which
+   ocVisitExternalRefs_ELF enumerates.  So ocTryLoadBatch splits
+   ocTryLoad over a batch of OBJECT_NEEDED ObjectCodes into three passes:
+
+   1. Sequentially, for each ObjectCode: insert its symbols into `symhash`
+      and look up the symbols its relocations refer to.  An ObjectCode
+      that defines one of them and is still OBJECT_LOADED is marked
+      OBJECT_NEEDED and processed the same way, depth first.  This is
+      exactly the order in which ocTryLoad would have inserted and looked
+      up the symbols, so duplicate and weak symbols (which lookups
+      promote) are handled as before.  The ObjectCodes end up in
+      `post-order', i.e. the order in which ocTryLoad would have run
+      their initialisers.
+
+   2. Resolve all the ObjectCodes, on up to +RTS -xl threads.  Nothing
+      writes to `symhash` or the status of an ObjectCode during this
+      pass: every lookup finds a symbol that pass 1 already looked up, so
+      ghciLookupSymbolInfo does not write the weak flag, and loadSymbol
+      finds no OBJECT_LOADED owners.  The only other shared state,
+      dlsym(), is protected by dl_mutex.  Everything else ocResolve_ELF
+      touches (symbol extras, the image itself) belongs to the ObjectCode
+      being resolved.
+
+   3. Sequentially, in post-order, run the initialisers and mark the
+      ObjectCodes OBJECT_RESOLVED.
+
+   On ARM and AArch64 ocResolve_ELF also fills in a GOT, and on other
+   object formats lookups can load DLLs and frameworks, so there we keep
+   resolving one ObjectCode at a time.
+*/
+
+/* Below this many ObjectCodes per thread, starting a thread isn't worth it */
+#define RESOLVE_OBJS_PER_THREAD 8
+
+typedef struct {
+    ObjectCode **ocs;
+    uint32_t n_ocs;
+    uint32_t size;
+} ObjectCodeList;
+
+static void addObjectCodeList (ObjectCodeList *list, ObjectCode *oc)
+{
+    if (list->n_ocs == list->size) {
+        list->size = list->size == 0 ? 64 : list->size * 2;
+        list->ocs = stgReallocBytes(list->ocs,
+                                    list->size * sizeof(ObjectCode *),
+                                    "addObjectCodeList");
+    }
+    list->ocs[list->n_ocs++] = oc;
+}
+
+static int collectNeeded (ObjectCode *oc, ObjectCodeList *order);
+
+static int collectExternalRef (SymbolName *name, void *user)
+{
+    RtsSymbolInfo *pinfo;
+
+    if (ghciLookupSymbolInfo(symhash, name, &pinfo)) {
+        ObjectCode *owner = pinfo->owner;
+        if (owner && owner->status == OBJECT_LOADED) {
+            IF_DEBUG(linker, debugBelch("ocTryLoadBatch: on-demand "
+                                        "loading symbol '%s'\n", name));
+            if (owner->lazyImagePath != NULL) {
+                if (!ocLoadLazyDefinition(owner, name, &pinfo)) {
+                    return 0;
+                }
+                owner = pinfo->owner;
+                if (!owner || owner->status != OBJECT_LOADED) {
+                    return 1;
+                }
+            }
+            owner->status = OBJECT_NEEDED;
+            return collectNeeded(owner, (ObjectCodeList *)user);
+        }
+    }
     return 1;
 }
 
+/* Pass 1 of Note [Resolving objects in parallel] */
+static int collectNeeded (ObjectCode *oc, ObjectCodeList *order)
+{
+    if (!ocInsertSymbols(oc)) {
+        return 0;
+    }
+    if (!ocVisitExternalRefs_ELF(oc, collectExternalRef, order)) {
+        return 0;
+    }
+    addObjectCodeList(order, oc);
+    return 1;
+}
+
+typedef struct {
+    ObjectCode **ocs;
+    uint32_t n_ocs;
+    volatile StgWord next;      // index of the next ObjectCode to resolve
+    volatile StgWord failed;    // number of ObjectCodes that failed
+#if defined(THREADED_RTS)
+    uint32_t running;           // worker threads still running
+    Mutex lock;
+    Condition done;
+#endif
+} ResolveJob;
+
+static void resolveSome (ResolveJob *job)
+{
+    StgWord i;
+
+    while ((i = atomic_inc(&job->next, 1) - 1) < job->n_ocs) {
+        if (!ocResolve(job->ocs[i])) {
+            atomic_inc(&job->failed, 1);
+        }
+    }
+}
+
+#if defined(THREADED_RTS)
+static void *resolveWorker (void *arg)
+{
+    ResolveJob *job = arg;
+
+    resolveSome(job);
+
+    ACQUIRE_LOCK(&job->lock);
+    if (--job->running == 0) {
+        signalCondition(&job->done);
+    }
+    RELEASE_LOCK(&job->lock);
+    return NULL;
+}
+#endif
+
+/* Pass 2 of Note [Resolving objects in parallel] */
+static int resolveAll (ObjectCode **ocs, uint32_t n_ocs)
+{
+    ResolveJob job;
+
+    job.ocs = ocs;
+    job.n_ocs = n_ocs;
+    job.next = 0;
+    job.failed = 0;
+
+#if defined(THREADED_RTS)
+    uint32_t n_threads = RtsFlags.MiscFlags.linkerThreads;
+    if (n_threads == 0) {
+        n_threads = getNumberOfProcessors();
+    }
+    n_threads = stg_min(n_threads, n_ocs / RESOLVE_OBJS_PER_THREAD);
+
+    if (n_threads > 1) {
+        uint32_t i;
+
+        initMutex(&job.lock);
+        initCondition(&job.done);
+        job.running = 0;
+        resolving_in_parallel = true;
+
+        // this thread is one of the workers
+        for (i = 1; i < n_threads; i++) {
+            OSThreadId tid;
+            ACQUIRE_LOCK(&job.lock);
+            job.running++;
+            RELEASE_LOCK(&job.lock);
+            if (createOSThread(&tid, "ghc_linker", resolveWorker, &job) != 0) {
+                // we'll just have to do with fewer threads
+                ACQUIRE_LOCK(&job.lock);
+                job.running--;
+                RELEASE_LOCK(&job.lock);
+                break;
+            }
+        }
+        IF_DEBUG(linker, debugBelch("resolveAll: %u objects on %u threads\n",
+                                    n_ocs, i));
+
+        resolveSome(&job);
+
+        ACQUIRE_LOCK(&job.lock);
+        while (job.running > 0) {
+            waitCondition(&job.done, &job.lock);
+        }
+        RELEASE_LOCK(&job.lock);
+
+        resolving_in_parallel = false;
+        closeCondition(&job.done);
+        closeMutex(&job.lock);
+    } else
+#endif
+    {
+        resolveSome(&job);
+    }
+
+    return job.failed == 0;
+}
+
+/* -----------------------------------------------------------------------------
+* load and initialize a batch of OBJECT_NEEDED ObjectCodes together with
+* the ObjectCodes they demand-load.
+* See Note [Resolving objects in parallel].
+*
+* Returns: 1 if ok, 0 on error.
+*/
+static int ocTryLoadBatch (ObjectCode **roots, uint32_t n_roots)
+{
+    ObjectCodeList order = { NULL, 0, 0 };
+    uint32_t i;
+    int r = 0;
+
+    for (i = 0; i < n_roots; i++) {
+        ASSERT(roots[i]->status == OBJECT_NEEDED);
+        if (!collectNeeded(roots[i], &order)) {
+            goto fail;
+        }
+    }
+
+    if (!resolveAll(order.ocs, order.n_ocs)) {
+        goto fail;
+    }
+
+    for (i = 0; i < order.n_ocs; i++) {
+        if (!ocRunInit(order.ocs[i])) {
+            goto fail;
+        }
+        order.ocs[i]->status = OBJECT_RESOLVED;
+    }
+    r = 1;
+
+fail:
+    stgFree(order.ocs);
+    return r;
+}
+#endif /* RESOLVE_IN_BATCHES */
+
 /* -----------------------------------------------------------------------------
  * resolve all the currently unlinked objects in memory
  *
@@ -1650,6 +2078,19 @@ static HsInt resolveObjs_ (void)
 
     IF_DEBUG(linker, debugBelch("resolveObjs: start\n"));
 
+#if defined(RESOLVE_IN_BATCHES)
+    ObjectCodeList roots = { NULL, 0, 0 };
+    for (oc = objects; oc; oc = oc->next) {
+        if (oc->status == OBJECT_NEEDED) {
+            addObjectCodeList(&roots, oc);
+        }
+    }
+    r = roots.n_ocs == 0 || ocTryLoadBatch(roots.ocs, roots.n_ocs);
+    stgFree(roots.ocs);
+    if (!r) {
+        return r;
+    }
+#else
     for (oc = objects; oc; oc = oc->next) {
         r = ocTryLoad(oc);
         if (!r)
@@ -1657,6 +2098,7 @@ static HsInt resolveObjs_ (void)
             return r;
         }
     }
+#endif
 
 #if defined(PROFILING)
     // collect any new cost centres & CCSs that were defined during runInit
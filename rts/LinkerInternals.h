@@ -244,6 +244,14 @@ typedef struct _ObjectCode {
        require extra information.*/
     HashTable *extraInfos;
 
+    /* If this is an archive member that we have only indexed so far, the
+       file its image is in and where, otherwise NULL.
+       See Note [Lazy archive members] in LoadArchive.c */
+    pathchar *lazyImagePath;
+    long lazyImageOffset;
+    /* The names of the placeholder symbols of a lazy archive member */
+    char *lazyNames;
+
 } ObjectCode;
 
 #define OC_INFORMATIVE_FILENAME(OC)             \
@@ -255,6 +263,16 @@ typedef struct _ObjectCode {
 extern ObjectCode *objects;
 extern ObjectCode *unloaded_objects;
 
+/* What loadArchive did with the members of the archives it loaded */
+typedef struct {
+    StgWord loaded;      /* read and indexed when the archive was loaded */
+    StgWord lazy;        /* only put in the symbol table at that time */
+    StgWord demanded;    /* lazy members read later, because they were needed */
+    StgWord skipped;     /* members that define no symbols */
+} ArchiveMemberCounts;
+
+extern ArchiveMemberCounts archive_member_counts;
+
 #if defined(THREADED_RTS)
 extern Mutex linker_mutex;
 extern Mutex linker_unloaded_mutex;
@@ -343,6 +361,7 @@ ObjectCode* mkOc( pathchar *path, char *image, int imageSize,
                   bool mapped, char *archiveMemberName,
                   int misalignment
                   );
+char *readLazyArchiveMember( ObjectCode *oc );
 
 void initSegment(Segment *s, void *start, size_t size, SegmentProt prot, int n_sections);
 void freeSegments(ObjectCode *oc);
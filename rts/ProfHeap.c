@@ -21,6 +21,9 @@
 #include "Arena.h"
 #include "Printer.h"
 #include "Trace.h"
+#include "Proftimer.h"
+#include "sm/Storage.h"
+#include "sm/GC.h"
 #include "sm/GCThread.h"
 
 #include <fs_rts.h>
@@ -413,6 +416,11 @@ initHeapProfiling(void)
         errorBelch("cannot mix -hb and -hr");
         stg_exit(EXIT_FAILURE);
     }
+    if (RtsFlags.ProfFlags.heapSampleBytes != 0
+        && (doingLDVProfiling() || doingRetainerProfiling())) {
+        errorBelch("--heap-sample cannot be used with -hb or -hr");
+        stg_exit(EXIT_FAILURE);
+    }
 #if defined(THREADED_RTS)
     // See #12019.
     if (doingLDVProfiling() && RtsFlags.ParFlags.nCapabilities > 1) {
@@ -505,6 +513,12 @@ endHeapProfiling(void)
     }
 #endif
 
+    // report the samples taken since the end of the last interval
+    if (RtsFlags.ProfFlags.heapSampleBytes != 0) {
+        censuses[era].time = mut_user_time();
+        dumpCensus( &censuses[era] );
+    }
+
 #if defined(PROFILING)
     if (doingLDVProfiling()) {
         uint32_t t;
@@ -888,26 +902,19 @@ dumpCensus( Census *census )
 }
 
 
-static void heapProfObject(Census *census, StgClosure *p, size_t size,
-                           bool prim
+// Count real_size words for the closure p
+static void countClosure(Census *census, StgClosure *p, size_t real_size,
+                         bool prim
 #if !defined(PROFILING)
-                           STG_UNUSED
+                         STG_UNUSED
 #endif
-                           )
+                         )
 {
     const void *identity;
-    size_t real_size;
     counter *ctr;
 
             identity = NULL;
 
-#if defined(PROFILING)
-            // subtract the profiling overhead
-            real_size = size - sizeofW(StgProfHeader);
-#else
-            real_size = size;
-#endif
-
             if (closureSatisfiesConstraints((StgClosure*)p)) {
 #if defined(PROFILING)
                 if (RtsFlags.ProfFlags.doHeapProfile == HEAP_BY_LDV) {
@@ -965,6 +972,17 @@ static void heapProfObject(Census *census, StgClosure *p, size_t size,
             }
 }
 
+static void heapProfObject(Census *census, StgClosure *p, size_t size,
+                           bool prim)
+{
+#if defined(PROFILING)
+    // subtract the profiling overhead
+    countClosure(census, p, size - sizeofW(StgProfHeader), prim);
+#else
+    countClosure(census, p, size, prim);
+#endif
+}
+
 // Compact objects require special handling code because they
 // are not stored consecutively in memory (rather, each object
 // is a list of objects), and that would break the while loop
@@ -973,9 +991,9 @@ static void heapProfObject(Census *census, StgClosure *p, size_t size,
 //
 // See Note [Compact Normal Forms] for details.
 static void
-heapCensusCompactList(Census *census, bdescr *bd)
+heapCensusCompactList(Census *census, bdescr *bd, bdescr *stop)
 {
-    for (; bd != NULL; bd = bd->link) {
+    for (; bd != stop; bd = bd->link) {
         StgCompactNFDataBlock *block = (StgCompactNFDataBlock*)bd->start;
         StgCompactNFData *str = block->owner;
         heapProfObject(census, (StgClosure*)str,
@@ -987,14 +1005,14 @@ heapCensusCompactList(Census *census, bdescr *bd)
  * Code to perform a heap census.
  * -------------------------------------------------------------------------- */
 static void
-heapCensusChain( Census *census, bdescr *bd )
+heapCensusChain( Census *census, bdescr *bd, bdescr *stop )
 {
     StgPtr p;
     const StgInfoTable *info;
     size_t size;
     bool prim;
 
-    for (; bd != NULL; bd = bd->link) {
+    for (; bd != stop; bd = bd->link) {
 
         // HACK: pretend a pinned block is just one big ARR_WORDS
         // owned by CCS_PINNED.  These blocks can be full of holes due
@@ -1175,10 +1193,143 @@ heapCensusChain( Census *census, bdescr *bd )
     }
 }
 
+/* -----------------------------------------------------------------------------
+   Note [Parallel heap census]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   A census visits every object in the heap while the program is stopped,
+   so with a big heap it can take much longer than the GC that precedes
+   it.  We therefore share it out among the GC threads that took part in
+   that GC, using runOnGcThreads() (see GC.c); without a parallel GC that
+   is just the thread doing the census.
+
+   The heap is a set of chains of blocks: the blocks, large objects and
+   compact regions of each generation, and the lists of blocks left in the
+   GC threads' workspaces.  The threads take pieces of CENSUS_CHUNK_BLOCKS
+   blocks from these chains under a spin lock, so that even a heap that is
+   a single enormous chain in the old generation is split evenly.  Each
+   thread counts into a Census of its own, so the counting itself needs no
+   synchronisation, and at the end we merge them into censuses[era] with
+   mergeCensus().  The counters that LDV_recordDead() has already put in
+   censuses[era] stay where they are.
+   -------------------------------------------------------------------------- */
+
+#define CENSUS_CHUNK_BLOCKS 256
+
+typedef struct {
+    bdescr *bd;
+    bool compact;           // a list of compact regions
+} CensusChain;
+
+typedef struct {
+#if defined(THREADED_RTS)
+    SpinLock lock;          // protects next_chain, next_bd and next_compact
+#endif
+    CensusChain *chains;
+    uint32_t n_chains;
+    uint32_t next_chain;
+    bdescr *next_bd;        // what's left of chains[next_chain-1]
+    bool next_compact;
+
+    Census *censuses;       // for each GC thread; hash == NULL if unused
+} CensusWork;
+
+static void
+addCensusChain( CensusWork *work, bdescr *bd, bool compact )
+{
+    if (bd != NULL) {
+        work->chains[work->n_chains].bd = bd;
+        work->chains[work->n_chains].compact = compact;
+        work->n_chains++;
+    }
+}
+
+// Take the next piece of the heap to count: the blocks from *bd up to,
+// but not including, *stop.
+static bool
+takeCensusChunk( CensusWork *work, bdescr **bd, bdescr **stop, bool *compact )
+{
+    uint32_t n;
+
+    ACQUIRE_SPIN_LOCK(&work->lock);
+    if (work->next_bd == NULL) {
+        if (work->next_chain == work->n_chains) {
+            RELEASE_SPIN_LOCK(&work->lock);
+            return false;
+        }
+        work->next_bd      = work->chains[work->next_chain].bd;
+        work->next_compact = work->chains[work->next_chain].compact;
+        work->next_chain++;
+    }
+
+    *bd = work->next_bd;
+    *compact = work->next_compact;
+    for (n = 0; work->next_bd != NULL && n < CENSUS_CHUNK_BLOCKS;
+         work->next_bd = work->next_bd->link) {
+        n += work->next_bd->blocks;
+    }
+    *stop = work->next_bd;
+    RELEASE_SPIN_LOCK(&work->lock);
+    return true;
+}
+
+static void
+heapCensusWorker( uint32_t thread_index, void *user )
+{
+    CensusWork *work = (CensusWork *)user;
+    Census *census = &work->censuses[thread_index];
+    bdescr *bd, *stop;
+    bool compact;
+
+    while (takeCensusChunk(work, &bd, &stop, &compact)) {
+        if (census->hash == NULL) {
+            initEra(census);
+        }
+        if (compact) {
+            heapCensusCompactList(census, bd, stop);
+        } else {
+            heapCensusChain(census, bd, stop);
+        }
+    }
+}
+
+// Add the counts in 'from' to 'census'
+static void
+mergeCensus( Census *census, Census *from )
+{
+    counter *c, *d;
+
+    census->prim     += from->prim;
+    census->not_used += from->not_used;
+    census->used     += from->used;
+
+    for (c = from->ctrs; c != NULL; c = c->next) {
+        d = lookupHashTable(census->hash, (StgWord)c->identity);
+        if (d == NULL) {
+            d = arenaAlloc(census->arena, sizeof(counter));
+            *d = *c;
+            insertHashTable(census->hash, (StgWord)c->identity, d);
+            d->next = census->ctrs;
+            census->ctrs = d;
+            continue;
+        }
+#if defined(PROFILING)
+        if (RtsFlags.ProfFlags.bioSelector != NULL) {
+            d->c.ldv.prim     += c->c.ldv.prim;
+            d->c.ldv.not_used += c->c.ldv.not_used;
+            d->c.ldv.used     += c->c.ldv.used;
+        } else
+#endif
+        {
+            d->c.resid += c->c.resid;
+        }
+    }
+}
+
 void heapCensus (Time t)
 {
   uint32_t g, n;
   Census *census;
+  CensusWork work;
   gen_workspace *ws;
 
   census = &censuses[era];
@@ -1195,21 +1346,45 @@ void heapCensus (Time t)
   stat_startHeapCensus();
 #endif
 
-  // Traverse the heap, collecting the census info
+  // Traverse the heap, collecting the census info, on all the GC
+  // threads (Note [Parallel heap census])
+  work.chains = stgMallocBytes(sizeof(CensusChain)
+                               * RtsFlags.GcFlags.generations
+                               * (3 + 3 * n_capabilities),
+                               "heapCensus");
+  work.n_chains = 0;
   for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
-      heapCensusChain( census, generations[g].blocks );
+      addCensusChain( &work, generations[g].blocks, false );
       // Are we interested in large objects?  might be
       // confusing to include the stack in a heap profile.
-      heapCensusChain( census, generations[g].large_objects );
-      heapCensusCompactList ( census, generations[g].compact_objects );
+      addCensusChain( &work, generations[g].large_objects, false );
+      addCensusChain( &work, generations[g].compact_objects, true );
 
       for (n = 0; n < n_capabilities; n++) {
           ws = &gc_threads[n]->gens[g];
-          heapCensusChain(census, ws->todo_bd);
-          heapCensusChain(census, ws->part_list);
-          heapCensusChain(census, ws->scavd_list);
+          addCensusChain( &work, ws->todo_bd, false );
+          addCensusChain( &work, ws->part_list, false );
+          addCensusChain( &work, ws->scavd_list, false );
+      }
+  }
+#if defined(THREADED_RTS)
+  initSpinLock(&work.lock);
+#endif
+  work.next_chain = 0;
+  work.next_bd = NULL;
+  work.next_compact = false;
+  work.censuses = stgCallocBytes(n_capabilities, sizeof(Census), "heapCensus");
+
+  runOnGcThreads(heapCensusWorker, &work);
+
+  for (n = 0; n < n_capabilities; n++) {
+      if (work.censuses[n].hash != NULL) {
+          mergeCensus(census, &work.censuses[n]);
+          freeEra(&work.censuses[n]);
       }
   }
+  stgFree(work.censuses);
+  stgFree(work.chains);
 
   // dump out the census info
 #if defined(PROFILING)
@@ -1240,3 +1415,135 @@ void heapCensus (Time t)
   stat_endHeapCensus();
 #endif
 }
+
+/* -----------------------------------------------------------------------------
+   Note [Sampling heap profile]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   A census visits every live closure, so its cost grows with the heap,
+   and it needs a major GC.  With +RTS --heap-sample=<n> we take no
+   censuses.  Instead we sample the allocation: out of every <n> bytes
+   allocated we pick one byte, and attribute <n> bytes to the closure that
+   contains it, with the usual breakdown (-hT, -hc, -hd, ...).  At the end
+   of each -i interval the samples are reported like a census, to the .hp
+   file and as heap profile samples in the eventlog, so each band shows
+   how much it allocated in the interval rather than how much of it is
+   live.  The cost depends on the allocation rate and on <n>, not on the
+   size of the heap.
+
+   We take the samples at the start of each GC, before anything moves out
+   of the nursery.  A nursery block can't be parsed in general, because
+   updating a thunk leaves slop behind it (Note [zeroing slop] in
+   ClosureMacros.h), but the first closure in a block is always intact.
+   So we count down the bytes used in each block, and when the count runs
+   out we sample the closure at the start of that block.  That is still a
+   sample of the allocated bytes: the closure at the start of a block is
+   the one that didn't fit into the previous block, and the chance of a
+   closure crossing the end of a block is proportional to its size.  (All
+   the closures of one heap check move to the next block together, which
+   favours the first of them a little.)  A thunk that has been updated
+   since it was allocated counts as a BLACKHOLE, although in a profiled
+   RTS it still has its cost centre stack.
+
+   Large objects are sampled in the same way, but only the ones allocated
+   since the last GC: with -G1 the large objects that survived earlier GCs
+   are on the same list (see sampleNewLargeObjects).  New compact regions
+   also count towards g0->n_new_large_words, so with -G1 a few old large
+   objects can be sampled again after one was allocated.  Pinned blocks are counted
+   as ARR_WORDS owned by CCS_PINNED, as in a census, when they are full.
+   To avoid aliasing with programs that allocate in a regular pattern,
+   the distance between two samples is random, between <n>/2 and 3<n>/2
+   bytes.  Biographical and retainer profiles need to see the whole heap,
+   so they can't be sampled.
+   -------------------------------------------------------------------------- */
+
+static StgInt64 bytes_to_sample = 0;
+static StgWord64 sample_seed = 0x9e3779b97f4a7c15ULL;
+
+static StgInt64
+nextSampleDistance( void )
+{
+    StgWord64 n = RtsFlags.ProfFlags.heapSampleBytes;
+
+    // xorshift64
+    sample_seed ^= sample_seed << 13;
+    sample_seed ^= sample_seed >> 7;
+    sample_seed ^= sample_seed << 17;
+    return (StgInt64)(n / 2 + sample_seed % n);
+}
+
+// Account for 'bytes' of allocation, which begin with the closure p
+static void
+sampleAllocation( Census *census, StgClosure *p, StgWord bytes, bool prim )
+{
+    bytes_to_sample -= bytes;
+    while (bytes_to_sample <= 0) {
+        countClosure(census, p, RtsFlags.ProfFlags.heapSampleBytes / sizeof(W_),
+                     prim);
+        bytes_to_sample += nextSampleDistance();
+    }
+}
+
+static void
+sampleBlocks( Census *census, bdescr *bd )
+{
+    for (; bd != NULL; bd = bd->link) {
+        if (bd->free <= bd->start) {
+            continue; // not allocated into since the last GC
+        }
+        if (bd->flags & BF_PINNED) {
+            // see heapCensusChain()
+            StgClosure arr;
+            SET_HDR(&arr, &stg_ARR_WORDS_info, CCS_PINNED);
+            sampleAllocation(census, &arr,
+                             (bd->free - bd->start) * sizeof(W_), true);
+        } else {
+            sampleAllocation(census, (StgClosure *)bd->start,
+                             (bd->free - bd->start) * sizeof(W_), false);
+        }
+    }
+}
+
+// allocate() puts each new large object at the front of g0->large_objects,
+// so the ones allocated since the last GC come first and add up to
+// g0->n_new_large_words.  With one generation the old ones follow them.
+static void
+sampleNewLargeObjects( Census *census )
+{
+    bdescr *bd;
+    W_ words = 0;
+
+    for (bd = g0->large_objects;
+         bd != NULL && words < g0->n_new_large_words;
+         bd = bd->link) {
+        words += bd->free - bd->start;
+        sampleAllocation(census, (StgClosure *)bd->start,
+                         (bd->free - bd->start) * sizeof(W_), false);
+    }
+}
+
+void heapSample (Time t)
+{
+    Census *census = &censuses[era];
+    uint32_t n;
+
+    if (bytes_to_sample == 0) {
+        bytes_to_sample = nextSampleDistance();
+    }
+
+    for (n = 0; n < n_nurseries; n++) {
+        sampleBlocks(census, nurseries[n].blocks);
+    }
+    for (n = 0; n < n_capabilities; n++) {
+        // cap->pinned_object_block is counted when it is full
+        sampleBlocks(census, capabilities[n]->pinned_object_blocks);
+    }
+    sampleNewLargeObjects(census);
+
+    if (performHeapProfile || RtsFlags.ProfFlags.heapProfileInterval == 0) {
+        census->time = mut_user_time_until(t);
+        dumpCensus(census);
+        freeEra(census);
+        nextEra();
+        performHeapProfile = false;
+    }
+}
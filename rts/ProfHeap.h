@@ -11,6 +11,7 @@
 #include "BeginPrivate.h"
 
 void        heapCensus         (Time t);
+void        heapSample         (Time t);
 uint32_t    initHeapProfiling  (void);
 void        endHeapProfiling   (void);
 bool        strMatchesSelector (const char* str, const char* sel);
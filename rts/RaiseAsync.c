@@ -19,6 +19,7 @@
 #include "sm/Sanity.h"
 #include "Profiling.h"
 #include "Messages.h"
+#include "AwaitEvent.h"
 #if defined(mingw32_HOST_OS)
 #include "win32/IOManager.h"
 #endif
@@ -704,6 +705,13 @@ removeFromQueues(Capability *cap, StgTSO *tso)
   case BlockedOnWrite:
 #if defined(mingw32_HOST_OS)
   case BlockedOnDoProc:
+#endif
+#if !defined(mingw32_HOST_OS)
+      if (tso->flags & TSO_IO_REGISTERED) {
+          // awaitEvent() moved it off the blocked queue
+          removeAwaitingIO(tso);
+          goto done;
+      }
 #endif
       removeThreadFromDeQueue(cap, &blocked_queue_hd, &blocked_queue_tl, tso);
 #if defined(mingw32_HOST_OS)
@@ -1035,6 +1043,7 @@ raiseAsync(Capability *cap, StgTSO *tso, StgClosure *exception,
                               "raiseAsync: freezing atomically frame")
                 stmAbortTransaction(cap, trec);
                 stmFreeAbortedTRec(cap, trec);
+                stmCountAbort(cap, false);
                 tso->trec = outer;
 
                 atomically = (StgThunk*)allocate(cap,sizeofW(StgThunk)+1);
@@ -1768,7 +1768,7 @@ computeRetainerSet( void )
     // Consider roots from the stable ptr table.
     markStablePtrTable(retainRoot, NULL);
     // Remember old stable name addresses.
-    rememberOldStableNameAddresses ();
+    rememberOldStableNameAddresses (RtsFlags.GcFlags.generations - 1);
 
     // The following code resets the rs field of each unvisited mutable
     // object (computing sumOfNewCostExtra and updating costArray[] when
@@ -158,6 +158,7 @@ void initRtsFlagsDefaults(void)
     RtsFlags.GcFlags.compact            = false;
     RtsFlags.GcFlags.compactThreshold   = 30.0;
     RtsFlags.GcFlags.sweep              = false;
+    RtsFlags.GcFlags.prefetchDepth      = 0;
     RtsFlags.GcFlags.idleGCDelayTime    = USToTime(300000); // 300ms
 #if defined(THREADED_RTS)
     RtsFlags.GcFlags.doIdleGC           = true;
@@ -168,6 +169,7 @@ void initRtsFlagsDefaults(void)
     RtsFlags.GcFlags.allocLimitGrace    = (100*1024) / BLOCK_SIZE;
     RtsFlags.GcFlags.numa               = false;
     RtsFlags.GcFlags.numaMask           = 1;
+    RtsFlags.GcFlags.hugePageSize       = 0;
     RtsFlags.GcFlags.ringBell           = false;
     RtsFlags.GcFlags.longGCSync         = 0; /* detection turned off */
 
@@ -196,6 +198,7 @@ void initRtsFlagsDefaults(void)
 
     RtsFlags.ProfFlags.doHeapProfile      = false;
     RtsFlags.ProfFlags.heapProfileInterval = USToTime(100000); // 100ms
+    RtsFlags.ProfFlags.heapSampleBytes    = 0;
 
 #if defined(PROFILING)
     RtsFlags.ProfFlags.includeTSOs        = false;
@@ -220,6 +223,10 @@ void initRtsFlagsDefaults(void)
     RtsFlags.TraceFlags.sparks_full   = false;
     RtsFlags.TraceFlags.user          = false;
     RtsFlags.TraceFlags.trace_output  = NULL;
+    RtsFlags.TraceFlags.drop_events   = false;
+    RtsFlags.TraceFlags.eventlog_socket = NULL;
+    RtsFlags.TraceFlags.flush_interval  = 0;
+    RtsFlags.TraceFlags.compact         = false;
 #endif
 
 #if defined(PROFILING)
@@ -238,6 +245,9 @@ void initRtsFlagsDefaults(void)
     RtsFlags.MiscFlags.internalCounters        = false;
     RtsFlags.MiscFlags.linkerAlwaysPic         = DEFAULT_LINKER_ALWAYS_PIC;
     RtsFlags.MiscFlags.linkerMemBase           = 0;
+    RtsFlags.MiscFlags.linkerThreads           = 0;
+    RtsFlags.MiscFlags.linkerIndexCache        = NULL;
+    RtsFlags.MiscFlags.linkerLazyArchives      = false;
 
 #if defined(THREADED_RTS)
     RtsFlags.ParFlags.nCapabilities     = 1;
@@ -303,6 +313,9 @@ usage_text[] = {
 "  -c       Use in-place compaction for all oldest generation collections",
 "           (the default is to use copying)",
 "  -w       Use mark-region for the oldest generation (experimental)",
+"  --gc-prefetch[=<n>]",
+"           Prefetch the objects that <n> fields point to ahead of copying",
+"           them in the GC (default: 8, maximum 32)",
 #if defined(THREADED_RTS)
 "  -I<sec>  Perform full GC after <sec> idle time (default: 0.3, 0 == off)",
 #endif
@@ -374,9 +387,22 @@ usage_text[] = {
 #  endif
 "               -x    disable an event class, for any flag above",
 "             the initial enabled event classes are 'sgpu'",
+"  --eventlog-drop  Drop events, rather than wait, when the eventlog",
+"             is written more slowly than events are logged",
+#  if !defined(mingw32_HOST_OS)
+"  --eventlog-socket=<path>  Stream the eventlog to a consumer of the Unix",
+"             domain socket <path>, instead of writing it to a file",
+#  endif
+"  --eventlog-flush-interval=<secs>  Write out logged events at least this",
+"             often (default: 1 with --eventlog-socket, otherwise only",
+"             when a buffer is full)",
+"  --eventlog-compact  Compress the eventlog (to <program>.ceventlog, by",
+"             default); decode it with eventlog-decode",
 #endif
 
 "  -i<sec>  Time between heap profile samples (seconds, default: 0.1)",
+"  --heap-sample=<size>  Profile the allocation by sampling one byte in",
+"            <size> (at least 4k), instead of taking heap censuses",
 "",
 #if defined(TICKY_TICKY)
 "  -r<file>  Produce ticky-ticky statistics (with -rstderr for stderr)",
@@ -440,6 +466,8 @@ usage_text[] = {
 "",
 #endif
 #endif
+"  --huge-pages[=<size>]",
+"            Back the heap with huge pages of <size> (default: 2m)",
 "  --install-signal-handlers=<yes|no>",
 "            Install signal handlers (default: yes)",
 #if defined(mingw32_HOST_OS)
@@ -466,6 +494,15 @@ usage_text[] = {
 "  -xm       Base address to mmap memory in the GHCi linker",
 "            (hex; must be <80000000)",
 #endif
+#if defined(THREADED_RTS)
+"  -xl<n>    Resolve object files on <n> threads in the GHCi linker",
+"            (default: 0, the number of processors)",
+#endif
+"  --linker-index-cache=<dir>",
+"            Cache the symbol indices of the archives that the GHCi",
+"            linker loads in <dir>",
+"  --linker-lazy-archives",
+"            Only read the archive members that the GHCi linker needs",
 "  -xq       The allocation limit given to a thread after it receives",
 "            an AllocationLimitExceeded exception. (default: 100k)",
 "",
@@ -966,6 +1003,106 @@ error = true;
                       }
                   }
 #endif
+                  else if (!strncmp("huge-pages", &rts_argv[arg][2], 10)) {
+                      OPTION_SAFE;
+                      StgWord64 size = 2 * 1024 * 1024;
+                      if (!osBuiltWithHugePageSupport()) {
+                          errorBelch("%s: huge pages are not supported on "
+                                     "this platform", rts_argv[arg]);
+                          error = true;
+                          break;
+                      }
+                      if (rts_argv[arg][12] == '=') {
+                          size = decodeSize(rts_argv[arg], 13,
+                                            2 * 1024 * 1024,
+                                            1024 * 1024 * 1024);
+                      } else if (rts_argv[arg][12] != '\0') {
+                          bad_option(rts_argv[arg]);
+                      }
+                      if ((size & (size - 1)) != 0) {
+                          errorBelch("%s: the size of a huge page must be a "
+                                     "power of 2", rts_argv[arg]);
+                          error = true;
+                          break;
+                      }
+                      RtsFlags.GcFlags.hugePageSize = (StgWord)size;
+                  }
+                  else if (!strncmp("linker-index-cache=",
+                                    &rts_argv[arg][2], 19)) {
+                      OPTION_UNSAFE;
+                      if (rts_argv[arg][21] == '\0') {
+                          errorBelch("--linker-index-cache expects a directory");
+                          error = true;
+                      } else {
+                          RtsFlags.MiscFlags.linkerIndexCache =
+                              strdup(&rts_argv[arg][21]);
+                      }
+                  }
+                  else if (strequal("eventlog-drop",
+                                    &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.drop_events = true;
+                          );
+                  }
+                  else if (!strncmp("eventlog-socket=",
+                                    &rts_argv[arg][2], 16)) {
+                      OPTION_UNSAFE;
+#if defined(mingw32_HOST_OS)
+                      errorBelch("%s: not supported on Windows",
+                                 rts_argv[arg]);
+                      error = true;
+#else
+                      TRACING_BUILD_ONLY(
+                          if (rts_argv[arg][18] == '\0') {
+                              errorBelch("--eventlog-socket expects a path");
+                              error = true;
+                          } else {
+                              RtsFlags.TraceFlags.eventlog_socket =
+                                  strdup(&rts_argv[arg][18]);
+                          }
+                          );
+#endif
+                  }
+                  else if (!strncmp("eventlog-flush-interval=",
+                                    &rts_argv[arg][2], 24)) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.flush_interval =
+                              fsecondsToTime(atof(rts_argv[arg]+26));
+                          );
+                  }
+                  else if (strequal("eventlog-compact",
+                                    &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.compact = true;
+                          );
+                  }
+                  else if (!strncmp("gc-prefetch", &rts_argv[arg][2], 11)) {
+                      OPTION_SAFE;
+                      if (rts_argv[arg][13] == '=') {
+                          RtsFlags.GcFlags.prefetchDepth =
+                              (uint32_t)decodeSize(rts_argv[arg], 14,
+                                                   0, GC_PREFETCH_MAX);
+                      } else if (rts_argv[arg][13] == '\0') {
+                          RtsFlags.GcFlags.prefetchDepth = 8;
+                      } else {
+                          bad_option(rts_argv[arg]);
+                      }
+                  }
+                  else if (strequal("linker-lazy-archives",
+                                    &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      RtsFlags.MiscFlags.linkerLazyArchives = true;
+                  }
+                  else if (!strncmp("heap-sample=",
+                                    &rts_argv[arg][2], 12)) {
+                      OPTION_UNSAFE;
+                      RtsFlags.ProfFlags.heapSampleBytes =
+                          decodeSize(rts_argv[arg], 14, BLOCK_SIZE,
+                                     HS_INT_MAX);
+                  }
                   else if (!strncmp("long-gc-sync=", &rts_argv[arg][2], 13)) {
                       OPTION_SAFE;
                       if (rts_argv[arg][2] == '\0') {
@@ -1528,6 +1665,20 @@ error = true;
                     break;
 #endif
 
+                case 'l': /* linkerThreads */
+                    OPTION_UNSAFE;
+                    THREADED_BUILD_ONLY(
+                        int threads
+                            = strtol(rts_argv[arg]+3, (char **) NULL, 10);
+                        if (rts_argv[arg][3] == '\0' || threads < 0) {
+                            errorBelch("bad value for -xl");
+                            error = true;
+                        } else {
+                            RtsFlags.MiscFlags.linkerThreads
+                                = (uint32_t)threads;
+                        }
+                        ) break;
+
                 case 'c': /* Debugging tool: show current cost centre on
                            an exception */
                     OPTION_SAFE;
@@ -1663,6 +1814,12 @@ static void normaliseRtsOpts (void)
         errorUsage();
     }
 
+    if (RtsFlags.ProfFlags.heapSampleBytes != 0 &&
+        !RtsFlags.ProfFlags.doHeapProfile) {
+        errorBelch("--heap-sample needs a heap profile (-h)");
+        errorUsage();
+    }
+
     if (RtsFlags.GcFlags.maxHeapSize != 0 &&
         RtsFlags.GcFlags.heapSizeSuggestion >
         RtsFlags.GcFlags.maxHeapSize) {
@@ -570,6 +570,8 @@
       SymI_HasProto(stg_compactAllocateBlockzh)                         \
       SymI_HasProto(stg_compactFixupPointerszh)                         \
       SymI_HasProto(stg_compactSizzezh)                                 \
+      SymI_HasProto(compactWriteFile)                                   \
+      SymI_HasProto(compactMapFile)                                     \
       SymI_HasProto(closure_flags)                                      \
       SymI_HasProto(cmp_thread)                                         \
       SymI_HasProto(createAdjustor)                                     \
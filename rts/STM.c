@@ -95,6 +95,7 @@
 #include "SMPClosureOps.h"
 
 #include <stdio.h>
+#include <string.h>
 
 // ACQ_ASSERT is used for assertions which are only required for
 // THREADED_RTS builds with fine-grained locking.
@@ -367,6 +368,7 @@ static void unpark_waiters_on(Capability *cap, StgTVar *s) {
        q != END_STM_WATCH_QUEUE;
        q = q -> prev_queue_entry) {
       unpark_tso(cap, (StgTSO *)(q -> closure));
+      cap -> stm_stats.wakeups ++;
   }
 }
 
@@ -400,6 +402,7 @@ static StgTRecHeader *new_stg_trec_header(Capability *cap,
 
   result -> enclosing_trec = enclosing_trec;
   result -> current_chunk = new_stg_trec_chunk(cap);
+  result -> index = NO_TREC_INDEX;
 
   if (enclosing_trec == NO_TREC) {
     result -> state = TREC_ACTIVE;
@@ -469,6 +472,7 @@ static StgTRecHeader *alloc_stg_trec_header(Capability *cap,
     cap -> free_trec_headers = result -> enclosing_trec;
     result -> enclosing_trec = enclosing_trec;
     result -> current_chunk -> next_entry_idx = 0;
+    result -> index = NO_TREC_INDEX;
     if (enclosing_trec == NO_TREC) {
       result -> state = TREC_ACTIVE;
     } else {
@@ -571,8 +575,126 @@ static void remove_watch_queue_entries_for_trec(Capability *cap,
 
 /*......................................................................*/
 
+// Note [TRec index]
+// ~~~~~~~~~~~~~~~~~
+// Looking up the entry for a TVar in a TRec is a linear search through its
+// chunks, so a transaction that touches N TVars would take O(N^2) time.
+// Once a TRec outgrows its first chunk we give it an index: an open
+// addressing hash table, with linear probing, from TVars to their entries.
+// It lives in an ARR_WORDS hanging off the TRec's "index" field
+// (NO_TREC_INDEX for small TRecs), so that it goes away with the TRec.
+//
+// The index holds the addresses of TVars and entries, which change when the
+// GC moves them; it is not traced by the GC.  Instead every GC bumps
+// stm_gc_epoch (in stmPreGCHook), and an index built in an earlier epoch is
+// thrown away and rebuilt from the entries when it is next used.
+//
+// The index is kept at most half full, and there is at most one entry for
+// a TVar in each TRec, so a lookup finds it or an empty slot quickly.
+
+#define TREC_INDEX_MIN_SLOTS (4 * TREC_CHUNK_NUM_ENTRIES)
+
+typedef struct {
+  StgWord epoch;        // stm_gc_epoch when the index was built
+  StgWord n_entries;    // the number of entries in the TRec
+  StgWord mask;         // the number of slots - 1
+  TRecEntry *slots[];   // NULL for an empty slot
+} TRecIndex;
+
+static volatile StgWord stm_gc_epoch = 0;
+
+static StgWord hash_tvar(StgTVar *tvar) {
+  StgWord h = (StgWord)tvar * (StgWord)0x9e3779b97f4a7c15ULL;
+  return h ^ (h >> 16);
+}
+
+static void trec_index_insert(TRecIndex *index, TRecEntry *e) {
+  StgWord i = hash_tvar(e -> tvar) & index -> mask;
+  while (index -> slots[i] != NULL) {
+    i = (i + 1) & index -> mask;
+  }
+  index -> slots[i] = e;
+  index -> n_entries ++;
+}
+
+// Build a new index of the n_entries entries of t
+static TRecIndex *build_trec_index(Capability *cap,
+                                   StgTRecHeader *t,
+                                   StgWord n_entries) {
+  StgWord n_slots = TREC_INDEX_MIN_SLOTS;
+  StgWord bytes;
+  StgArrBytes *arr;
+  TRecIndex *index;
+
+  while (n_slots < 2 * n_entries) {
+    n_slots *= 2;
+  }
+  bytes = sizeof(TRecIndex) + n_slots * sizeof(TRecEntry *);
+  arr = (StgArrBytes *)allocate(cap, sizeofW(StgArrBytes)
+                                     + ROUNDUP_BYTES_TO_WDS(bytes));
+  SET_HDR (arr, &stg_ARR_WORDS_info, CCS_SYSTEM);
+  arr -> bytes = bytes;
+
+  index = (TRecIndex *)arr -> payload;
+  index -> epoch = stm_gc_epoch;
+  index -> n_entries = 0;
+  index -> mask = n_slots - 1;
+  memset(index -> slots, 0, n_slots * sizeof(TRecEntry *));
+  FOR_EACH_ENTRY(t, e, {
+    trec_index_insert(index, e);
+  });
+  ASSERT(index -> n_entries == n_entries);
+
+  t -> index = arr;
+  TRACE("%p : indexed %ld entries", t, n_entries);
+  return index;
+}
+
+// The index of t, or NULL if it is too small to have one
+static TRecIndex *get_trec_index(Capability *cap, StgTRecHeader *t) {
+  TRecIndex *index;
+
+  if (t -> index == NO_TREC_INDEX) {
+    return NULL;
+  }
+  index = (TRecIndex *)t -> index -> payload;
+  if (index -> epoch != stm_gc_epoch) {
+    // The GC has moved things since we built it
+    index = build_trec_index(cap, t, index -> n_entries);
+  }
+  return index;
+}
+
+// Look for the entry for tvar in t, not in its enclosing TRecs
+static TRecEntry *find_entry(Capability *cap,
+                             StgTRecHeader *t,
+                             StgTVar *tvar) {
+  TRecIndex *index = get_trec_index(cap, t);
+  TRecEntry *result = NULL;
+
+  if (index != NULL) {
+    StgWord i = hash_tvar(tvar) & index -> mask;
+    while ((result = index -> slots[i]) != NULL && result -> tvar != tvar) {
+      i = (i + 1) & index -> mask;
+    }
+    return result;
+  }
+
+  FOR_EACH_ENTRY(t, e, {
+    if (e -> tvar == tvar) {
+      result = e;
+      BREAK_FOR_EACH;
+    }
+  });
+  return result;
+}
+
+/*......................................................................*/
+
 static TRecEntry *get_new_entry(Capability *cap,
-                                StgTRecHeader *t) {
+                                StgTRecHeader *t,
+                                StgTVar *tvar) {
+  TRecIndex *index = get_trec_index(cap, t);
   TRecEntry *result;
   StgTRecChunk *c;
   int i;
@@ -588,6 +710,10 @@ static TRecEntry *get_new_entry(Capability *cap,
   } else {
     // Current chunk is full: allocate a fresh one
     StgTRecChunk *nc;
+    if (index == NULL) {
+      // The TRec is getting big: index the entries so far
+      index = build_trec_index(cap, t, TREC_CHUNK_NUM_ENTRIES);
+    }
     nc = alloc_stg_trec_chunk(cap);
     nc -> prev_chunk = c;
     nc -> next_entry_idx = 1;
@@ -595,6 +721,16 @@ static TRecEntry *get_new_entry(Capability *cap,
     result = &(nc -> entries[0]);
   }
 
+  result -> tvar = tvar;
+  if (index != NULL) {
+    if (2 * (index -> n_entries + 1) > index -> mask + 1) {
+      // Too full: the new index includes the new entry
+      build_trec_index(cap, t, index -> n_entries + 1);
+    } else {
+      trec_index_insert(index, result);
+    }
+  }
+
   return result;
 }
 
@@ -607,28 +743,20 @@ static void merge_update_into(Capability *cap,
                               StgClosure *new_value)
 {
   // Look for an entry in this trec
-  bool found = false;
-  FOR_EACH_ENTRY(t, e, {
-    StgTVar *s;
-    s = e -> tvar;
-    if (s == tvar) {
-      found = true;
-      if (e -> expected_value != expected_value) {
-        // Must abort if the two entries start from different values
-        TRACE("%p : update entries inconsistent at %p (%p vs %p)",
-              t, tvar, e -> expected_value, expected_value);
-        t -> state = TREC_CONDEMNED;
-      }
-      e -> new_value = new_value;
-      BREAK_FOR_EACH;
+  TRecEntry *e = find_entry(cap, t, tvar);
+
+  if (e != NULL) {
+    if (e -> expected_value != expected_value) {
+      // Must abort if the two entries start from different values
+      TRACE("%p : update entries inconsistent at %p (%p vs %p)",
+            t, tvar, e -> expected_value, expected_value);
+      t -> state = TREC_CONDEMNED;
     }
-  });
-
-  if (!found) {
+    e -> new_value = new_value;
+  } else {
     // No entry so far in this trec
     TRecEntry *ne;
-    ne = get_new_entry(cap, t);
-    ne -> tvar = tvar;
+    ne = get_new_entry(cap, t, tvar);
     ne -> expected_value = expected_value;
     ne -> new_value = new_value;
   }
@@ -667,25 +795,22 @@ static void merge_read_into(Capability *cap,
   //
   for (t = trec; !found && t != NO_TREC; t = t -> enclosing_trec)
   {
-    FOR_EACH_ENTRY(t, e, {
-      if (e -> tvar == tvar) {
-        found = true;
-        if (e -> expected_value != expected_value) {
-            // Must abort if the two entries start from different values
-            TRACE("%p : read entries inconsistent at %p (%p vs %p)",
-                  t, tvar, e -> expected_value, expected_value);
-            t -> state = TREC_CONDEMNED;
-        }
-        BREAK_FOR_EACH;
+    TRecEntry *e = find_entry(cap, t, tvar);
+    if (e != NULL) {
+      found = true;
+      if (e -> expected_value != expected_value) {
+          // Must abort if the two entries start from different values
+          TRACE("%p : read entries inconsistent at %p (%p vs %p)",
+                t, tvar, e -> expected_value, expected_value);
+          t -> state = TREC_CONDEMNED;
       }
-    });
+    }
   }
 
   if (!found) {
     // No entry found
     TRecEntry *ne;
-    ne = get_new_entry(cap, trec);
-    ne -> tvar = tvar;
+    ne = get_new_entry(cap, trec, tvar);
     ne -> expected_value = expected_value;
     ne -> new_value = expected_value;
   }
@@ -693,12 +818,84 @@ static void merge_read_into(Capability *cap,
 
 /*......................................................................*/
 
+// Note [STM version clock]
+// ~~~~~~~~~~~~~~~~~~~~~~~~
+// With fine-grained locking we use a global version clock, as in TL2
+// ("Transactional Locking II", Dice, Shalev and Shavit, DISC 2006), so
+// that most commits don't have to look at the TVars they only read:
+//
+//  - A writing commit, having locked the TVars that it updates, advances
+//    stm_version_clock, and stores the new time (its write version) in
+//    the "num_updates" field of each TVar it writes, before unlocking it.
+//
+//  - A transaction takes the time when it starts as its read version
+//    (nested transactions share the read version of the outermost one).
+//    Whenever it reads a TVar that isn't in its TRecs yet, it checks that
+//    the TVar was last written at or before its read version, and that
+//    the value and version it saw go together.  If all of its reads pass,
+//    they are a snapshot of the heap at the read version.
+//
+//  - So a read-only transaction whose reads are a snapshot commits at its
+//    read version, without locking or even looking at any TVar.
+//
+//  - A writing transaction whose reads are a snapshot only needs to check
+//    that the TVars it read haven't been written since its read version,
+//    and not even that if no other transaction has advanced the clock in
+//    the meantime.
+//
+// A read that finds a TVar written after the read version doesn't abort
+// the transaction, as it would in TL2: it sets the read version to
+// TREC_NO_SNAPSHOT, and the transaction is validated at commit as before,
+// with check_read_only comparing the versions it saw when it acquired
+// ownership.  TVars are created with version 0, which is before any read
+// version.
+//
+// The clock is a StgWord, which on a 32-bit platform wraps around after
+// 2^32 writing commits.  A read version taken just before the wrap would
+// then be later than the versions written after it, and the transaction
+// would miss those writes.  So a transaction that starts when the clock
+// has reached STM_VERSION_LIMIT, half way round, doesn't take a snapshot
+// but is validated in full.  Once the clock has wrapped, the TVars still
+// carry versions from before, which look as if they were written after
+// any new read version; that only costs the readers their snapshots.  A
+// transaction would have to stay live for 2^31 commits to see a wrap,
+// which is the same kind of assumption as the one behind max_commits
+// below.
+
+#define TREC_NO_SNAPSHOT 0
+
+#define STM_VERSION_LIMIT ((StgWord)1 << (sizeof(StgWord) * 8 - 1))
+
+static volatile StgWord stm_version_clock = 1;
+
+/*......................................................................*/
+
 static StgBool entry_is_update(TRecEntry *e) {
   StgBool result;
   result = (e -> expected_value != e -> new_value);
   return result;
 }
 
+// A read-only transaction whose reads are a snapshot commits at its read
+// version, without looking at the TVars (Note [STM version clock])
+static StgBool commit_read_only_snapshot(StgTRecHeader *trec STG_UNUSED) {
+#if defined(STM_FG_LOCKS)
+  if (trec -> state != TREC_ACTIVE ||
+      trec -> read_version == TREC_NO_SNAPSHOT ||
+      shake()) {
+    return false;
+  }
+  FOR_EACH_ENTRY(trec, e, {
+    if (entry_is_update(e)) {
+      return false;
+    }
+  });
+  return true;
+#else
+  return false;
+#endif
+}
+
 #if defined(STM_FG_LOCKS)
 static StgBool entry_is_read_only(TRecEntry *e) {
   StgBool result;
@@ -778,7 +975,7 @@ static StgBool validate_and_acquire_ownership (Capability *cap,
           result = false;
           BREAK_FOR_EACH;
         }
-      } else {
+      } else if (trec -> read_version == TREC_NO_SNAPSHOT) {
         ASSERT(config_use_read_phase);
         IF_STM_FG_LOCKS({
           TRACE("%p : will need to check %p", trec, s);
@@ -817,12 +1014,56 @@ static StgBool validate_and_acquire_ownership (Capability *cap,
 // The paper "Concurrent programming without locks" (under submission), or
 // Keir Fraser's PhD dissertation "Practical lock-free programming" discuss
 // this kind of algorithm.
+//
+// If the reads of trec are a snapshot (Note [STM version clock]), we check
+// instead that no TVar it read has been written since its read version;
+// there's no need to look if the commit that is calling us is the first
+// one since then, which it knows from its write_version (0 if it doesn't
+// write).
 
-static StgBool check_read_only(StgTRecHeader *trec STG_UNUSED) {
+#if defined(STM_FG_LOCKS)
+static StgBool check_read_snapshot(StgTRecHeader *trec,
+                                   StgWord write_version) {
+  StgWord read_version = trec -> read_version;
+  StgBool result = true;
+
+  if (write_version == read_version + 1) {
+    TRACE("%p : nothing committed since %ld", trec, read_version);
+    return true;
+  }
+  FOR_EACH_ENTRY(trec, e, {
+    StgTVar *s;
+    s = e -> tvar;
+    if (entry_is_read_only(e)) {
+      // current_value first: a TVar locked by a commit may not have its
+      // new version yet
+      if (s -> current_value != e -> expected_value) {
+        TRACE("%p : %p changed", trec, s);
+        result = false;
+        BREAK_FOR_EACH;
+      }
+      load_load_barrier();
+      if ((StgWord)s -> num_updates > read_version) {
+        TRACE("%p : %p written since %ld", trec, s, read_version);
+        result = false;
+        BREAK_FOR_EACH;
+      }
+    }
+  });
+  return result;
+}
+#endif
+
+static StgBool check_read_only(StgTRecHeader *trec STG_UNUSED,
+                               StgWord write_version STG_UNUSED) {
   StgBool result = true;
 
   ASSERT(config_use_read_phase);
   IF_STM_FG_LOCKS({
+    if (trec -> read_version != TREC_NO_SNAPSHOT) {
+      return check_read_snapshot(trec, write_version);
+    }
+
     FOR_EACH_ENTRY(trec, e, {
       StgTVar *s;
       s = e -> tvar;
@@ -854,6 +1095,8 @@ void stmPreGCHook (Capability *cap) {
   cap->free_tvar_watch_queues = END_STM_WATCH_QUEUE;
   cap->free_trec_chunks = END_STM_CHUNK_LIST;
   cap->free_trec_headers = NO_TREC;
+  // See Note [TRec index]
+  atomic_inc(&stm_gc_epoch, 1);
   unlock_stm(NO_TREC);
 }
 
@@ -906,6 +1149,15 @@ StgTRecHeader *stmStartTransaction(Capability *cap,
   getToken(cap);
 
   t = alloc_stg_trec_header(cap, outer);
+  if (outer == NO_TREC) {
+    cap -> stm_stats.starts ++;
+    StgWord now = stm_version_clock;
+    t -> read_version = now < STM_VERSION_LIMIT ? now : TREC_NO_SNAPSHOT;
+    // read the clock before we read any TVars
+    load_load_barrier();
+  } else {
+    t -> read_version = outer -> read_version;
+  }
   TRACE("%p : stmStartTransaction()=%p", outer, t);
   return t;
 }
@@ -943,6 +1195,9 @@ void stmAbortTransaction(Capability *cap,
       StgTVar *s = e -> tvar;
       merge_read_into(cap, et, s, e -> expected_value);
     });
+    if (trec -> read_version == TREC_NO_SNAPSHOT) {
+      et -> read_version = TREC_NO_SNAPSHOT;
+    }
   }
 
   trec -> state = TREC_ABORTED;
@@ -1019,22 +1274,18 @@ StgBool stmValidateNestOfTransactions(Capability *cap, StgTRecHeader *trec) {
 
 /*......................................................................*/
 
-static TRecEntry *get_entry_for(StgTRecHeader *trec, StgTVar *tvar, StgTRecHeader **in) {
+static TRecEntry *get_entry_for(Capability *cap, StgTRecHeader *trec,
+                                StgTVar *tvar, StgTRecHeader **in) {
   TRecEntry *result = NULL;
 
   TRACE("%p : get_entry_for TVar %p", trec, tvar);
   ASSERT(trec != NO_TREC);
 
   do {
-    FOR_EACH_ENTRY(trec, e, {
-      if (e -> tvar == tvar) {
-        result = e;
-        if (in != NULL) {
-          *in = trec;
-        }
-        BREAK_FOR_EACH;
-      }
-    });
+    result = find_entry(cap, trec, tvar);
+    if (result != NULL && in != NULL) {
+      *in = trec;
+    }
     trec = trec -> enclosing_trec;
   } while (result == NULL && trec != NO_TREC);
 
@@ -1055,9 +1306,21 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
   ASSERT((trec -> state == TREC_ACTIVE) ||
          (trec -> state == TREC_CONDEMNED));
 
+  if (commit_read_only_snapshot(trec)) {
+    // See Note [STM version clock]
+    TRACE("%p : read-only, committed at version %ld",
+          trec, trec -> read_version);
+    unlock_stm(trec);
+    free_stg_trec_header(cap, trec);
+    cap -> stm_stats.commits ++;
+    return true;
+  }
+
   // Use a read-phase (i.e. don't lock TVars we've read but not updated) if
   // the configuration lets us use a read phase.
 
+  StgWord write_version = 0;
+  bool condemned = (trec -> state == TREC_CONDEMNED);
   bool result = validate_and_acquire_ownership(cap, trec, (!config_use_read_phase), true);
   if (result) {
     // We now know that all the updated locations hold their expected values.
@@ -1066,8 +1329,11 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
     if (config_use_read_phase) {
       StgInt64 max_commits_at_end;
       StgInt64 max_concurrent_commits;
+      // We hold the locks on everything that we update, so we can take
+      // our place in the order of commits (Note [STM version clock])
+      write_version = atomic_inc(&stm_version_clock, 1);
       TRACE("%p : doing read check", trec);
-      result = check_read_only(trec);
+      result = check_read_only(trec, write_version);
       TRACE("%p : read-check %s", trec, result ? "succeeded" : "failed");
 
       max_commits_at_end = max_commits;
@@ -1095,7 +1361,9 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
           TRACE("%p : writing %p to %p, waking waiters", trec, e -> new_value, s);
           unpark_waiters_on(cap,s);
           IF_STM_FG_LOCKS({
-            s -> num_updates ++;
+            s -> num_updates = write_version;
+            // the version must be there before the new value
+            write_barrier();
           });
           unlock_tvar(cap, trec, s, e -> new_value, true);
         }
@@ -1110,6 +1378,14 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
 
   free_stg_trec_header(cap, trec);
 
+  if (result) {
+    cap -> stm_stats.commits ++;
+  } else if (condemned) {
+    cap -> stm_stats.aborts_invalid ++;
+  } else {
+    cap -> stm_stats.aborts_conflict ++;
+  }
+
   TRACE("%p : stmCommitTransaction()=%d", trec, result);
 
   return result;
@@ -1132,7 +1408,7 @@ StgBool stmCommitNestedTransaction(Capability *cap, StgTRecHeader *trec) {
 
     if (config_use_read_phase) {
       TRACE("%p : doing read check", trec);
-      result = check_read_only(trec);
+      result = check_read_only(trec, 0);
     }
     if (result) {
       // We now know that all of the read-only locations held their expected values
@@ -1152,6 +1428,9 @@ StgBool stmCommitNestedTransaction(Capability *cap, StgTRecHeader *trec) {
         merge_update_into(cap, et, s, e -> expected_value, e -> new_value);
         ACQ_ASSERT(s -> current_value != (StgClosure *)trec);
       });
+      if (trec -> read_version == TREC_NO_SNAPSHOT) {
+        et -> read_version = TREC_NO_SNAPSHOT;
+      }
     } else {
         revert_ownership(cap, trec, false);
     }
@@ -1168,6 +1447,16 @@ StgBool stmCommitNestedTransaction(Capability *cap, StgTRecHeader *trec) {
 
 /*......................................................................*/
 
+void stmCountAbort(Capability *cap, StgBool invalid) {
+  if (invalid) {
+    cap -> stm_stats.aborts_invalid ++;
+  } else {
+    cap -> stm_stats.aborts_exception ++;
+  }
+}
+
+/*......................................................................*/
+
 StgBool stmWait(Capability *cap, StgTSO *tso, StgTRecHeader *trec) {
   TRACE("%p : stmWait(%p)", trec, tso);
   ASSERT(trec != NO_TREC);
@@ -1175,6 +1464,8 @@ StgBool stmWait(Capability *cap, StgTSO *tso, StgTRecHeader *trec) {
   ASSERT((trec -> state == TREC_ACTIVE) ||
          (trec -> state == TREC_CONDEMNED));
 
+  cap -> stm_stats.retries ++;
+
   lock_stm(trec);
   bool result = validate_and_acquire_ownership(cap, trec, true, true);
   if (result) {
@@ -1200,6 +1491,8 @@ StgBool stmWait(Capability *cap, StgTSO *tso, StgTRecHeader *trec) {
   } else {
     unlock_stm(trec);
     free_stg_trec_header(cap, trec);
+    // the caller runs it again
+    cap -> stm_stats.aborts_invalid ++;
   }
 
   TRACE("%p : stmWait(%p)=%d", trec, tso, result);
@@ -1240,6 +1533,8 @@ StgBool stmReWait(Capability *cap, StgTSO *tso) {
       remove_watch_queue_entries_for_trec (cap, trec);
     }
     free_stg_trec_header(cap, trec);
+    // the caller runs it again
+    cap -> stm_stats.aborts_invalid ++;
   }
   unlock_stm(trec);
 
@@ -1264,6 +1559,33 @@ static StgClosure *read_current_value(StgTRecHeader *trec STG_UNUSED, StgTVar *t
   return result;
 }
 
+// Read a TVar for a new entry in trec, and check that the value is part of
+// the snapshot at trec's read version (Note [STM version clock])
+static StgClosure *read_new_value(StgTRecHeader *trec, StgTVar *tvar) {
+#if defined(STM_FG_LOCKS)
+  StgClosure *result;
+  StgWord before, after;
+
+  do {
+    before = tvar -> num_updates;
+    load_load_barrier();
+    result = read_current_value(trec, tvar);
+    load_load_barrier();
+    after = tvar -> num_updates;
+  } while (before != after);
+
+  if (after > trec -> read_version
+      && trec -> read_version != TREC_NO_SNAPSHOT) {
+    TRACE("%p : %p was written at %ld, after %ld", trec, tvar, after,
+          trec -> read_version);
+    trec -> read_version = TREC_NO_SNAPSHOT;
+  }
+  return result;
+#else
+  return read_current_value(trec, tvar);
+#endif
+}
+
 /*......................................................................*/
 
 StgClosure *stmReadTVar(Capability *cap,
@@ -1277,7 +1599,7 @@ StgClosure *stmReadTVar(Capability *cap,
   ASSERT(trec -> state == TREC_ACTIVE ||
          trec -> state == TREC_CONDEMNED);
 
-  entry = get_entry_for(trec, tvar, &entry_in);
+  entry = get_entry_for(cap, trec, tvar, &entry_in);
 
   if (entry != NULL) {
     if (entry_in == trec) {
@@ -1285,20 +1607,19 @@ StgClosure *stmReadTVar(Capability *cap,
       result = entry -> new_value;
     } else {
       // Entry found in another trec
-      TRecEntry *new_entry = get_new_entry(cap, trec);
-      new_entry -> tvar = tvar;
+      TRecEntry *new_entry = get_new_entry(cap, trec, tvar);
       new_entry -> expected_value = entry -> expected_value;
       new_entry -> new_value = entry -> new_value;
       result = new_entry -> new_value;
     }
   } else {
     // No entry found
-    StgClosure *current_value = read_current_value(trec, tvar);
-    TRecEntry *new_entry = get_new_entry(cap, trec);
-    new_entry -> tvar = tvar;
+    StgClosure *current_value = read_new_value(trec, tvar);
+    TRecEntry *new_entry = get_new_entry(cap, trec, tvar);
     new_entry -> expected_value = current_value;
     new_entry -> new_value = current_value;
     result = current_value;
+    cap -> stm_stats.tvars ++;
   }
 
   TRACE("%p : stmReadTVar(%p)=%p", trec, tvar, result);
@@ -1319,7 +1640,7 @@ void stmWriteTVar(Capability *cap,
   ASSERT(trec -> state == TREC_ACTIVE ||
          trec -> state == TREC_CONDEMNED);
 
-  entry = get_entry_for(trec, tvar, &entry_in);
+  entry = get_entry_for(cap, trec, tvar, &entry_in);
 
   if (entry != NULL) {
     if (entry_in == trec) {
@@ -1327,18 +1648,17 @@ void stmWriteTVar(Capability *cap,
       entry -> new_value = new_value;
     } else {
       // Entry found in another trec
-      TRecEntry *new_entry = get_new_entry(cap, trec);
-      new_entry -> tvar = tvar;
+      TRecEntry *new_entry = get_new_entry(cap, trec, tvar);
       new_entry -> expected_value = entry -> expected_value;
       new_entry -> new_value = new_value;
     }
   } else {
     // No entry found
-    StgClosure *current_value = read_current_value(trec, tvar);
-    TRecEntry *new_entry = get_new_entry(cap, trec);
-    new_entry -> tvar = tvar;
+    StgClosure *current_value = read_new_value(trec, tvar);
+    TRecEntry *new_entry = get_new_entry(cap, trec, tvar);
     new_entry -> expected_value = current_value;
     new_entry -> new_value = new_value;
+    cap -> stm_stats.tvars ++;
   }
 
   TRACE("%p : stmWriteTVar done", trec);
@@ -41,6 +41,27 @@
 
 #include "BeginPrivate.h"
 
+/*----------------------------------------------------------------------
+
+   Statistics
+   ----------
+
+   Each Capability counts what happens to the top-level transactions that
+   it runs, for +RTS -s and the eventlog (see traceStmCounters).  Nested
+   transactions are part of the transaction that encloses them.
+*/
+
+typedef struct {
+    StgWord starts;           // transactions started, including re-runs
+    StgWord commits;
+    StgWord aborts_conflict;  // another commit changed a TVar we used
+    StgWord aborts_invalid;   // found to be inconsistent while running
+    StgWord aborts_exception; // an exception escaped from atomically
+    StgWord retries;          // calls to retry# outside orElse
+    StgWord tvars;            // TVars read or written, summed over all
+    StgWord wakeups;          // threads woken by commits to their TVars
+} StmCounters;
+
 /*----------------------------------------------------------------------
 
    GC interaction
@@ -71,6 +92,15 @@ StgTRecHeader *stmStartNestedTransaction(Capability *cap, StgTRecHeader *outer
 void stmAbortTransaction(Capability *cap, StgTRecHeader *trec);
 void stmFreeAbortedTRec(Capability *cap, StgTRecHeader *trec);
 
+/*
+ * Count the abort of a top-level transaction in the statistics.  Only the
+ * caller knows why it aborted: 'invalid' if it is about to run the
+ * transaction again, otherwise an exception is leaving it.  stmCommit-
+ * Transaction, stmWait and stmReWait count their own failures.
+ */
+
+void stmCountAbort(Capability *cap, StgBool invalid);
+
 /*
  * Ensure that a subsequent commit / validation will fail.  We use this 
  * in our current handling of transactions that may have become invalid
@@ -201,6 +231,8 @@ void stmWriteTVar(Capability *cap,
 
 #define NO_TREC ((StgTRecHeader *)(void *)&stg_NO_TREC_closure)
 
+#define NO_TREC_INDEX ((StgArrBytes *)(void *)&stg_NO_TREC_INDEX_closure)
+
 /*----------------------------------------------------------------------*/
 
 #include "EndPrivate.h"
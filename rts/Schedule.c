@@ -695,6 +695,30 @@ scheduleYield (Capability **pcap, Task *task)
  * Push work to other Capabilities if we have some.
  * -------------------------------------------------------------------------- */
 
+/*
+   Note [NUMA-aware work stealing]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   With --numa, each Capability allocates its nursery and the blocks of
+   the threads it runs on its own NUMA node (cap->node).  A thread or a
+   spark that moves to a Capability on another node takes its data with
+   it, and every access to it is then a remote one, so we try to keep work
+   on its node:
+
+     - schedulePushWork gives threads and sparks away to the free
+       Capabilities on our own node.  Only if there are none does it go to
+       the free Capabilities on the other nodes, so that they don't sit
+       idle while we have work.
+
+     - findSpark steals sparks from the Capabilities on its own node.
+       Only if there are no sparks anywhere on the node, including our own
+       pool, does it steal from the other nodes.
+
+   Without --numa there is a single node and this is just the old
+   behaviour.  Each Capability counts the threads and sparks that moved on
+   the same node and across nodes in cap->migration_stats, which +RTS -s
+   reports.
+*/
+
 static void
 schedulePushWork(Capability *cap USED_IF_THREADS,
                  Task *task      USED_IF_THREADS)
@@ -703,6 +727,7 @@ schedulePushWork(Capability *cap USED_IF_THREADS,
 
     Capability *free_caps[n_capabilities], *cap0;
     uint32_t i, n_wanted_caps, n_free_caps;
+    bool local;
 
     uint32_t spare_threads = cap->n_run_queue > 0 ? cap->n_run_queue - 1 : 0;
 
@@ -716,23 +741,30 @@ schedulePushWork(Capability *cap USED_IF_THREADS,
     n_wanted_caps = sparkPoolSizeCap(cap) + spare_threads;
     if (n_wanted_caps == 0) return;
 
-    // First grab as many free Capabilities as we can.  ToDo: we should use
-    // capabilities on the same NUMA node preferably, but not exclusively.
-    for (i = (cap->no + 1) % n_capabilities, n_free_caps=0;
-         n_free_caps < n_wanted_caps && i != cap->no;
-         i = (i + 1) % n_capabilities) {
-        cap0 = capabilities[i];
-        if (cap != cap0 && !cap0->disabled && tryGrabCapability(cap0,task)) {
-            if (!emptyRunQueue(cap0)
-                || cap0->n_returning_tasks != 0
-                || !emptyInbox(cap0)) {
-                // it already has some work, we just grabbed it at
-                // the wrong moment.  Or maybe it's deadlocked!
-                releaseCapability(cap0);
-            } else {
-                free_caps[n_free_caps++] = cap0;
+    // First grab as many free Capabilities as we can, from our own NUMA
+    // node if possible: see Note [NUMA-aware work stealing].
+    n_free_caps = 0;
+    for (local = true; ; local = false) {
+        for (i = (cap->no + 1) % n_capabilities;
+             n_free_caps < n_wanted_caps && i != cap->no;
+             i = (i + 1) % n_capabilities) {
+            cap0 = capabilities[i];
+            if ((cap0->node == cap->node) != local) {
+                continue;
+            }
+            if (cap != cap0 && !cap0->disabled && tryGrabCapability(cap0,task)) {
+                if (!emptyRunQueue(cap0)
+                    || cap0->n_returning_tasks != 0
+                    || !emptyInbox(cap0)) {
+                    // it already has some work, we just grabbed it at
+                    // the wrong moment.  Or maybe it's deadlocked!
+                    releaseCapability(cap0);
+                } else {
+                    free_caps[n_free_caps++] = cap0;
+                }
             }
         }
+        if (!local || n_free_caps > 0 || n_numa_nodes == 1) break;
     }
 
     // We now have n_free_caps free capabilities stashed in
@@ -805,6 +837,11 @@ schedulePushWork(Capability *cap USED_IF_THREADS,
             else {
                 appendToRunQueue(free_caps[i],t);
                 traceEventMigrateThread (cap, t, free_caps[i]->no);
+                if (free_caps[i]->node == cap->node) {
+                    cap->migration_stats.threads_local++;
+                } else {
+                    cap->migration_stats.threads_remote++;
+                }
 
                 if (t->bound) { t->bound->task->cap = free_caps[i]; }
                 t->cap = free_caps[i];
@@ -881,7 +918,7 @@ scheduleCheckBlockedThreads(Capability *cap USED_IF_NOT_THREADS)
     // run queue is empty, and there are no other tasks running, we
     // can wait indefinitely for something to happen.
     //
-    if ( !emptyQueue(blocked_queue_hd) || !emptyQueue(sleeping_queue) )
+    if ( !EMPTY_BLOCKED_QUEUE() || !EMPTY_SLEEPING_QUEUE() )
     {
         awaitEvent (emptyRunQueue(cap));
     }
@@ -1350,6 +1387,12 @@ scheduleHandleThreadFinished (Capability *cap, Task *task, StgTSO *t)
 static bool
 scheduleNeedHeapProfile( bool ready_to_gc )
 {
+    // A sampling heap profile is reported at the next GC, whatever kind
+    // of GC it is (Note [Sampling heap profile] in ProfHeap.c).
+    if (RtsFlags.ProfFlags.heapSampleBytes != 0) {
+        return false;
+    }
+
     // When we have +RTS -i0 and we're heap profiling, do a census at
     // every GC.  This lets us get repeatable runs for debugging.
     if (performHeapProfile ||
@@ -1812,6 +1855,7 @@ delete_threads_and_gc:
     }
 
     traceSparkCounters(cap);
+    traceStmCounters(cap);
 
     switch (recent_activity) {
     case ACTIVITY_INACTIVE:
@@ -2112,6 +2156,12 @@ forkProcess(HsStablePtr *entry
         initTimer();
         startTimer();
 
+#if !defined(THREADED_RTS)
+        // The epoll instance of the I/O backend is shared with the
+        // parent, the child needs its own.
+        resetAwaitEvent();
+#endif
+
         // TODO: need to trace various other things in the child
         // like startup event, capabilities, process info etc
         traceTaskCreate(task, cap);
@@ -2298,7 +2348,7 @@ deleteAllThreads ()
     // being GC'd, and we don't want the "main thread has been GC'd" panic.
 
 #if !defined(THREADED_RTS)
-    ASSERT(blocked_queue_hd == END_TSO_QUEUE);
+    ASSERT(EMPTY_BLOCKED_QUEUE());
     ASSERT(sleeping_queue == END_TSO_QUEUE);
 #endif
 }
@@ -2707,6 +2757,9 @@ void markScheduler (evac_fn evac USED_IF_NOT_THREADS,
     evac(user, (StgClosure **)(void *)&blocked_queue_hd);
     evac(user, (StgClosure **)(void *)&blocked_queue_tl);
     evac(user, (StgClosure **)(void *)&sleeping_queue);
+#if !defined(mingw32_HOST_OS)
+    markAwaitEvent(evac, user);
+#endif
 #endif
 }
 
@@ -98,6 +98,11 @@ extern volatile StgWord recent_activity;
 #if !defined(THREADED_RTS)
 extern  StgTSO *blocked_queue_hd, *blocked_queue_tl;
 extern  StgTSO *sleeping_queue;
+#if !defined(mingw32_HOST_OS)
+// the threads blocked on I/O that awaitEvent() keeps off blocked_queue
+// (see posix/await/Epoll.c)
+extern  uint32_t n_awaiting_io;
+#endif
 #endif
 
 extern bool heap_overflow;
@@ -229,7 +234,12 @@ truncateRunQueue(Capability *cap)
 }
 
 #if !defined(THREADED_RTS)
+#if defined(mingw32_HOST_OS)
 #define EMPTY_BLOCKED_QUEUE()  (emptyQueue(blocked_queue_hd))
+#else
+#define EMPTY_BLOCKED_QUEUE()  (emptyQueue(blocked_queue_hd) \
+                                && n_awaiting_io == 0)
+#endif
 #define EMPTY_SLEEPING_QUEUE() (emptyQueue(sleeping_queue))
 #endif
 
@@ -40,6 +40,9 @@ INLINE_HEADER StgClosure* reclaimSpark(SparkPool *pool);
 INLINE_HEADER bool looksEmpty(SparkPool* deque);
 
 INLINE_HEADER StgClosure * tryStealSpark (SparkPool *pool);
+INLINE_HEADER uint32_t     tryStealSparks (SparkPool *pool,
+                                           StgClosure **sparks,
+                                           uint32_t max);
 INLINE_HEADER bool         fizzledSpark  (StgClosure *);
 
 void         freeSparkPool     (SparkPool *pool);
@@ -95,6 +98,21 @@ INLINE_HEADER StgClosure * tryStealSpark (SparkPool *pool)
     // other pools before trying again.
 }
 
+/* ----------------------------------------------------------------------------
+ *
+ * tryStealSparks: try to steal half of the sparks of a Capability, and at
+ * most max of them, into sparks[].  Returns the number stolen, which may
+ * include fizzled sparks, and is 0 when tryStealSpark would return NULL.
+ *
+ -------------------------------------------------------------------------- */
+
+INLINE_HEADER uint32_t tryStealSparks (SparkPool *pool,
+                                       StgClosure **sparks,
+                                       uint32_t max)
+{
+    return stealHalfWSDeque_(pool, (void **)sparks, max);
+}
+
 INLINE_HEADER bool fizzledSpark (StgClosure *spark)
 {
     return (GET_CLOSURE_TAG(spark) != 0 || !closure_SHOULD_SPARK(spark));
@@ -16,6 +16,7 @@
 #include "RtsUtils.h"
 #include "Trace.h"
 #include "StableName.h"
+#include "sm/HeapAlloc.h"
 
 #include <string.h>
 
@@ -38,6 +39,35 @@ static void enlargeStableNameTable(void);
 
 static HashTable *addrToStableHash = NULL;
 
+/*
+ * Note [Generational stable names]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * A GC only has to look at the stable name entries whose pointee or
+ * StableName object is in a generation it collects: the others can't die
+ * or move.  So we keep the indices of the live entries in one list per
+ * generation, sn_gen_entries[g] holding the entries whose younger object
+ * is in generation g (or, for an object in a compact, possibly younger,
+ * since only the first block of a compact knows its generation).
+ *
+ * A new entry goes on the list for generation 0, since its StableName
+ * object is about to be allocated in the nursery.  A GC of generations
+ * 0..N takes the entries off lists 0..N into sn_gc_entries, checks them in
+ * gcStableNameTable, and puts the live ones back on the list for their new
+ * generation.  updateStableNameTable then re-hashes the entries in
+ * sn_gc_entries whose pointee moved, so addrToStableHash is never rebuilt
+ * from scratch, not even after a major GC.
+ */
+
+typedef struct {
+    StgWord *entries;           // indices into stable_name_table
+    uint32_t n_entries;
+    uint32_t size;
+} SnEntryList;
+
+static SnEntryList *sn_gen_entries = NULL;   // one per generation
+static SnEntryList sn_gc_entries = { NULL, 0, 0 };
+
 void
 stableNameLock(void)
 {
@@ -81,12 +111,37 @@ initStableNameTable(void)
      */
     initSnEntryFreeList(stable_name_table + 1,INIT_SNT_SIZE-1,NULL);
     addrToStableHash = allocHashTable();
+    sn_gen_entries = stgCallocBytes(RtsFlags.GcFlags.generations,
+                                    sizeof(SnEntryList),
+                                    "initStableNameTable");
 
 #if defined(THREADED_RTS)
     initMutex(&stable_name_mutex);
 #endif
 }
 
+STATIC_INLINE void
+addSnEntryList(SnEntryList *list, StgWord sn)
+{
+    if (list->n_entries == list->size) {
+        list->size = list->size == 0 ? 64 : list->size * 2;
+        list->entries = stgReallocBytes(list->entries,
+                                        list->size * sizeof(StgWord),
+                                        "addSnEntryList");
+    }
+    list->entries[list->n_entries++] = sn;
+}
+
+static void
+freeSnEntryList(SnEntryList *list)
+{
+    if (list->entries)
+        stgFree(list->entries);
+    list->entries = NULL;
+    list->n_entries = 0;
+    list->size = 0;
+}
+
 /* -----------------------------------------------------------------------------
  * Enlarging the tables
  * -------------------------------------------------------------------------- */
@@ -123,6 +178,16 @@ exitStableNameTable(void)
     stable_name_table = NULL;
     SNT_size = 0;
 
+    if (sn_gen_entries) {
+        uint32_t g;
+        for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+            freeSnEntryList(&sn_gen_entries[g]);
+        }
+        stgFree(sn_gen_entries);
+    }
+    sn_gen_entries = NULL;
+    freeSnEntryList(&sn_gc_entries);
+
 #if defined(THREADED_RTS)
     closeMutex(&stable_name_mutex);
 #endif
@@ -132,7 +197,9 @@ STATIC_INLINE void
 freeSnEntry(snEntry *sn)
 {
   ASSERT(sn->sn_obj == NULL);
-  removeHashTable(addrToStableHash, (W_)sn->old, NULL);
+  if (sn->old != NULL) {
+      removeHashTable(addrToStableHash, (W_)sn->old, NULL);
+  }
   sn->addr = (P_)stable_name_free;
   stable_name_free = sn;
 }
@@ -209,6 +276,10 @@ lookupStableName (StgPtr p)
   /* add the new stable name to the hash table */
   insertHashTable(addrToStableHash, (W_)p, (void *)sn);
 
+  // its StableName object will be in the nursery
+  // (see Note [Generational stable names])
+  addSnEntryList(&sn_gen_entries[0], sn);
+
   stableNameUnlock();
 
   return sn;
@@ -240,10 +311,17 @@ lookupStableName (StgPtr p)
     } while(0)
 
 void
-rememberOldStableNameAddresses(void)
+rememberOldStableNameAddresses(uint32_t max_gen)
 {
-    /* TODO: Only if !full GC */
-    FOR_EACH_STABLE_NAME(p, p->old = p->addr;);
+    uint32_t g, i;
+    snEntry *p;
+
+    for (g = 0; g <= max_gen; g++) {
+        for (i = 0; i < sn_gen_entries[g].n_entries; i++) {
+            p = &stable_name_table[sn_gen_entries[g].entries[i]];
+            p->old = p->addr;
+        }
+    }
 }
 
 /* -----------------------------------------------------------------------------
@@ -281,69 +359,104 @@ threadStableNameTable( evac_fn evac, void *user )
  * refer to the entry.
  * -------------------------------------------------------------------------- */
 
+// The generation whose list an object's stable name entry belongs on
+static uint32_t
+snObjectGen(StgPtr p)
+{
+    bdescr *bd;
+
+    if (!HEAP_ALLOCED_GC(p)) {
+        return oldest_gen->no;
+    }
+    bd = Bdescr(p);
+    if (bd->flags & BF_COMPACT) {
+        return 0;
+    }
+    return bd->gen_no;
+}
+
 void
 gcStableNameTable( void )
 {
-    FOR_EACH_STABLE_NAME(
-        p, {
-            // FOR_EACH_STABLE_NAME traverses free entries too, so
-            // check sn_obj
-            if (p->sn_obj != NULL) {
-                // Update the pointer to the StableName object, if there is one
-                p->sn_obj = isAlive(p->sn_obj);
-                if (p->sn_obj == NULL) {
-                    // StableName object died
-                    debugTrace(DEBUG_stable, "GC'd StableName %ld (addr=%p)",
-                               (long)(p - stable_name_table), p->addr);
-                    freeSnEntry(p);
-                } else if (p->addr != NULL) {
-                    // sn_obj is alive, update pointee
-                    p->addr = (StgPtr)isAlive((StgClosure *)p->addr);
-                    if (p->addr == NULL) {
-                        // Pointee died
-                        debugTrace(DEBUG_stable, "GC'd pointee %ld",
-                                   (long)(p - stable_name_table));
-                    }
-                }
+    uint32_t g, i;
+    StgWord sn;
+    snEntry *p;
+
+    // See Note [Generational stable names]
+    for (g = 0; g <= N; g++) {
+        for (i = 0; i < sn_gen_entries[g].n_entries; i++) {
+            addSnEntryList(&sn_gc_entries, sn_gen_entries[g].entries[i]);
+        }
+        sn_gen_entries[g].n_entries = 0;
+    }
+
+    for (i = 0; i < sn_gc_entries.n_entries; i++) {
+        sn = sn_gc_entries.entries[i];
+        p = &stable_name_table[sn];
+
+        if (p->sn_obj == NULL) {
+            // lookupStableName made the entry, but its StableName object
+            // isn't there yet (see stg_makeStableNamezh)
+            addSnEntryList(&sn_gen_entries[0], sn);
+            continue;
+        }
+
+        // Update the pointer to the StableName object, if there is one
+        p->sn_obj = isAlive(p->sn_obj);
+        if (p->sn_obj == NULL) {
+            // StableName object died
+            debugTrace(DEBUG_stable, "GC'd StableName %ld (addr=%p)",
+                       (long)sn, p->addr);
+            freeSnEntry(p);
+            sn_gc_entries.entries[i] = 0;
+            continue;
+        }
+
+        g = snObjectGen((StgPtr)p->sn_obj);
+        if (p->addr != NULL) {
+            // sn_obj is alive, update pointee
+            p->addr = (StgPtr)isAlive((StgClosure *)p->addr);
+            if (p->addr == NULL) {
+                // Pointee died
+                debugTrace(DEBUG_stable, "GC'd pointee %ld", (long)sn);
+            } else {
+                g = stg_min(g, snObjectGen(p->addr));
             }
-        });
+        }
+        addSnEntryList(&sn_gen_entries[g], sn);
+    }
 }
 
 /* -----------------------------------------------------------------------------
  * Update the StableName hash table
  *
- * The boolean argument 'full' indicates that a major collection is
- * being done, so we might as well throw away the hash table and build
- * a new one.  For a minor collection, we just re-hash the elements
- * that changed.
+ * Re-hash the entries that gcStableNameTable looked at whose pointee
+ * moved or died.  All the old addresses are removed before any new one is
+ * inserted, because a pointee may have moved to where another one was.
  * -------------------------------------------------------------------------- */
 
 void
-updateStableNameTable(bool full)
+updateStableNameTable(void)
 {
-    if (full && addrToStableHash != NULL && 0 != keyCountHashTable(addrToStableHash)) {
-        freeHashTable(addrToStableHash,NULL);
-        addrToStableHash = allocHashTable();
+    uint32_t i;
+    StgWord sn;
+    snEntry *p;
+
+    for (i = 0; i < sn_gc_entries.n_entries; i++) {
+        sn = sn_gc_entries.entries[i];
+        p = &stable_name_table[sn];
+        if (sn != 0 && p->addr != p->old && p->old != NULL) {
+            removeHashTable(addrToStableHash, (W_)p->old, NULL);
+        }
     }
 
-    if(full) {
-        FOR_EACH_STABLE_NAME(
-            p, {
-                if (p->addr != NULL) {
-                    // Target still alive, Re-hash this stable name
-                    insertHashTable(addrToStableHash, (W_)p->addr, (void *)(p - stable_name_table));
-                }
-            });
-    } else {
-        FOR_EACH_STABLE_NAME(
-            p, {
-                if (p->addr != p->old) {
-                    removeHashTable(addrToStableHash, (W_)p->old, NULL);
-                    /* Movement happened: */
-                    if (p->addr != NULL) {
-                        insertHashTable(addrToStableHash, (W_)p->addr, (void *)(p - stable_name_table));
-                    }
-                }
-            });
+    for (i = 0; i < sn_gc_entries.n_entries; i++) {
+        sn = sn_gc_entries.entries[i];
+        p = &stable_name_table[sn];
+        if (sn != 0 && p->addr != p->old && p->addr != NULL) {
+            insertHashTable(addrToStableHash, (W_)p->addr, (void *)sn);
+        }
     }
+
+    sn_gc_entries.n_entries = 0;
 }
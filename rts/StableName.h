@@ -14,11 +14,11 @@ void    initStableNameTable   ( void );
 void    exitStableNameTable      ( void );
 StgWord lookupStableName      ( StgPtr p );
 
-void    rememberOldStableNameAddresses ( void );
+void    rememberOldStableNameAddresses ( uint32_t max_gen );
 
 void    threadStableNameTable ( evac_fn evac, void *user );
 void    gcStableNameTable     ( void );
-void    updateStableNameTable ( bool full );
+void    updateStableNameTable ( void );
 
 void    stableNameLock            ( void );
 void    stableNameUnlock          ( void );
@@ -16,6 +16,8 @@
 #include "RtsUtils.h"
 #include "Trace.h"
 #include "StablePtr.h"
+#include "Capability.h"
+#include "Task.h"
 
 #include <string.h>
 
@@ -112,6 +114,10 @@ static uint32_t n_old_SPTs = 0;
 
 #if defined(THREADED_RTS)
 Mutex stable_ptr_mutex;
+
+/* Odd while enlargeStablePtrTable is copying the table; see Note
+ * [Per-capability stable pointers] */
+static volatile StgWord SPT_enlarging = 0;
 #endif
 
 static void enlargeStablePtrTable(void);
@@ -183,6 +189,10 @@ enlargeStablePtrTable(void)
     new_stable_ptr_table =
         stgMallocBytes(SPT_size * sizeof(spEntry),
                        "enlargeStablePtrTable");
+#if defined(THREADED_RTS)
+    SPT_enlarging++;
+    store_load_barrier();
+#endif
     memcpy(new_stable_ptr_table,
            stable_ptr_table,
            old_SPT_size * sizeof(spEntry));
@@ -194,6 +204,10 @@ enlargeStablePtrTable(void)
      * pointer will always read a valid address.
      */
     stable_ptr_table = new_stable_ptr_table;
+#if defined(THREADED_RTS)
+    write_barrier();
+    SPT_enlarging++;
+#endif
 
     initSpEntryFreeList(stable_ptr_table + old_SPT_size, old_SPT_size, NULL);
 }
@@ -214,6 +228,79 @@ enlargeStablePtrTable(void)
  */
 
 
+/* Note [Per-capability stable pointers]
+ *
+ * FFI code can create and free stable pointers at a great rate from many
+ * threads at once, so in the threaded RTS each capability keeps a few free
+ * entries of the table in cap->stable_ptr_free, and getStablePtr and
+ * freeStablePtr only take stable_ptr_mutex to move a batch of entries
+ * between that cache and the global free list.  They use the cache of the
+ * capability that the calling thread holds, if any: a thread that doesn't
+ * (a C thread, or Haskell thread in a safe foreign call) takes the lock as
+ * before.
+ *
+ * The entries in a cache have addr == NULL, which markStablePtrTable
+ * already treats as free, and which, unlike a free list link, stays valid
+ * when the table is copied by enlargeStablePtrTable.
+ *
+ * Writing an entry without the lock can race with enlargeStablePtrTable
+ * copying the table: the write may land in the old table after the entry
+ * has been copied.  So the enlarger makes SPT_enlarging odd while it copies,
+ * and setSpEntry writes the entry again (to the new table) if SPT_enlarging
+ * changed around its write.  The barriers on both sides ensure that either
+ * the writer sees the change, or the copy sees the write.
+ *
+ * Readers are unaffected: see Note [Enlarging the stable pointer table].
+ */
+
+#if defined(THREADED_RTS)
+// The capability that the calling thread holds, or NULL
+static Capability *
+myHeldCapability(void)
+{
+    Task *task = myTask();
+
+    if (task == NULL || task->cap == NULL
+        || task->cap->running_task != task) {
+        return NULL;
+    }
+    return task->cap;
+}
+
+// Set an entry owned by the caller without holding stable_ptr_mutex
+static void
+setSpEntry(StgWord sp, StgPtr addr)
+{
+    StgWord seq;
+
+    do {
+        while ((seq = SPT_enlarging) & 1) {
+            busy_wait_nop();
+        }
+        load_load_barrier();
+        stable_ptr_table[sp].addr = addr;
+        store_load_barrier();
+    } while (SPT_enlarging != seq);
+}
+
+// Take half a cache of entries from the global free list
+static void
+refillStablePtrCache(Capability *cap)
+{
+    StgWord sp;
+
+    stablePtrLock();
+    while (cap->n_stable_ptr_free < STABLE_PTR_CACHE_SIZE / 2) {
+        if (!stable_ptr_free) enlargeStablePtrTable();
+        sp = stable_ptr_free - stable_ptr_table;
+        stable_ptr_free = (spEntry*)(stable_ptr_free->addr);
+        stable_ptr_table[sp].addr = NULL;
+        cap->stable_ptr_free[cap->n_stable_ptr_free++] = sp;
+    }
+    stablePtrUnlock();
+}
+#endif
+
 /* -----------------------------------------------------------------------------
  * Freeing entries and tables
  * -------------------------------------------------------------------------- */
@@ -258,9 +345,37 @@ freeStablePtrUnsafe(StgStablePtr sp)
     freeSpEntry(&stable_ptr_table[(StgWord)sp]);
 }
 
+#if defined(THREADED_RTS)
+// Give half a cache of entries back to the global free list
+static void
+flushStablePtrCache(Capability *cap)
+{
+    stablePtrLock();
+    while (cap->n_stable_ptr_free > STABLE_PTR_CACHE_SIZE / 2) {
+        freeSpEntry(&stable_ptr_table[
+                        cap->stable_ptr_free[--cap->n_stable_ptr_free]]);
+    }
+    stablePtrUnlock();
+}
+#endif
+
 void
 freeStablePtr(StgStablePtr sp)
 {
+#if defined(THREADED_RTS)
+    Capability *cap = myHeldCapability();
+
+    if (cap != NULL) {
+        ASSERT((StgWord)sp < SPT_size);
+        if (cap->n_stable_ptr_free == STABLE_PTR_CACHE_SIZE) {
+            flushStablePtrCache(cap);
+        }
+        setSpEntry((StgWord)sp, NULL);
+        cap->stable_ptr_free[cap->n_stable_ptr_free++] = (StgWord)sp;
+        return;
+    }
+#endif
+
     stablePtrLock();
     freeStablePtrUnsafe(sp);
     stablePtrUnlock();
@@ -275,6 +390,19 @@ getStablePtr(StgPtr p)
 {
   StgWord sp;
 
+#if defined(THREADED_RTS)
+  Capability *cap = myHeldCapability();
+
+  if (cap != NULL) {
+      if (cap->n_stable_ptr_free == 0) {
+          refillStablePtrCache(cap);
+      }
+      sp = cap->stable_ptr_free[--cap->n_stable_ptr_free];
+      setSpEntry(sp, p);
+      return (StgStablePtr)(sp);
+  }
+#endif
+
   stablePtrLock();
   if (!stable_ptr_free) enlargeStablePtrTable();
   sp = stable_ptr_free - stable_ptr_table;
@@ -18,6 +18,10 @@
 
 #include "BeginPrivate.h"
 
+/* The most free entries of the table that a capability keeps for itself
+ * (see Note [Per-capability stable pointers] in StablePtr.c) */
+#define STABLE_PTR_CACHE_SIZE 64
+
 void    freeStablePtr         ( StgStablePtr sp );
 
 /* Use the "Unsafe" one after only when manually locking and
@@ -18,11 +18,14 @@
 #include "sm/Storage.h"
 #include "sm/GCThread.h"
 #include "sm/BlockAlloc.h"
+#include "sm/OSMem.h"
 
 // for spin/yield counters
 #include "sm/GC.h"
 #include "ThreadPaused.h"
 #include "Messages.h"
+#include "LinkerInternals.h"
+#include "eventlog/EventLog.h"
 
 #include <string.h> // for memset
 
@@ -64,6 +67,11 @@ static Time *GC_coll_cpu = NULL;
 static Time *GC_coll_elapsed = NULL;
 static Time *GC_coll_max_pause = NULL;
 
+// cards of mutable arrays looked at by GCs that didn't collect the array,
+// see Note [Scanning card tables] in sm/Scav.c
+static uint64_t GC_cards_scanned = 0;
+static uint64_t GC_cards_skipped = 0;
+
 static void statsPrintf( char *s, ... ) GNUC3_ATTRIBUTE(format (PRINTF, 1, 2));
 static void statsFlush( void );
 static void statsClose( void );
@@ -145,6 +153,8 @@ initStats0(void)
 #endif
 
     GC_end_faults = 0;
+    GC_cards_scanned = 0;
+    GC_cards_skipped = 0;
 
     stats = (RTSStats) {
         .gcs = 0,
@@ -324,7 +334,7 @@ stat_endGC (Capability *cap, gc_thread *gct, W_ live, W_ copied, W_ slop,
             uint32_t gen, uint32_t par_n_threads, W_ par_max_copied,
             W_ par_balanced_copied, W_ gc_spin_spin, W_ gc_spin_yield,
             W_ mut_spin_spin, W_ mut_spin_yield, W_ any_work, W_ no_work,
-            W_ scav_find_work)
+            W_ scav_find_work, W_ cards_scanned, W_ cards_skipped)
 {
     // -------------------------------------------------
     // Collect all the stats about this GC in stats.gc. We always do this since
@@ -398,6 +408,8 @@ stat_endGC (Capability *cap, gc_thread *gct, W_ live, W_ copied, W_ slop,
     }
     stats.gc_cpu_ns += stats.gc.cpu_ns;
     stats.gc_elapsed_ns += stats.gc.elapsed_ns;
+    GC_cards_scanned += cards_scanned;
+    GC_cards_skipped += cards_skipped;
 
     if (gen == RtsFlags.GcFlags.generations-1) { // major GC?
         stats.major_gcs++;
@@ -693,6 +705,54 @@ static void report_summary(const RTSSummaryStats* sum)
                 stats.max_live_bytes  / (1024 * 1024),
                 sum->fragmentation_bytes / (1024 * 1024));
 
+    /* See Note [Huge pages] in posix/OSMem.c */
+    if (RtsFlags.GcFlags.hugePageSize != 0) {
+        StgWord64 hugetlb, transparent;
+        osHugePageBytes(&hugetlb, &transparent);
+        statsPrintf("%16" FMT_Word64 " MB of heap in huge pages (%"
+                    FMT_Word64 " MB MAP_HUGETLB, %" FMT_Word64
+                    " MB transparent)\n\n",
+                    (hugetlb + transparent) / (1024 * 1024),
+                    hugetlb / (1024 * 1024),
+                    transparent / (1024 * 1024));
+    }
+
+    /* See Note [Lazy archive members] */
+    if (archive_member_counts.loaded + archive_member_counts.lazy
+        + archive_member_counts.skipped > 0) {
+        statsPrintf("%16" FMT_Word " archive members loaded by the linker "
+                    "(%" FMT_Word " on demand, %" FMT_Word " never needed, %"
+                    FMT_Word " skipped)\n\n",
+                    archive_member_counts.loaded
+                        + archive_member_counts.demanded,
+                    archive_member_counts.demanded,
+                    archive_member_counts.lazy
+                        - archive_member_counts.demanded,
+                    archive_member_counts.skipped);
+    }
+
+    /* See Note [Scanning card tables] in sm/Scav.c */
+    if (sum->cards_scanned + sum->cards_skipped > 0) {
+        showStgWord64(sum->cards_scanned, temp, true/*commas*/);
+        statsPrintf("%16s array cards scanned in minor GCs (%.1f%% of "
+                    "those looked at)\n\n",
+                    temp,
+                    sum->cards_scanned * 100.0
+                        / (sum->cards_scanned + sum->cards_skipped));
+    }
+
+#if defined(TRACING)
+    /* See Note [Eventlog writer thread] */
+    if (eventlog_writer_counts.events_dropped
+        + eventlog_writer_counts.waits > 0) {
+        statsPrintf("%16" FMT_Word " eventlog events dropped (%" FMT_Word
+                    " blocks), %" FMT_Word " waits for the eventlog writer\n\n",
+                    eventlog_writer_counts.events_dropped,
+                    eventlog_writer_counts.blocks_dropped,
+                    eventlog_writer_counts.waits);
+    }
+#endif
+
     /* Print garbage collections in each gen */
     statsPrintf("                                     Tot time (elapsed)  Avg pause  Max pause\n");
     for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
@@ -733,8 +793,34 @@ static void report_summary(const RTSSummaryStats* sum)
                 sum->sparks.converted, sum->sparks.overflowed,
                 sum->sparks.dud, sum->sparks.gcd,
                 sum->sparks.fizzled);
+
+    if (n_numa_nodes > 1) {
+        // See Note [NUMA-aware work stealing]
+        statsPrintf("  MIGRATION: %" FMT_Word " threads (%" FMT_Word
+                    " to other NUMA nodes), %" FMT_Word " sparks stolen (%"
+                    FMT_Word " from other NUMA nodes)\n\n",
+                    sum->migration.threads_local
+                      + sum->migration.threads_remote,
+                    sum->migration.threads_remote,
+                    sum->migration.sparks_local
+                      + sum->migration.sparks_remote,
+                    sum->migration.sparks_remote);
+    }
 #endif
 
+    if (sum->stm.starts > 0) {
+        statsPrintf("  STM: %" FMT_Word " transactions (%" FMT_Word
+                    " committed, %" FMT_Word " conflicts, %" FMT_Word
+                    " invalid, %" FMT_Word " exceptions, %" FMT_Word
+                    " retries)\n",
+                    sum->stm.starts, sum->stm.commits,
+                    sum->stm.aborts_conflict, sum->stm.aborts_invalid,
+                    sum->stm.aborts_exception, sum->stm.retries);
+        statsPrintf("       %" FMT_Word " TVars accessed, %" FMT_Word
+                    " threads woken\n\n",
+                    sum->stm.tvars, sum->stm.wakeups);
+    }
+
     statsPrintf("  INIT    time  %7.3fs  (%7.3fs elapsed)\n",
                 TimeToSecondsDbl(stats.init_cpu_ns),
                 TimeToSecondsDbl(stats.init_elapsed_ns));
@@ -941,6 +1027,12 @@ static void report_machine_readable (const RTSSummaryStats * sum)
             stats.cumulative_par_max_copied_bytes);
     MR_STAT("cumulative_par_balanced_copied_bytes", FMT_Word64,
             stats.cumulative_par_balanced_copied_bytes);
+    // The times above are in seconds.  Give them again as integers, which
+    // the testsuite driver can track as perf metrics.
+    MR_STAT("mutator_cpu_ns", FMT_Int64, stats.mutator_cpu_ns);
+    MR_STAT("mutator_elapsed_ns", FMT_Int64, stats.mutator_elapsed_ns);
+    MR_STAT("gc_cpu_ns", FMT_Int64, stats.gc_cpu_ns);
+    MR_STAT("gc_elapsed_ns", FMT_Int64, stats.gc_elapsed_ns);
 
     // next, the computed fields in RTSSummaryStats
 #if !defined(THREADED_RTS) // THREADED_RTS
@@ -953,6 +1045,16 @@ static void report_machine_readable (const RTSSummaryStats * sum)
     MR_STAT("productivity_cpu_percent", "f", sum->productivity_cpu_percent);
     MR_STAT("productivity_wall_percent", "f",
             sum->productivity_elapsed_percent);
+    MR_STAT("stm_starts", FMT_Word, sum->stm.starts);
+    MR_STAT("stm_commits", FMT_Word, sum->stm.commits);
+    MR_STAT("stm_aborts_conflict", FMT_Word, sum->stm.aborts_conflict);
+    MR_STAT("stm_aborts_invalid", FMT_Word, sum->stm.aborts_invalid);
+    MR_STAT("stm_aborts_exception", FMT_Word, sum->stm.aborts_exception);
+    MR_STAT("stm_retries", FMT_Word, sum->stm.retries);
+    MR_STAT("stm_tvars", FMT_Word, sum->stm.tvars);
+    MR_STAT("stm_wakeups", FMT_Word, sum->stm.wakeups);
+    MR_STAT("cards_scanned", FMT_Word64, sum->cards_scanned);
+    MR_STAT("cards_skipped", FMT_Word64, sum->cards_skipped);
 
     // next, the THREADED_RTS fields in RTSSummaryStats
 
@@ -964,6 +1066,12 @@ static void report_machine_readable (const RTSSummaryStats * sum)
     MR_STAT("sparks_dud ", FMT_Word, sum->sparks.dud);
     MR_STAT("sparks_gcd", FMT_Word, sum->sparks.gcd);
     MR_STAT("sparks_fizzled", FMT_Word, sum->sparks.fizzled);
+    MR_STAT("threads_migrated_local", FMT_Word,
+            sum->migration.threads_local);
+    MR_STAT("threads_migrated_remote", FMT_Word,
+            sum->migration.threads_remote);
+    MR_STAT("sparks_stolen_local", FMT_Word, sum->migration.sparks_local);
+    MR_STAT("sparks_stolen_remote", FMT_Word, sum->migration.sparks_remote);
     MR_STAT("work_balance", "f", sum->work_balance);
 
     // next, globals (other than internal counters)
@@ -1170,6 +1278,12 @@ stat_exit (void)
                   capabilities[i]->spark_stats.converted;
                 sum.sparks.gcd       += capabilities[i]->spark_stats.gcd;
                 sum.sparks.fizzled   += capabilities[i]->spark_stats.fizzled;
+
+                MigrationCounters *m = &capabilities[i]->migration_stats;
+                sum.migration.threads_local  += m->threads_local;
+                sum.migration.threads_remote += m->threads_remote;
+                sum.migration.sparks_local   += m->sparks_local;
+                sum.migration.sparks_remote  += m->sparks_remote;
             }
 
             sum.sparks_count = sum.sparks.created
@@ -1193,6 +1307,21 @@ stat_exit (void)
                                   / stats.elapsed_ns;
     #endif // THREADED_RTS
 
+            for (uint32_t i = 0; i < n_capabilities; i++) {
+                StmCounters *s = &capabilities[i]->stm_stats;
+                sum.stm.starts           += s->starts;
+                sum.stm.commits          += s->commits;
+                sum.stm.aborts_conflict  += s->aborts_conflict;
+                sum.stm.aborts_invalid   += s->aborts_invalid;
+                sum.stm.aborts_exception += s->aborts_exception;
+                sum.stm.retries          += s->retries;
+                sum.stm.tvars            += s->tvars;
+                sum.stm.wakeups          += s->wakeups;
+            }
+
+            sum.cards_scanned = GC_cards_scanned;
+            sum.cards_skipped = GC_cards_skipped;
+
             sum.fragmentation_bytes =
                 (uint64_t)(peak_mblocks_allocated
                          * BLOCKS_PER_MBLOCK
@@ -11,6 +11,8 @@
 #include "GetTime.h"
 #include "sm/GC.h"
 #include "Sparks.h"
+#include "STM.h"
+#include "Capability.h"
 
 #include "BeginPrivate.h"
 
@@ -35,7 +37,8 @@ void      stat_endGC  (Capability *cap, struct gc_thread_ *_gct, W_ live,
                        W_ par_max_copied, W_ par_balanced_copied,
                        W_ gc_spin_spin, W_ gc_spin_yield, W_ mut_spin_spin,
                        W_ mut_spin_yield, W_ any_work, W_ no_work,
-                       W_ scav_find_work);
+                       W_ scav_find_work, W_ cards_scanned,
+                       W_ cards_skipped);
 
 #if defined(PROFILING)
 void      stat_startRP(void);
@@ -99,11 +102,15 @@ typedef struct RTSSummaryStats_ {
     uint32_t bound_task_count;
     uint64_t sparks_count;
     SparkCounters sparks;
+    MigrationCounters migration;
     double work_balance;
 #else // THREADED_RTS
     double gc_cpu_percent;
     double gc_elapsed_percent;
 #endif
+    StmCounters stm;
+    uint64_t cards_scanned;
+    uint64_t cards_skipped;
     uint64_t fragmentation_bytes;
     uint64_t average_bytes_used; // This is not shown in the '+RTS -s' report
     uint64_t alloc_rate;
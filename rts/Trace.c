@@ -47,6 +47,11 @@ static bool eventlog_enabled;
 
 static const EventLogWriter *getEventLogWriter(void)
 {
+#if !defined(mingw32_HOST_OS)
+    if (RtsFlags.TraceFlags.eventlog_socket != NULL) {
+        return &SocketEventLogWriter;
+    }
+#endif
     return rtsConfig.eventlog_writer;
 }
 
@@ -137,6 +142,14 @@ void flushTrace (void)
     }
 }
 
+// Called at every timer tick
+void tickTracing (void)
+{
+    if (eventlog_enabled) {
+        eventLogTick();
+    }
+}
+
 void tracingAddCapapilities (uint32_t from, uint32_t to)
 {
     if (eventlog_enabled) {
@@ -563,6 +576,52 @@ void traceSparkCounters_ (Capability *cap,
     }
 }
 
+void traceStmCounters_ (Capability *cap)
+{
+#if defined(DEBUG)
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        StmCounters *s = &cap->stm_stats;
+        ACQUIRE_LOCK(&trace_utx);
+        tracePreface();
+        debugBelch("cap %d: STM: %" FMT_Word " started, %" FMT_Word
+                   " committed, %" FMT_Word " conflicts, %" FMT_Word
+                   " invalid, %" FMT_Word " exceptions, %" FMT_Word
+                   " retries, %" FMT_Word " TVars, %" FMT_Word " wakeups\n",
+                   cap->no, s->starts, s->commits, s->aborts_conflict,
+                   s->aborts_invalid, s->aborts_exception, s->retries,
+                   s->tvars, s->wakeups);
+        RELEASE_LOCK(&trace_utx);
+    } else
+#endif
+    {
+        postStmCountersEvent(cap, cap->stm_stats);
+    }
+}
+
+void traceEventGcWorkStats_ (Capability *cap,
+                             W_          blocks_stolen,
+                             W_          objs_shared,
+                             W_          objs_stolen,
+                             StgWord64   idle_time)
+{
+#if defined(DEBUG)
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        ACQUIRE_LOCK(&trace_utx);
+        tracePreface();
+        debugBelch("cap %d: GC work: %" FMT_Word " blocks stolen, %" FMT_Word
+                   " objects shared, %" FMT_Word " objects stolen, %"
+                   FMT_Word64 "ns idle\n",
+                   cap->no, blocks_stolen, objs_shared, objs_stolen,
+                   idle_time);
+        RELEASE_LOCK(&trace_utx);
+    } else
+#endif
+    {
+        postGcWorkStatsEvent(cap, blocks_stolen, objs_shared, objs_stolen,
+                             idle_time);
+    }
+}
+
 void traceTaskCreate_ (Task       *task,
                        Capability *cap)
 {
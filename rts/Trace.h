@@ -277,6 +277,14 @@ void traceSparkCounters_ (Capability *cap,
                           SparkCounters counters,
                           StgWord remaining);
 
+void traceStmCounters_ (Capability *cap);
+
+void traceEventGcWorkStats_ (Capability *cap,
+                             W_          blocks_stolen,
+                             W_          objs_shared,
+                             W_          objs_stolen,
+                             StgWord64   idle_time);
+
 void traceTaskCreate_ (Task       *task,
                        Capability *cap);
 
@@ -301,6 +309,7 @@ void traceHeapProfSampleCostCentre(StgWord8 profile_id,
 #endif /* PROFILING */
 
 void flushTrace(void);
+void tickTracing(void);
 
 #else /* !TRACING */
 
@@ -329,6 +338,9 @@ void flushTrace(void);
 #define traceWallClockTime_() /* nothing */
 #define traceOSProcessInfo_() /* nothing */
 #define traceSparkCounters_(cap, counters, remaining) /* nothing */
+#define traceStmCounters_(cap) /* nothing */
+#define traceEventGcWorkStats_(cap, blocks_stolen, objs_shared, \
+                               objs_stolen, idle_time) /* nothing */
 #define traceTaskCreate_(taskID, cap) /* nothing */
 #define traceTaskMigrate_(taskID, cap, new_cap) /* nothing */
 #define traceTaskDelete_(taskID) /* nothing */
@@ -339,6 +351,7 @@ void flushTrace(void);
 #define traceHeapProfSampleString(profile_id, label, residency) /* nothing */
 
 #define flushTrace() /* nothing */
+#define tickTracing() /* nothing */
 
 #endif /* TRACING */
 
@@ -692,6 +705,18 @@ INLINE_HEADER void traceEventGcStats(Capability *cap            STG_UNUSED,
                        par_tot_copied, par_balanced_copied);
 }
 
+INLINE_HEADER void traceEventGcWorkStats(Capability *cap           STG_UNUSED,
+                                         W_          blocks_stolen STG_UNUSED,
+                                         W_          objs_shared   STG_UNUSED,
+                                         W_          objs_stolen   STG_UNUSED,
+                                         StgWord64   idle_time     STG_UNUSED)
+{
+    if (RTS_UNLIKELY(TRACE_gc)) {
+        traceEventGcWorkStats_(cap, blocks_stolen, objs_shared,
+                               objs_stolen, idle_time);
+    }
+}
+
 INLINE_HEADER void traceEventHeapInfo(CapsetID    heap_capset   STG_UNUSED,
                                       uint32_t  gens          STG_UNUSED,
                                       W_        maxHeapSize   STG_UNUSED,
@@ -797,6 +822,14 @@ INLINE_HEADER void traceSparkCounters(Capability *cap STG_UNUSED)
 #endif
 }
 
+// The STM counters go with the scheduler events
+INLINE_HEADER void traceStmCounters(Capability *cap STG_UNUSED)
+{
+    if (RTS_UNLIKELY(TRACE_sched)) {
+        traceStmCounters_(cap);
+    }
+}
+
 INLINE_HEADER void traceEventSparkCreate(Capability *cap STG_UNUSED)
 {
     traceSparkEvent(cap, EVENT_SPARK_CREATE);
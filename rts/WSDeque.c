@@ -228,6 +228,39 @@ stealWSDeque (WSDeque *q)
     return stolen;
 }
 
+/* -----------------------------------------------------------------------------
+ * stealHalfWSDeque_
+ *
+ * A thief that takes half of the elements has work for a while, and leaves
+ * the rest for the other thieves, so they don't all keep coming back to the
+ * same victim.  We take the elements one at a time: claiming them all with
+ * a single cas of top would race with popWSDeque(), which only
+ * synchronises with thieves for the last element.  We stop at the first
+ * collision with another thief rather than fight over the same elements.
+ * -------------------------------------------------------------------------- */
+
+uint32_t
+stealHalfWSDeque_ (WSDeque *q, void **elems, uint32_t max)
+{
+    long size = dequeElements(q);
+    uint32_t n, wanted;
+    void *stolen;
+
+    if (size <= 0) {
+        return 0;
+    }
+    wanted = (uint32_t)stg_min((size + 1) / 2, (long)max);
+
+    for (n = 0; n < wanted; n++) {
+        stolen = stealWSDeque_(q);
+        if (stolen == NULL) {
+            break;
+        }
+        elems[n] = stolen;
+    }
+    return n;
+}
+
 /* -----------------------------------------------------------------------------
  * pushWSQueue
  * -------------------------------------------------------------------------- */
@@ -61,7 +61,8 @@ typedef struct WSDeque_ {
  *
  * A WSDeque has an *owner* thread.  The owner can perform any operation;
  * other threads are only allowed to call stealWSDeque_(),
- * stealWSDeque(), looksEmptyWSDeque(), and dequeElements().
+ * stealWSDeque(), stealHalfWSDeque_(), looksEmptyWSDeque(), and
+ * dequeElements().
  *
  * -------------------------------------------------------------------------- */
 
@@ -89,6 +90,12 @@ void * stealWSDeque_ (WSDeque *q);
 // NULL if the pool is empty.
 void * stealWSDeque (WSDeque *q);
 
+// Removes half of the elements of the deque (rounded up), but no more
+// than max, from the "read" end into elems[].  Returns how many it
+// removed: 0 if the pool is empty, or if there was a collision with
+// another thief on the first element.
+uint32_t stealHalfWSDeque_ (WSDeque *q, void **elems, uint32_t max);
+
 // "guesses" whether a deque is empty. Can return false negatives in
 //  presence of concurrent steal() calls, and false positives in
 //  presence of a concurrent pushBottom().
@@ -16,6 +16,7 @@
 #include "RtsUtils.h"
 #include "Stats.h"
 #include "EventLog.h"
+#include "eventlog/EventLogCompact.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -32,6 +33,61 @@ static const EventLogWriter *event_log_writer;
 
 static int flushCount;
 
+/*
+   Note [Eventlog writer thread]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   Each EventsBuf is filled in a block of EVENT_LOG_SIZE bytes.  In the
+   non-threaded RTS a full block is written out by the thread that filled
+   it, as it always was.  In the threaded RTS writing it out can take
+   milliseconds (a slow disk, a full pipe) and the capability that posted
+   the event can't run Haskell code in the meantime, so instead a full block
+   is handed to a dedicated writer thread, and the buffer carries on in a
+   spare block:
+
+     - full_blocks is a lock-free stack of the blocks waiting to be written.
+       Any thread pushes to it with cas(); the writer thread takes the whole
+       stack at once with xchg() and reverses it, so the blocks of each
+       buffer are written in the order they were filled.
+
+     - Every buffer has a stack of the blocks that the writer has finished
+       with (returned), which works the same way the other way round.  The
+       owner of the buffer moves the whole stack to its private list of
+       spare blocks.  Neither stack pops single blocks, so there is no ABA
+       problem.
+
+     - A buffer allocates up to EVENTS_BLOCKS_PER_BUF blocks, but only when
+       it fills a block before the writer has returned one, so a buffer that
+       the writer keeps up with stays at two blocks.
+
+   If a buffer has no spare block because the writer can't keep up, we
+   either wait for it to return one (the default), or with +RTS
+   --eventlog-drop throw away the events in the full block and reuse it.
+   Dropped events are counted in eventlog_writer_counts, which +RTS -s
+   reports, and the buffer starts the new block with a log message saying
+   how many events were lost, so that the gap is visible in the eventlog.
+
+   The writer thread only sleeps when full_blocks is empty, so a thread that
+   pushes onto an empty stack takes writer_lock to wake it up; that happens
+   at most once per block, which is cheap compared to writing the block.
+   endEventLogging stops the writer thread before it writes out the
+   remaining events, so that no events are dropped at exit.
+*/
+
+#define EVENTS_BLOCKS_PER_BUF 3
+
+// A block of events, and the link in a stack of them
+typedef struct _EventsBlock {
+  struct _EventsBlock *link;
+  struct _EventsBlockStack *home; // where the writer returns the block
+  StgWord64 len;                  // bytes of events in a full block
+  StgInt8 data[];
+} EventsBlock;
+
+// A lock-free stack of EventsBlocks, see Note [Eventlog writer thread]
+typedef struct _EventsBlockStack {
+  EventsBlock *volatile head;
+} EventsBlockStack;
+
 // Struct for record keeping of buffer to store event types and events.
 typedef struct _EventsBuf {
   StgInt8 *begin;
@@ -39,6 +95,12 @@ typedef struct _EventsBuf {
   StgInt8 *marker;
   StgWord64 size;
   EventCapNo capno; // which capability this buffer belongs to, or -1
+  StgWord32 n_events; // posted to the current block
+  EventsBlock *block; // the block that begin points into
+  EventsBlock *spare; // empty blocks, only used by the owner of the buffer
+  uint32_t n_blocks;  // blocks allocated for this buffer
+  EventsBlockStack *returned; // blocks the writer has finished with
+  StgWord flush_epoch; // see Note [Flushing the eventlog periodically]
 } EventsBuf;
 
 EventsBuf *capEventBuf; // one EventsBuf for each Capability
@@ -48,6 +110,44 @@ EventsBuf eventBuf; // an EventsBuf not associated with any Capability
 Mutex eventBufMutex; // protected by this mutex
 #endif
 
+EventLogWriterCounts eventlog_writer_counts = { 0, 0, 0 };
+
+// The header, see getEventLogHeader()
+static StgInt8 *header_events = NULL;
+static size_t header_size = 0;
+
+/*
+   Note [Flushing the eventlog periodically]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   Events normally reach the EventLogWriter only when an EventsBuf fills
+   up, which with EVENT_LOG_SIZE buffers can take minutes.  That is fine
+   for a file that is read after the program exits, but not for a
+   collector that is watching the eventlog live through a socket.
+
+   So with +RTS --eventlog-flush-interval (which --eventlog-socket turns
+   on), the timer bumps flush_epoch every so many ticks, and
+   ensureRoomForEvent flushes a buffer that hasn't been flushed since the
+   epoch changed before it posts the next event to it.  This costs a load
+   and a compare per event, and the buffers are still only ever touched by
+   their owners.  A capability that posts no more events keeps its last
+   ones until it does, or until the program exits.
+*/
+static volatile StgWord flush_epoch = 0;
+static int flush_ticks = 0;     // 0: don't flush periodically
+static int ticks_to_flush = 0;
+
+#if defined(THREADED_RTS)
+// See Note [Eventlog writer thread]
+static EventsBlockStack full_blocks = { NULL };
+
+static Mutex writer_lock;
+static Condition writer_wakeup;   // signalled when full_blocks is non-empty
+static Condition writer_progress; // broadcast when the writer returns blocks
+static bool writer_running = false;
+static bool writer_busy = false;  // writing blocks it took from full_blocks
+static bool writer_stop = false;
+#endif
+
 char *EventDesc[] = {
   [EVENT_CREATE_THREAD]       = "Create thread",
   [EVENT_RUN_THREAD]          = "Run thread",
@@ -105,7 +205,9 @@ char *EventDesc[] = {
   [EVENT_HEAP_PROF_SAMPLE_BEGIN]  = "Start of heap profile sample",
   [EVENT_HEAP_PROF_SAMPLE_STRING] = "Heap profile string sample",
   [EVENT_HEAP_PROF_SAMPLE_COST_CENTRE] = "Heap profile cost-centre sample",
-  [EVENT_USER_BINARY_MSG]     = "User binary message"
+  [EVENT_USER_BINARY_MSG]     = "User binary message",
+  [EVENT_STM_COUNTERS]        = "STM counters",
+  [EVENT_GC_WORK_STATS]       = "GC work balance"
 };
 
 // Event type.
@@ -118,7 +220,15 @@ typedef struct _EventType {
 
 EventType eventTypes[NUM_GHC_EVENT_TAGS];
 
+// The sizes of the events in the header, -1 for the events that aren't
+// there.  See Note [Compact eventlog] in EventLogCompact.c.
+static StgInt32 event_sizes[NUM_GHC_EVENT_TAGS];
+
 static void initEventsBuf(EventsBuf* eb, StgWord64 size, EventCapNo capno);
+static void freeEventsBuf(EventsBuf* eb);
+static void freeEventsBlocks(EventsBlock *block);
+static EventsBlock *allocEventsBlock(EventsBuf* eb);
+static void setEventsBlock(EventsBuf* eb, EventsBlock *block);
 static void resetEventsBuf(EventsBuf* eb);
 static void printAndClearEventBuf (EventsBuf *eventsBuf);
 
@@ -184,7 +294,10 @@ static inline StgWord64 time_ns(void)
 { return TimeToNS(stat_getElapsedTime()); }
 
 static inline void postEventTypeNum(EventsBuf *eb, EventTypeNum etNum)
-{ postWord16(eb, etNum); }
+{
+    postWord16(eb, etNum);
+    eb->n_events++;
+}
 
 static inline void postTimestamp(EventsBuf *eb)
 { postWord64(eb, time_ns()); }
@@ -241,6 +354,14 @@ writeEventLog(void *eventlog, size_t eventlog_size)
 {
     if (event_log_writer != NULL &&
             event_log_writer->writeEventLog != NULL) {
+        if (RtsFlags.TraceFlags.compact) {
+            size_t size;
+            StgWord8 *frame = compactEventLogBlock(eventlog, eventlog_size,
+                                                   event_sizes, &size);
+            bool ok = event_log_writer->writeEventLog(frame, size);
+            stgFree(frame);
+            return ok;
+        }
         return event_log_writer->writeEventLog(eventlog, eventlog_size);
     } else {
         return false;
@@ -259,12 +380,177 @@ stopEventLogWriter(void)
 void
 flushEventLog(void)
 {
+#if defined(THREADED_RTS)
+    if (writer_running) {
+        // wait until the writer thread has written every full block
+        ACQUIRE_LOCK(&writer_lock);
+        while (full_blocks.head != NULL || writer_busy) {
+            waitCondition(&writer_progress, &writer_lock);
+        }
+        RELEASE_LOCK(&writer_lock);
+    }
+#endif
+
     if (event_log_writer != NULL &&
             event_log_writer->flushEventLog != NULL) {
         event_log_writer->flushEventLog();
     }
 }
 
+#if defined(THREADED_RTS)
+/* Push a block onto a stack, returning true if the stack was empty.
+ * See Note [Eventlog writer thread]. */
+static bool pushEventsBlock (EventsBlockStack *stack, EventsBlock *block)
+{
+    EventsBlock *head;
+
+    do {
+        head = stack->head;
+        block->link = head;
+    } while (cas((StgVolatilePtr)&stack->head, (StgWord)head,
+                 (StgWord)block) != (StgWord)head);
+    return head == NULL;
+}
+
+/* Take all the blocks on a stack, most recently pushed first */
+static EventsBlock *takeEventsBlocks (EventsBlockStack *stack)
+{
+    if (stack->head == NULL) {
+        return NULL; // don't bother with the xchg
+    }
+    return (EventsBlock *)xchg((StgPtr)&stack->head, (StgWord)NULL);
+}
+
+/* Hand a full block over to the writer thread */
+static void queueEventsBlock (EventsBlock *block)
+{
+    if (pushEventsBlock(&full_blocks, block)) {
+        // the writer may be asleep
+        ACQUIRE_LOCK(&writer_lock);
+        signalCondition(&writer_wakeup);
+        RELEASE_LOCK(&writer_lock);
+    }
+}
+
+static void *eventLogWriterThread (void *arg STG_UNUSED)
+{
+    ACQUIRE_LOCK(&writer_lock);
+    while (true) {
+        EventsBlock *blocks, *order = NULL;
+
+        blocks = takeEventsBlocks(&full_blocks);
+        if (blocks == NULL) {
+            if (writer_stop) {
+                break;
+            }
+            waitCondition(&writer_wakeup, &writer_lock);
+            continue;
+        }
+        writer_busy = true;
+        RELEASE_LOCK(&writer_lock);
+
+        // write the blocks in the order they were pushed
+        while (blocks != NULL) {
+            EventsBlock *next = blocks->link;
+            blocks->link = order;
+            order = blocks;
+            blocks = next;
+        }
+        while (order != NULL) {
+            EventsBlock *next = order->link;
+            if (!writeEventLog(order->data, order->len)) {
+                debugBelch("eventLogWriterThread: could not flush event log");
+            }
+            pushEventsBlock(order->home, order);
+            order = next;
+        }
+
+        ACQUIRE_LOCK(&writer_lock);
+        writer_busy = false;
+        broadcastCondition(&writer_progress);
+    }
+    writer_running = false;
+    broadcastCondition(&writer_progress);
+    RELEASE_LOCK(&writer_lock);
+    return NULL;
+}
+
+static void
+startEventLogWriterThread(void)
+{
+    OSThreadId tid;
+
+    initMutex(&writer_lock);
+    initCondition(&writer_wakeup);
+    initCondition(&writer_progress);
+    full_blocks.head = NULL;
+    writer_busy = false;
+    writer_stop = false;
+    writer_running = true;
+
+    if (createOSThread(&tid, "ghc_eventlog", eventLogWriterThread, NULL) != 0) {
+        // the capabilities will just have to write their own blocks
+        writer_running = false;
+    }
+}
+
+/* Wait for the writer thread to write all the blocks it has been given,
+ * and stop it. */
+static void
+stopEventLogWriterThread(void)
+{
+    if (!writer_running) {
+        return;
+    }
+
+    ACQUIRE_LOCK(&writer_lock);
+    writer_stop = true;
+    signalCondition(&writer_wakeup);
+    while (writer_running) {
+        waitCondition(&writer_progress, &writer_lock);
+    }
+    RELEASE_LOCK(&writer_lock);
+
+    closeCondition(&writer_wakeup);
+    closeCondition(&writer_progress);
+    closeMutex(&writer_lock);
+}
+#endif /* THREADED_RTS */
+
+const void *
+getEventLogHeader(size_t *size)
+{
+    *size = header_size;
+    return header_events;
+}
+
+static void
+initEventLogFlushing(void)
+{
+    Time interval = RtsFlags.TraceFlags.flush_interval;
+
+    if (interval == 0 && RtsFlags.TraceFlags.eventlog_socket != NULL) {
+        interval = SecondsToTime(1);
+    }
+    if (interval != 0 && RtsFlags.MiscFlags.tickInterval != 0) {
+        flush_ticks = stg_max(1, (int)(interval /
+                                       RtsFlags.MiscFlags.tickInterval));
+    } else {
+        flush_ticks = 0;
+    }
+    ticks_to_flush = flush_ticks;
+}
+
+/* Called by the timer, see Note [Flushing the eventlog periodically] */
+void
+eventLogTick(void)
+{
+    if (flush_ticks > 0 && --ticks_to_flush <= 0) {
+        ticks_to_flush = flush_ticks;
+        flush_epoch++;
+    }
+}
+
 static void
 postHeaderEvents(void)
 {
@@ -275,6 +561,7 @@ postHeaderEvents(void)
     postInt32(&eventBuf, EVENT_HET_BEGIN);
     for (int t = 0; t < NUM_GHC_EVENT_TAGS; ++t) {
 
+        event_sizes[t] = -1;
         eventTypes[t].etNum = t;
         eventTypes[t].desc = EventDesc[t];
 
@@ -367,6 +654,15 @@ postHeaderEvents(void)
             eventTypes[t].size = 7 * sizeof(StgWord64);
             break;
 
+        case EVENT_STM_COUNTERS:     // (cap, 8*counter)
+            eventTypes[t].size = 8 * sizeof(StgWord64);
+            break;
+
+        case EVENT_GC_WORK_STATS:    // (cap, blocks_stolen, objs_shared,
+                                     //  objs_stolen, idle_time)
+            eventTypes[t].size = 4 * sizeof(StgWord64);
+            break;
+
         case EVENT_HEAP_ALLOCATED:    // (heap_capset, alloc_bytes)
         case EVENT_HEAP_SIZE:         // (heap_capset, size_bytes)
         case EVENT_HEAP_LIVE:         // (heap_capset, live_bytes)
@@ -448,6 +744,7 @@ postHeaderEvents(void)
 
         // Write in buffer: the start event type.
         postEventType(&eventBuf, &eventTypes[t]);
+        event_sizes[t] = (StgWord16)eventTypes[t].size;
     }
 
     // Mark end of event types in the header.
@@ -497,12 +794,38 @@ initEventLogging(const EventLogWriter *ev_writer)
 
     postHeaderEvents();
 
+    // Keep a copy of the header for writers that send it more than once
+    size_t size = eventBuf.pos - eventBuf.begin;
+    StgInt8 *header;
+    if (RtsFlags.TraceFlags.compact) {
+        header = (StgInt8 *)compactEventLogHeader((StgWord8 *)eventBuf.begin,
+                                                  size, &size);
+    } else {
+        header = stgMallocBytes(size, "initEventLogging");
+        memcpy(header, eventBuf.begin, size);
+    }
+
     // Flush capEventBuf with header.
     /*
      * Flush header and data begin marker to the file, thus preparing the
      * file to have events written to it.
      */
-    printAndClearEventBuf(&eventBuf);
+    if (event_log_writer != NULL &&
+        event_log_writer->writeEventLog != NULL &&
+        !event_log_writer->writeEventLog(header, size)) {
+        debugBelch("initEventLogging: could not write event log header");
+    }
+    resetEventsBuf(&eventBuf);
+    flushCount++;
+    postBlockMarker(&eventBuf);
+
+    header_events = header;
+    header_size = size;
+    initEventLogFlushing();
+
+#if defined(THREADED_RTS)
+    startEventLogWriterThread();
+#endif
 
     for (uint32_t c = 0; c < n_caps; ++c) {
         postBlockMarker(&capEventBuf[c]);
@@ -512,6 +835,12 @@ initEventLogging(const EventLogWriter *ev_writer)
 void
 endEventLogging(void)
 {
+#if defined(THREADED_RTS)
+    // From here on we write the blocks ourselves, so that nothing is
+    // dropped at exit.
+    stopEventLogWriterThread();
+#endif
+
     // Flush all events remaining in the buffers.
     for (uint32_t c = 0; c < n_capabilities; ++c) {
         printAndClearEventBuf(&capEventBuf[c]);
@@ -559,16 +888,29 @@ freeEventLogging(void)
     // Free events buffer.
     for (uint32_t c = 0; c < n_capabilities; ++c) {
         if (capEventBuf[c].begin != NULL)
-            stgFree(capEventBuf[c].begin);
+            freeEventsBuf(&capEventBuf[c]);
     }
     if (capEventBuf != NULL)  {
         stgFree(capEventBuf);
     }
+    if (eventBuf.begin != NULL) {
+        freeEventsBuf(&eventBuf);
+    }
+    if (header_events != NULL) {
+        stgFree(header_events);
+        header_events = NULL;
+    }
 }
 
 void
 abortEventLogging(void)
 {
+#if defined(THREADED_RTS)
+    // We are in the child of a fork(), which has no writer thread: free
+    // the blocks that the writer thread of the parent didn't get to.
+    freeEventsBlocks(takeEventsBlocks(&full_blocks));
+    writer_running = false;
+#endif
     freeEventLogging();
     stopEventLogWriter();
 }
@@ -682,6 +1024,40 @@ postSparkCountersEvent (Capability *cap,
     postWord64(eb,remaining);
 }
 
+void
+postStmCountersEvent (Capability *cap, StmCounters counters)
+{
+    EventsBuf *eb = &capEventBuf[cap->no];
+    ensureRoomForEvent(eb, EVENT_STM_COUNTERS);
+
+    postEventHeader(eb, EVENT_STM_COUNTERS);
+    postWord64(eb,counters.starts);
+    postWord64(eb,counters.commits);
+    postWord64(eb,counters.aborts_conflict);
+    postWord64(eb,counters.aborts_invalid);
+    postWord64(eb,counters.aborts_exception);
+    postWord64(eb,counters.retries);
+    postWord64(eb,counters.tvars);
+    postWord64(eb,counters.wakeups);
+}
+
+void
+postGcWorkStatsEvent (Capability *cap,
+                      W_          blocks_stolen,
+                      W_          objs_shared,
+                      W_          objs_stolen,
+                      StgWord64   idle_time)
+{
+    EventsBuf *eb = &capEventBuf[cap->no];
+    ensureRoomForEvent(eb, EVENT_GC_WORK_STATS);
+
+    postEventHeader(eb, EVENT_GC_WORK_STATS);
+    postWord64(eb,blocks_stolen);
+    postWord64(eb,objs_shared);
+    postWord64(eb,objs_stolen);
+    postWord64(eb,idle_time);
+}
+
 void
 postCapEvent (EventTypeNum  tag,
               EventCapNo    capno)
@@ -1275,6 +1651,57 @@ void postHeapProfSampleCostCentre(StgWord8 profile_id,
 }
 #endif /* PROFILING */
 
+#if defined(THREADED_RTS)
+/* An empty block for a buffer whose current block is full, or NULL if we
+ * should drop the events in the current block instead.
+ * See Note [Eventlog writer thread]. */
+static EventsBlock *getSpareEventsBlock (EventsBuf *eb)
+{
+    EventsBlock *block;
+
+    if (eb->spare == NULL) {
+        eb->spare = takeEventsBlocks(eb->returned);
+    }
+    if (eb->spare == NULL) {
+        if (eb->n_blocks < EVENTS_BLOCKS_PER_BUF) {
+            return allocEventsBlock(eb);
+        }
+        if (RtsFlags.TraceFlags.drop_events) {
+            return NULL;
+        }
+        atomic_inc(&eventlog_writer_counts.waits, 1);
+        ACQUIRE_LOCK(&writer_lock);
+        while ((eb->spare = takeEventsBlocks(eb->returned)) == NULL) {
+            waitCondition(&writer_progress, &writer_lock);
+        }
+        RELEASE_LOCK(&writer_lock);
+    }
+    block = eb->spare;
+    eb->spare = block->link;
+    return block;
+}
+
+/* Throw away the events in a full buffer, and say so in the eventlog */
+static void dropEventsBuf (EventsBuf *ebuf)
+{
+    StgWord32 n_events = ebuf->n_events;
+    char msg[64];
+    uint32_t size;
+
+    atomic_inc(&eventlog_writer_counts.blocks_dropped, 1);
+    atomic_inc(&eventlog_writer_counts.events_dropped, n_events);
+
+    resetEventsBuf(ebuf);
+    postBlockMarker(ebuf);
+
+    size = snprintf(msg, sizeof(msg), "eventlog: dropped %" FMT_Word32
+                    " events", n_events);
+    postEventHeader(ebuf, EVENT_LOG_MSG);
+    postPayloadSize(ebuf, size);
+    postBuf(ebuf, (StgWord8*)msg, size);
+}
+#endif /* THREADED_RTS */
+
 void printAndClearEventBuf (EventsBuf *ebuf)
 {
     closeBlockMarker(ebuf);
@@ -1282,6 +1709,24 @@ void printAndClearEventBuf (EventsBuf *ebuf)
     if (ebuf->begin != NULL && ebuf->pos != ebuf->begin)
     {
         size_t elog_size = ebuf->pos - ebuf->begin;
+
+#if defined(THREADED_RTS)
+        if (writer_running) {
+            EventsBlock *next = getSpareEventsBlock(ebuf);
+            if (next == NULL) {
+                dropEventsBuf(ebuf);
+                return;
+            }
+            ebuf->block->len = elog_size;
+            queueEventsBlock(ebuf->block);
+            setEventsBlock(ebuf, next);
+            flushCount++;
+
+            postBlockMarker(ebuf);
+            return;
+        }
+#endif
+
         if (!writeEventLog(ebuf->begin, elog_size)) {
             debugBelch(
                     "printAndClearEventLog: could not flush event log"
@@ -1297,18 +1742,60 @@ void printAndClearEventBuf (EventsBuf *ebuf)
     }
 }
 
+EventsBlock *allocEventsBlock(EventsBuf* eb)
+{
+    EventsBlock *block = stgMallocBytes(sizeof(EventsBlock) + eb->size,
+                                        "allocEventsBlock");
+    block->link = NULL;
+    block->home = eb->returned;
+    block->len = 0;
+    eb->n_blocks++;
+    return block;
+}
+
+void setEventsBlock(EventsBuf* eb, EventsBlock *block)
+{
+    eb->block = block;
+    eb->begin = eb->pos = block->data;
+    eb->marker = NULL;
+    eb->n_events = 0;
+}
+
 void initEventsBuf(EventsBuf* eb, StgWord64 size, EventCapNo capno)
 {
-    eb->begin = eb->pos = stgMallocBytes(size, "initEventsBuf");
     eb->size = size;
-    eb->marker = NULL;
     eb->capno = capno;
+    eb->spare = NULL;
+    eb->n_blocks = 0;
+    eb->flush_epoch = flush_epoch;
+    eb->returned = stgMallocBytes(sizeof(EventsBlockStack), "initEventsBuf");
+    eb->returned->head = NULL;
+    setEventsBlock(eb, allocEventsBlock(eb));
+}
+
+void freeEventsBlocks(EventsBlock *block)
+{
+    while (block != NULL) {
+        EventsBlock *next = block->link;
+        stgFree(block);
+        block = next;
+    }
+}
+
+void freeEventsBuf(EventsBuf* eb)
+{
+    stgFree(eb->block);
+    freeEventsBlocks(eb->spare);
+    freeEventsBlocks(eb->returned->head);
+    stgFree(eb->returned);
+    eb->begin = eb->pos = NULL;
 }
 
 void resetEventsBuf(EventsBuf* eb)
 {
     eb->pos = eb->begin;
     eb->marker = NULL;
+    eb->n_events = 0;
 }
 
 StgBool hasRoomForEvent(EventsBuf *eb, EventTypeNum eNum)
@@ -1336,15 +1823,18 @@ StgBool hasRoomForVariableEvent(EventsBuf *eb, uint32_t payload_bytes)
 
 void ensureRoomForEvent(EventsBuf *eb, EventTypeNum tag)
 {
-    if (!hasRoomForEvent(eb, tag)) {
-        // Flush event buffer to make room for new event.
+    if (!hasRoomForEvent(eb, tag) || eb->flush_epoch != flush_epoch) {
+        // Flush event buffer to make room for new event, or because it's
+        // time to (see Note [Flushing the eventlog periodically]).
+        eb->flush_epoch = flush_epoch;
         printAndClearEventBuf(eb);
     }
 }
 
 int ensureRoomForVariableEvent(EventsBuf *eb, StgWord16 size)
 {
-    if (!hasRoomForVariableEvent(eb, size)) {
+    if (!hasRoomForVariableEvent(eb, size) || eb->flush_epoch != flush_epoch) {
+        eb->flush_epoch = flush_epoch;
         // Flush event buffer to make room for new event.
         printAndClearEventBuf(eb);
         if (!hasRoomForVariableEvent(eb, size))
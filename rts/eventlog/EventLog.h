@@ -28,6 +28,30 @@ void abortEventLogging(void); // #4512 - after fork child needs to abort
 void flushEventLog(void);     // event log inherited from parent
 void moreCapEventBufs (uint32_t from, uint32_t to);
 
+/* What the writer thread had to put up with, see
+ * Note [Eventlog writer thread] in EventLog.c */
+typedef struct {
+    StgWord blocks_dropped;    // with +RTS --eventlog-drop
+    StgWord events_dropped;
+    StgWord waits;             // for the writer to return a block
+} EventLogWriterCounts;
+
+extern EventLogWriterCounts eventlog_writer_counts;
+
+/* The header and event types that begin the eventlog, which a writer that
+ * streams the eventlog to consumers that come and go sends to each of
+ * them first.  NULL until the writer has been sent the header itself. */
+const void *getEventLogHeader(size_t *size);
+
+/* Flush the event buffers every +RTS --eventlog-flush-interval */
+void eventLogTick(void);
+
+#if !defined(mingw32_HOST_OS)
+/* Streams the eventlog to the consumers of the Unix domain socket given
+ * by +RTS --eventlog-socket, see EventLogWriter.c */
+extern const EventLogWriter SocketEventLogWriter;
+#endif
+
 /*
  * Post a scheduler event to the capability's event buffer (an event
  * that has an associated thread).
@@ -94,6 +118,21 @@ void postSparkCountersEvent (Capability *cap,
                              SparkCounters counters,
                              StgWord remaining);
 
+/*
+ * Post an event with the STM counters of a capability
+ */
+void postStmCountersEvent (Capability *cap, StmCounters counters);
+
+/*
+ * Post an event with the work balance of a GC thread in the GC that has
+ * just finished
+ */
+void postGcWorkStatsEvent (Capability *cap,
+                           W_          blocks_stolen,
+                           W_          objs_shared,
+                           W_          objs_stolen,
+                           StgWord64   idle_time);
+
 /*
  * Post an event to annotate a thread with a label
  */
@@ -0,0 +1,295 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2019
+ *
+ * The compact encoding of the eventlog (+RTS --eventlog-compact).
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#if defined(TRACING)
+
+#include "RtsUtils.h"
+#include "rts/EventLogFormat.h"
+#include "eventlog/EventLogCompact.h"
+
+#include <string.h>
+
+/*
+   Note [Compact eventlog]
+   ~~~~~~~~~~~~~~~~~~~~~~~
+   An eventlog spends most of its bytes on things that hardly change from
+   one event to the next: every event has a 64-bit big-endian timestamp,
+   which is only a little bigger than the previous one, and the thread and
+   capability numbers in the payloads repeat endlessly.  With +RTS
+   --eventlog-compact, each buffer that EventLog.c hands to the
+   EventLogWriter is encoded as a frame first:
+
+       eventlog = magic frame*                magic = "ghcevz01"
+       frame    = kind:u8 raw_size:varint data_size:varint data
+
+   raw_size is the size of the buffer, and the data is either
+
+     - FRAME_STORED: the buffer itself.  The header, the end of data
+       marker, and any block that doesn't parse as events are stored.
+
+     - FRAME_EVENTS: the events of the buffer with each event written as
+
+           tag:varint  (timestamp - previous timestamp):zigzag varint
+           [payload size:varint, for variable-sized events]  payload
+
+       where the timestamps are relative to 0 at the start of every frame,
+       compressed with LZ below.  The payloads are left alone; LZ takes
+       care of their repetitions.
+
+   varints are unsigned LEB128.  Every buffer begins with a block marker,
+   so each frame can be decoded on its own with just the sizes of the
+   events from the header, and decoding all the frames gives back exactly
+   the eventlog that we would have written without --eventlog-compact.
+   The eventlog-decode program in utils/ does that, so that the usual
+   tools can read a compact eventlog.
+
+   LZ is a simple LZ77 in the style of LZ4:
+
+       block    = sequence* last
+       sequence = token literals offset:u16le [match length extension]
+       last     = token literals
+       token    = literal length:4 | (match length - 4):4
+
+   where a length field of 15 is followed by a varint to add to it.  The
+   last sequence is the one that ends the input.  We find matches with a
+   hash table of the last position of each 4-byte string in a 64k window,
+   which is cheap and good enough for the very repetitive data of an
+   eventlog.  In the threaded RTS all this happens in the writer thread
+   (Note [Eventlog writer thread] in EventLog.c), not in the mutator.
+*/
+
+#define FRAME_STORED 0
+#define FRAME_EVENTS 1
+
+#define LZ_HASH_BITS  14
+#define LZ_MIN_MATCH  4
+#define LZ_MAX_OFFSET 0xffff
+
+static size_t putVarint (StgWord8 *p, StgWord64 v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (StgWord8)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (StgWord8)v;
+    return n;
+}
+
+static StgWord64 getBigEndian (const StgWord8 *p, size_t bytes)
+{
+    StgWord64 r = 0;
+
+    for (size_t i = 0; i < bytes; i++) {
+        r = (r << 8) | p[i];
+    }
+    return r;
+}
+
+static StgWord32 get32 (const StgWord8 *p)
+{
+    StgWord32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static StgWord32 lzHash (StgWord32 v)
+{
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static StgWord8 *lzSequence (StgWord8 *out, const StgWord8 *literals,
+                             size_t n_literals, size_t offset,
+                             size_t match_length)
+{
+    StgWord8 *token = out++;
+    size_t m = match_length > 0 ? match_length - LZ_MIN_MATCH : 0;
+
+    *token = (StgWord8)((stg_min(n_literals, 15) << 4) | stg_min(m, 15));
+    if (n_literals >= 15) {
+        out += putVarint(out, n_literals - 15);
+    }
+    memcpy(out, literals, n_literals);
+    out += n_literals;
+
+    if (match_length > 0) {
+        *out++ = (StgWord8)offset;
+        *out++ = (StgWord8)(offset >> 8);
+        if (m >= 15) {
+            out += putVarint(out, m - 15);
+        }
+    }
+    return out;
+}
+
+/* The most that lzCompress can expand 'size' bytes to */
+#define LZ_BOUND(size) ((size) + (size) / 8 + 64)
+
+static size_t lzCompress (const StgWord8 *in, size_t size, StgWord8 *out)
+{
+    // positions + 1 of the last occurrence of each hash, 0 for none
+    StgWord32 *table = stgCallocBytes(1 << LZ_HASH_BITS, sizeof(StgWord32),
+                                      "lzCompress");
+    const StgWord8 *ip = in, *anchor = in, *end = in + size;
+    StgWord8 *op = out;
+
+    while (end - ip >= LZ_MIN_MATCH) {
+        StgWord32 h = lzHash(get32(ip));
+        StgWord32 candidate = table[h];
+
+        table[h] = (StgWord32)(ip - in) + 1;
+        if (candidate != 0) {
+            const StgWord8 *ref = in + candidate - 1;
+            if (ip - ref <= LZ_MAX_OFFSET && get32(ref) == get32(ip)) {
+                const StgWord8 *mp = ip + LZ_MIN_MATCH;
+                const StgWord8 *rp = ref + LZ_MIN_MATCH;
+                while (mp < end && *mp == *rp) {
+                    mp++;
+                    rp++;
+                }
+                op = lzSequence(op, anchor, ip - anchor, ip - ref, mp - ip);
+                ip = anchor = mp;
+                continue;
+            }
+        }
+        ip++;
+    }
+    op = lzSequence(op, anchor, end - anchor, 0, 0);
+
+    stgFree(table);
+    return op - out;
+}
+
+/* Rewrite the events in a block with varint tags and timestamp deltas.
+ * Returns 0 if the block isn't a sequence of events that we know. */
+static size_t encodeEvents (const StgWord8 *in, size_t size,
+                            const StgInt32 *event_sizes, StgWord8 *out)
+{
+    const StgWord8 *ip = in, *end = in + size;
+    StgWord8 *op = out;
+    StgWord64 prev = 0;
+
+    while (ip < end) {
+        StgWord16 tag;
+        StgWord64 ts;
+        StgInt64 delta;
+        size_t payload;
+
+        if (end - ip < 2 + 8) {
+            return 0;
+        }
+        tag = getBigEndian(ip, 2);
+        if (tag >= NUM_GHC_EVENT_TAGS || event_sizes[tag] < 0) {
+            return 0;
+        }
+        ts = getBigEndian(ip + 2, 8);
+        ip += 2 + 8;
+
+        delta = (StgInt64)(ts - prev);
+        prev = ts;
+        op += putVarint(op, tag);
+        op += putVarint(op, ((StgWord64)delta << 1)
+                            ^ (StgWord64)(delta >> 63)); // zigzag
+
+        if (event_sizes[tag] == 0xffff) {
+            if (end - ip < 2) {
+                return 0;
+            }
+            payload = getBigEndian(ip, 2);
+            ip += 2;
+            op += putVarint(op, payload);
+        } else {
+            payload = event_sizes[tag];
+        }
+        if ((size_t)(end - ip) < payload) {
+            return 0;
+        }
+        memcpy(op, ip, payload);
+        op += payload;
+        ip += payload;
+    }
+    return op - out;
+}
+
+/* The most that a frame header takes */
+#define FRAME_HEADER_BOUND (1 + 10 + 10)
+
+static StgWord8 *putFrameHeader (StgWord8 *out, StgWord8 kind,
+                                 size_t raw_size, size_t data_size)
+{
+    *out++ = kind;
+    out += putVarint(out, raw_size);
+    out += putVarint(out, data_size);
+    return out;
+}
+
+static StgWord8 *storedFrame (StgWord8 *out, const StgWord8 *buf, size_t size)
+{
+    out = putFrameHeader(out, FRAME_STORED, size, size);
+    memcpy(out, buf, size);
+    return out + size;
+}
+
+StgWord8 *compactEventLogHeader (const StgWord8 *header, size_t size,
+                                 size_t *out_size)
+{
+    StgWord8 *out = stgMallocBytes(COMPACT_EVENTLOG_MAGIC_SIZE
+                                   + FRAME_HEADER_BOUND + size,
+                                   "compactEventLogHeader");
+    StgWord8 *op;
+
+    memcpy(out, COMPACT_EVENTLOG_MAGIC, COMPACT_EVENTLOG_MAGIC_SIZE);
+    op = storedFrame(out + COMPACT_EVENTLOG_MAGIC_SIZE, header, size);
+    *out_size = op - out;
+    return out;
+}
+
+StgWord8 *compactEventLogBlock (const StgWord8 *block, size_t size,
+                                const StgInt32 *event_sizes,
+                                size_t *out_size)
+{
+    // an event grows by at most 4 bytes, and is at least 10 bytes
+    StgWord8 *events = stgMallocBytes(size + size / 2 + 16,
+                                      "compactEventLogBlock");
+    StgWord8 *out = stgMallocBytes(FRAME_HEADER_BOUND
+                                   + stg_max(LZ_BOUND(size + size / 2 + 16),
+                                             size),
+                                   "compactEventLogBlock");
+    StgWord8 *op;
+    size_t n_events, n_data;
+
+    n_events = encodeEvents(block, size, event_sizes, events);
+    if (n_events > 0) {
+        StgWord8 header[FRAME_HEADER_BOUND];
+        StgWord8 *data = out + FRAME_HEADER_BOUND;
+
+        n_data = lzCompress(events, n_events, data);
+        if (n_data < size) {
+            // we reserved room for the longest frame header, so move the
+            // data up behind the real one
+            size_t n_header = putFrameHeader(header, FRAME_EVENTS,
+                                             size, n_data) - header;
+            memmove(out + n_header, data, n_data);
+            memcpy(out, header, n_header);
+            stgFree(events);
+            *out_size = n_header + n_data;
+            return out;
+        }
+    }
+
+    op = storedFrame(out, block, size);
+    stgFree(events);
+    *out_size = op - out;
+    return out;
+}
+
+#endif /* TRACING */
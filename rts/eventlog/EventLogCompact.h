@@ -0,0 +1,34 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2019
+ *
+ * The compact encoding of the eventlog (+RTS --eventlog-compact).
+ *
+ * ---------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "BeginPrivate.h"
+
+#if defined(TRACING)
+
+/* The first bytes of a compact eventlog */
+#define COMPACT_EVENTLOG_MAGIC "ghcevz01"
+#define COMPACT_EVENTLOG_MAGIC_SIZE 8
+
+/* Encode the header of the eventlog, including the magic number.
+ * Returns a buffer allocated with stgMallocBytes. */
+StgWord8 *compactEventLogHeader (const StgWord8 *header, size_t size,
+                                 size_t *out_size);
+
+/* Encode a block of events.  event_sizes[tag] is the size of the payload
+ * of event 'tag' as given in the header: 0xffff for variable-sized events,
+ * and -1 for events that are not in the header.  Returns a buffer
+ * allocated with stgMallocBytes. */
+StgWord8 *compactEventLogBlock (const StgWord8 *block, size_t size,
+                                const StgInt32 *event_sizes,
+                                size_t *out_size);
+
+#endif /* TRACING */
+
+#include "EndPrivate.h"
@@ -11,6 +11,7 @@
 
 #include "RtsUtils.h"
 #include "rts/EventLogWriter.h"
+#include "eventlog/EventLog.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -21,6 +22,13 @@
 #if defined(HAVE_UNISTD_H)
 #include <unistd.h>
 #endif
+#if defined(TRACING) && !defined(mingw32_HOST_OS)
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 
 // PID of the process that writes to event_log_filename (#4512)
 static pid_t event_log_pid = -1;
@@ -52,14 +60,17 @@ static char *outputFileName(void)
             }
         }
 #endif
+        // see Note [Compact eventlog] in EventLogCompact.c
+        const char *suffix = RtsFlags.TraceFlags.compact
+                             ? "ceventlog" : "eventlog";
         char *filename = stgMallocBytes(strlen(prog)
                                         + 10 /* .%d */
-                                        + 10 /* .eventlog */,
+                                        + 11 /* .ceventlog */,
                                         "initEventLogFileWriter");
 
         if (event_log_pid == -1) { // #4512
             // Single process
-            sprintf(filename, "%s.eventlog", prog);
+            sprintf(filename, "%s.%s", prog, suffix);
             event_log_pid = getpid();
         } else {
             // Forked process, eventlog already started by the parent
@@ -68,8 +79,8 @@ static char *outputFileName(void)
             // We don't have a FMT* symbol for pid_t, so we go via Word64
             // to be sure of not losing range. It would be nicer to have a
             // FMT* symbol or similar, though.
-            sprintf(filename, "%s.%" FMT_Word64 ".eventlog",
-                    prog, (StgWord64)event_log_pid);
+            sprintf(filename, "%s.%" FMT_Word64 ".%s",
+                    prog, (StgWord64)event_log_pid, suffix);
         }
         stgFree(prog);
         return filename;
@@ -131,3 +142,195 @@ const EventLogWriter FileEventLogWriter = {
     .flushEventLog = flushEventLogFile,
     .stopEventLogWriter = stopEventLogFileWriter
 };
+
+#if defined(TRACING) && !defined(mingw32_HOST_OS)
+
+/*
+   Note [Streaming the eventlog]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   With +RTS --eventlog-socket=<path> the RTS listens on the Unix domain
+   socket <path>, and streams the eventlog to whoever connects to it, so
+   that a collector can watch a long-running program live.
+
+   There is one consumer at a time.  A new consumer first gets the header
+   (see getEventLogHeader) and then every block of events from then on.
+   Each block is a whole number of events starting with a block marker, so
+   every consumer sees a well-formed eventlog, which ends with the data end
+   marker when the program exits.  Blocks that arrive while nobody is
+   connected are dropped.  A consumer that goes away, or that doesn't
+   accept any of a block for EVENTLOG_SOCKET_TIMEOUT milliseconds, is
+   disconnected, and the next one to connect starts afresh.
+
+   In the threaded RTS the blocks are written by the writer thread (see
+   Note [Eventlog writer thread] in EventLog.c), so a slow consumer only
+   holds up the mutator when the writer runs out of blocks.  So that
+   events arrive promptly, --eventlog-socket flushes the event buffers
+   every second unless --eventlog-flush-interval says otherwise.
+*/
+
+#define EVENTLOG_SOCKET_TIMEOUT 1000 // milliseconds
+
+#if defined(MSG_NOSIGNAL)
+#define EVENTLOG_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define EVENTLOG_SEND_FLAGS 0
+#endif
+
+static int event_log_listen_fd = -1;
+static int event_log_client_fd = -1;
+static char *event_log_socket_path = NULL;
+
+// PID of the process that created event_log_socket_path
+static pid_t event_log_socket_pid = -1;
+
+static void setSocketFlags(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+static void
+initEventLogSocketWriter(void)
+{
+    const char *flag = RtsFlags.TraceFlags.eventlog_socket;
+    struct sockaddr_un addr;
+    char *path;
+    int fd;
+
+    if (event_log_socket_pid == -1) {
+        path = strdup(flag);
+    } else {
+        // Forked process: the parent still owns its socket (cf. #4512)
+        size_t len = strlen(flag) + 1 + 20 + 1;
+        path = stgMallocBytes(len, "initEventLogSocketWriter");
+        snprintf(path, len, "%s.%" FMT_Word64, flag, (StgWord64)getpid());
+    }
+    event_log_socket_pid = getpid();
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errorBelch("initEventLogSocketWriter: socket path too long: %s", path);
+        stg_exit(EXIT_FAILURE);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    // the socket of an earlier run of the program may still be there
+    unlink(path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0
+        || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || listen(fd, 1) != 0) {
+        sysErrorBelch("initEventLogSocketWriter: can't listen on %s", path);
+        stg_exit(EXIT_FAILURE);
+    }
+    // we look for a consumer whenever we have events, but never wait
+    setSocketFlags(fd);
+
+    event_log_listen_fd = fd;
+    event_log_socket_path = path;
+}
+
+static void
+closeEventLogSocketClient(void)
+{
+    close(event_log_client_fd);
+    event_log_client_fd = -1;
+}
+
+/* Send all of a buffer to the consumer, or disconnect it */
+static void
+sendEventLogSocket(const void *buf, size_t size)
+{
+    const char *p = buf;
+
+    while (size > 0) {
+        ssize_t n = send(event_log_client_fd, p, size, EVENTLOG_SEND_FLAGS);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = { event_log_client_fd, POLLOUT, 0 };
+                int r = poll(&pfd, 1, EVENTLOG_SOCKET_TIMEOUT);
+                if (r > 0 || (r < 0 && errno == EINTR)) {
+                    continue;
+                }
+            }
+            // the consumer went away, or is too slow
+            closeEventLogSocketClient();
+            return;
+        }
+        p += n;
+        size -= n;
+    }
+}
+
+static void
+acceptEventLogSocketClient(void)
+{
+    const void *header;
+    size_t header_size;
+    int fd;
+
+    header = getEventLogHeader(&header_size);
+    if (header == NULL) {
+        return; // we are being sent the header itself
+    }
+
+    fd = accept(event_log_listen_fd, NULL, NULL);
+    if (fd < 0) {
+        return; // nobody there
+    }
+    setSocketFlags(fd);
+#if defined(SO_NOSIGPIPE)
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+    event_log_client_fd = fd;
+    sendEventLogSocket(header, header_size);
+}
+
+static bool
+writeEventLogSocket(void *eventlog, size_t eventlog_size)
+{
+    if (event_log_client_fd < 0) {
+        acceptEventLogSocketClient();
+    }
+    if (event_log_client_fd >= 0) {
+        sendEventLogSocket(eventlog, eventlog_size);
+    }
+    // nobody listening is not an error
+    return true;
+}
+
+static void
+stopEventLogSocketWriter(void)
+{
+    if (event_log_client_fd >= 0) {
+        closeEventLogSocketClient();
+    }
+    if (event_log_listen_fd >= 0) {
+        close(event_log_listen_fd);
+        event_log_listen_fd = -1;
+    }
+    if (event_log_socket_path != NULL) {
+        // after a fork() the socket belongs to the parent
+        if (getpid() == event_log_socket_pid) {
+            unlink(event_log_socket_path);
+        }
+        stgFree(event_log_socket_path);
+        event_log_socket_path = NULL;
+    }
+}
+
+const EventLogWriter SocketEventLogWriter = {
+    .initEventLogWriter = initEventLogSocketWriter,
+    .writeEventLog = writeEventLogSocket,
+    .flushEventLog = NULL,
+    .stopEventLogWriter = stopEventLogSocketWriter
+};
+
+#endif /* TRACING && !mingw32_HOST_OS */
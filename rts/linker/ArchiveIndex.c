@@ -0,0 +1,373 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2019
+ *
+ * RTS Object Linker: symbol indices of archives
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "Rts.h"
+#include "RtsUtils.h"
+#include "linker/ArchiveIndex.h"
+
+#if defined(USE_ARCHIVE_INDEX)
+
+#include "xxhash.h"
+
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#if defined(HAVE_UNISTD_H)
+#include <unistd.h>
+#endif
+
+#define DEBUG_LOG(...) IF_DEBUG(linker, debugBelch("archiveIndex: " __VA_ARGS__))
+
+/*
+   Note [Archive index cache]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~
+   loadArchive_ uses the symbol table of an archive to skip the members
+   that define no symbols: nothing can ever demand-load them, so there is
+   no point in reading, verifying and indexing them.
+
+   The symbol table lists the symbols in archive order, so we have to sort
+   it by member to use it.  For the multi-hundred-megabyte libraries that
+   GHCi and Template Haskell load at every start, +RTS
+   --linker-index-cache=<dir> saves the result in <dir>, in the same
+   format we use in memory, so that the next process can simply mmap()
+   it:
+
+       ArchiveIndexHeader
+       ArchiveIndexMember members[n_members]   (sorted by offset)
+       uint32_t           symbols[n_symbols]   (offsets into strings)
+       char               strings[strings_size]
+
+   A cached index is named after the XXH64 hash of the path and the
+   identity (device, inode, size, and modification and status change
+   times) of the archive, and the header repeats the identity so that an
+   archive which is replaced in place invalidates its entry.  The times
+   are in nanoseconds: a build that rewrites an archive within the same
+   second as the previous one, without changing its size, must not find
+   the old index.  We deliberately don't hash
+   the contents of the archive: that would read every page of it, which
+   is exactly what we are trying to avoid.  The XXH64 checksum of the
+   body protects against truncated or corrupted cache files.
+
+   The cache files are written to a temporary file and renamed into
+   place, so concurrent processes never see a partial one.  Any failure
+   to read or write the cache just means we use the symbol table in the
+   archive.
+*/
+
+#define ARCHIVE_INDEX_MAGIC "GHCAIX02"
+
+typedef struct {
+    char     magic[8];
+    uint64_t archive_dev;
+    uint64_t archive_ino;
+    uint64_t archive_size;
+    uint64_t archive_mtime_ns;
+    uint64_t archive_ctime_ns;
+    uint32_t n_members;
+    uint32_t n_symbols;
+    uint64_t strings_size;
+    uint64_t checksum;        /* XXH64 of everything after the header */
+} ArchiveIndexHeader;
+
+static uint64_t archiveIndexChecksum (ArchiveIndexHeader *hdr, size_t size)
+{
+    return XXH64((char *)hdr + sizeof(ArchiveIndexHeader),
+                 size - sizeof(ArchiveIndexHeader), 0);
+}
+
+/* Fill in the identity of the archive and compute the cache key */
+static bool archiveIdentity (pathchar *path, ArchiveIndexHeader *hdr,
+                             uint64_t *key)
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0) {
+        return false;
+    }
+    hdr->archive_dev      = (uint64_t)st.st_dev;
+    hdr->archive_ino      = (uint64_t)st.st_ino;
+    hdr->archive_size     = (uint64_t)st.st_size;
+    hdr->archive_mtime_ns = (uint64_t)st.st_mtim.tv_sec * 1000000000
+                            + (uint64_t)st.st_mtim.tv_nsec;
+    hdr->archive_ctime_ns = (uint64_t)st.st_ctim.tv_sec * 1000000000
+                            + (uint64_t)st.st_ctim.tv_nsec;
+    *key = XXH64(&hdr->archive_dev, 5 * sizeof(uint64_t),
+                 XXH64(path, strlen(path), 0));
+    return true;
+}
+
+static char *cachedIndexPath (uint64_t key, const char *suffix)
+{
+    const char *dir = RtsFlags.MiscFlags.linkerIndexCache;
+    size_t len = strlen(dir) + 1 + 16 + strlen(suffix) + 1;
+    char *file = stgMallocBytes(len, "cachedIndexPath");
+
+    snprintf(file, len, "%s/%016" PRIx64 "%s", dir, key, suffix);
+    return file;
+}
+
+/* Set up the view of a block that contains a well-formed index */
+static ArchiveIndex *mkArchiveIndex (void *block, size_t size, bool mapped)
+{
+    ArchiveIndexHeader *hdr = block;
+    ArchiveIndex *index = stgMallocBytes(sizeof(ArchiveIndex),
+                                         "mkArchiveIndex");
+
+    index->n_members  = hdr->n_members;
+    index->n_symbols  = hdr->n_symbols;
+    index->members    = (ArchiveIndexMember *)(hdr + 1);
+    index->symbols    = (uint32_t *)(index->members + hdr->n_members);
+    index->strings    = (char *)(index->symbols + hdr->n_symbols);
+    index->block      = block;
+    index->block_size = size;
+    index->mapped     = mapped;
+    return index;
+}
+
+static void writeCachedArchiveIndex (ArchiveIndex *index, uint64_t key)
+{
+    char *tmp, *file;
+    int fd;
+    size_t written = 0;
+
+    // it's fine if this fails because the directory exists
+    mkdir(RtsFlags.MiscFlags.linkerIndexCache, 0777);
+
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%d.tmp", (int)getpid());
+    tmp = cachedIndexPath(key, suffix);
+    file = cachedIndexPath(key, ".idx");
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        DEBUG_LOG("can't create %s: %s\n", tmp, strerror(errno));
+        goto done;
+    }
+    while (written < index->block_size) {
+        ssize_t n = write(fd, (char *)index->block + written,
+                          index->block_size - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        written += n;
+    }
+    close(fd);
+
+    if (written != index->block_size || rename(tmp, file) != 0) {
+        DEBUG_LOG("can't write %s: %s\n", file, strerror(errno));
+        unlink(tmp);
+    } else {
+        DEBUG_LOG("wrote %s\n", file);
+    }
+
+done:
+    stgFree(tmp);
+    stgFree(file);
+}
+
+ArchiveIndex *readCachedArchiveIndex (pathchar *path)
+{
+    ArchiveIndexHeader expected, *hdr;
+    uint64_t key;
+    struct stat st;
+    char *file;
+    void *block;
+    int fd;
+
+    if (RtsFlags.MiscFlags.linkerIndexCache == NULL
+        || !archiveIdentity(path, &expected, &key)) {
+        return NULL;
+    }
+
+    file = cachedIndexPath(key, ".idx");
+    fd = open(file, O_RDONLY);
+    stgFree(file);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*hdr)) {
+        close(fd);
+        return NULL;
+    }
+
+    block = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (block == MAP_FAILED) {
+        return NULL;
+    }
+
+    hdr = block;
+    if (memcmp(hdr->magic, ARCHIVE_INDEX_MAGIC, 8) != 0
+        || hdr->archive_dev      != expected.archive_dev
+        || hdr->archive_ino      != expected.archive_ino
+        || hdr->archive_size     != expected.archive_size
+        || hdr->archive_mtime_ns != expected.archive_mtime_ns
+        || hdr->archive_ctime_ns != expected.archive_ctime_ns
+        || sizeof(*hdr)
+           + (uint64_t)hdr->n_members * sizeof(ArchiveIndexMember)
+           + (uint64_t)hdr->n_symbols * sizeof(uint32_t)
+           + hdr->strings_size != (uint64_t)st.st_size
+        || hdr->checksum != archiveIndexChecksum(hdr, st.st_size)) {
+        DEBUG_LOG("stale or corrupt index for %" PATH_FMT "\n", path);
+        munmap(block, st.st_size);
+        return NULL;
+    }
+
+    DEBUG_LOG("using cached index for %" PATH_FMT "\n", path);
+    return mkArchiveIndex(block, st.st_size, true);
+}
+
+typedef struct {
+    uint64_t offset;   /* of the member that defines the symbol */
+    uint32_t name;     /* offset of the name in the string table */
+    uint32_t order;    /* position in the symbol table */
+} SymtabEntry;
+
+static int compareSymtabEntries (const void *a, const void *b)
+{
+    const SymtabEntry *x = a, *y = b;
+
+    if (x->offset != y->offset) {
+        return x->offset < y->offset ? -1 : 1;
+    }
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static uint64_t readBigEndian (const char *p, size_t word)
+{
+    uint64_t r = 0;
+    for (size_t i = 0; i < word; i++) {
+        r = (r << 8) | (uint8_t)p[i];
+    }
+    return r;
+}
+
+ArchiveIndex *readArchiveSymbolTable (pathchar *path, const char *symtab,
+                                      size_t size, bool is64)
+{
+    const size_t word = is64 ? 8 : 4;
+    const char *names;
+    size_t names_size, block_size, p;
+    uint64_t n, i, key;
+    uint32_t n_members;
+    SymtabEntry *entries;
+    ArchiveIndexHeader *hdr;
+    ArchiveIndex *index;
+
+    if (size < word) {
+        return NULL;
+    }
+    n = readBigEndian(symtab, word);
+    if (n > (size - word) / word || n >= UINT32_MAX) {
+        return NULL;
+    }
+    names = symtab + word + n * word;
+    names_size = size - word - n * word;
+    if (names_size >= UINT32_MAX) {
+        return NULL;
+    }
+
+    entries = stgMallocBytes(n * sizeof(SymtabEntry) + 1,
+                             "readArchiveSymbolTable");
+    p = 0;
+    for (i = 0; i < n; i++) {
+        size_t len;
+        if (p >= names_size) {
+            stgFree(entries);
+            return NULL;
+        }
+        len = strnlen(names + p, names_size - p);
+        if (len == names_size - p) {
+            stgFree(entries);
+            return NULL;
+        }
+        entries[i].offset = readBigEndian(symtab + word + i * word, word);
+        entries[i].name   = p;
+        entries[i].order  = i;
+        p += len + 1;
+    }
+    qsort(entries, n, sizeof(SymtabEntry), compareSymtabEntries);
+
+    n_members = 0;
+    for (i = 0; i < n; i++) {
+        if (i == 0 || entries[i].offset != entries[i-1].offset) {
+            n_members++;
+        }
+    }
+
+    block_size = sizeof(ArchiveIndexHeader)
+               + n_members * sizeof(ArchiveIndexMember)
+               + n * sizeof(uint32_t)
+               + names_size;
+    hdr = stgMallocBytes(block_size, "readArchiveSymbolTable");
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, ARCHIVE_INDEX_MAGIC, 8);
+    hdr->n_members    = n_members;
+    hdr->n_symbols    = n;
+    hdr->strings_size = names_size;
+
+    index = mkArchiveIndex(hdr, block_size, false);
+    n_members = 0;
+    for (i = 0; i < n; i++) {
+        if (i == 0 || entries[i].offset != entries[i-1].offset) {
+            ArchiveIndexMember *m = &index->members[n_members++];
+            m->offset       = entries[i].offset;
+            m->first_symbol = i;
+            m->n_symbols    = 0;
+        }
+        index->members[n_members - 1].n_symbols++;
+        index->symbols[i] = entries[i].name;
+    }
+    memcpy(index->strings, names, names_size);
+    stgFree(entries);
+
+    DEBUG_LOG("%" PATH_FMT ": %" PRIu64 " symbols in %" PRIu32 " members\n",
+              path, n, n_members);
+
+    if (RtsFlags.MiscFlags.linkerIndexCache != NULL
+        && archiveIdentity(path, hdr, &key)) {
+        hdr->checksum = archiveIndexChecksum(hdr, block_size);
+        writeCachedArchiveIndex(index, key);
+    }
+
+    return index;
+}
+
+ArchiveIndexMember *lookupArchiveIndex (ArchiveIndex *index, uint64_t offset)
+{
+    uint32_t lo = 0, hi = index->n_members;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (index->members[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < index->n_members && index->members[lo].offset == offset) {
+        return &index->members[lo];
+    }
+    return NULL;
+}
+
+void freeArchiveIndex (ArchiveIndex *index)
+{
+    if (index->mapped) {
+        munmap(index->block, index->block_size);
+    } else {
+        stgFree(index->block);
+    }
+    stgFree(index);
+}
+
+#endif /* USE_ARCHIVE_INDEX */
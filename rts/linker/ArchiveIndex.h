@@ -0,0 +1,59 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2019
+ *
+ * RTS Object Linker: symbol indices of archives
+ *
+ * ---------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "Rts.h"
+#include "LinkerInternals.h"
+
+#include "BeginPrivate.h"
+
+/* We only read the System V/GNU archive symbol table ("/" or "/SYM64/").
+ * Windows import libraries need every member loaded, and Darwin uses the
+ * BSD variant, so there archives are loaded without an index. */
+#if !defined(OBJFORMAT_PEi386) && !defined(OBJFORMAT_MACHO)
+#define USE_ARCHIVE_INDEX 1
+#endif
+
+/* A member of an archive that defines at least one symbol */
+typedef struct {
+    uint64_t offset;         /* of the member header in the archive */
+    uint32_t first_symbol;   /* index into ArchiveIndex.symbols */
+    uint32_t n_symbols;
+} ArchiveIndexMember;
+
+/* Which members of an archive define which symbols.  This is a view of a
+ * single contiguous block of memory, which is also the format of the
+ * index cache (see Note [Archive index cache] in ArchiveIndex.c). */
+typedef struct {
+    uint32_t n_members;
+    uint32_t n_symbols;
+    ArchiveIndexMember *members;   /* sorted by offset */
+    uint32_t *symbols;             /* offsets of the names in strings */
+    char *strings;
+
+    void *block;
+    size_t block_size;
+    bool mapped;                   /* block was mmap()ed from the cache */
+} ArchiveIndex;
+
+/* Look up the index of an archive in the index cache, if enabled with
+ * +RTS --linker-index-cache.  Returns NULL if it isn't there. */
+ArchiveIndex *readCachedArchiveIndex (pathchar *path);
+
+/* Build the index of an archive from its symbol table member, and add it
+ * to the index cache.  Returns NULL if the symbol table is malformed. */
+ArchiveIndex *readArchiveSymbolTable (pathchar *path, const char *symtab,
+                                      size_t size, bool is64);
+
+/* The entry of the member at 'offset', or NULL if it defines no symbols */
+ArchiveIndexMember *lookupArchiveIndex (ArchiveIndex *index, uint64_t offset);
+
+void freeArchiveIndex (ArchiveIndex *index);
+
+#include "EndPrivate.h"
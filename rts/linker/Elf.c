@@ -1734,6 +1734,64 @@ do_Elf_Rela_relocations ( ObjectCode* oc, char* ehdrC,
 }
 #endif /* !aarch64_HOST_ARCH */
 
+/*
+ * Call 'visit' on the name of every non-local symbol referred to by a
+ * relocation of 'oc', in the order in which ocResolve_ELF looks them up.
+ * Stops and returns 0 as soon as 'visit' does.
+ *
+ * See Note [Resolving objects in parallel] in Linker.c.
+ */
+int
+ocVisitExternalRefs_ELF ( ObjectCode* oc,
+                          int (*visit)(SymbolName *name, void *user),
+                          void *user )
+{
+   char*     ehdrC = (char*)(oc->image);
+   Elf_Ehdr* ehdr  = (Elf_Ehdr*) ehdrC;
+   Elf_Shdr* shdr  = (Elf_Shdr*) (ehdrC + ehdr->e_shoff);
+   const Elf_Word shnum = elf_shnum(ehdr);
+
+   for (Elf_Word i = 0; i < shnum; i++) {
+      size_t entsize;
+
+      if (shdr[i].sh_type == SHT_REL) {
+         entsize = sizeof(Elf_Rel);
+      } else if (shdr[i].sh_type == SHT_RELA) {
+         entsize = sizeof(Elf_Rela);
+      } else {
+         continue;
+      }
+
+      /* Skip sections that we're not interested in. */
+      if (oc->sections[shdr[i].sh_info].kind == SECTIONKIND_OTHER) {
+         continue;
+      }
+
+      int   symtab_shndx = shdr[i].sh_link;
+      int   strtab_shndx = shdr[symtab_shndx].sh_link;
+      Elf_Sym* stab   = (Elf_Sym*) (ehdrC + shdr[symtab_shndx].sh_offset);
+      char*    strtab = (char*)    (ehdrC + shdr[strtab_shndx].sh_offset);
+      char*    rtab   = ehdrC + shdr[i].sh_offset;
+      size_t   nent   = shdr[i].sh_size / entsize;
+
+      for (size_t j = 0; j < nent; j++) {
+         /* r_info is at the same offset in Elf_Rel and Elf_Rela */
+         Elf_Addr info = ((Elf_Rel*) (rtab + j * entsize))->r_info;
+         if (!info) {
+            continue;
+         }
+         Elf_Sym *sym = &stab[ELF_R_SYM(info)];
+         if (ELF_ST_BIND(sym->st_info) == STB_LOCAL) {
+            continue;
+         }
+         if (!visit(strtab + sym->st_name, user)) {
+            return 0;
+         }
+      }
+   }
+   return 1;
+}
+
 
 int
 ocResolve_ELF ( ObjectCode* oc )
@@ -14,5 +14,14 @@ int ocGetNames_ELF       ( ObjectCode* oc );
 int ocResolve_ELF        ( ObjectCode* oc );
 int ocRunInit_ELF        ( ObjectCode* oc );
 int ocAllocateExtras_ELF ( ObjectCode *oc );
+int ocVisitExternalRefs_ELF ( ObjectCode* oc,
+                              int (*visit)(SymbolName *name, void *user),
+                              void *user );
+
+/* On ARM and AArch64 ocResolve_ELF also looks up the symbols of the GOT,
+ * so ocVisitExternalRefs_ELF does not predict all of its lookups. */
+#if !defined(arm_HOST_ARCH) && !defined(aarch64_HOST_ARCH)
+#define ELF_EXTERNAL_REFS_PREDICT_RESOLVE 1
+#endif
 
 #include "EndPrivate.h"
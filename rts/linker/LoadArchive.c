@@ -6,6 +6,7 @@
 #include "RtsUtils.h"
 #include "LinkerInternals.h"
 #include "linker/M32Alloc.h"
+#include "linker/ArchiveIndex.h"
 
 /* Platform specific headers */
 #if defined(OBJFORMAT_PEi386)
@@ -239,6 +240,119 @@ lookupGNUArchiveIndex(int gnuFileIndexSize, char **fileName_,
     return true;
 }
 
+ArchiveMemberCounts archive_member_counts = { 0, 0, 0, 0 };
+
+#if defined(USE_ARCHIVE_INDEX)
+/*
+   Note [Lazy archive members]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   Most members of the archives that GHCi and Template Haskell load are
+   never used, but loading an archive reads, verifies and indexes all of
+   them (ocVerifyImage and ocGetNames), and keeps their images in memory.
+   With +RTS --linker-lazy-archives, loadArchive_ instead creates an
+   ObjectCode without an image for every member that the archive index
+   (see Note [Archive index cache]) says defines symbols.  Its symbols
+   are put in `symhash` as placeholders with a NULL value, owned by the
+   ObjectCode, which has status OBJECT_LOADED like the members we read.
+   The ObjectCode records where its image is (lazyImagePath and
+   lazyImageOffset), and the placeholders are its `symbols`, so
+   unloadObj() needs no special treatment.  The names of the
+   placeholders (lazyNames) stay around until the ObjectCode is freed,
+   because they are the keys of the entries in `symhash` that other
+   ObjectCodes took over.
+
+   When a placeholder is looked up (loadSymbol) or is about to be
+   resolved (ocTryLoadBatch), ocLoadLazyMember reads the image, drops
+   the placeholders and loads the member like loadArchive_ would have,
+   before it becomes OBJECT_NEEDED as usual.
+
+   The archive symbol table doesn't say which symbols are weak, so the
+   placeholder of a symbol belongs to the first member that defines it.
+   A symbol must still resolve to the definition it would get if the
+   archives were read eagerly: a strong definition beats weak ones, and
+   otherwise the first one wins.  So when the member that
+   ocLoadLazyDefinition reads turns out to define the symbol weakly, it
+   also reads the other lazy members with a placeholder of that name, in
+   archive order, until one of them defines it strongly and takes the
+   entry over.  Only then is the entry looked up with
+   ghciLookupSymbolInfo, which makes it strong for good.  The first
+   member stays OBJECT_LOADED and is never resolved.  This search walks all lazy members, but only happens for
+   weak definitions.  Members of thin archives are loaded eagerly.
+
+   archive_member_counts tracks how many members were read, left lazy,
+   read on demand and skipped; +RTS -s reports them.
+*/
+
+static ObjectCode *mkLazyOc (pathchar *path, char *archiveMemberName,
+                             int memberSize, long imageOffset,
+                             ArchiveIndex *index, ArchiveIndexMember *member)
+{
+    ObjectCode *oc;
+    size_t namesSize = 0;
+    char *names;
+    uint32_t i;
+
+    oc = mkOc(path, NULL, memberSize, false, archiveMemberName, 0);
+
+    for (i = 0; i < member->n_symbols; i++) {
+        namesSize += strlen(index->strings
+                            + index->symbols[member->first_symbol + i]) + 1;
+    }
+
+    oc->symbols = stgMallocBytes(member->n_symbols * sizeof(Symbol_t),
+                                 "mkLazyOc");
+    oc->n_symbols = member->n_symbols;
+    names = oc->lazyNames = stgMallocBytes(namesSize, "mkLazyOc");
+
+    for (i = 0; i < member->n_symbols; i++) {
+        char *name = index->strings + index->symbols[member->first_symbol + i];
+        size_t len = strlen(name) + 1;
+
+        memcpy(names, name, len);
+        oc->symbols[i].name = names;
+        oc->symbols[i].addr = NULL;
+        /* as oc is OBJECT_LOADED, this can't find a duplicate */
+        ghciInsertSymbolTable(oc->fileName, symhash, names, NULL,
+                              HS_BOOL_FALSE, oc);
+        names += len;
+    }
+
+    oc->lazyImagePath = pathdup(path);
+    oc->lazyImageOffset = imageOffset;
+    archive_member_counts.lazy++;
+    return oc;
+}
+#endif /* USE_ARCHIVE_INDEX */
+
+/* Read the image of an archive member that mkLazyOc left out. */
+char *readLazyArchiveMember (ObjectCode *oc)
+{
+    char *image;
+    FILE *f;
+    int n;
+
+    image = stgMallocBytes(oc->fileSize, "readLazyArchiveMember");
+    f = pathopen(oc->lazyImagePath, WSTR("rb"));
+    if (!f) {
+        errorBelch("loadArchive: can't read `%" PATH_FMT "'",
+                   oc->lazyImagePath);
+        stgFree(image);
+        return NULL;
+    }
+    n = fseek(f, oc->lazyImageOffset, SEEK_SET);
+    if (n == 0) {
+        n = fread(image, 1, oc->fileSize, f) == (size_t)oc->fileSize ? 0 : -1;
+    }
+    fclose(f);
+    if (n != 0) {
+        errorBelch("loadArchive: error whilst reading `%s'",
+                   oc->archiveMemberName);
+        stgFree(image);
+        return NULL;
+    }
+    return image;
+}
+
 static HsInt loadArchive_ (pathchar *path)
 {
     ObjectCode* oc = NULL;
@@ -251,10 +365,16 @@ static HsInt loadArchive_ (pathchar *path)
     char *fileName;
     size_t fileNameSize;
     int isObject, isGnuIndex, isThin, isImportLib;
+    int isSymbolTable, isSymbolTable64, isLazy;
     char tmp[20];
     char *gnuFileIndex;
     int gnuFileIndexSize;
     int misalignment = 0;
+    long memberOffset;
+#if defined(USE_ARCHIVE_INDEX)
+    ArchiveIndex *index = NULL;
+    ArchiveIndexMember *member;
+#endif
 
     DEBUG_LOG("start\n");
     DEBUG_LOG("Loading archive `%" PATH_FMT "'\n", path);
@@ -276,6 +396,11 @@ static HsInt loadArchive_ (pathchar *path)
     isThin = 0;
     isImportLib = 0;
 
+#if defined(USE_ARCHIVE_INDEX)
+    /* See Note [Archive index cache] */
+    index = readCachedArchiveIndex(path);
+#endif
+
     f = pathopen(path, WSTR("rb"));
     if (!f)
         FAIL("loadObj: can't read `%" PATH_FMT "'", path);
@@ -330,7 +455,8 @@ static HsInt loadArchive_ (pathchar *path)
     DEBUG_LOG("loading archive contents\n");
 
     while (1) {
-        DEBUG_LOG("reading at %ld\n", ftell(f));
+        memberOffset = ftell(f);
+        DEBUG_LOG("reading at %ld\n", memberOffset);
         n = fread ( fileName, 1, 16, f );
         if (n != 16) {
             if (feof(f)) {
@@ -378,6 +504,8 @@ static HsInt loadArchive_ (pathchar *path)
                  path, ftell(f), tmp[0], tmp[1]);
 
         isGnuIndex = 0;
+        isSymbolTable = 0;
+        isSymbolTable64 = 0;
         /* Check for BSD-variant large filenames */
         if (0 == strncmp(fileName, "#1/", 3)) {
             size_t n = 0;
@@ -419,6 +547,15 @@ static HsInt loadArchive_ (pathchar *path)
             thisFileNameSize = 0;
             isGnuIndex = 1;
         }
+        /* Check for the 32-bit symbol table ("/" + 15 blank characters)
+           and the 64-bit symbol table ("/SYM64/" + 9 blank characters) */
+        else if (0 == strncmp(fileName, "/               ", 16) ||
+                 0 == strncmp(fileName, "/SYM64/         ", 16)) {
+            isSymbolTable64 = fileName[1] == 'S';
+            fileName[0] = '\0';
+            thisFileNameSize = 0;
+            isSymbolTable = 1;
+        }
         /* Check for a file in the GNU file index */
         else if (fileName[0] == '/') {
             if (!lookupGNUArchiveIndex(gnuFileIndexSize, &fileName,
@@ -478,9 +615,49 @@ static HsInt loadArchive_ (pathchar *path)
         isImportLib = thisFileNameSize >= 4 && strncmp(fileName + thisFileNameSize - 4, ".dll", 4) == 0;
 #endif // windows
 
+        isLazy = 0;
+#if defined(USE_ARCHIVE_INDEX)
+        member = isObject && index != NULL
+                     ? lookupArchiveIndex(index, memberOffset) : NULL;
+        /* A member that defines no symbols can never be demand-loaded.
+           See Note [Archive index cache] */
+        if (isObject && index != NULL && member == NULL) {
+            DEBUG_LOG("Member `%s' defines no symbols, skipping\n", fileName);
+            archive_member_counts.skipped++;
+            isObject = 0;
+        }
+        /* See Note [Lazy archive members] */
+        isLazy = member != NULL && !isThin
+                 && RtsFlags.MiscFlags.linkerLazyArchives;
+#endif
+
         DEBUG_LOG("\tthisFileNameSize = %d\n", (int)thisFileNameSize);
         DEBUG_LOG("\tisObject = %d\n", isObject);
 
+#if defined(USE_ARCHIVE_INDEX)
+        if (isLazy) {
+            char *archiveMemberName;
+
+            DEBUG_LOG("Member is an object file...indexing...\n");
+
+            archiveMemberName = stgMallocBytes(pathlen(path) + thisFileNameSize + 3,
+                                               "loadArchive(file)");
+            sprintf(archiveMemberName, "%" PATH_FMT "(%.*s)",
+                    path, (int)thisFileNameSize, fileName);
+
+            oc = mkLazyOc(path, archiveMemberName, memberSize, ftell(f),
+                          index, member);
+            stgFree(archiveMemberName);
+            oc->next = objects;
+            objects = oc;
+
+            n = fseek(f, memberSize, SEEK_CUR);
+            if (n != 0)
+                FAIL("error whilst seeking by %d in `%" PATH_FMT "'",
+                     memberSize, path);
+        }
+        else
+#endif
         if (isObject) {
             char *archiveMemberName;
 
@@ -531,12 +708,11 @@ static HsInt loadArchive_ (pathchar *path)
             stgFree(archiveMemberName);
 
             if (0 == loadOc(oc)) {
-                stgFree(fileName);
-                fclose(f);
-                return 0;
+                goto fail;
             } else {
                 oc->next = objects;
                 objects = oc;
+                archive_member_counts.loaded++;
             }
         }
         else if (isGnuIndex) {
@@ -557,6 +733,25 @@ while reading filename from `%" PATH_FMT "'", path);
             gnuFileIndex[memberSize] = '/';
             gnuFileIndexSize = memberSize;
         }
+#if defined(USE_ARCHIVE_INDEX)
+        else if (isSymbolTable && index == NULL) {
+            char *symtab;
+
+            DEBUG_LOG("Found symbol table\n");
+            symtab = stgMallocBytes(memberSize, "loadArchive(symtab)");
+            n = fread ( symtab, 1, memberSize, f );
+            if (n != memberSize) {
+                stgFree(symtab);
+                FAIL("error whilst reading `%" PATH_FMT "'", path);
+            }
+            index = readArchiveSymbolTable(path, symtab, memberSize,
+                                           isSymbolTable64);
+            stgFree(symtab);
+            if (index == NULL) {
+                DEBUG_LOG("malformed symbol table, loading every member\n");
+            }
+        }
+#endif
         else if (isImportLib) {
 #if defined(OBJFORMAT_PEi386)
             if (checkAndLoadImportLibrary(path, fileName, f)) {
@@ -615,6 +810,10 @@ fail:
         stgFree(gnuFileIndex);
 #endif
     }
+#if defined(USE_ARCHIVE_INDEX)
+    if (index != NULL)
+        freeArchiveIndex(index);
+#endif
 
     if (RTS_LINKER_USE_MMAP)
         m32_allocator_flush();
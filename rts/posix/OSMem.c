@@ -27,6 +27,7 @@
 #if defined(HAVE_STRING_H)
 #include <string.h>
 #endif
+#include <stdio.h>
 #if defined(HAVE_FCNTL_H)
 #include <fcntl.h>
 #endif
@@ -72,11 +73,32 @@
 # endif
 #endif
 
+/* See Note [Huge pages] */
+#if defined(linux_HOST_OS) && defined(USE_LARGE_ADDRESS_SPACE) \
+    && defined(MADV_HUGEPAGE) && defined(MAP_HUGETLB)
+# define USE_HUGE_PAGES 1
+# if !defined(MAP_HUGE_SHIFT)
+#  define MAP_HUGE_SHIFT 26
+# endif
+#endif
+
 static void *next_request = 0;
 
+#if defined(USE_HUGE_PAGES)
+static W_ huge_page_size = 0;  /* 0 unless --huge-pages */
+static bool hugetlb_ok;        /* MAP_HUGETLB hasn't failed yet */
+static W_ hugetlb_base;        /* the start of the heap */
+static StgWord8 *hugetlb_map;  /* a bit per huge page: backed by MAP_HUGETLB */
+static StgWord64 hugetlb_bytes;
+#endif
+
 void osMemInit(void)
 {
     next_request = (void *)RtsFlags.GcFlags.heapBase;
+#if defined(USE_HUGE_PAGES)
+    huge_page_size = RtsFlags.GcFlags.hugePageSize;
+    hugetlb_ok = true;
+#endif
 }
 
 /* -----------------------------------------------------------------------------
@@ -471,28 +493,136 @@ void setExecutable (void *p, W_ len, bool exec)
 
 #if defined(USE_LARGE_ADDRESS_SPACE)
 
+/*
+   Note [Huge pages]
+   ~~~~~~~~~~~~~~~~~
+   A large heap is mapped with 4k pages by default, and the GC, which
+   touches all of it, can spend a good part of its time in TLB misses.
+   With +RTS --huge-pages[=<size>] we back the heap with huge pages
+   (2MB by default) instead:
+
+     - osReserveHeapMemory aligns the reserved address space, and rounds
+       its size down, to the huge page size, so that every huge page of
+       the heap is a huge page of the address space.
+
+     - osCommitMemory maps each huge page that it commits in full with
+       MAP_HUGETLB.  This only works if the administrator has set aside
+       huge pages (vm.nr_hugepages); the first time it fails we give up
+       on MAP_HUGETLB.  Everything else is committed as usual and
+       madvise()d with MADV_HUGEPAGE, so that the kernel can still back
+       it with transparent huge pages (2MB only) if they are enabled.
+
+   A MAP_HUGETLB page can't be partly unmapped or decommitted, so we
+   remember which huge pages have one in hugetlb_map and never decommit
+   them: committing them again is a no-op, and their memory goes back to
+   the system when the heap is released.  osCanDecommit tells
+   returnMemoryToOS to leave the megablocks in them with the block
+   allocator, so that they still count as memory in use rather than as
+   returned to the OS.
+
+   Stats.c reports how much of the heap ended up in huge pages of either
+   kind; we find the transparent ones in /proc/self/smaps.
+*/
+
+#if defined(USE_HUGE_PAGES)
+
+/* The alignment of the heap */
+static W_ heapAlignment (void)
+{
+    return huge_page_size != 0 ? huge_page_size : MBLOCK_SIZE;
+}
+
+static bool isHugeTLBPage (W_ page)
+{
+    W_ i = (page - hugetlb_base) / huge_page_size;
+    return hugetlb_map != NULL && (hugetlb_map[i / 8] & (1 << (i % 8)));
+}
+
+/* Try to back a huge page of the heap with MAP_HUGETLB */
+static bool mapHugeTLBPage (W_ page)
+{
+    W_ i = (page - hugetlb_base) / huge_page_size;
+    void *r;
+
+    if (!hugetlb_ok) {
+        return false;
+    }
+    r = mmap((void *)page, huge_page_size, PROT_READ | PROT_WRITE,
+             MAP_FIXED | MAP_ANON | MAP_PRIVATE | MAP_HUGETLB
+             | ((W_)__builtin_ctzl(huge_page_size) << MAP_HUGE_SHIFT),
+             -1, 0);
+    if (r == MAP_FAILED) {
+        IF_DEBUG(gc, debugBelch("MAP_HUGETLB failed (%s), using "
+                                "transparent huge pages\n", strerror(errno)));
+        hugetlb_ok = false;
+        return false;
+    }
+    hugetlb_map[i / 8] |= 1 << (i % 8);
+    hugetlb_bytes += huge_page_size;
+    return true;
+}
+
+/* Is any of the memory from at to at+size backed by MAP_HUGETLB? */
+static bool anyHugeTLBPage (W_ at, W_ size)
+{
+    W_ page;
+
+    if (hugetlb_bytes == 0) {
+        return false;
+    }
+    for (page = at & ~(huge_page_size - 1); page < at + size;
+         page += huge_page_size) {
+        if (isHugeTLBPage(page)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void commitSmallPages (W_ at, W_ size)
+{
+    if (size == 0) {
+        return;
+    }
+    if (my_mmap((void *)at, size, MEM_COMMIT) == NULL) {
+        barf("Unable to commit %" FMT_Word " bytes of memory", size);
+    }
+    // fails harmlessly if transparent huge pages are disabled
+    madvise((void *)at, size, MADV_HUGEPAGE);
+}
+
+#else
+
+static W_ heapAlignment (void)
+{
+    return MBLOCK_SIZE;
+}
+
+#endif /* USE_HUGE_PAGES */
+
 static void *
 osTryReserveHeapMemory (W_ len, void *hint)
 {
     void *base, *top;
     void *start, *end;
+    W_ align = heapAlignment();
 
-    ASSERT((len & ~MBLOCK_MASK) == len);
+    ASSERT((len & ~(align - 1)) == len);
 
-    /* We try to allocate len + MBLOCK_SIZE,
-       because we need memory which is MBLOCK_SIZE aligned,
+    /* We try to allocate len + align,
+       because we need memory which is MBLOCK_SIZE aligned (or huge page
+       aligned, see Note [Huge pages]),
        and then we discard what we don't need */
 
-    base = my_mmap(hint, len + MBLOCK_SIZE, MEM_RESERVE);
+    base = my_mmap(hint, len + align, MEM_RESERVE);
     if (base == NULL)
         return NULL;
 
-    top = (void*)((W_)base + len + MBLOCK_SIZE);
+    top = (void*)((W_)base + len + align);
 
-    if (((W_)base & MBLOCK_MASK) != 0) {
-        start = MBLOCK_ROUND_UP(base);
-        end = MBLOCK_ROUND_DOWN(top);
-        ASSERT(((W_)end - (W_)start) == len);
+    if (((W_)base & (align - 1)) != 0) {
+        start = (void*)(((W_)base + align - 1) & ~(align - 1));
+        end = (void*)((W_)start + len);
 
         if (munmap(base, (W_)start-(W_)base) < 0) {
             sysErrorBelch("unable to release slop before heap");
@@ -555,7 +685,7 @@ void *osReserveHeapMemory(void *startAddressPtr, W_ *len)
 
     attempt = 0;
     while (1) {
-        *len &= ~MBLOCK_MASK;
+        *len &= ~(heapAlignment() - 1);
 
         if (*len < MBLOCK_SIZE) {
             // Give up if the system won't even give us 16 blocks worth of heap
@@ -589,21 +719,67 @@ void *osReserveHeapMemory(void *startAddressPtr, W_ *len)
         attempt++;
     }
 
+#if defined(USE_HUGE_PAGES)
+    if (huge_page_size != 0) {
+        hugetlb_base = (W_)at;
+        hugetlb_map = stgCallocBytes(*len / huge_page_size / 8 + 1, 1,
+                                     "osReserveHeapMemory");
+    }
+#endif
+
     return at;
 }
 
 void osCommitMemory(void *at, W_ size)
 {
+#if defined(USE_HUGE_PAGES)
+    if (huge_page_size != 0) {
+        // See Note [Huge pages]
+        W_ p = (W_)at, end = p + size;
+        W_ run = p;   // the start of the pages to commit as usual
+
+        while (p < end) {
+            W_ page = p & ~(huge_page_size - 1);
+            W_ next = stg_min(page + huge_page_size, end);
+
+            if (isHugeTLBPage(page)
+                || (p == page && next == page + huge_page_size
+                    && mapHugeTLBPage(page))) {
+                commitSmallPages(run, p - run);
+                run = next;
+            }
+            p = next;
+        }
+        commitSmallPages(run, end - run);
+        return;
+    }
+#endif
+
     void *r = my_mmap(at, size, MEM_COMMIT);
     if (r == NULL) {
         barf("Unable to commit %" FMT_Word " bytes of memory", size);
     }
 }
 
-void osDecommitMemory(void *at, W_ size)
+W_ osCommitGranularity(void)
+{
+#if defined(USE_HUGE_PAGES)
+    // only MAP_HUGETLB cares: the kernel can put a transparent huge page
+    // in any 2MB of memory that we commit
+    return hugetlb_ok ? huge_page_size : 0;
+#else
+    return 0;
+#endif
+}
+
+static void decommitPages(void *at, W_ size)
 {
     int r;
 
+    if (size == 0) {
+        return;
+    }
+
     // First make the memory unaccessible (so that we get a segfault
     // at the next attempt to touch it)
     // We only do this in DEBUG because it forces the OS to remove
@@ -639,6 +815,32 @@ void osDecommitMemory(void *at, W_ size)
         sysErrorBelch("unable to decommit memory");
 }
 
+void osDecommitMemory(void *at, W_ size)
+{
+#if defined(USE_HUGE_PAGES)
+    if (hugetlb_bytes != 0) {
+        // MAP_HUGETLB pages stay committed, see Note [Huge pages]
+        W_ p = (W_)at, end = p + size;
+        W_ run = p;
+
+        while (p < end) {
+            W_ page = p & ~(huge_page_size - 1);
+            W_ next = stg_min(page + huge_page_size, end);
+
+            if (isHugeTLBPage(page)) {
+                decommitPages((void *)run, p - run);
+                run = next;
+            }
+            p = next;
+        }
+        decommitPages((void *)run, end - run);
+        return;
+    }
+#endif
+
+    decommitPages(at, size);
+}
+
 void osReleaseHeapMemory(void)
 {
     int r;
@@ -647,10 +849,110 @@ void osReleaseHeapMemory(void)
                mblock_address_space.end - mblock_address_space.begin);
     if(r < 0)
         sysErrorBelch("unable to release address space");
+
+#if defined(USE_HUGE_PAGES)
+    if (hugetlb_map != NULL) {
+        stgFree(hugetlb_map);
+        hugetlb_map = NULL;
+    }
+#endif
 }
 
 #endif
 
+#if defined(USE_HUGE_PAGES)
+bool osCanDecommit(void *at, W_ size)
+{
+    return !anyHugeTLBPage((W_)at, size);
+}
+#else
+bool osCanDecommit(void *at STG_UNUSED, W_ size STG_UNUSED)
+{
+    return true;
+}
+#endif
+
+bool osBuiltWithHugePageSupport(void)
+{
+#if defined(USE_HUGE_PAGES)
+    return true;
+#else
+    return false;
+#endif
+}
+
+void osHugePageBytes(StgWord64 *hugetlb, StgWord64 *transparent)
+{
+    *hugetlb = 0;
+    *transparent = 0;
+
+#if defined(USE_HUGE_PAGES)
+    FILE *f;
+    char line[256];
+    bool in_heap = false;
+
+    if (huge_page_size == 0) {
+        return;
+    }
+    *hugetlb = hugetlb_bytes;
+
+    // Sum the AnonHugePages of the mappings in the heap
+    f = fopen("/proc/self/smaps", "r");
+    if (f == NULL) {
+        return;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        unsigned long start, end, kb;
+        if (sscanf(line, "%lx-%lx", &start, &end) == 2) {
+            in_heap = start < mblock_address_space.end
+                   && end > mblock_address_space.begin;
+        } else if (in_heap
+                   && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+            *transparent += (StgWord64)kb * 1024;
+        }
+    }
+    fclose(f);
+#endif
+}
+
+void osUnmapFile(void *at, W_ size)
+{
+    // Not my_mmap(MEM_COMMIT): on Darwin that only changes the protection
+    void *r = mmap(at, size, PROT_READ | PROT_WRITE,
+                   MAP_FIXED | MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (r == MAP_FAILED) {
+        barf("Unable to unmap %" FMT_Word " bytes of a file", size);
+    }
+}
+
+bool osMapFile(void *at, W_ size, int fd, StgWord64 offset)
+{
+    W_ page_mask = getPageSize() - 1;
+    void *r;
+
+    if (((W_)at & page_mask) != 0 || (size & page_mask) != 0
+        || (offset & page_mask) != 0) {
+        return false;
+    }
+
+#if defined(USE_HUGE_PAGES)
+    // A MAP_HUGETLB page can't be partly replaced
+    if (anyHugeTLBPage((W_)at, size)) {
+        return false;
+    }
+#endif
+
+    r = mmap(at, size, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_PRIVATE,
+             fd, (off_t)offset);
+    if (r == MAP_FAILED) {
+        // A failed MAP_FIXED mapping may have unmapped the memory
+        // already, so put it back before the caller falls back to read()
+        osUnmapFile(at, size);
+        return false;
+    }
+    return true;
+}
+
 bool osBuiltWithNumaSupport(void)
 {
 #if HAVE_LIBNUMA
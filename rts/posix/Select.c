@@ -7,6 +7,8 @@
  * all, instead we use the IO manager thread implemented in Haskell in
  * the base package.
  *
+ * The waiting itself is done by one of the backends in posix/await/.
+ *
  * ---------------------------------------------------------------------------*/
 
 #include "PosixSource.h"
@@ -115,17 +117,8 @@ static bool wakeUpSleepingThreads (LowResTime now)
     return flag;
 }
 
-static void GNUC3_ATTRIBUTE(__noreturn__)
-fdOutOfRange (int fd)
-{
-    errorBelch("file descriptor %d out of range for select (0--%d).\n"
-               "Recompile with -threaded to work around this.",
-               fd, (int)FD_SETSIZE);
-    stg_exit(EXIT_FAILURE);
-}
-
 /*
- * State of individual file descriptor after a 'select()' poll.
+ * State of individual file descriptor after polling it for events.
  */
 enum FdState {
     RTS_FD_IS_READY = 0,
@@ -133,75 +126,144 @@ enum FdState {
     RTS_FD_IS_INVALID,
 };
 
-static enum FdState fdPollReadState (int fd)
+/*
+ * Called by a backend when its wait for I/O was interrupted by a
+ * signal.  Returns true if awaitEvent() should return to the scheduler
+ * immediately, false if the backend should resume waiting.
+ */
+static bool awaitInterrupted (void)
 {
-    int r;
-    fd_set rfd;
-    struct timeval now;
-
-    FD_ZERO(&rfd);
-    FD_SET(fd, &rfd);
-
-    /* only poll */
-    now.tv_sec  = 0;
-    now.tv_usec = 0;
-    for (;;)
-    {
-        r = select(fd+1, &rfd, NULL, NULL, &now);
-        /* the descriptor is sane */
-        if (r != -1)
-            break;
+    /* We got a signal; could be one of ours.  If so, we need
+     * to start up the signal handler straight away, otherwise
+     * we could block for a long time before the signal is
+     * serviced.
+     */
+#if defined(RTS_USER_SIGNALS)
+    if (RtsFlags.MiscFlags.install_signal_handlers && signals_pending()) {
+        startSignalHandlers(&MainCapability);
+        return true; /* still hold the lock */
+    }
+#endif
 
-        switch (errno)
-        {
-            case EBADF: return RTS_FD_IS_INVALID;
-            case EINTR: continue;
-            default:
-                sysErrorBelch("select");
-                stg_exit(EXIT_FAILURE);
-        }
+    /* we were interrupted, return to the scheduler immediately.
+     */
+    if (sched_state >= SCHED_INTERRUPTING) {
+        return true; /* still hold the lock */
+    }
+
+    /* check for threads that need waking up
+     */
+    wakeUpSleepingThreads(getLowResTimeOfDay());
+
+    /* If new runnable threads have arrived, stop waiting for
+     * I/O and run them.
+     */
+    if (!emptyRunQueue(&MainCapability)) {
+        return true; /* still hold the lock */
     }
 
-    if (r == 0)
-        return RTS_FD_IS_BLOCKING;
-    else
-        return RTS_FD_IS_READY;
+    return false;
 }
 
-static enum FdState fdPollWriteState (int fd)
+/*
+ * Step through the blocked queue, unblocking every thread whose file
+ * descriptor is now in a ready state according to 'fdState', and
+ * raising an exception in the threads blocked on an invalid one.
+ */
+static void wakeUpBlockedThreads (enum FdState (*fdState)(StgTSO *tso))
 {
-    int r;
-    fd_set wfd;
-    struct timeval now;
-
-    FD_ZERO(&wfd);
-    FD_SET(fd, &wfd);
-
-    /* only poll */
-    now.tv_sec  = 0;
-    now.tv_usec = 0;
-    for (;;)
-    {
-        r = select(fd+1, NULL, &wfd, NULL, &now);
-        /* the descriptor is sane */
-        if (r != -1)
-            break;
+    StgTSO *tso, *prev, *next;
+
+    prev = NULL;
+    /*
+     * The queue is being rebuilt in this loop:
+     * 'blocked_queue_hd' will contain already
+     * traversed blocked TSOs. As a result you
+     * can't use functions accessing 'blocked_queue_hd'.
+     */
+    for(tso = blocked_queue_hd; tso != END_TSO_QUEUE; tso = next) {
+        next = tso->_link;
 
-        switch (errno)
-        {
-            case EBADF: return RTS_FD_IS_INVALID;
-            case EINTR: continue;
-            default:
-                sysErrorBelch("select");
-                stg_exit(EXIT_FAILURE);
+        switch (fdState(tso)) {
+        case RTS_FD_IS_INVALID:
+            /*
+             * Don't let RTS loop on such descriptors,
+             * pass an IOError to blocked threads (#4934)
+             */
+            IF_DEBUG(scheduler,
+                debugBelch("Killing blocked thread %lu on bad fd=%i\n",
+                           (unsigned long)tso->id,
+                           (int)tso->block_info.fd));
+            raiseAsync(&MainCapability, tso,
+                (StgClosure *)blockedOnBadFD_closure, false, NULL);
+            break;
+        case RTS_FD_IS_READY:
+            IF_DEBUG(scheduler,
+                debugBelch("Waking up blocked thread %lu\n",
+                           (unsigned long)tso->id));
+            tso->why_blocked = NotBlocked;
+            tso->_link = END_TSO_QUEUE;
+            pushOnRunQueue(&MainCapability,tso);
+            break;
+        case RTS_FD_IS_BLOCKING:
+            if (prev == NULL)
+                blocked_queue_hd = tso;
+            else
+                setTSOLink(&MainCapability, prev, tso);
+            prev = tso;
+            break;
         }
     }
 
-    if (r == 0)
-        return RTS_FD_IS_BLOCKING;
-    else
-        return RTS_FD_IS_READY;
+    if (prev == NULL)
+        blocked_queue_hd = blocked_queue_tl = END_TSO_QUEUE;
+    else {
+        prev->_link = END_TSO_QUEUE;
+        blocked_queue_tl = prev;
+    }
+}
+
+/*
+ * The I/O backends.  Each one provides a function
+ *
+ *     static bool xxxAwaitIO (Time timeout);
+ *
+ * that waits for at most 'timeout' (forever if 'timeout' is negative)
+ * for I/O on the threads in the blocked queue, wakes up those that
+ * became ready, and returns true if awaitEvent() should return to the
+ * scheduler straight away.
+ *
+ * select() is always available and is used as a fallback, but it is
+ * limited to FD_SETSIZE descriptors and costs O(blocked threads +
+ * largest fd) per call.  On Linux we prefer epoll, which keeps the
+ * registrations in the kernel between calls, moves each blocked thread
+ * onto a list for its descriptor once, and wakes only the threads whose
+ * descriptors epoll_wait() returns; the threads on those lists are
+ * counted by n_awaiting_io.
+ */
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+#define USE_EPOLL_FOR_AWAIT_EVENT
+#endif
+
+uint32_t n_awaiting_io = 0;
+
+#include "await/Select.c"
+#if defined(USE_EPOLL_FOR_AWAIT_EVENT)
+#include "await/Epoll.c"
+#else
+void resetAwaitEvent (void)
+{
+}
+
+void markAwaitEvent (evac_fn evac STG_UNUSED, void *user STG_UNUSED)
+{
+}
+
+void removeAwaitingIO (StgTSO *tso STG_UNUSED)
+{
+    barf("removeAwaitingIO");
 }
+#endif
 
 /* Argument 'wait' says whether to wait for I/O to become available,
  * or whether to just check and return immediately.  If there are
@@ -219,13 +281,9 @@ static enum FdState fdPollWriteState (int fd)
 void
 awaitEvent(bool wait)
 {
-    StgTSO *tso, *prev, *next;
-    fd_set rfd,wfd;
-    int numFound;
-    int maxfd = -1;
-    bool seen_bad_fd = false;
-    struct timeval tv, *ptv;
+    Time timeout;
     LowResTime now;
+    bool (*awaitIO)(Time timeout);
 
     IF_DEBUG(scheduler,
              debugBelch("scheduler: checking for threads blocked on I/O");
@@ -235,6 +293,12 @@ awaitEvent(bool wait)
              debugBelch("\n");
              );
 
+#if defined(USE_EPOLL_FOR_AWAIT_EVENT)
+    awaitIO = epollAvailable() ? epollAwaitIO : selectAwaitIO;
+#else
+    awaitIO = selectAwaitIO;
+#endif
+
     /* loop until we've woken up some threads.  This loop is needed
      * because the select timing isn't accurate, we sometimes sleep
      * for a while but not long enough to wake up a thread in
@@ -247,57 +311,9 @@ awaitEvent(bool wait)
           return;
       }
 
-      /*
-       * Collect all of the fd's that we're interested in
-       */
-      FD_ZERO(&rfd);
-      FD_ZERO(&wfd);
-
-      for(tso = blocked_queue_hd; tso != END_TSO_QUEUE; tso = next) {
-        next = tso->_link;
-
-      /* On older FreeBSDs, FD_SETSIZE is unsigned. Cast it to signed int
-       * in order to switch off the 'comparison between signed and
-       * unsigned error message
-       * Newer versions of FreeBSD have switched to unsigned int:
-       *   https://github.com/freebsd/freebsd/commit/12ae7f74a071f0439763986026525094a7032dfd
-       *   http://fa.freebsd.cvs-all.narkive.com/bCWNHbaC/svn-commit-r265051-head-sys-sys
-       * So the (int) cast should be removed across the code base once
-       * GHC requires a version of FreeBSD that has that change in it.
-       */
-        switch (tso->why_blocked) {
-        case BlockedOnRead:
-          {
-            int fd = tso->block_info.fd;
-            if ((fd >= (int)FD_SETSIZE) || (fd < 0)) {
-                fdOutOfRange(fd);
-            }
-            maxfd = (fd > maxfd) ? fd : maxfd;
-            FD_SET(fd, &rfd);
-            continue;
-          }
-
-        case BlockedOnWrite:
-          {
-            int fd = tso->block_info.fd;
-            if ((fd >= (int)FD_SETSIZE) || (fd < 0)) {
-                fdOutOfRange(fd);
-            }
-            maxfd = (fd > maxfd) ? fd : maxfd;
-            FD_SET(fd, &wfd);
-            continue;
-          }
-
-        default:
-          barf("AwaitEvent");
-        }
-      }
-
       if (!wait) {
           // just poll
-          tv.tv_sec  = 0;
-          tv.tv_usec = 0;
-          ptv = &tv;
+          timeout = 0;
       } else if (sleeping_queue != END_TSO_QUEUE) {
           /* SUSv2 allows implementations to have an implementation defined
            * maximum timeout for select(2). The standard requires
@@ -315,140 +331,19 @@ awaitEvent(bool wait)
            * thread still wants to be blocked longer and simply block on a new
            * iteration of select(2).
            */
-          const time_t max_seconds = 2678400; // 31 * 24 * 60 * 60
-
-          Time min = LowResTimeToTime(sleeping_queue->block_info.target - now);
-          tv.tv_sec  = TimeToSeconds(min);
-          if (tv.tv_sec < max_seconds) {
-              tv.tv_usec = TimeToUS(min) % 1000000;
-          } else {
-              tv.tv_sec = max_seconds;
-              tv.tv_usec = 0;
+          const Time max_timeout = SecondsToTime(2678400); // 31 days
+
+          timeout = LowResTimeToTime(sleeping_queue->block_info.target - now);
+          if (timeout > max_timeout) {
+              timeout = max_timeout;
           }
-          ptv = &tv;
       } else {
-          ptv = NULL;
+          timeout = -1;
       }
 
       /* Check for any interesting events */
-
-      while ((numFound = select(maxfd+1, &rfd, &wfd, NULL, ptv)) < 0) {
-          if (errno != EINTR) {
-            if ( errno == EBADF ) {
-                seen_bad_fd = true;
-                break;
-            } else {
-                sysErrorBelch("select");
-                stg_exit(EXIT_FAILURE);
-            }
-          }
-
-          /* We got a signal; could be one of ours.  If so, we need
-           * to start up the signal handler straight away, otherwise
-           * we could block for a long time before the signal is
-           * serviced.
-           */
-#if defined(RTS_USER_SIGNALS)
-          if (RtsFlags.MiscFlags.install_signal_handlers && signals_pending()) {
-              startSignalHandlers(&MainCapability);
-              return; /* still hold the lock */
-          }
-#endif
-
-          /* we were interrupted, return to the scheduler immediately.
-           */
-          if (sched_state >= SCHED_INTERRUPTING) {
-              return; /* still hold the lock */
-          }
-
-          /* check for threads that need waking up
-           */
-          wakeUpSleepingThreads(getLowResTimeOfDay());
-
-          /* If new runnable threads have arrived, stop waiting for
-           * I/O and run them.
-           */
-          if (!emptyRunQueue(&MainCapability)) {
-              return; /* still hold the lock */
-          }
-      }
-
-      /* Step through the waiting queue, unblocking every thread that now has
-       * a file descriptor in a ready state.
-       */
-
-      prev = NULL;
-      {
-          /*
-           * The queue is being rebuilt in this loop:
-           * 'blocked_queue_hd' will contain already
-           * traversed blocked TSOs. As a result you
-           * can't use functions accessing 'blocked_queue_hd'.
-           */
-          for(tso = blocked_queue_hd; tso != END_TSO_QUEUE; tso = next) {
-              next = tso->_link;
-              int fd;
-              enum FdState fd_state = RTS_FD_IS_BLOCKING;
-
-              switch (tso->why_blocked) {
-              case BlockedOnRead:
-                  fd = tso->block_info.fd;
-
-                  if (seen_bad_fd) {
-                      fd_state = fdPollReadState (fd);
-                  } else if (FD_ISSET(fd, &rfd)) {
-                      fd_state = RTS_FD_IS_READY;
-                  }
-                  break;
-              case BlockedOnWrite:
-                  fd = tso->block_info.fd;
-
-                  if (seen_bad_fd) {
-                      fd_state = fdPollWriteState (fd);
-                  } else if (FD_ISSET(fd, &wfd)) {
-                      fd_state = RTS_FD_IS_READY;
-                  }
-                  break;
-              default:
-                  barf("awaitEvent");
-              }
-
-              switch (fd_state) {
-              case RTS_FD_IS_INVALID:
-                  /*
-                   * Don't let RTS loop on such descriptors,
-                   * pass an IOError to blocked threads (#4934)
-                   */
-                  IF_DEBUG(scheduler,
-                      debugBelch("Killing blocked thread %lu on bad fd=%i\n",
-                                 (unsigned long)tso->id, fd));
-                  raiseAsync(&MainCapability, tso,
-                      (StgClosure *)blockedOnBadFD_closure, false, NULL);
-                  break;
-              case RTS_FD_IS_READY:
-                  IF_DEBUG(scheduler,
-                      debugBelch("Waking up blocked thread %lu\n",
-                                 (unsigned long)tso->id));
-                  tso->why_blocked = NotBlocked;
-                  tso->_link = END_TSO_QUEUE;
-                  pushOnRunQueue(&MainCapability,tso);
-                  break;
-              case RTS_FD_IS_BLOCKING:
-                  if (prev == NULL)
-                      blocked_queue_hd = tso;
-                  else
-                      setTSOLink(&MainCapability, prev, tso);
-                  prev = tso;
-                  break;
-              }
-          }
-
-          if (prev == NULL)
-              blocked_queue_hd = blocked_queue_tl = END_TSO_QUEUE;
-          else {
-              prev->_link = END_TSO_QUEUE;
-              blocked_queue_tl = prev;
-          }
+      if (awaitIO(timeout)) {
+          return; /* still hold the lock */
       }
 
     } while (wait && sched_state == SCHED_RUNNING
@@ -0,0 +1,538 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2019
+ *
+ * epoll()-based I/O backend for awaitEvent() in the non-threaded RTS.
+ * This file is #included into posix/Select.c.
+ *
+ * Unlike select(), the set of descriptors we are interested in lives in
+ * the kernel and persists between calls, and so do the threads waiting
+ * for them.  waitRead#/waitWrite# put a thread on blocked_queue as
+ * usual; the next call of epollAwaitIO() takes it off again, puts it on
+ * the list of waiters of its descriptor (linked through tso->_link) and
+ * marks it with TSO_IO_REGISTERED.  A descriptor is registered with
+ * epoll when it gets its first waiter for an event, and the events that
+ * epoll_wait() reports wake up the waiters of just those descriptors.
+ * So a call costs time in proportion to the threads that blocked since
+ * the last one and to the ready descriptors, not to all blocked threads.
+ *
+ * The lists of waiters are roots for the GC (markAwaitEvent), threads
+ * that get an exception are taken off them by removeAwaitingIO, and
+ * n_awaiting_io counts the threads on them, so that the scheduler still
+ * knows that there are threads blocked on I/O.
+ *
+ * Registrations are level-triggered.  Events we are no longer
+ * interested in are dropped lazily: when epoll reports an event that no
+ * thread is waiting for, we shrink or delete the registration.
+ *
+ * A descriptor can also be closed by another Haskell thread while a
+ * thread is blocked on it.  The kernel then drops the registration
+ * without telling us, and the blocked thread would wait forever, where
+ * select() fails with EBADF and we raise blockedOnBadFD (#4934).  So
+ * when we are about to go to sleep we check that the registrations
+ * still exist (epollRevalidate): a descriptor that has been closed gets
+ * the same exception as with select(), and one that has been closed and
+ * reused is registered again.  Each call checks at most
+ * EPOLL_CHECK_PER_CALL descriptors, taking turns, and while that doesn't
+ * cover all of them we sleep for at most EPOLL_CHECK_INTERVAL, so that
+ * the cost of the check is bounded and a closed descriptor is still
+ * noticed eventually.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <limits.h>
+
+#define EPOLL_FD_READ  1
+#define EPOLL_FD_WRITE 2
+#define EPOLL_FD_BAD   4
+
+/* Maximum number of events we retrieve with one epoll_wait().  Any
+ * remaining ones are reported again by the next call, because the
+ * registrations are level-triggered. */
+#define EPOLL_MAX_EVENTS 1024
+
+/* How many descriptors epollRevalidate() checks per call, and how long
+ * we sleep at most while that doesn't cover all of them. */
+#define EPOLL_CHECK_PER_CALL 64
+#define EPOLL_CHECK_INTERVAL MSToTime(100)
+
+/* What we know about a file descriptor. */
+typedef struct {
+    StgTSO   *waiters;     // threads blocked on it, linked by _link
+    uint32_t  n_read;      // how many of them wait to read
+    uint32_t  n_write;     // how many of them wait to write
+    uint32_t  active;      // index in epoll_active, if it has waiters
+    uint8_t   registered;  // events registered with epoll_fd
+} EpollFd;
+
+static int epoll_fd = -1;
+static bool epoll_failed = false;
+
+/* Indexed by file descriptor, grown on demand */
+static EpollFd *epoll_fds = NULL;
+static uint32_t epoll_fds_size = 0;
+
+/* The descriptors that have waiters, in no particular order */
+static int *epoll_active = NULL;
+static uint32_t epoll_n_active = 0;
+static uint32_t epoll_active_size = 0;
+
+/* Where epollRevalidate() carries on in epoll_active */
+static uint32_t epoll_check_next = 0;
+
+static struct epoll_event epoll_events[EPOLL_MAX_EVENTS];
+
+static uint32_t toEpollEvents (uint8_t events)
+{
+    return ((events & EPOLL_FD_READ)  ? EPOLLIN  : 0)
+         | ((events & EPOLL_FD_WRITE) ? EPOLLOUT : 0);
+}
+
+static uint8_t fromEpollEvents (uint32_t events)
+{
+    uint8_t r = 0;
+    // As with select(), an error or hangup makes the descriptor ready
+    // in both directions: the next read or write will report it.
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        r |= EPOLL_FD_READ;
+    }
+    if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+        r |= EPOLL_FD_WRITE;
+    }
+    return r;
+}
+
+static uint8_t blockedEvent (StgTSO *tso)
+{
+    switch (tso->why_blocked) {
+    case BlockedOnRead:
+        return EPOLL_FD_READ;
+    case BlockedOnWrite:
+        return EPOLL_FD_WRITE;
+    default:
+        barf("awaitEvent");
+    }
+}
+
+static uint8_t wantedEvents (EpollFd *info)
+{
+    return (info->n_read  > 0 ? EPOLL_FD_READ  : 0)
+         | (info->n_write > 0 ? EPOLL_FD_WRITE : 0);
+}
+
+static bool epollAvailable (void)
+{
+    if (epoll_fd >= 0) {
+        return true;
+    }
+    if (epoll_failed) {
+        return false;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        IF_DEBUG(scheduler,
+                 debugBelch("epoll_create1 failed (%s), using select()\n",
+                            strerror(errno)));
+        epoll_failed = true;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Called in the child of forkProcess#: the epoll instance is shared with
+ * the parent, so drop it and start afresh with the next awaitEvent().
+ * forkProcess# has killed all the other threads, so there are no
+ * waiters left.
+ */
+void resetAwaitEvent (void)
+{
+    uint32_t i;
+
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+    for (i = 0; i < epoll_fds_size; i++) {
+        epoll_fds[i].registered = 0;
+    }
+}
+
+static EpollFd *epollFd (int fd)
+{
+    if ((uint32_t)fd >= epoll_fds_size) {
+        uint32_t old_size = epoll_fds_size;
+        uint32_t new_size = old_size == 0 ? 1024 : old_size;
+        uint32_t i;
+
+        while (new_size <= (uint32_t)fd) {
+            new_size *= 2;
+        }
+        epoll_fds = stgReallocBytes(epoll_fds, new_size * sizeof(EpollFd),
+                                    "epollFd");
+        memset(&epoll_fds[old_size], 0,
+               (new_size - old_size) * sizeof(EpollFd));
+        for (i = old_size; i < new_size; i++) {
+            epoll_fds[i].waiters = END_TSO_QUEUE;
+        }
+        epoll_fds_size = new_size;
+    }
+    return &epoll_fds[fd];
+}
+
+/*
+ * Make the registration of 'fd' with epoll_fd cover 'events'.  Returns
+ * the events that are ready straight away: EPOLL_FD_BAD if the
+ * descriptor is invalid, both directions if it is a kind of file that
+ * epoll does not support (regular files and directories, which are
+ * always ready as far as select() is concerned), and none otherwise.
+ */
+static uint8_t epollRegister (int fd, EpollFd *info, uint8_t events)
+{
+    struct epoll_event ev;
+    int op, r;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events  = toEpollEvents(info->registered | events);
+    ev.data.fd = fd;
+
+    op = info->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    r = epoll_ctl(epoll_fd, op, fd, &ev);
+    if (r < 0 && errno == ENOENT) {
+        // closed and reopened since we registered it
+        r = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    } else if (r < 0 && errno == EEXIST) {
+        // we don't know about a registration: it survived a close()
+        // because the descriptor was dup()ed
+        r = epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+    }
+
+    if (r == 0) {
+        info->registered |= events;
+        return 0;
+    }
+
+    info->registered = 0;
+
+    switch (errno) {
+    case EPERM:
+        return EPOLL_FD_READ | EPOLL_FD_WRITE;
+    case EBADF:
+        return EPOLL_FD_BAD;
+    default:
+        sysErrorBelch("epoll_ctl");
+        stg_exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Drop the events from the registration of 'fd' that no blocked thread
+ * is waiting for any more.
+ */
+static void epollUnregisterUnwanted (int fd, EpollFd *info)
+{
+    uint8_t wanted;
+    struct epoll_event ev;
+    int r;
+
+    wanted = wantedEvents(info);
+    if ((info->registered & ~wanted) == 0) {
+        return;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    if (wanted == 0) {
+        r = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+    } else {
+        ev.events  = toEpollEvents(wanted);
+        ev.data.fd = fd;
+        r = epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+    }
+    // ENOENT/EBADF: the descriptor was closed, which removed it from
+    // the epoll set anyway.
+    if (r < 0 && errno != ENOENT && errno != EBADF) {
+        sysErrorBelch("epoll_ctl");
+        stg_exit(EXIT_FAILURE);
+    }
+    info->registered = r < 0 ? 0 : wanted;
+}
+
+static void addWaiter (int fd, EpollFd *info, StgTSO *tso)
+{
+    if (info->waiters == END_TSO_QUEUE) {
+        if (epoll_n_active == epoll_active_size) {
+            epoll_active_size = epoll_active_size == 0
+                ? 64 : epoll_active_size * 2;
+            epoll_active = stgReallocBytes(epoll_active,
+                                           epoll_active_size * sizeof(int),
+                                           "addWaiter");
+        }
+        info->active = epoll_n_active;
+        epoll_active[epoll_n_active++] = fd;
+    }
+
+    setTSOLink(&MainCapability, tso, info->waiters);
+    info->waiters = tso;
+    if (blockedEvent(tso) == EPOLL_FD_READ) {
+        info->n_read++;
+    } else {
+        info->n_write++;
+    }
+    tso->flags |= TSO_IO_REGISTERED;
+    n_awaiting_io++;
+}
+
+/* Unlink 'tso', which follows 'prev' (NULL if it is the first) */
+static void removeWaiter (EpollFd *info, StgTSO *prev, StgTSO *tso)
+{
+    if (prev == NULL) {
+        info->waiters = tso->_link;
+    } else {
+        setTSOLink(&MainCapability, prev, tso->_link);
+    }
+    tso->_link = END_TSO_QUEUE;
+    if (blockedEvent(tso) == EPOLL_FD_READ) {
+        info->n_read--;
+    } else {
+        info->n_write--;
+    }
+    tso->flags &= ~TSO_IO_REGISTERED;
+    n_awaiting_io--;
+
+    if (info->waiters == END_TSO_QUEUE) {
+        int last = epoll_active[--epoll_n_active];
+        epoll_active[info->active] = last;
+        epoll_fds[last].active = info->active;
+    }
+}
+
+/*
+ * Wake up a thread that is no longer on any queue: with
+ * blockedOnBadFD if 'ready' says that its descriptor is invalid.
+ */
+static void wakeUpAwaitingThread (StgTSO *tso, uint8_t ready)
+{
+    if (ready & EPOLL_FD_BAD) {
+        // Don't let RTS loop on such descriptors, pass an IOError to
+        // blocked threads (#4934)
+        IF_DEBUG(scheduler,
+            debugBelch("Killing blocked thread %lu on bad fd=%i\n",
+                       (unsigned long)tso->id, (int)tso->block_info.fd));
+        raiseAsync(&MainCapability, tso,
+                   (StgClosure *)blockedOnBadFD_closure, false, NULL);
+    } else {
+        IF_DEBUG(scheduler,
+            debugBelch("Waking up blocked thread %lu\n",
+                       (unsigned long)tso->id));
+        tso->why_blocked = NotBlocked;
+        pushOnRunQueue(&MainCapability, tso);
+    }
+}
+
+/* Wake up the waiters of 'fd' for which 'ready' has the event */
+static void wakeUpWaiters (EpollFd *info, uint8_t ready)
+{
+    StgTSO *tso, *prev, *next;
+
+    prev = NULL;
+    for (tso = info->waiters; tso != END_TSO_QUEUE; tso = next) {
+        next = tso->_link;
+        if (ready & (blockedEvent(tso) | EPOLL_FD_BAD)) {
+            removeWaiter(info, prev, tso);
+            wakeUpAwaitingThread(tso, ready);
+        } else {
+            prev = tso;
+        }
+    }
+}
+
+/*
+ * Take the threads that blocked since the last call off blocked_queue
+ * and wait for their descriptors.  Returns true if some thread could be
+ * woken up straight away.
+ */
+static bool epollAddBlockedThreads (void)
+{
+    StgTSO *tso;
+    bool woken = false;
+
+    while (blocked_queue_hd != END_TSO_QUEUE) {
+        int fd;
+        EpollFd *info;
+        uint8_t event, ready;
+
+        tso = blocked_queue_hd;
+        blocked_queue_hd = tso->_link;
+        tso->_link = END_TSO_QUEUE;
+
+        event = blockedEvent(tso);
+        fd = tso->block_info.fd;
+        if (fd < 0) {
+            wakeUpAwaitingThread(tso, EPOLL_FD_BAD);
+            woken = true;
+            continue;
+        }
+
+        // The descriptor may have been closed and reused since we last
+        // saw it, which silently drops it from the epoll set, so only
+        // trust a registration that other threads are still waiting on
+        // (epollRevalidate checks those).
+        info = epollFd(fd);
+        if (info->waiters == END_TSO_QUEUE || !(info->registered & event)) {
+            ready = epollRegister(fd, info, event);
+            if (ready != 0) {
+                wakeUpWaiters(info, ready);
+                wakeUpAwaitingThread(tso, ready);
+                woken = true;
+                continue;
+            }
+        }
+        addWaiter(fd, info, tso);
+    }
+    blocked_queue_tl = END_TSO_QUEUE;
+    return woken;
+}
+
+/*
+ * Check that the registrations of some of the descriptors with waiters
+ * still exist, see the comment at the top of this file.  Returns true if
+ * some descriptor turned out to be invalid, or ready.
+ */
+static bool epollRevalidate (void)
+{
+    uint32_t n;
+    bool seen_ready = false;
+
+    for (n = 0; n < EPOLL_CHECK_PER_CALL && epoll_n_active > 0; n++) {
+        int fd;
+        EpollFd *info;
+        struct epoll_event ev;
+        uint8_t events, ready;
+
+        if (epoll_check_next >= epoll_n_active) {
+            epoll_check_next = 0;
+        }
+        fd = epoll_active[epoll_check_next];
+        info = &epoll_fds[fd];
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events  = toEpollEvents(info->registered);
+        ev.data.fd = fd;
+        if (info->registered != 0
+            && epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0) {
+            epoll_check_next++;
+            continue;
+        }
+
+        switch (info->registered == 0 ? ENOENT : errno) {
+        case EBADF:
+            // closed under our feet
+            info->registered = 0;
+            ready = EPOLL_FD_BAD;
+            break;
+        case ENOENT:
+            // closed and reused: register the new file
+            events = wantedEvents(info);
+            info->registered = 0;
+            ready = epollRegister(fd, info, events);
+            break;
+        default:
+            sysErrorBelch("epoll_ctl");
+            stg_exit(EXIT_FAILURE);
+        }
+
+        if (ready != 0) {
+            // removes fd from epoll_active, which moves another one
+            // to epoll_check_next
+            wakeUpWaiters(info, ready);
+            seen_ready = true;
+        } else {
+            epoll_check_next++;
+        }
+    }
+    return seen_ready;
+}
+
+/*
+ * Threads that awaitEvent() took off blocked_queue are on the lists of
+ * waiters instead; see the comment at the top of this file.
+ */
+void markAwaitEvent (evac_fn evac, void *user)
+{
+    uint32_t i;
+
+    for (i = 0; i < epoll_n_active; i++) {
+        evac(user, (StgClosure **)(void *)&epoll_fds[epoll_active[i]].waiters);
+    }
+}
+
+void removeAwaitingIO (StgTSO *tso)
+{
+    EpollFd *info = &epoll_fds[tso->block_info.fd];
+    StgTSO *t, *prev;
+
+    prev = NULL;
+    for (t = info->waiters; t != END_TSO_QUEUE; prev = t, t = t->_link) {
+        if (t == tso) {
+            // the registration is dropped lazily, as usual
+            removeWaiter(info, prev, tso);
+            return;
+        }
+    }
+    barf("removeAwaitingIO: not found");
+}
+
+static bool epollAwaitIO (Time timeout)
+{
+    int i, n, timeout_ms;
+    bool seen_ready;
+
+    seen_ready = epollAddBlockedThreads();
+
+    // Don't go to sleep on a registration that has gone away, and don't
+    // sleep for long while we haven't checked them all
+    if (!seen_ready && timeout != 0) {
+        seen_ready = epollRevalidate();
+        if (epoll_n_active > EPOLL_CHECK_PER_CALL
+            && (timeout < 0 || timeout > EPOLL_CHECK_INTERVAL)) {
+            timeout = EPOLL_CHECK_INTERVAL;
+        }
+    }
+
+    // Some threads have been woken up without asking the kernel, so just
+    // poll: the time we would have waited is spent on those threads.
+    if (seen_ready || timeout == 0) {
+        timeout_ms = 0;
+    } else if (timeout < 0) {
+        timeout_ms = -1;
+    } else if (timeout >= MSToTime(INT_MAX)) {
+        timeout_ms = INT_MAX;
+    } else {
+        // round up: we never want to sleep *less* than the timeout
+        timeout_ms = (int)TimeToMS(timeout + MSToTime(1) - 1);
+    }
+
+    while ((n = epoll_wait(epoll_fd, epoll_events, EPOLL_MAX_EVENTS,
+                           timeout_ms)) < 0) {
+        if (errno != EINTR) {
+            sysErrorBelch("epoll_wait");
+            stg_exit(EXIT_FAILURE);
+        }
+
+        if (awaitInterrupted()) {
+            return true;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        int fd = epoll_events[i].data.fd;
+        EpollFd *info = epollFd(fd);
+
+        wakeUpWaiters(info, fromEpollEvents(epoll_events[i].events));
+        epollUnregisterUnwanted(fd, info);
+    }
+    return false;
+}
@@ -0,0 +1,195 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 1995-2002
+ *
+ * select()-based I/O backend for awaitEvent() in the non-threaded RTS.
+ * This file is #included into posix/Select.c.
+ *
+ * ---------------------------------------------------------------------------*/
+
+static void GNUC3_ATTRIBUTE(__noreturn__)
+fdOutOfRange (int fd)
+{
+    errorBelch("file descriptor %d out of range for select (0--%d).\n"
+               "Recompile with -threaded to work around this.",
+               fd, (int)FD_SETSIZE);
+    stg_exit(EXIT_FAILURE);
+}
+
+static enum FdState fdPollReadState (int fd)
+{
+    int r;
+    fd_set rfd;
+    struct timeval now;
+
+    FD_ZERO(&rfd);
+    FD_SET(fd, &rfd);
+
+    /* only poll */
+    now.tv_sec  = 0;
+    now.tv_usec = 0;
+    for (;;)
+    {
+        r = select(fd+1, &rfd, NULL, NULL, &now);
+        /* the descriptor is sane */
+        if (r != -1)
+            break;
+
+        switch (errno)
+        {
+            case EBADF: return RTS_FD_IS_INVALID;
+            case EINTR: continue;
+            default:
+                sysErrorBelch("select");
+                stg_exit(EXIT_FAILURE);
+        }
+    }
+
+    if (r == 0)
+        return RTS_FD_IS_BLOCKING;
+    else
+        return RTS_FD_IS_READY;
+}
+
+static enum FdState fdPollWriteState (int fd)
+{
+    int r;
+    fd_set wfd;
+    struct timeval now;
+
+    FD_ZERO(&wfd);
+    FD_SET(fd, &wfd);
+
+    /* only poll */
+    now.tv_sec  = 0;
+    now.tv_usec = 0;
+    for (;;)
+    {
+        r = select(fd+1, NULL, &wfd, NULL, &now);
+        /* the descriptor is sane */
+        if (r != -1)
+            break;
+
+        switch (errno)
+        {
+            case EBADF: return RTS_FD_IS_INVALID;
+            case EINTR: continue;
+            default:
+                sysErrorBelch("select");
+                stg_exit(EXIT_FAILURE);
+        }
+    }
+
+    if (r == 0)
+        return RTS_FD_IS_BLOCKING;
+    else
+        return RTS_FD_IS_READY;
+}
+
+/* The result of the last select() call, consulted by selectFdState() */
+static fd_set select_rfd, select_wfd;
+static bool select_seen_bad_fd;
+
+static enum FdState selectFdState (StgTSO *tso)
+{
+    int fd = tso->block_info.fd;
+
+    switch (tso->why_blocked) {
+    case BlockedOnRead:
+        if (select_seen_bad_fd) {
+            return fdPollReadState (fd);
+        } else if (FD_ISSET(fd, &select_rfd)) {
+            return RTS_FD_IS_READY;
+        }
+        return RTS_FD_IS_BLOCKING;
+    case BlockedOnWrite:
+        if (select_seen_bad_fd) {
+            return fdPollWriteState (fd);
+        } else if (FD_ISSET(fd, &select_wfd)) {
+            return RTS_FD_IS_READY;
+        }
+        return RTS_FD_IS_BLOCKING;
+    default:
+        barf("awaitEvent");
+    }
+}
+
+static bool selectAwaitIO (Time timeout)
+{
+    StgTSO *tso;
+    int maxfd = -1;
+    struct timeval tv, *ptv;
+
+    /*
+     * Collect all of the fd's that we're interested in
+     */
+    FD_ZERO(&select_rfd);
+    FD_ZERO(&select_wfd);
+    select_seen_bad_fd = false;
+
+    for(tso = blocked_queue_hd; tso != END_TSO_QUEUE; tso = tso->_link) {
+
+        /* On older FreeBSDs, FD_SETSIZE is unsigned. Cast it to signed int
+         * in order to switch off the 'comparison between signed and
+         * unsigned error message
+         * Newer versions of FreeBSD have switched to unsigned int:
+         *   https://github.com/freebsd/freebsd/commit/12ae7f74a071f0439763986026525094a7032dfd
+         *   http://fa.freebsd.cvs-all.narkive.com/bCWNHbaC/svn-commit-r265051-head-sys-sys
+         * So the (int) cast should be removed across the code base once
+         * GHC requires a version of FreeBSD that has that change in it.
+         */
+        switch (tso->why_blocked) {
+        case BlockedOnRead:
+          {
+            int fd = tso->block_info.fd;
+            if ((fd >= (int)FD_SETSIZE) || (fd < 0)) {
+                fdOutOfRange(fd);
+            }
+            maxfd = (fd > maxfd) ? fd : maxfd;
+            FD_SET(fd, &select_rfd);
+            continue;
+          }
+
+        case BlockedOnWrite:
+          {
+            int fd = tso->block_info.fd;
+            if ((fd >= (int)FD_SETSIZE) || (fd < 0)) {
+                fdOutOfRange(fd);
+            }
+            maxfd = (fd > maxfd) ? fd : maxfd;
+            FD_SET(fd, &select_wfd);
+            continue;
+          }
+
+        default:
+          barf("AwaitEvent");
+        }
+    }
+
+    if (timeout < 0) {
+        ptv = NULL;
+    } else {
+        tv.tv_sec  = TimeToSeconds(timeout);
+        tv.tv_usec = TimeToUS(timeout) % 1000000;
+        ptv = &tv;
+    }
+
+    while (select(maxfd+1, &select_rfd, &select_wfd, NULL, ptv) < 0) {
+        if (errno != EINTR) {
+          if ( errno == EBADF ) {
+              select_seen_bad_fd = true;
+              break;
+          } else {
+              sysErrorBelch("select");
+              stg_exit(EXIT_FAILURE);
+          }
+        }
+
+        if (awaitInterrupted()) {
+            return true;
+        }
+    }
+
+    wakeUpBlockedThreads(selectFdState);
+    return false;
+}
@@ -812,25 +812,36 @@ void returnMemoryToOS(uint32_t n /* megablocks */)
 
     // ToDo: not fair, we free all the memory starting with node 0.
     for (node = 0; n > 0 && node < n_numa_nodes; node++) {
-        bd = free_mblock_list[node];
+        bdescr **prev = &free_mblock_list[node];
+        bd = *prev;
         while ((n > 0) && (bd != NULL)) {
+            char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
             size = BLOCKS_TO_MBLOCKS(bd->blocks);
             if (size > n) {
                 StgWord newSize = size - n;
-                char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
                 freeAddr += newSize * MBLOCK_SIZE;
-                bd->blocks = MBLOCK_GROUP_BLOCKS(newSize);
-                freeMBlocks(freeAddr, n);
-                n = 0;
+                if (osCanDecommit(freeAddr, n * MBLOCK_SIZE)) {
+                    bd->blocks = MBLOCK_GROUP_BLOCKS(newSize);
+                    freeMBlocks(freeAddr, n);
+                    n = 0;
+                } else {
+                    prev = &bd->link;
+                    bd = bd->link;
+                }
             }
-            else {
-                char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
+            else if (osCanDecommit(freeAddr, size * MBLOCK_SIZE)) {
                 n -= size;
-                bd = bd->link;
+                bd = *prev = bd->link;
                 freeMBlocks(freeAddr, size);
             }
+            else {
+                // MAP_HUGETLB pages stay committed, so keep them rather
+                // than count them as returned (Note [Huge pages] in
+                // posix/OSMem.c)
+                prev = &bd->link;
+                bd = bd->link;
+            }
         }
-        free_mblock_list[node] = bd;
     }
 
     // Ask the OS to release any address space portion
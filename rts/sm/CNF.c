@@ -23,8 +23,10 @@
 #include "BlockAlloc.h"
 #include "Trace.h"
 #include "sm/ShouldCompact.h"
+#include "sm/OSMem.h"
 
 #include <string.h>
+#include <errno.h>
 
 #if defined(HAVE_UNISTD_H)
 #include <unistd.h>
@@ -141,13 +143,15 @@
   Compacts are also suitable for network or disk serialization, and to
   that extent they support a pointer fixup operation, which adjusts pointers
   from a previous layout of the chain in memory to the new allocation.
-  This works by constructing a temporary binary search table (in the C heap)
-  of the old block addresses (which are known from the block header), and
-  then searching for each pointer in the table, and adjusting it.
+  This works by constructing a temporary table (in the C heap) indexing the
+  old block addresses (which are known from the block header), and then
+  looking up each pointer in the table, and adjusting it (see Note [Fixing
+  up imported compacts]).
   It relies on ABI compatibility and static linking (or no ASLR) because it
   does not attempt to reconstruct info tables, and uses info tables to detect
   pointers. In practice this means only the exact same binary should be
-  used.
+  used.  A compact can also be written to a file that is later mapped back
+  into memory (see Note [Compacts in files]).
 */
 
 typedef enum {
@@ -265,6 +269,28 @@ firstBlockGetCompact(StgCompactNFDataBlock *block)
     return (StgCompactNFData*) ((W_)block + sizeof(StgCompactNFDataBlock));
 }
 
+// See Note [Compacts in files]
+// The part of a block group that compactMapFile maps from the file: the
+// whole group, unless it is a megablock group for a block bigger than a
+// megablock, whose group may go on past the end of the block's data
+static W_
+mapped_size (bdescr *bd)
+{
+    if (bd->blocks > BLOCKS_PER_MBLOCK) {
+        return BLOCK_ROUND_UP((W_)bd->free - (W_)bd->start);
+    }
+    return bd->blocks * BLOCK_SIZE;
+}
+
+static void
+free_compact_block (bdescr *bd)
+{
+    if (bd->flags & BF_MAPPED) {
+        osUnmapFile(bd->start, mapped_size(bd));
+    }
+    freeGroup(bd);
+}
+
 void
 compactFree(StgCompactNFData *str)
 {
@@ -277,7 +303,7 @@ compactFree(StgCompactNFData *str)
         next = block->next;
         bd = Bdescr((StgPtr)block);
         ASSERT((bd->flags & BF_EVACUATED) == 0);
-        freeGroup(bd);
+        free_compact_block(bd);
     }
 }
 
@@ -791,9 +817,54 @@ any_needs_fixup(StgCompactNFDataBlock *block)
     return false;
 }
 
+/*
+  Note [Fixing up imported compacts]
+  ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+  When a compact is imported at a different address, every pointer in it
+  has to be mapped from the old layout of the chain to the new one.
+
+  The fixup table indexes the old layout by megablock: a FixupMBlock
+  records, for each block allocator block of one old megablock, the new
+  StgCompactNFDataBlock that now holds it.  Mapping a pointer is then a
+  binary search over the old megablocks (of which there are few) followed
+  by an array lookup, rather than a binary search over every block in the
+  chain.  To build it we sort the blocks by their old address with a radix
+  sort, after which the blocks of one old megablock are adjacent.
+
+  Fixing up a block reads only the table and writes only the closures of
+  that block, so blocks can be fixed up independently.  For a large compact
+  in the threaded RTS we start some OS threads that claim blocks from a
+  shared counter, and the calling thread does its share too.  We use as
+  many threads as the parallel GC would (-qn, or else -N), and none with
+  -qg.  The root is
+  fixed up once every block is done.  The GC can't move anything under our
+  feet meanwhile: the compact is still on compact_blocks_in_import, and the
+  calling thread holds its capability throughout.
+*/
+
+#define BLOCKS_PER_FIXUP_MBLOCK (MBLOCK_SIZE / BLOCK_SIZE)
+
+/* Below this many words per thread, starting a thread isn't worth it */
+#define FIXUP_WORDS_PER_THREAD ((4 * 1024 * 1024) / sizeof(W_))
+
+typedef struct {
+    StgWord mblock;             // old address of the megablock
+    // the new block holding each block allocator block of the megablock
+    StgCompactNFDataBlock *blocks[BLOCKS_PER_FIXUP_MBLOCK];
+} FixupMBlock;
+
+typedef struct {
+    StgCompactNFDataBlock **blocks;     // sorted by old address
+    uint32_t n_blocks;
+    FixupMBlock *mblocks;               // sorted by old address
+    uint32_t n_mblocks;
+    StgWord totalW;
+} FixupTable;
+
 #if defined(DEBUG)
 static void
-spew_failing_pointer(StgWord *fixup_table, uint32_t count, StgWord address)
+spew_failing_pointer(FixupTable *table, StgWord address)
 {
     uint32_t i;
     StgWord key, value;
@@ -804,11 +875,11 @@ spew_failing_pointer(StgWord *fixup_table, uint32_t count, StgWord address)
     debugBelch("Failed to adjust 0x%" FMT_HexWord ". Block dump follows...\n",
                address);
 
-    for (i  = 0; i < count; i++) {
-        key = fixup_table [2 * i];
-        value = fixup_table [2 * i + 1];
+    for (i  = 0; i < table->n_blocks; i++) {
+        block = table->blocks[i];
+        key = (W_)block->self;
+        value = (W_)block;
 
-        block = (StgCompactNFDataBlock*)value;
         bd = Bdescr((P_)block);
         size = (W_)bd->free - (W_)bd->start;
 
@@ -820,54 +891,40 @@ spew_failing_pointer(StgWord *fixup_table, uint32_t count, StgWord address)
 #endif
 
 STATIC_INLINE StgCompactNFDataBlock *
-find_pointer(StgWord *fixup_table, uint32_t count, StgClosure *q)
+find_pointer(FixupTable *table, StgClosure *q)
 {
     StgWord address = (W_)q;
+    StgWord mblock = address & ~MBLOCK_MASK;
+    StgCompactNFDataBlock *block;
     uint32_t a, b, c;
-    StgWord key, value;
-    bdescr *bd;
 
     a = 0;
-    b = count;
-    while (a < b-1) {
+    b = table->n_mblocks;
+    while (a < b) {
         c = (a+b)/2;
 
-        key = fixup_table[c * 2];
-        value = fixup_table[c * 2 + 1];
-
-        if (key > address)
-            b = c;
+        if (table->mblocks[c].mblock < mblock)
+            a = c + 1;
         else
-            a = c;
+            b = c;
     }
 
-    // three cases here: 0, 1 or 2 blocks to check
-    for ( ; a < b; a++) {
-        key = fixup_table[a * 2];
-        value = fixup_table[a * 2 + 1];
-
-        if (key > address)
-            goto fail;
-
-        bd = Bdescr((P_)value);
-
-        if (key + bd->blocks * BLOCK_SIZE <= address)
-            goto fail;
-
-        return (StgCompactNFDataBlock*)value;
+    if (a < table->n_mblocks && table->mblocks[a].mblock == mblock) {
+        block = table->mblocks[a].blocks[(address & MBLOCK_MASK) >> BLOCK_SHIFT];
+        if (block != NULL)
+            return block;
     }
 
- fail:
     // We should never get here
 
 #if defined(DEBUG)
-    spew_failing_pointer(fixup_table, count, address);
+    spew_failing_pointer(table, address);
 #endif
     return NULL;
 }
 
 static bool
-fixup_one_pointer(StgWord *fixup_table, uint32_t count, StgClosure **p)
+fixup_one_pointer(FixupTable *table, StgClosure **p)
 {
     StgWord tag;
     StgClosure *q;
@@ -884,7 +941,7 @@ fixup_one_pointer(StgWord *fixup_table, uint32_t count, StgClosure **p)
     if (!HEAP_ALLOCED(q))
         return true;
 
-    block = find_pointer(fixup_table, count, q);
+    block = find_pointer(table, q);
     if (block == NULL)
         return false;
     if (block == block->self)
@@ -897,8 +954,7 @@ fixup_one_pointer(StgWord *fixup_table, uint32_t count, StgClosure **p)
 }
 
 static bool
-fixup_mut_arr_ptrs (StgWord          *fixup_table,
-                    uint32_t               count,
+fixup_mut_arr_ptrs (FixupTable       *table,
                     StgMutArrPtrs    *a)
 {
     StgPtr p, q;
@@ -906,7 +962,7 @@ fixup_mut_arr_ptrs (StgWord          *fixup_table,
     p = (StgPtr)&a->payload[0];
     q = (StgPtr)&a->payload[a->ptrs];
     for (; p < q; p++) {
-        if (!fixup_one_pointer(fixup_table, count, (StgClosure**)p))
+        if (!fixup_one_pointer(table, (StgClosure**)p))
             return false;
     }
 
@@ -914,7 +970,7 @@ fixup_mut_arr_ptrs (StgWord          *fixup_table,
 }
 
 static bool
-fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
+fixup_block(StgCompactNFDataBlock *block, FixupTable *table)
 {
     const StgInfoTable *info;
     bdescr *bd;
@@ -928,8 +984,7 @@ fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
 
         switch (info->type) {
         case CONSTR_1_0:
-            if (!fixup_one_pointer(fixup_table, count,
-                                   &((StgClosure*)p)->payload[0]))
+            if (!fixup_one_pointer(table, &((StgClosure*)p)->payload[0]))
                 return false;
             FALLTHROUGH;
         case CONSTR_0_1:
@@ -937,13 +992,11 @@ fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
             break;
 
         case CONSTR_2_0:
-            if (!fixup_one_pointer(fixup_table, count,
-                                   &((StgClosure*)p)->payload[1]))
+            if (!fixup_one_pointer(table, &((StgClosure*)p)->payload[1]))
                 return false;
             FALLTHROUGH;
         case CONSTR_1_1:
-            if (!fixup_one_pointer(fixup_table, count,
-                                   &((StgClosure*)p)->payload[0]))
+            if (!fixup_one_pointer(table, &((StgClosure*)p)->payload[0]))
                 return false;
             FALLTHROUGH;
         case CONSTR_0_2:
@@ -958,7 +1011,7 @@ fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
 
             end = (P_)((StgClosure *)p)->payload + info->layout.payload.ptrs;
             for (p = (P_)((StgClosure *)p)->payload; p < end; p++) {
-                if (!fixup_one_pointer(fixup_table, count, (StgClosure **)p))
+                if (!fixup_one_pointer(table, (StgClosure **)p))
                     return false;
             }
             p += info->layout.payload.nptrs;
@@ -971,7 +1024,7 @@ fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
 
         case MUT_ARR_PTRS_FROZEN_CLEAN:
         case MUT_ARR_PTRS_FROZEN_DIRTY:
-            fixup_mut_arr_ptrs(fixup_table, count, (StgMutArrPtrs*)p);
+            fixup_mut_arr_ptrs(table, (StgMutArrPtrs*)p);
             p += mut_arr_ptrs_sizeW((StgMutArrPtrs*)p);
             break;
 
@@ -982,8 +1035,7 @@ fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
             StgSmallMutArrPtrs *arr = (StgSmallMutArrPtrs*)p;
 
             for (i = 0; i < arr->ptrs; i++) {
-                if (!fixup_one_pointer(fixup_table, count,
-                                       &arr->payload[i]))
+                if (!fixup_one_pointer(table, &arr->payload[i]))
                     return false;
             }
 
@@ -1011,21 +1063,65 @@ fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
     return true;
 }
 
-static int
-cmp_fixup_table_item (const void *e1, const void *e2)
+// LSD radix sort of the blocks by their old address, a byte at a time.
+// Bytes in which all the addresses agree are skipped, which in practice
+// leaves only a few passes.
+static void
+sort_fixup_blocks (StgCompactNFDataBlock **blocks, uint32_t count)
 {
-    const StgWord *w1 = e1;
-    const StgWord *w2 = e2;
+    StgCompactNFDataBlock **tmp, **from, **to, **swap;
+    uint32_t counts[256];
+    uint32_t i, shift, sum, n;
+    StgWord diff;
+
+    diff = 0;
+    for (i = 1; i < count; i++) {
+        diff |= (W_)blocks[i]->self ^ (W_)blocks[0]->self;
+    }
+    if (diff == 0)
+        return;
+
+    tmp = stgMallocBytes(sizeof(StgCompactNFDataBlock *) * count,
+                         "sort_fixup_blocks");
+    from = blocks;
+    to = tmp;
 
-    return *w1 - *w2;
+    for (shift = 0; shift < sizeof(W_) * 8 && (diff >> shift) != 0;
+         shift += 8) {
+        if (((diff >> shift) & 0xff) == 0)
+            continue;
+
+        memset(counts, 0, sizeof(counts));
+        for (i = 0; i < count; i++) {
+            counts[((W_)from[i]->self >> shift) & 0xff]++;
+        }
+        for (i = 0, sum = 0; i < 256; i++) {
+            n = counts[i];
+            counts[i] = sum;
+            sum += n;
+        }
+        for (i = 0; i < count; i++) {
+            to[counts[((W_)from[i]->self >> shift) & 0xff]++] = from[i];
+        }
+
+        swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != blocks) {
+        memcpy(blocks, from, sizeof(StgCompactNFDataBlock *) * count);
+    }
+    stgFree(tmp);
 }
 
-static StgWord *
-build_fixup_table (StgCompactNFDataBlock *block, uint32_t *pcount)
+static void
+build_fixup_table (StgCompactNFDataBlock *block, FixupTable *table)
 {
-    uint32_t count;
+    uint32_t count, i;
     StgCompactNFDataBlock *tmp;
-    StgWord *table;
+    StgWord p, end, mblock;
+    FixupMBlock *m;
 
     count = 0;
     tmp = block;
@@ -1034,44 +1130,169 @@ build_fixup_table (StgCompactNFDataBlock *block, uint32_t *pcount)
         tmp = tmp->next;
     } while(tmp && tmp->owner);
 
-    table = stgMallocBytes(sizeof(StgWord) * 2 * count, "build_fixup_table");
+    table->blocks = stgMallocBytes(sizeof(StgCompactNFDataBlock *) * count,
+                                   "build_fixup_table");
+    table->totalW = 0;
 
     count = 0;
     do {
-        table[count * 2] = (W_)block->self;
-        table[count * 2 + 1] = (W_)block;
-        count++;
+        table->blocks[count++] = block;
+        table->totalW += Bdescr((P_)block)->blocks * BLOCK_SIZE_W;
         block = block->next;
     } while(block && block->owner);
+    table->n_blocks = count;
+
+    sort_fixup_blocks(table->blocks, count);
+
+    // The old blocks are now in address order, so all the blocks of an
+    // old megablock are adjacent.  Count the megablocks...
+    table->n_mblocks = 0;
+    mblock = 0;
+    for (i = 0; i < count; i++) {
+        p = (W_)table->blocks[i]->self;
+        end = p + Bdescr((P_)table->blocks[i])->blocks * BLOCK_SIZE;
+        for (; p < end; p += BLOCK_SIZE) {
+            if (table->n_mblocks == 0 || (p & ~MBLOCK_MASK) != mblock) {
+                mblock = p & ~MBLOCK_MASK;
+                table->n_mblocks++;
+            }
+        }
+    }
+
+    // ...and record which new block holds each of their blocks.
+    table->mblocks = stgCallocBytes(table->n_mblocks, sizeof(FixupMBlock),
+                                    "build_fixup_table");
+    m = NULL;
+    for (i = 0; i < count; i++) {
+        tmp = table->blocks[i];
+        p = (W_)tmp->self;
+        end = p + Bdescr((P_)tmp)->blocks * BLOCK_SIZE;
+        for (; p < end; p += BLOCK_SIZE) {
+            if (m == NULL || (p & ~MBLOCK_MASK) != m->mblock) {
+                m = m == NULL ? table->mblocks : m + 1;
+                m->mblock = p & ~MBLOCK_MASK;
+            }
+            m->blocks[(p & MBLOCK_MASK) >> BLOCK_SHIFT] = tmp;
+        }
+    }
+}
+
+static void
+free_fixup_table (FixupTable *table)
+{
+    stgFree(table->mblocks);
+    stgFree(table->blocks);
+}
+
+typedef struct {
+    FixupTable *table;
+    volatile StgWord next;      // index of the next block to fix up
+    volatile StgWord failed;    // number of blocks that failed
+#if defined(THREADED_RTS)
+    uint32_t running;           // worker threads still running
+    Mutex lock;
+    Condition done;
+#endif
+} FixupJob;
 
-    qsort(table, count, sizeof(StgWord) * 2, cmp_fixup_table_item);
+static void
+fixup_some (FixupJob *job)
+{
+    StgWord i;
 
-    *pcount = count;
-    return table;
+    while (job->failed == 0 &&
+           (i = atomic_inc(&job->next, 1) - 1) < job->table->n_blocks) {
+        if (!fixup_block(job->table->blocks[i], job->table)) {
+            atomic_inc(&job->failed, 1);
+        }
+    }
 }
 
+#if defined(THREADED_RTS)
+static void *
+fixup_worker (void *arg)
+{
+    FixupJob *job = arg;
+
+    fixup_some(job);
+
+    ACQUIRE_LOCK(&job->lock);
+    if (--job->running == 0) {
+        signalCondition(&job->done);
+    }
+    RELEASE_LOCK(&job->lock);
+    return NULL;
+}
+#endif
+
+// See Note [Fixing up imported compacts]
 static bool
 fixup_loop(StgCompactNFDataBlock *block, StgClosure **proot)
 {
-    StgWord *table;
+    FixupTable table;
+    FixupJob job;
     bool ok;
-    uint32_t count;
 
-    table = build_fixup_table (block, &count);
+    build_fixup_table(block, &table);
 
-    do {
-        if (!fixup_block(block, table, count)) {
-            ok = false;
-            goto out;
+    job.table = &table;
+    job.next = 0;
+    job.failed = 0;
+
+#if defined(THREADED_RTS)
+    // as many threads as the parallel GC would use, see -qn and -qg
+    uint32_t n_threads = 1;
+    if (RtsFlags.ParFlags.parGcEnabled) {
+        n_threads = RtsFlags.ParFlags.parGcThreads > 0 ?
+            RtsFlags.ParFlags.parGcThreads : n_capabilities;
+    }
+    n_threads = stg_min(n_threads,
+                        (uint32_t)(table.totalW / FIXUP_WORDS_PER_THREAD));
+
+    if (n_threads > 1) {
+        uint32_t i;
+
+        initMutex(&job.lock);
+        initCondition(&job.done);
+        job.running = 0;
+
+        // this thread is one of the workers
+        for (i = 1; i < n_threads; i++) {
+            OSThreadId tid;
+            ACQUIRE_LOCK(&job.lock);
+            job.running++;
+            RELEASE_LOCK(&job.lock);
+            if (createOSThread(&tid, "ghc_compact", fixup_worker, &job) != 0) {
+                // we'll just have to do with fewer threads
+                ACQUIRE_LOCK(&job.lock);
+                job.running--;
+                RELEASE_LOCK(&job.lock);
+                break;
+            }
         }
+        IF_DEBUG(compact, debugBelch("Fixing up %" FMT_Word32 " blocks "
+                                     "on %" FMT_Word32 " threads\n",
+                                     table.n_blocks, i));
 
-        block = block->next;
-    } while(block && block->owner);
+        fixup_some(&job);
 
-    ok = fixup_one_pointer(table, count, proot);
+        ACQUIRE_LOCK(&job.lock);
+        while (job.running > 0) {
+            waitCondition(&job.done, &job.lock);
+        }
+        RELEASE_LOCK(&job.lock);
 
- out:
-    stgFree(table);
+        closeCondition(&job.done);
+        closeMutex(&job.lock);
+    } else
+#endif
+    {
+        fixup_some(&job);
+    }
+
+    ok = job.failed == 0 && fixup_one_pointer(&table, proot);
+
+    free_fixup_table(&table);
     return ok;
 }
 
@@ -1184,3 +1405,268 @@ compactFixupPointers(StgCompactNFData *str,
 
     return (StgPtr)root;
 }
+
+/*
+  Note [Compacts in files]
+  ~~~~~~~~~~~~~~~~~~~~~~~~
+
+  compactWriteFile writes a compact to a file that compactMapFile can map
+  back into the heap, instead of copying it through user buffers as
+  importCompact does.  The file contains
+
+    CompactFileHeader
+    CompactFileBlock[n_blocks]      one for each block of the chain
+    padding up to BLOCK_SIZE
+    the blocks, each at an offset that is a multiple of BLOCK_SIZE, and
+    padded to their size rounded up to BLOCK_SIZE
+
+  so that each block can be mapped copy-on-write over a block group of the
+  same size, allocated by compactAllocateBlock as for any other import.  A
+  block bigger than a megablock (one holding a large array, say) gets a
+  megablock group, of which we map only the part that the block uses.  The
+  data is then paged in from the file on demand, and its pages are shared
+  with every other process that maps the file until they are written to.
+  Blocks that we can't map (small ones, which aren't worth a mapping of
+  their own, those in huge pages, or all of them on Windows) are read
+  instead.  Mapped block groups are flagged BF_MAPPED, so that compactFree
+  can put ordinary memory back before returning them to the block
+  allocator.
+
+  The pointers are then fixed up by compactFixupPointers as usual, which
+  writes to (and so copies) the pages with pointers in blocks that moved.
+  Pages without any, such as the payloads of large ByteArrays, stay shared.
+*/
+
+#define COMPACT_FILE_MAGIC UINT64_C(0x67686320636e6631) // "ghc cnf1"
+
+/* Blocks smaller than this are read: a mapping costs more than the copy */
+#define COMPACT_MAP_MIN_SIZE (16 * BLOCK_SIZE)
+
+typedef struct {
+    StgWord64 magic;
+    StgWord64 block_size;       // BLOCK_SIZE of the writer
+    StgWord64 n_blocks;
+    StgWord64 root;             // address of the root when written
+} CompactFileHeader;
+
+typedef struct {
+    StgWord64 size;             // bytes in use, including the block header
+    StgWord64 offset;           // where the block starts in the file
+} CompactFileBlock;
+
+static bool
+write_zeros (FILE *f, StgWord64 n)
+{
+    static const char zeros[BLOCK_SIZE];
+    size_t m;
+
+    while (n > 0) {
+        m = (size_t)stg_min(n, (StgWord64)BLOCK_SIZE);
+        if (fwrite(zeros, 1, m, f) != m)
+            return false;
+        n -= m;
+    }
+    return true;
+}
+
+int
+compactWriteFile (StgCompactNFDataBlock *first, StgClosure *root,
+                  const char *path)
+{
+    StgCompactNFData *str = firstBlockGetCompact(first);
+    StgCompactNFDataBlock *block;
+    CompactFileHeader header;
+    CompactFileBlock *table;
+    StgWord64 n, i, offset;
+    bdescr *bd;
+    FILE *f;
+    bool ok;
+    int saved_errno;
+
+    // As in stg_compactGetFirstBlockzh, save hp back to the nursery so
+    // that bd->free is right
+    Bdescr((P_)str->nursery)->free = str->hp;
+
+    n = 0;
+    for (block = first; block != NULL; block = block->next)
+        n++;
+
+    table = stgMallocBytes(n * sizeof(CompactFileBlock), "compactWriteFile");
+    offset = BLOCK_ROUND_UP(sizeof(CompactFileHeader)
+                            + n * sizeof(CompactFileBlock));
+    for (block = first, i = 0; block != NULL; block = block->next, i++) {
+        bd = Bdescr((P_)block);
+        table[i].size = (W_)bd->free - (W_)bd->start;
+        table[i].offset = offset;
+        offset += BLOCK_ROUND_UP(table[i].size);
+    }
+
+    header.magic = COMPACT_FILE_MAGIC;
+    header.block_size = BLOCK_SIZE;
+    header.n_blocks = n;
+    header.root = (W_)root;
+
+    f = fopen(path, "wb");
+    if (f == NULL) {
+        stgFree(table);
+        return -1;
+    }
+
+    ok = fwrite(&header, sizeof(header), 1, f) == 1
+        && fwrite(table, sizeof(CompactFileBlock), n, f) == n
+        && write_zeros(f, table[0].offset - sizeof(header)
+                          - n * sizeof(CompactFileBlock));
+
+    for (block = first, i = 0; ok && block != NULL; block = block->next, i++) {
+        ok = fwrite(block, 1, table[i].size, f) == table[i].size
+            && write_zeros(f, BLOCK_ROUND_UP(table[i].size) - table[i].size);
+    }
+
+    saved_errno = errno;
+    if (fclose(f) != 0 && ok) {
+        ok = false;
+        saved_errno = errno;
+    }
+    stgFree(table);
+
+    IF_DEBUG(compact, debugBelch("compactWriteFile: %" FMT_Word64 " blocks "
+                                 "to %s\n", n, path));
+
+    errno = saved_errno;
+    return ok ? 0 : -1;
+}
+
+// Free the first n blocks of a compact that failed to import
+static void
+free_import (StgCompactNFDataBlock *first, StgWord64 n)
+{
+    StgCompactNFDataBlock *block, *next;
+    bdescr *bd;
+
+    ACQUIRE_SM_LOCK;
+    dbl_link_remove(Bdescr((P_)first), &g0->compact_blocks_in_import);
+    for (block = first; n > 0; block = next, n--) {
+        // the next field of the last block may not be ours
+        next = block->next;
+        bd = Bdescr((P_)block);
+        g0->n_compact_blocks_in_import -= bd->blocks;
+        free_compact_block(bd);
+    }
+    RELEASE_SM_LOCK;
+}
+
+// Files may be bigger than a long can say
+static int
+seek_file (FILE *f, StgWord64 offset, int whence)
+{
+#if defined(mingw32_HOST_OS)
+    return _fseeki64(f, (__int64)offset, whence);
+#else
+    return fseeko(f, (off_t)offset, whence);
+#endif
+}
+
+static StgInt64
+tell_file (FILE *f)
+{
+#if defined(mingw32_HOST_OS)
+    return _ftelli64(f);
+#else
+    return ftello(f);
+#endif
+}
+
+static bool
+fill_block_from_file (FILE *f, StgCompactNFDataBlock *block,
+                      CompactFileBlock *entry)
+{
+    bdescr *bd = Bdescr((P_)block);
+
+    if (entry->size >= COMPACT_MAP_MIN_SIZE
+        && osMapFile(bd->start, mapped_size(bd), fileno(f),
+                     entry->offset)) {
+        bd->flags |= BF_MAPPED;
+        return true;
+    }
+
+    return seek_file(f, entry->offset, SEEK_SET) == 0
+        && fread(bd->start, 1, entry->size, f) == entry->size;
+}
+
+StgCompactNFDataBlock *
+compactMapFile (const char *path, StgClosure **proot)
+{
+    Capability *cap = rts_unsafeGetMyCapability();
+    CompactFileHeader header;
+    CompactFileBlock *table = NULL;
+    StgCompactNFDataBlock *first = NULL, *block = NULL;
+    StgWord64 i, data_start, file_size;
+    StgInt64 end;
+    FILE *f;
+    int saved_errno = EINVAL;
+
+    f = fopen(path, "rb");
+    if (f == NULL)
+        return NULL;
+
+    if (fread(&header, sizeof(header), 1, f) != 1
+        || header.magic != COMPACT_FILE_MAGIC
+        || header.block_size != BLOCK_SIZE
+        || header.n_blocks == 0
+        || header.n_blocks > UINT32_MAX) {
+        goto bad;
+    }
+
+    table = stgMallocBytes(header.n_blocks * sizeof(CompactFileBlock),
+                           "compactMapFile");
+    if (fread(table, sizeof(CompactFileBlock), header.n_blocks, f)
+            != header.n_blocks
+        || seek_file(f, 0, SEEK_END) != 0
+        || (end = tell_file(f)) < 0) {
+        goto bad;
+    }
+    file_size = (StgWord64)end;
+
+    // Check the whole table before allocating anything, so that a
+    // truncated file doesn't leave us with half an import
+    data_start = sizeof(header) + header.n_blocks * sizeof(CompactFileBlock);
+    for (i = 0; i < header.n_blocks; i++) {
+        if (table[i].size < sizeof(StgCompactNFDataBlock)
+                + (i == 0 ? sizeof(StgCompactNFData) : 0)
+            || table[i].size > file_size
+            || table[i].offset % BLOCK_SIZE != 0
+            || table[i].offset > file_size
+            || table[i].offset < data_start
+            || table[i].offset + BLOCK_ROUND_UP(table[i].size) > file_size) {
+            goto bad;
+        }
+    }
+
+    for (i = 0; i < header.n_blocks; i++) {
+        block = compactAllocateBlock(cap, table[i].size, block);
+        if (first == NULL)
+            first = block;
+        if (!fill_block_from_file(f, block, &table[i])) {
+            saved_errno = errno;
+            free_import(first, i + 1);
+            first = NULL;
+            goto out;
+        }
+    }
+    // The chain ends here, whatever the last block says
+    block->next = NULL;
+
+    IF_DEBUG(compact, debugBelch("compactMapFile: %" FMT_Word64 " blocks "
+                                 "from %s\n", header.n_blocks, path));
+
+    *proot = (StgClosure *)(W_)header.root;
+    goto out;
+
+ bad:
+    saved_errno = EINVAL;
+ out:
+    stgFree(table);
+    fclose(f);
+    errno = saved_errno;
+    return first;
+}
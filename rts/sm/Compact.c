@@ -68,8 +68,16 @@
    closure is normally the same (if they are not the same, then
    presumably the tag is not essential and it therefore doesn't matter
    if we throw away some of the tags).
+
+   When several threads are compacting (see Note [Parallel compaction])
+   two of them may add a field to the same chain at once, so then we
+   swap the field into the info pointer with a CAS.
    ------------------------------------------------------------------------- */
 
+#if defined(THREADED_RTS)
+static uint32_t compact_threads = 1; // see Note [Parallel compaction]
+#endif
+
 STATIC_INLINE void
 thread (StgClosure **p)
 {
@@ -90,6 +98,22 @@ thread (StgClosure **p)
 
         if (bd->flags & BF_MARKED)
         {
+#if defined(THREADED_RTS)
+            if (compact_threads > 1) {
+                StgWord new;
+                do {
+                    iptr = *(StgVolatilePtr)q;
+                    if (GET_CLOSURE_TAG((StgClosure *)iptr) == 0) {
+                        *p = (StgClosure *)((StgWord)iptr + GET_CLOSURE_TAG(q0));
+                        new = (StgWord)p + 1;
+                    } else {
+                        *p = (StgClosure *)iptr;
+                        new = (StgWord)p + 2;
+                    }
+                } while (cas((StgVolatilePtr)q, iptr, new) != iptr);
+                return;
+            }
+#endif
             iptr = *q;
             switch (GET_CLOSURE_TAG((StgClosure *)iptr))
             {
@@ -459,13 +483,14 @@ thread_TSO (StgTSO *tso)
 }
 
 
+// Thread the pointers in the n large objects starting at bd
 static void
-update_fwd_large( bdescr *bd )
+update_fwd_large( bdescr *bd, W_ n )
 {
   StgPtr p;
   const StgInfoTable* info;
 
-  for (; bd != NULL; bd = bd->link) {
+  for (; n > 0; n--, bd = bd->link) {
 
     // nothing to do in a pinned block; it might not even have an object
     // at the beginning.
@@ -743,17 +768,207 @@ thread_obj (const StgInfoTable *info, StgPtr p)
     }
 }
 
+/* Note [Parallel compaction]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~
+   compact() first threads the roots (1), and then makes three passes
+   over the heap:
+
+     2. update_fwd: thread every pointer field in the heap: in the
+        blocks and large objects of every generation, and in the marked
+        objects of the blocks being compacted.
+
+     3. update_fwd_compact: walk the marked objects in address order,
+        working out where each one goes, and unthread it, which writes
+        the new address into every field that points to it.
+
+     4. update_bkwd_compact: walk the marked objects again, sliding each
+        one to its new address.
+
+   Unlike the classic algorithm, which unthreads the forward pointers to
+   an object in pass 2 and the backward ones in pass 3, we thread
+   everything before we unthread anything, so that the objects can be
+   compacted out of order.
+
+   The blocks being compacted are divided into regions of consecutive
+   blocks, and each region is compacted into its own first blocks, so
+   passes 3 and 4 work on each region independently: the new address of
+   an object only depends on the sizes of the live objects before it in
+   its region.  In pass 2 the work is divided up into chunks of at most
+   COMPACT_CHUNK_BLOCKS blocks.  The chunks and regions are shared out
+   among compact_threads threads, which take them from a shared counter.
+
+   Everything else is private to one region or one chunk, except:
+
+     - In pass 2, two threads may add a field to the chain of the same
+       object at once, so thread() does it with a CAS, and
+       get_threaded_info() may walk a chain that another thread is
+       adding to.  That is fine, because fields are only ever added to
+       the front of a chain.
+
+     - In pass 3, unthreading an object writes into fields of objects in
+       other regions.  Nothing else looks at those fields in pass 3:
+       working out sizes only needs the info pointer (at the end of the
+       object's own chain) and non-pointer fields.  No object moves until
+       pass 4, and a region only moves its own objects.
+
+   The passes are separated by waiting for all the threads to finish.
+
+   The price of the regions is up to one partly full block at the end of
+   each one, so we only use several threads when there are at least
+   COMPACT_PAR_MIN_BLOCKS blocks to compact, and then make the regions
+   no smaller than COMPACT_REGION_MIN_BLOCKS blocks.  Sequential
+   compaction is the same algorithm with a single region.
+
+   The threads are OS threads started for each pass, because the GC
+   threads are not running during a compacting GC: marking with the
+   global mark stack is sequential, so a GC of a marked generation is
+   never a parallel GC.  We use as many threads as a parallel GC would
+   (+RTS -qn, or -N), or just one with +RTS -qg.
+*/
+
+#define COMPACT_CHUNK_BLOCKS      64
+#define COMPACT_REGION_MIN_BLOCKS 256
+#define COMPACT_PAR_MIN_BLOCKS    1024
+
+typedef enum {
+    FWD_BLOCKS,         // blocks of objects that are not being compacted
+    FWD_LARGE,          // large objects
+    FWD_COMPACT,        // blocks that are being compacted
+} FwdKind;
+
+typedef struct {
+    FwdKind kind;
+    bdescr *bd;         // the first block of the chunk
+    W_ n;               // the number of blocks (or large objects) in it
+} FwdChunk;
+
+typedef struct {
+    bdescr *first;      // the first block of the region
+    W_ n_blocks;        // the number of blocks in the region
+    bdescr *last;       // the last block with objects in, after pass 3
+    W_ n_live_blocks;   // the number of blocks up to last
+} CompactRegion;
+
+typedef struct CompactJob_ {
+    void (*work)(struct CompactJob_ *job, W_ i);
+    W_ n_items;
+    volatile StgWord next;      // the next item to do
+    FwdChunk *chunks;
+    W_ n_chunks, chunks_size;
+    CompactRegion *regions;
+    W_ n_regions;
+#if defined(THREADED_RTS)
+    uint32_t running;           // worker threads still running
+    Mutex lock;
+    Condition done;
+#endif
+} CompactJob;
+
 static void
-update_fwd( bdescr *blocks )
+compact_some (CompactJob *job)
 {
-    StgPtr p;
-    bdescr *bd;
-    const StgInfoTable *info;
+    StgWord i;
 
-    bd = blocks;
+    while ((i = atomic_inc(&job->next, 1) - 1) < job->n_items) {
+        job->work(job, i);
+    }
+}
+
+#if defined(THREADED_RTS)
+static void *
+compact_worker (void *arg)
+{
+    CompactJob *job = arg;
+
+    compact_some(job);
+
+    ACQUIRE_LOCK(&job->lock);
+    if (--job->running == 0) {
+        signalCondition(&job->done);
+    }
+    RELEASE_LOCK(&job->lock);
+    return NULL;
+}
+#endif
+
+// Do work(job, i) for each i < n_items, and wait for it all to be done.
+static void
+run_compact_job (CompactJob *job, void (*work)(CompactJob *, W_),
+                 W_ n_items)
+{
+    job->work = work;
+    job->n_items = n_items;
+    job->next = 0;
+
+#if defined(THREADED_RTS)
+    uint32_t n_threads = (uint32_t)stg_min((W_)compact_threads, n_items);
+
+    if (n_threads > 1) {
+        uint32_t i;
+
+        job->running = 0;
+
+        // this thread is one of the workers
+        for (i = 1; i < n_threads; i++) {
+            OSThreadId tid;
+            ACQUIRE_LOCK(&job->lock);
+            job->running++;
+            RELEASE_LOCK(&job->lock);
+            if (createOSThread(&tid, "ghc_gc_compact",
+                               compact_worker, job) != 0) {
+                // we'll just have to do with fewer threads
+                ACQUIRE_LOCK(&job->lock);
+                job->running--;
+                RELEASE_LOCK(&job->lock);
+                break;
+            }
+        }
+
+        compact_some(job);
+
+        ACQUIRE_LOCK(&job->lock);
+        while (job->running > 0) {
+            waitCondition(&job->done, &job->lock);
+        }
+        RELEASE_LOCK(&job->lock);
+        return;
+    }
+#endif
+
+    compact_some(job);
+}
+
+// Add the chain of blocks from bd onwards to the work for pass 2
+static void
+add_fwd_chunks (CompactJob *job, FwdKind kind, bdescr *bd)
+{
+    FwdChunk *c = NULL;
 
-    // cycle through all the blocks in the step
     for (; bd != NULL; bd = bd->link) {
+        if (c == NULL || c->n == COMPACT_CHUNK_BLOCKS) {
+            if (job->n_chunks == job->chunks_size) {
+                job->chunks_size = stg_max(job->chunks_size * 2, 64);
+                job->chunks = stgReallocBytes(job->chunks,
+                                              job->chunks_size * sizeof(FwdChunk),
+                                              "add_fwd_chunks");
+            }
+            c = &job->chunks[job->n_chunks++];
+            c->kind = kind;
+            c->bd = bd;
+            c->n = 0;
+        }
+        c->n++;
+    }
+}
+
+static void
+update_fwd( bdescr *bd, W_ n )
+{
+    StgPtr p;
+    const StgInfoTable *info;
+
+    // cycle through the blocks
+    for (; n > 0; n--, bd = bd->link) {
         p = bd->start;
 
         // linearly scan the objects in this block
@@ -765,24 +980,15 @@ update_fwd( bdescr *blocks )
     }
 }
 
+// Thread the pointers in the marked objects of blocks being compacted
 static void
-update_fwd_compact( bdescr *blocks )
+update_fwd_marked( bdescr *bd, W_ n )
 {
-    StgPtr p, q, free;
-#if 0
-    StgWord m;
-#endif
-    bdescr *bd, *free_bd;
+    StgPtr p;
     StgInfoTable *info;
-    StgWord size;
     StgWord iptr;
 
-    bd = blocks;
-    free_bd = blocks;
-    free = free_bd->start;
-
-    // cycle through all the blocks in the step
-    for (; bd != NULL; bd = bd->link) {
+    for (; n > 0; n--, bd = bd->link) {
         p = bd->start;
 
         while (p < bd->free ) {
@@ -794,81 +1000,109 @@ update_fwd_compact( bdescr *blocks )
                 break;
             }
 
-#if 0
-    next:
-        m = * ((StgPtr)bd->u.bitmap + ((p - bd->start) / (BITS_IN(StgWord))));
-        m >>= ((p - bd->start) & (BITS_IN(StgWord) - 1));
+            // the info pointer is at the end of the object's chain
+            iptr = get_threaded_info(p);
+            info = INFO_PTR_TO_STRUCT((StgInfoTable *)UNTAG_CLOSURE((StgClosure *)iptr));
+            p = thread_obj(info, p);
+        }
+    }
+}
 
-        while ( p < bd->free ) {
+static void
+update_fwd_chunk (CompactJob *job, W_ i)
+{
+    FwdChunk *c = &job->chunks[i];
 
-            if ((m & 1) == 0) {
-                m >>= 1;
+    switch (c->kind) {
+    case FWD_BLOCKS:
+        update_fwd(c->bd, c->n);
+        break;
+    case FWD_LARGE:
+        update_fwd_large(c->bd, c->n);
+        break;
+    case FWD_COMPACT:
+        update_fwd_marked(c->bd, c->n);
+        break;
+    }
+}
+
+// Work out the new address of each marked object in a region, and
+// unthread it.  All the pointers have been threaded by now, so this
+// updates every pointer to the object.
+static void
+update_fwd_compact( CompactJob *job, W_ r )
+{
+    CompactRegion *region = &job->regions[r];
+    StgPtr p, free;
+    bdescr *bd, *free_bd;
+    StgInfoTable *info;
+    StgWord size;
+    StgWord iptr;
+    W_ n;
+
+    bd = region->first;
+    free_bd = region->first;
+    free = free_bd->start;
+
+    // cycle through all the blocks in the region
+    for (n = region->n_blocks; n > 0; n--, bd = bd->link) {
+        p = bd->start;
+
+        while (p < bd->free ) {
+
+            while ( p < bd->free && !is_marked(p,bd) ) {
                 p++;
-                if (((StgWord)p & (sizeof(W_) * BITS_IN(StgWord))) == 0) {
-                    goto next;
-                } else {
-                    continue;
-                }
             }
-#endif
+            if (p >= bd->free) {
+                break;
+            }
 
             // Problem: we need to know the destination for this cell
             // in order to unthread its info pointer.  But we can't
             // know the destination without the size, because we may
             // spill into the next block.  So we have to run down the
-            // threaded list and get the info ptr first.
-            //
-            // ToDo: one possible avenue of attack is to use the fact
-            // that if (p&BLOCK_MASK) >= (free&BLOCK_MASK), then we
-            // definitely have enough room.  Also see bug #1147.
+            // threaded list and get the info ptr first.  The size only
+            // depends on the info pointer and non-pointer fields.
             iptr = get_threaded_info(p);
             info = INFO_PTR_TO_STRUCT((StgInfoTable *)UNTAG_CLOSURE((StgClosure *)iptr));
+            size = closure_sizeW_((StgClosure *)p, info);
 
-            q = p;
-
-            p = thread_obj(info, p);
-
-            size = p - q;
             if (free + size > free_bd->start + BLOCK_SIZE_W) {
                 // set the next bit in the bitmap to indicate that
                 // this object needs to be pushed into the next
                 // block.  This saves us having to run down the
                 // threaded info pointer list twice during the next pass.
-                mark(q+1,bd);
+                mark(p+1,bd);
                 free_bd = free_bd->link;
                 free = free_bd->start;
             } else {
-                ASSERT(!is_marked(q+1,bd));
+                ASSERT(!is_marked(p+1,bd));
             }
 
-            unthread(q,(StgWord)free + GET_CLOSURE_TAG((StgClosure *)iptr));
+            unthread(p,(StgWord)free + GET_CLOSURE_TAG((StgClosure *)iptr));
             free += size;
-#if 0
-            goto next;
-#endif
+            p += size;
         }
     }
 }
 
-static W_
-update_bkwd_compact( generation *gen )
+// Slide the marked objects of a region to their new addresses
+static void
+update_bkwd_compact( CompactJob *job, W_ r )
 {
+    CompactRegion *region = &job->regions[r];
     StgPtr p, free;
-#if 0
-    StgWord m;
-#endif
     bdescr *bd, *free_bd;
     const StgInfoTable *info;
     StgWord size;
-    W_ free_blocks;
-    StgWord iptr;
+    W_ n, free_blocks;
 
-    bd = free_bd = gen->old_blocks;
+    bd = free_bd = region->first;
     free = free_bd->start;
     free_blocks = 1;
 
-    // cycle through all the blocks in the step
-    for (; bd != NULL; bd = bd->link) {
+    // cycle through all the blocks in the region
+    for (n = region->n_blocks; n > 0; n--, bd = bd->link) {
         p = bd->start;
 
         while (p < bd->free ) {
@@ -880,24 +1114,6 @@ update_bkwd_compact( generation *gen )
                 break;
             }
 
-#if 0
-    next:
-        m = * ((StgPtr)bd->u.bitmap + ((p - bd->start) / (BITS_IN(StgWord))));
-        m >>= ((p - bd->start) & (BITS_IN(StgWord) - 1));
-
-        while ( p < bd->free ) {
-
-            if ((m & 1) == 0) {
-                m >>= 1;
-                p++;
-                if (((StgWord)p & (sizeof(W_) * BITS_IN(StgWord))) == 0) {
-                    goto next;
-                } else {
-                    continue;
-                }
-            }
-#endif
-
             if (is_marked(p+1,bd)) {
                 // don't forget to update the free ptr in the block desc.
                 free_bd->free = free;
@@ -906,8 +1122,6 @@ update_bkwd_compact( generation *gen )
                 free_blocks++;
             }
 
-            iptr = get_threaded_info(p);
-            unthread(p, (StgWord)free + GET_CLOSURE_TAG((StgClosure *)iptr));
             ASSERT(LOOKS_LIKE_INFO_PTR((StgWord)((StgClosure *)p)->header.info));
             info = get_itbl((StgClosure *)p);
             size = closure_sizeW_((StgClosure *)p,info);
@@ -923,20 +1137,86 @@ update_bkwd_compact( generation *gen )
 
             free += size;
             p += size;
-#if 0
-            goto next;
-#endif
         }
     }
 
-    // free the remaining blocks and count what's left.
     free_bd->free = free;
-    if (free_bd->link != NULL) {
-        freeChain(free_bd->link);
-        free_bd->link = NULL;
+    region->last = free_bd;
+    region->n_live_blocks = free_blocks;
+}
+
+// Divide the blocks being compacted into regions, for passes 3 and 4
+static void
+make_regions (CompactJob *job, generation *gen)
+{
+    W_ region_blocks, n;
+    bdescr *bd;
+    CompactRegion *region;
+
+    region_blocks = gen->n_old_blocks;
+#if defined(THREADED_RTS)
+    if (compact_threads > 1) {
+        region_blocks = stg_max((W_)COMPACT_REGION_MIN_BLOCKS,
+                                gen->n_old_blocks / (compact_threads * 4));
+    }
+#endif
+
+    job->regions = stgMallocBytes(sizeof(CompactRegion) *
+                                  (gen->n_old_blocks / region_blocks + 1),
+                                  "make_regions");
+    job->n_regions = 0;
+    region = NULL;
+    for (bd = gen->old_blocks, n = 0; bd != NULL; bd = bd->link, n++) {
+        if (n % region_blocks == 0) {
+            region = &job->regions[job->n_regions++];
+            region->first = bd;
+            region->n_blocks = 0;
+        }
+        region->n_blocks++;
+    }
+}
+
+// Put the compacted regions back together, freeing the blocks that
+// nothing was moved into, and return the number of blocks left.
+static W_
+join_regions (CompactJob *job, generation *gen)
+{
+    CompactRegion *region;
+    bdescr *bd, *next, *last = NULL;
+    W_ r, n, blocks = 0;
+
+    gen->old_blocks = NULL;
+    for (r = 0; r < job->n_regions; r++) {
+        region = &job->regions[r];
+
+        // free the blocks at the end of the region
+        bd = region->last->link;
+        for (n = region->n_live_blocks; n < region->n_blocks; n++) {
+            next = bd->link;
+            freeGroup(bd);
+            bd = next;
+        }
+
+        if (region->n_live_blocks == 1 &&
+            region->last->free == region->last->start) {
+            // nothing in this region is alive
+            freeGroup(region->last);
+            continue;
+        }
+
+        if (last == NULL) {
+            gen->old_blocks = region->first;
+        } else {
+            last->link = region->first;
+        }
+        last = region->last;
+        blocks += region->n_live_blocks;
+    }
+    if (last != NULL) {
+        last->link = NULL;
     }
 
-    return free_blocks;
+    return blocks;
 }
 
 void
@@ -946,6 +1226,7 @@ compact(StgClosure *static_objects,
 {
     W_ n, g, blocks;
     generation *gen;
+    CompactJob job;
 
     // 1. thread the roots
     markCapabilities((evac_fn)thread_root, NULL);
@@ -1011,30 +1292,64 @@ compact(StgClosure *static_objects,
     // the CAF list (used by GHCi)
     markCAFs((evac_fn)thread_root, NULL);
 
+    // See Note [Parallel compaction]
+    gen = oldest_gen;
+    job.chunks = NULL;
+    job.n_chunks = 0;
+    job.chunks_size = 0;
+    job.regions = NULL;
+    job.n_regions = 0;
+#if defined(THREADED_RTS)
+    compact_threads = 1;
+    if (RtsFlags.ParFlags.parGcEnabled &&
+        gen->n_old_blocks >= COMPACT_PAR_MIN_BLOCKS) {
+        compact_threads = RtsFlags.ParFlags.parGcThreads > 0 ?
+            RtsFlags.ParFlags.parGcThreads : n_capabilities;
+    }
+    debugTrace(DEBUG_gc, "compacting on %d threads", (int)compact_threads);
+    initMutex(&job.lock);
+    initCondition(&job.done);
+#endif
+
     // 2. update forward ptrs
     for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
         gen = &generations[g];
-        debugTrace(DEBUG_gc, "update_fwd:  %d", g);
-
-        update_fwd(gen->blocks);
+        add_fwd_chunks(&job, FWD_BLOCKS, gen->blocks);
         for (n = 0; n < n_capabilities; n++) {
-            update_fwd(gc_threads[n]->gens[g].todo_bd);
-            update_fwd(gc_threads[n]->gens[g].part_list);
+            add_fwd_chunks(&job, FWD_BLOCKS, gc_threads[n]->gens[g].todo_bd);
+            add_fwd_chunks(&job, FWD_BLOCKS, gc_threads[n]->gens[g].part_list);
         }
-        update_fwd_large(gen->scavenged_large_objects);
-        if (g == RtsFlags.GcFlags.generations-1 && gen->old_blocks != NULL) {
-            debugTrace(DEBUG_gc, "update_fwd:  %d (compact)", g);
-            update_fwd_compact(gen->old_blocks);
+        add_fwd_chunks(&job, FWD_LARGE, gen->scavenged_large_objects);
+        if (g == RtsFlags.GcFlags.generations-1) {
+            add_fwd_chunks(&job, FWD_COMPACT, gen->old_blocks);
         }
     }
+    debugTrace(DEBUG_gc, "update_fwd: %d chunks", (int)job.n_chunks);
+    run_compact_job(&job, update_fwd_chunk, job.n_chunks);
 
-    // 3. update backward ptrs
     gen = oldest_gen;
     if (gen->old_blocks != NULL) {
-        blocks = update_bkwd_compact(gen);
+        make_regions(&job, gen);
+
+        // 3. work out where everything goes, and update all pointers
+        run_compact_job(&job, update_fwd_compact, job.n_regions);
+
+        // 4. move the objects
+        run_compact_job(&job, update_bkwd_compact, job.n_regions);
+
+        blocks = join_regions(&job, gen);
         debugTrace(DEBUG_gc,
-                   "update_bkwd: %d (compact, old: %d blocks, now %d blocks)",
-                   gen->no, gen->n_old_blocks, blocks);
+                   "update_bkwd: %d (compact, old: %d blocks, now %d blocks, "
+                   "%d regions)",
+                   gen->no, gen->n_old_blocks, blocks, (int)job.n_regions);
         gen->n_old_blocks = blocks;
     }
+
+    stgFree(job.chunks);
+    stgFree(job.regions);
+#if defined(THREADED_RTS)
+    closeCondition(&job.done);
+    closeMutex(&job.lock);
+    compact_threads = 1;
+#endif
 }
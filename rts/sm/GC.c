@@ -150,6 +150,16 @@ volatile StgWord64 whitehole_gc_spin = 0;
 
 bool work_stealing;
 
+#if defined(THREADED_RTS)
+// The work that runOnGcThreads() gives to the GC threads
+static void (*gc_thread_work)(uint32_t thread_index, void *user);
+static void *gc_thread_work_user;
+
+// The gc_thread of the thread running GarbageCollect().  We can't use gct
+// in runOnGcThreads(), which is called from outside the GC.
+static uint32_t gc_main_thread;
+#endif
+
 uint32_t static_flag = STATIC_FLAG_B;
 uint32_t prev_static_flag = STATIC_FLAG_A;
 
@@ -206,7 +216,7 @@ GarbageCollect (uint32_t collect_gen,
   generation *gen;
   StgWord live_blocks, live_words, par_max_copied, par_balanced_copied,
       gc_spin_spin, gc_spin_yield, mut_spin_spin, mut_spin_yield,
-      any_work, no_work, scav_find_work;
+      any_work, no_work, scav_find_work, cards_scanned, cards_skipped;
 #if defined(THREADED_RTS)
   gc_thread *saved_gct;
 #endif
@@ -235,6 +245,9 @@ GarbageCollect (uint32_t collect_gen,
 
   // this is the main thread
   SET_GCT(gc_threads[cap->no]);
+#if defined(THREADED_RTS)
+  gc_main_thread = cap->no;
+#endif
 
   // tell the stats department that we've started a GC
   stat_startGC(cap, gct);
@@ -319,6 +332,15 @@ GarbageCollect (uint32_t collect_gen,
   // check sanity *before* GC
   IF_DEBUG(sanity, checkSanity(false /* before GC */, major_gc));
 
+  // sample the allocation for a sampling heap profile while the nursery
+  // is intact (Note [Sampling heap profile] in ProfHeap.c)
+  if (RtsFlags.ProfFlags.doHeapProfile
+      && RtsFlags.ProfFlags.heapSampleBytes != 0) {
+      RELEASE_SM_LOCK;
+      heapSample(gct->gc_start_cpu);
+      ACQUIRE_SM_LOCK;
+  }
+
   // gather blocks allocated using allocatePinned() from each capability
   // and put them on the g0->large_object list.
   collect_pinned_object_blocks();
@@ -410,7 +432,7 @@ GarbageCollect (uint32_t collect_gen,
   markStablePtrTable(mark_root, gct);
 
   // Remember old stable name addresses.
-  rememberOldStableNameAddresses ();
+  rememberOldStableNameAddresses (N);
 
   /* -------------------------------------------------------------------------
    * Repeatedly scavenge all the areas we know about until there's no
@@ -438,6 +460,13 @@ GarbageCollect (uint32_t collect_gen,
       break;
   }
 
+  // Post the totals for the whole collection, not for each round of
+  // the loop above: the counters in gct accumulate across rounds.
+  if (n_gc_threads > 1) {
+      traceEventGcWorkStats(gct->cap, gct->blocks_stolen, gct->objs_shared,
+                            gct->objs_stolen, TimeToNS(gct->idle_time));
+  }
+
   shutdown_gc_threads(gct->thread_index, idle_cap);
 
   // Now see which stable names are still alive.
@@ -490,6 +519,8 @@ GarbageCollect (uint32_t collect_gen,
   any_work = 0;
   no_work = 0;
   scav_find_work = 0;
+  cards_scanned = 0;
+  cards_skipped = 0;
   {
       uint32_t i;
       uint64_t par_balanced_copied_acc = 0;
@@ -497,6 +528,8 @@ GarbageCollect (uint32_t collect_gen,
 
       for (i=0; i < n_gc_threads; i++) {
           copied += gc_threads[i]->copied;
+          cards_scanned += gc_threads[i]->cards_scanned;
+          cards_skipped += gc_threads[i]->cards_skipped;
       }
       for (i=0; i < n_gc_threads; i++) {
           thread = gc_threads[i];
@@ -743,7 +776,7 @@ GarbageCollect (uint32_t collect_gen,
 #endif
 
   // Update the stable name hash table
-  updateStableNameTable(major_gc);
+  updateStableNameTable();
 
   // unlock the StablePtr table.  Must be before scheduleFinalizers(),
   // because a finalizer may call hs_free_fun_ptr() or
@@ -867,7 +900,8 @@ GarbageCollect (uint32_t collect_gen,
              live_blocks * BLOCK_SIZE_W - live_words /* slop */,
              N, n_gc_threads, par_max_copied, par_balanced_copied,
              gc_spin_spin, gc_spin_yield, mut_spin_spin, mut_spin_yield,
-             any_work, no_work, scav_find_work);
+             any_work, no_work, scav_find_work,
+             cards_scanned, cards_skipped);
 
 #if defined(RTS_USER_SIGNALS)
   if (RtsFlags.MiscFlags.install_signal_handlers) {
@@ -916,6 +950,9 @@ new_gc_thread (uint32_t n, gc_thread *t)
     t->thread_index = n;
     t->free_blocks = NULL;
     t->gc_count = 0;
+#if defined(THREADED_RTS)
+    t->obj_q = newWSDeque(128);
+#endif
 
     init_gc_thread(t);
 
@@ -1000,6 +1037,7 @@ freeGcThreads (void)
             {
                 freeWSDeque(gc_threads[i]->gens[g].todo_q);
             }
+            freeWSDeque(gc_threads[i]->obj_q);
             stgFree (gc_threads[i]);
         }
         stgFree (gc_threads);
@@ -1018,7 +1056,11 @@ freeGcThreads (void)
    Start GC threads
    ------------------------------------------------------------------------- */
 
-static volatile StgWord gc_running_threads;
+volatile StgWord gc_running_threads;
+
+// The number of GC threads waiting for work in scavenge_until_all_done().
+// share_object() only hands out objects when one of them could take it.
+volatile StgWord gc_idle_threads;
 
 static StgWord
 inc_running (void)
@@ -1071,6 +1113,7 @@ any_work (void)
                 ws = &gc_threads[n]->gens[g];
                 if (!looksEmptyWSDeque(ws->todo_q)) return true;
             }
+            if (!looksEmptyWSDeque(gc_threads[n]->obj_q)) return true;
         }
     }
 #endif
@@ -1087,6 +1130,7 @@ static void
 scavenge_until_all_done (void)
 {
     DEBUG_ONLY( uint32_t r );
+    Time idle_start;
 
 
 loop:
@@ -1111,13 +1155,21 @@ loop:
 #endif
 
     traceEventGcIdle(gct->cap);
+    idle_start = getProcessElapsedTime();
 
     debugTrace(DEBUG_gc, "%d GC threads still running", r);
 
+#if defined(THREADED_RTS)
+    atomic_inc(&gc_idle_threads, 1);
+#endif
     while (gc_running_threads != 0) {
         // usleep(1);
         if (any_work()) {
             inc_running();
+#if defined(THREADED_RTS)
+            atomic_dec(&gc_idle_threads);
+#endif
+            gct->idle_time += getProcessElapsedTime() - idle_start;
             traceEventGcWork(gct->cap);
             goto loop;
         }
@@ -1126,7 +1178,11 @@ loop:
         // then we increment gc_running_threads and go back to
         // scavenge_loop() to perform any pending work.
     }
+#if defined(THREADED_RTS)
+    atomic_dec(&gc_idle_threads);
+#endif
 
+    gct->idle_time += getProcessElapsedTime() - idle_start;
     traceEventGcDone(gct->cap);
 }
 
@@ -1165,6 +1221,9 @@ gcWorkerThread (Capability *cap)
 
     scavenge_until_all_done();
 
+    traceEventGcWorkStats(gct->cap, gct->blocks_stolen, gct->objs_shared,
+                          gct->objs_stolen, TimeToNS(gct->idle_time));
+
 #if defined(THREADED_RTS)
     // Now that the whole heap is marked, we discard any sparks that
     // were found to be unreachable.  The main GC thread is currently
@@ -1175,12 +1234,22 @@ gcWorkerThread (Capability *cap)
     pruneSparkQueue(cap);
 #endif
 
-    // Wait until we're told to continue
-    RELEASE_SPIN_LOCK(&gct->gc_spin);
-    gct->wakeup = GC_THREAD_WAITING_TO_CONTINUE;
-    debugTrace(DEBUG_gc, "GC thread %d waiting to continue...",
-               gct->thread_index);
-    ACQUIRE_SPIN_LOCK(&gct->mut_spin);
+    for (;;) {
+        // Wait until we're told to continue
+        RELEASE_SPIN_LOCK(&gct->gc_spin);
+        gct->wakeup = GC_THREAD_WAITING_TO_CONTINUE;
+        debugTrace(DEBUG_gc, "GC thread %d waiting to continue...",
+                   gct->thread_index);
+        ACQUIRE_SPIN_LOCK(&gct->mut_spin);
+        if (gct->wakeup != GC_THREAD_WORKING) break;
+
+        // We were woken up by runOnGcThreads() rather than by
+        // releaseGCThreads(): do the work, then go back to waiting.
+        gc_thread_work(gct->thread_index, gc_thread_work_user);
+        RELEASE_SPIN_LOCK(&gct->mut_spin);
+        gct->wakeup = GC_THREAD_WORK_DONE;
+        ACQUIRE_SPIN_LOCK(&gct->gc_spin);
+    }
     debugTrace(DEBUG_gc, "GC thread %d on my way...", gct->thread_index);
 
     SET_GCT(saved_gct);
@@ -1255,6 +1324,7 @@ start_gc_threads (void)
 {
 #if defined(THREADED_RTS)
     gc_running_threads = 0;
+    gc_idle_threads = 0;
 #endif
 }
 
@@ -1303,6 +1373,73 @@ shutdown_gc_threads (uint32_t me USED_IF_THREADS,
 #endif
 }
 
+/* -----------------------------------------------------------------------------
+   Borrowing the GC threads at the end of a GC
+
+   After a parallel GC, the GC threads wait in GC_THREAD_WAITING_TO_CONTINUE
+   until releaseGCThreads() sends them back to their capabilities.  In the
+   meantime the main GC thread can hand them some more work that needs the
+   world to be stopped, such as a heap census (Note [Parallel heap census]
+   in ProfHeap.c).  This is the same handshake as wakeup_gc_threads() and
+   gcWorkerThread() do at the start of a GC, the other way around: we hold
+   each thread's gc_spin while it works, and take back its mut_spin when it
+   is done.
+
+   runOnGcThreads() calls work(thread_index, user) once on each GC thread
+   that took part in the GC, including the calling one, and returns when
+   all the calls have returned.  Without a parallel GC, that is just the
+   calling thread.
+   -------------------------------------------------------------------------- */
+
+void
+runOnGcThreads (void (*work)(uint32_t thread_index, void *user), void *user)
+{
+#if defined(THREADED_RTS)
+    const uint32_t me = gc_main_thread;
+    uint32_t i;
+
+    gc_thread_work = work;
+    gc_thread_work_user = user;
+
+    for (i = 0; i < n_gc_threads; i++) {
+        if (i == me
+            || gc_threads[i]->wakeup != GC_THREAD_WAITING_TO_CONTINUE) {
+            continue; // an idle capability
+        }
+        debugTrace(DEBUG_gc, "lending work to gc thread %d", i);
+        gc_threads[i]->wakeup = GC_THREAD_WORKING;
+        ACQUIRE_SPIN_LOCK(&gc_threads[i]->gc_spin);
+        RELEASE_SPIN_LOCK(&gc_threads[i]->mut_spin);
+    }
+
+    work(me, user);
+
+    for (i = 0; i < n_gc_threads; i++) {
+        if (i == me
+            || (gc_threads[i]->wakeup != GC_THREAD_WORKING
+                && gc_threads[i]->wakeup != GC_THREAD_WORK_DONE)) {
+            continue;
+        }
+        while (gc_threads[i]->wakeup != GC_THREAD_WORK_DONE) {
+            busy_wait_nop();
+            write_barrier();
+        }
+        ACQUIRE_SPIN_LOCK(&gc_threads[i]->mut_spin);
+        RELEASE_SPIN_LOCK(&gc_threads[i]->gc_spin);
+        // and wait for it to be ready for releaseGCThreads()
+        while (gc_threads[i]->wakeup != GC_THREAD_WAITING_TO_CONTINUE) {
+            busy_wait_nop();
+            write_barrier();
+        }
+    }
+
+    gc_thread_work = NULL;
+    gc_thread_work_user = NULL;
+#else
+    work(0, user);
+#endif
+}
+
 #if defined(THREADED_RTS)
 void
 releaseGCThreads (Capability *cap USED_IF_THREADS, bool idle_cap[])
@@ -1577,11 +1714,20 @@ init_gc_thread (gc_thread *t)
     t->failed_to_evac = false;
     t->eager_promotion = true;
     t->thunk_selector_depth = 0;
+    t->prefetch_head = 0;
+    t->prefetch_count = 0;
+    t->prefetch_recorded = NULL;
     t->copied = 0;
     t->scanned = 0;
     t->any_work = 0;
     t->no_work = 0;
     t->scav_find_work = 0;
+    t->blocks_stolen = 0;
+    t->objs_shared = 0;
+    t->objs_stolen = 0;
+    t->idle_time = 0;
+    t->cards_scanned = 0;
+    t->cards_skipped = 0;
 }
 
 /* -----------------------------------------------------------------------------
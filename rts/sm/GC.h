@@ -37,6 +37,11 @@ extern StgPtr mark_sp;
 
 extern bool work_stealing;
 
+#if defined(THREADED_RTS)
+extern volatile StgWord gc_running_threads;
+extern volatile StgWord gc_idle_threads;
+#endif
+
 #if defined(DEBUG)
 extern uint32_t mutlist_MUTVARS, mutlist_MUTARRS, mutlist_MVARS, mutlist_OTHERS,
     mutlist_TVAR,
@@ -52,6 +57,8 @@ extern volatile StgWord64 waitForGcThreads_yield;
 #endif
 
 void gcWorkerThread (Capability *cap);
+void runOnGcThreads (void (*work)(uint32_t thread_index, void *user),
+                     void *user);
 void initGcThreads (uint32_t from, uint32_t to);
 void freeGcThreads (void);
 
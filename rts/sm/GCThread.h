@@ -121,6 +121,8 @@ typedef struct gen_workspace_ {
 #define GC_THREAD_STANDING_BY          1
 #define GC_THREAD_RUNNING              2
 #define GC_THREAD_WAITING_TO_CONTINUE  3
+#define GC_THREAD_WORKING              4 // lent to runOnGcThreads()
+#define GC_THREAD_WORK_DONE            5
 
 typedef struct gc_thread_ {
     Capability *cap;
@@ -178,6 +180,24 @@ typedef struct gc_thread_ {
     W_ thunk_selector_depth;       // used to avoid unbounded recursion in
                                    // evacuate() for THUNK_SELECTOR
 
+    // -------------------
+    // fields whose evacuation the scavenger has put off until the
+    // objects they point to have been prefetched, a ring of
+    // prefetch_count entries starting at prefetch_head.  See
+    // Note [Prefetching in the scavenger] in Scav.c.
+
+    StgClosure **prefetch_field[GC_PREFETCH_MAX];
+    StgClosure * prefetch_owner[GC_PREFETCH_MAX]; // object holding the field
+    uint32_t     prefetch_head;
+    uint32_t     prefetch_count;
+    StgClosure * prefetch_recorded; // owner we last put on the mut_list
+
+#if defined(THREADED_RTS)
+    // to-space objects that this thread has left for idle GC threads
+    // to scavenge; see Note [Sharing out objects] in Scav.c
+    WSDeque *    obj_q;
+#endif
+
     // -------------------
     // stats
 
@@ -186,6 +206,12 @@ typedef struct gc_thread_ {
     W_ any_work;
     W_ no_work;
     W_ scav_find_work;
+    W_ blocks_stolen;              // todo blocks taken from other threads
+    W_ objs_shared;                // objects pushed on obj_q
+    W_ objs_stolen;                // objects taken from other threads' obj_q
+    Time idle_time;                // time spent waiting for work
+    W_ cards_scanned;              // marked cards of mutable arrays scanned
+    W_ cards_skipped;              // clean cards skipped
 
     Time gc_start_cpu;   // process CPU time
     Time gc_sync_start_elapsed;  // start of GC sync
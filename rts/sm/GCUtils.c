@@ -129,11 +129,30 @@ steal_todo_block (uint32_t g)
         if (n == gct->thread_index) continue;
         bd = stealWSDeque(gc_threads[n]->gens[g].todo_q);
         if (bd) {
+            gct->blocks_stolen++;
             return bd;
         }
     }
     return NULL;
 }
+
+StgClosure *
+steal_object (void)
+{
+    uint32_t n;
+    StgClosure *q;
+
+    // see Note [Sharing out objects] in Scav.c
+    for (n = 0; n < n_gc_threads; n++) {
+        if (n == gct->thread_index) continue;
+        q = stealWSDeque(gc_threads[n]->obj_q);
+        if (q) {
+            gct->objs_stolen++;
+            return q;
+        }
+    }
+    return NULL;
+}
 #endif
 
 void
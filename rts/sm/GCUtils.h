@@ -40,6 +40,7 @@ StgPtr  alloc_todo_block     (gen_workspace *ws, uint32_t size);
 bdescr *grab_local_todo_block  (gen_workspace *ws);
 #if defined(THREADED_RTS)
 bdescr *steal_todo_block       (uint32_t s);
+StgClosure *steal_object       (void);
 #endif
 
 // Returns true if a block is partially full.  This predicate is used to try
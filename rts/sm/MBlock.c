@@ -194,6 +194,7 @@ static void *getFreshMBlocks(uint32_t n)
 {
     W_ size = MBLOCK_SIZE * (W_)n;
     void *addr = (void*)mblock_high_watermark;
+    W_ granularity = osCommitGranularity();
 
     if (mblock_high_watermark + size > mblock_address_space.end)
     {
@@ -202,7 +203,16 @@ static void *getFreshMBlocks(uint32_t n)
         stg_exit(EXIT_HEAPOVERFLOW);
     }
 
-    osCommitMemory(addr, size);
+    if (granularity > MBLOCK_SIZE) {
+        // Nothing above the watermark is in use, so commit the rest of the
+        // huge page too (see Note [Huge pages] in posix/OSMem.c).  When we
+        // get to it, committing it again costs nothing.
+        osCommitMemory(addr, roundUpToAlign(mblock_high_watermark + size,
+                                            granularity)
+                             - mblock_high_watermark);
+    } else {
+        osCommitMemory(addr, size);
+    }
     mblock_high_watermark += size;
     return addr;
 }
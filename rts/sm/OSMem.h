@@ -23,6 +23,25 @@ bool osNumaAvailable(void);
 uint32_t osNumaNodes(void);
 uint64_t osNumaMask(void);
 void osBindMBlocksToNode(void *addr, StgWord size, uint32_t node);
+bool osBuiltWithHugePageSupport(void);
+
+// How much of the heap is backed by MAP_HUGETLB and by transparent huge
+// pages with +RTS --huge-pages (see Note [Huge pages] in posix/OSMem.c)
+void osHugePageBytes(StgWord64 *hugetlb, StgWord64 *transparent);
+
+// Whether the heap memory from p to p+len can be given back to the OS.
+// MAP_HUGETLB pages stay committed (see Note [Huge pages] in
+// posix/OSMem.c).
+bool osCanDecommit(void *p, W_ len);
+
+// Map @size bytes of the file @fd, from @offset, copy-on-write over the
+// committed memory at @at.  Returns false, leaving the memory committed,
+// if that can't be done (eg. the range is not page aligned, or is backed
+// by huge pages), in which case the caller should read the file instead.
+bool osMapFile(void *at, W_ size, int fd, StgWord64 offset);
+
+// Replace memory mapped by osMapFile with ordinary committed memory.
+void osUnmapFile(void *at, W_ size);
 
 INLINE_HEADER size_t
 roundDownToPage (size_t x)
@@ -77,6 +96,12 @@ void *osReserveHeapMemory(void *startAddress, W_ *len);
 // @p, in particular it must not be assumed to contain all zeros.
 void osCommitMemory(void *p, W_ len);
 
+// The size of the pages that osCommitMemory would rather commit whole, so
+// that it can map them as huge pages, or 0 if it doesn't matter.  It is
+// only safe to round a commit up to this if the rest of the page is not in
+// use.
+W_ osCommitGranularity(void);
+
 // Decommit (release backing memory for) a piece of address space,
 // which must be within the previously reserve space and must have
 // been previously committed After this call, it is again unsafe to
@@ -239,17 +239,53 @@ static StgPtr scavenge_mut_arr_ptrs (StgMutArrPtrs *a)
     return (StgPtr)a + mut_arr_ptrs_sizeW(a);
 }
 
-// scavenge only the marked areas of a MUT_ARR_PTRS
+/* Note [Scanning card tables]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+   An array of pointers in an old generation is on the mutable list, and
+   has a card for every 2^MUT_ARR_PTRS_CARD_BITS elements, which the
+   write barrier marks when it writes to one of them.  A card is left
+   marked after a GC only if it still points into a younger generation
+   (see scavenge_mut_arr_ptrs()), so a GC that doesn't collect the array's
+   generation only has to look at the marked cards; the rest of the array
+   can only point to generations that aren't being collected.
+
+   That holds for frozen arrays too: an array is frozen in place, cards
+   and all, by unsafeFreeze#, and nothing can write to it afterwards.
+   scavenge_mutable_list() therefore treats MUT_ARR_PTRS_FROZEN_DIRTY
+   like MUT_ARR_PTRS_DIRTY, rather than rescanning every element of a big
+   immutable vector on each minor GC.
+
+   With a large array even the card table is worth skipping: most of it
+   is clean, and the table is word-aligned, so we look at it a word at a
+   time.  The cards looked at and skipped are counted in the gc_thread
+   and reported by +RTS -s.
+*/
+
+// scavenge only the marked areas of a MUT_ARR_PTRS,
+// see Note [Scanning card tables]
 static StgPtr scavenge_mut_arr_ptrs_marked (StgMutArrPtrs *a)
 {
-    W_ m;
+    W_ m, n_cards;
     StgPtr p, q;
     bool any_failed;
+    StgWord8 *cards;
 
     any_failed = false;
-    for (m = 0; m < mutArrPtrsCards(a->ptrs); m++)
+    n_cards = mutArrPtrsCards(a->ptrs);
+    cards = mutArrPtrsCard(a,0);
+    for (m = 0; m < n_cards; m++)
     {
-        if (*mutArrPtrsCard(a,m) != 0) {
+        if ((m & (sizeof(W_) - 1)) == 0 && m + sizeof(W_) <= n_cards
+            && *(StgWord *)&cards[m] == 0) {
+            gct->cards_skipped += sizeof(W_);
+            m += sizeof(W_) - 1;
+            continue;
+        }
+        if (cards[m] == 0) {
+            gct->cards_skipped++;
+        } else {
+            gct->cards_scanned++;
             p = (StgPtr)&a->payload[m << MUT_ARR_PTRS_CARD_BITS];
             q = stg_min(p + (1 << MUT_ARR_PTRS_CARD_BITS),
                         (StgPtr)&a->payload[a->ptrs]);
@@ -260,7 +296,7 @@ static StgPtr scavenge_mut_arr_ptrs_marked (StgMutArrPtrs *a)
                 any_failed = true;
                 gct->failed_to_evac = false;
             } else {
-                *mutArrPtrsCard(a,m) = 0;
+                cards[m] = 0;
             }
         }
     }
@@ -394,6 +430,170 @@ scavenge_fun_srt(const StgInfoTable *info)
     }
 }
 
+/* Note [Prefetching in the scavenger]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+   Most of the time in a copying GC goes on cache misses: scavenge_block
+   walks to-space in order, which the hardware prefetcher handles well,
+   but every field it evacuates points somewhere unpredictable in
+   from-space, and evacuate() must read the header of that object (and
+   its block descriptor) before it can do anything.
+
+   With +RTS --gc-prefetch=<n>, scavenge_block doesn't evacuate the
+   fields of immutable objects (constructors, functions, thunks) straight
+   away.  Instead evacuate_field() issues a prefetch for the object the
+   field points to and its block descriptor, and puts the field on a
+   small ring in the gc_thread.  Once <n> fields are waiting, each new
+   field pushes the oldest one out, and that one is evacuated: by then
+   its object has usually arrived in the cache.
+
+   Putting off an evacuation is safe because the order in which objects
+   are evacuated doesn't matter (the parallel GC already evacuates in an
+   arbitrary order), and the objects holding the fields are in to-space,
+   so they don't move.  Two things need care:
+
+     - failed_to_evac belongs to the object being scavenged, so
+       evacuate_deferred() saves and restores it around the evacuation
+       and, if the deferred field couldn't be promoted, puts the field's
+       owner on the mutable list itself.
+
+     - Everything must be evacuated before scavenge_block() returns,
+       because evac_gen_no is per-block and the block may be handed to
+       another thread once it has been scanned.  Evacuating the last
+       fields may copy more objects into the block we are scanning, so
+       scavenge_block() goes back to the scan loop after flushing.
+
+   Mutable objects are not deferred: they fiddle with eager_promotion
+   and look at failed_to_evac straight after evacuating their fields.
+   The depth is 0 (no prefetching) by default; it's worth trying on
+   machines where the GC is memory-bound.
+*/
+
+STATIC_INLINE void
+evacuate_deferred (uint32_t gen_no)
+{
+    uint32_t i = gct->prefetch_head;
+    StgClosure *owner = gct->prefetch_owner[i];
+    bool saved_failed_to_evac = gct->failed_to_evac;
+
+    gct->prefetch_head = (i + 1) & (GC_PREFETCH_MAX - 1);
+    gct->prefetch_count--;
+
+    gct->failed_to_evac = false;
+    evacuate(gct->prefetch_field[i]);
+    if (gct->failed_to_evac) {
+        if (gen_no > 0 && owner != gct->prefetch_recorded) {
+            recordMutableGen_GC(owner, gen_no);
+            gct->prefetch_recorded = owner;
+        }
+    }
+    gct->failed_to_evac = saved_failed_to_evac;
+}
+
+STATIC_INLINE void
+evacuate_field (StgClosure **p, StgPtr owner, uint32_t depth, uint32_t gen_no)
+{
+    StgClosure *c;
+    uint32_t i;
+
+    if (depth == 0) {
+        evacuate(p);
+        return;
+    }
+
+    if (gct->prefetch_count == depth) {
+        evacuate_deferred(gen_no);
+    }
+
+    i = (gct->prefetch_head + gct->prefetch_count) & (GC_PREFETCH_MAX - 1);
+    gct->prefetch_field[i] = p;
+    gct->prefetch_owner[i] = (StgClosure *)owner;
+    gct->prefetch_count++;
+
+    c = UNTAG_CLOSURE(*p);
+    __builtin_prefetch(c, 1);             // evacuate() overwrites the header
+    __builtin_prefetch(Bdescr((P_)c), 0);
+}
+
+/* Note [Sharing out objects]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+   The parallel GC balances its work by passing around blocks of
+   to-space that still have to be scanned (see todo_block_full()).  That
+   works well for a wide heap, but the objects reachable from a deep
+   structure trickle into one thread's todo block a few at a time, and
+   the block is still being scanned when it fills up, so it never goes
+   out to the other threads, which sit idle in any_work().
+
+   So when some GC thread is idle in scavenge_until_all_done()
+   (gc_idle_threads != 0), scavenge_block() doesn't scavenge a
+   constructor itself: share_object() pushes it on the thread's obj_q, a WSDeque of to-space objects, and
+   the scan goes on to the next object.  Another thread steals it with
+   steal_object() and scavenges it with scavenge_shared_object(); the
+   objects its fields point to are then copied into the thief's own
+   todo blocks, so the thief goes on to scavenge that part of the heap.
+   If nobody steals the object, its owner pops it again once it has
+   nothing else to do in scavenge_find_work().
+
+   We only push an object when the deque is empty, so there is at most
+   one object waiting per thread, and the cost when every thread is busy
+   is one read of gc_idle_threads per constructor.  Only constructors
+   are shared: they have no SRT, and no clean/dirty state that depends
+   on failed_to_evac, so all the thief has to do is evacuate the
+   pointers and put the object on the mutable list if that fails, just
+   as scavenge_block() would have done.
+
+   We count idle threads rather than compare gc_running_threads with
+   n_gc_threads, because after the first round of the weak-pointer loop
+   in GarbageCollect() the workers have left scavenge_until_all_done()
+   and the leader scavenges alone: nobody could steal from it then.
+
+   Objects in a compacted or swept generation go on the mark stack
+   rather than into to-space, but a GC that marks the old generation
+   runs on one thread anyway (see scheduleDoGC()).
+*/
+
+#if defined(PARALLEL_GC)
+STATIC_INLINE bool
+share_object (StgPtr q)
+{
+    if (!work_stealing || gc_idle_threads == 0 ||
+        !looksEmptyWSDeque(gct->obj_q)) {
+        return false;
+    }
+    if (!pushWSDeque(gct->obj_q, q)) {
+        return false;
+    }
+    gct->objs_shared++;
+    return true;
+}
+
+static void
+scavenge_shared_object (StgClosure *q)
+{
+    bdescr *bd = Bdescr((P_)q);
+    const StgInfoTable *info = get_itbl(q);
+    StgPtr p, end;
+
+    ASSERT(LOOKS_LIKE_CLOSURE_PTR(q));
+
+    gct->evac_gen_no = bd->gen_no;
+    gct->failed_to_evac = false;
+
+    end = (P_)q->payload + info->layout.payload.ptrs;
+    for (p = (P_)q->payload; p < end; p++) {
+        evacuate((StgClosure **)p);
+    }
+
+    if (gct->failed_to_evac) {
+        gct->failed_to_evac = false;
+        if (bd->gen_no > 0) {
+            recordMutableGen_GC(q, bd->gen_no);
+        }
+    }
+}
+#endif
+
 /* -----------------------------------------------------------------------------
    Scavenge a block from the given scan pointer up to bd->free.
 
@@ -413,6 +613,7 @@ scavenge_block (bdescr *bd)
   const StgInfoTable *info;
   bool saved_eager_promotion;
   gen_workspace *ws;
+  uint32_t depth = RtsFlags.GcFlags.prefetchDepth;
 
   debugTrace(DEBUG_gc, "scavenging block %p (gen %d) @ %p",
              bd->start, bd->gen_no, bd->u.scan);
@@ -429,6 +630,7 @@ scavenge_block (bdescr *bd)
   // we might be evacuating into the very object that we're
   // scavenging, so we have to check the real bd->free pointer each
   // time around the loop.
+scan:
   while (p < bd->free || (bd == ws->todo_bd && p < ws->todo_free)) {
 
       ASSERT(bd->link == NULL);
@@ -478,27 +680,33 @@ scavenge_block (bdescr *bd)
 
     case FUN_2_0:
         scavenge_fun_srt(info);
-        evacuate(&((StgClosure *)p)->payload[1]);
-        evacuate(&((StgClosure *)p)->payload[0]);
+        evacuate_field(&((StgClosure *)p)->payload[1], q, depth, bd->gen_no);
+        evacuate_field(&((StgClosure *)p)->payload[0], q, depth, bd->gen_no);
         p += sizeofW(StgHeader) + 2;
         break;
 
     case THUNK_2_0:
         scavenge_thunk_srt(info);
-        evacuate(&((StgThunk *)p)->payload[1]);
-        evacuate(&((StgThunk *)p)->payload[0]);
+        evacuate_field(&((StgThunk *)p)->payload[1], q, depth, bd->gen_no);
+        evacuate_field(&((StgThunk *)p)->payload[0], q, depth, bd->gen_no);
         p += sizeofW(StgThunk) + 2;
         break;
 
     case CONSTR_2_0:
-        evacuate(&((StgClosure *)p)->payload[1]);
-        evacuate(&((StgClosure *)p)->payload[0]);
+#if defined(PARALLEL_GC)
+        if (share_object(q)) {
+            p += sizeofW(StgHeader) + 2;
+            break;
+        }
+#endif
+        evacuate_field(&((StgClosure *)p)->payload[1], q, depth, bd->gen_no);
+        evacuate_field(&((StgClosure *)p)->payload[0], q, depth, bd->gen_no);
         p += sizeofW(StgHeader) + 2;
         break;
 
     case THUNK_1_0:
         scavenge_thunk_srt(info);
-        evacuate(&((StgThunk *)p)->payload[0]);
+        evacuate_field(&((StgThunk *)p)->payload[0], q, depth, bd->gen_no);
         p += sizeofW(StgThunk) + 1;
         break;
 
@@ -506,7 +714,7 @@ scavenge_block (bdescr *bd)
         scavenge_fun_srt(info);
         FALLTHROUGH;
     case CONSTR_1_0:
-        evacuate(&((StgClosure *)p)->payload[0]);
+        evacuate_field(&((StgClosure *)p)->payload[0], q, depth, bd->gen_no);
         p += sizeofW(StgHeader) + 1;
         break;
 
@@ -536,7 +744,7 @@ scavenge_block (bdescr *bd)
 
     case THUNK_1_1:
         scavenge_thunk_srt(info);
-        evacuate(&((StgThunk *)p)->payload[0]);
+        evacuate_field(&((StgThunk *)p)->payload[0], q, depth, bd->gen_no);
         p += sizeofW(StgThunk) + 2;
         break;
 
@@ -544,7 +752,7 @@ scavenge_block (bdescr *bd)
         scavenge_fun_srt(info);
         FALLTHROUGH;
     case CONSTR_1_1:
-        evacuate(&((StgClosure *)p)->payload[0]);
+        evacuate_field(&((StgClosure *)p)->payload[0], q, depth, bd->gen_no);
         p += sizeofW(StgHeader) + 2;
         break;
 
@@ -559,15 +767,22 @@ scavenge_block (bdescr *bd)
         scavenge_thunk_srt(info);
         end = (P_)((StgThunk *)p)->payload + info->layout.payload.ptrs;
         for (p = (P_)((StgThunk *)p)->payload; p < end; p++) {
-            evacuate((StgClosure **)p);
+            evacuate_field((StgClosure **)p, q, depth, bd->gen_no);
         }
         p += info->layout.payload.nptrs;
         break;
     }
 
-    gen_obj:
     case CONSTR:
     case CONSTR_NOCAF:
+#if defined(PARALLEL_GC)
+        if (info->layout.payload.ptrs > 1 && share_object(q)) {
+            p += sizeW_fromITBL(info);
+            break;
+        }
+#endif
+        FALLTHROUGH;
+    gen_obj:
     case WEAK:
     case PRIM:
     {
@@ -575,7 +790,7 @@ scavenge_block (bdescr *bd)
 
         end = (P_)((StgClosure *)p)->payload + info->layout.payload.ptrs;
         for (p = (P_)((StgClosure *)p)->payload; p < end; p++) {
-            evacuate((StgClosure **)p);
+            evacuate_field((StgClosure **)p, q, depth, bd->gen_no);
         }
         p += info->layout.payload.nptrs;
         break;
@@ -819,6 +1034,14 @@ scavenge_block (bdescr *bd)
     }
   }
 
+  // see Note [Prefetching in the scavenger]
+  if (gct->prefetch_count != 0) {
+      while (gct->prefetch_count != 0) {
+          evacuate_deferred(bd->gen_no);
+      }
+      goto scan;
+  }
+
   if (p > bd->free)  {
       gct->copied += ws->todo_free - bd->free;
       bd->free = p;
@@ -1642,6 +1865,22 @@ scavenge_mutable_list(bdescr *bd, generation *gen)
                 recordMutableGen_GC((StgClosure *)p,gen_no);
                 continue;
             }
+            case MUT_ARR_PTRS_FROZEN_DIRTY:
+            {
+                // see Note [Scanning card tables]
+                scavenge_mut_arr_ptrs_marked((StgMutArrPtrs *)p);
+
+                if (gct->failed_to_evac) {
+                    ((StgClosure *)p)->header.info =
+                        &stg_MUT_ARR_PTRS_FROZEN_DIRTY_info;
+                    gct->failed_to_evac = false;
+                    recordMutableGen_GC((StgClosure *)p,gen_no);
+                } else {
+                    ((StgClosure *)p)->header.info =
+                        &stg_MUT_ARR_PTRS_FROZEN_CLEAN_info;
+                }
+                continue;
+            }
             default:
                 ;
             }
@@ -2066,6 +2305,20 @@ loop:
         goto loop;
     }
 
+#if defined(PARALLEL_GC)
+    {
+        StgClosure *q;
+
+        // take back the objects that nobody stole,
+        // see Note [Sharing out objects]
+        if ((q = popWSDeque(gct->obj_q)) != NULL) {
+            scavenge_shared_object(q);
+            did_anything = true;
+            goto loop;
+        }
+    }
+#endif
+
 #if defined(THREADED_RTS)
     if (work_stealing) {
         // look for work to steal
@@ -2081,6 +2334,18 @@ loop:
             did_anything = true;
             goto loop;
         }
+
+#if defined(PARALLEL_GC)
+        {
+            StgClosure *q;
+
+            if ((q = steal_object()) != NULL) {
+                scavenge_shared_object(q);
+                did_anything = true;
+                goto loop;
+            }
+        }
+#endif
     }
 #endif
 
@@ -493,6 +493,11 @@ void osCommitMemory (void *at, W_ size)
     }
 }
 
+W_ osCommitGranularity (void)
+{
+    return 0;
+}
+
 void osDecommitMemory (void *at, W_ size)
 {
     if (!VirtualFree(at, size, MEM_DECOMMIT)) {
@@ -508,6 +513,35 @@ void osReleaseHeapMemory (void)
 
 #endif
 
+bool osBuiltWithHugePageSupport(void)
+{
+    return false;
+}
+
+bool osCanDecommit(void *at STG_UNUSED, W_ size STG_UNUSED)
+{
+    return true;
+}
+
+void osHugePageBytes(StgWord64 *hugetlb, StgWord64 *transparent)
+{
+    *hugetlb = 0;
+    *transparent = 0;
+}
+
+bool osMapFile(void *at STG_UNUSED, W_ size STG_UNUSED, int fd STG_UNUSED,
+               StgWord64 offset STG_UNUSED)
+{
+    // MapViewOfFileEx needs the address to be aligned to the allocation
+    // granularity (64k), and can't replace memory we have committed
+    // already, so we always read the file instead.
+    return false;
+}
+
+void osUnmapFile(void *at STG_UNUSED, W_ size STG_UNUSED)
+{
+}
+
 bool osBuiltWithNumaSupport(void)
 {
     return true;
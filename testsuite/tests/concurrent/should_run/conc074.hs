@@ -0,0 +1,46 @@
+import Control.Concurrent
+import Control.Exception
+import Control.Monad
+import GHC.Conc
+
+-- Writers on two capabilities move units between TVars that conflict with
+-- each other's, while readers sum all of the TVars.  Every committed read
+-- has to see a consistent state, whether it was a snapshot of the version
+-- clock or validated in full, and a reader that sees an inconsistent
+-- state before it commits must be restarted rather than get its exception.
+
+nVars, nWriters, nReaders :: Int
+nVars = 16
+nWriters = 4
+nReaders = 2
+
+total :: Int
+total = nVars * 100
+
+main :: IO ()
+main = do
+  vs <- replicateM nVars (newTVarIO (100 :: Int))
+  done <- newEmptyMVar
+  forM_ [0 .. nWriters - 1] $ \w -> forkIO $ do
+    forM_ [1 .. 20000] $ \i -> atomically $ do
+      let a = (w * 7 + i) `mod` nVars
+          b = (a + 1 + i `mod` (nVars - 1)) `mod` nVars
+      x <- readTVar (vs !! a)
+      y <- readTVar (vs !! b)
+      writeTVar (vs !! a) (x - 1)
+      writeTVar (vs !! b) (y + 1)
+    putMVar done Nothing
+  forM_ [1 .. nReaders] $ \_ -> forkIO $ do
+    bad <- fmap or $ forM [1 .. 5000 :: Int] $ \_ -> do
+      r <- try $ atomically $ do
+        t <- sum <$> mapM readTVar vs
+        when (t /= total) $ throwSTM (ErrorCall "inconsistent read")
+        return t
+      case r of
+        Left e -> do putStrLn ("reader: " ++ show (e :: ErrorCall))
+                     return True
+        Right t -> return (t /= total)
+    putMVar done (Just bad)
+  results <- replicateM (nWriters + nReaders) (takeMVar done)
+  print [ bad | Just bad <- results ]
+  atomically (sum <$> mapM readTVar vs) >>= print
@@ -0,0 +1,66 @@
+import Control.Concurrent
+import Control.Exception
+import Control.Monad
+import Data.IORef
+import GHC.Conc
+
+-- A workload for the STM counters of +RTS -s: conflicting writers on two
+-- capabilities, a transaction that throws because it has seen an
+-- inconsistent state (and so is run again rather than abandoned), a
+-- transaction that blocks in retry, and transactions that throw.  The
+-- Makefile checks the stm_* fields of the machine-readable statistics.
+
+main :: IO ()
+main = do
+  counter <- newTVarIO (0 :: Int)
+  done <- newEmptyMVar
+  forM_ [1 .. 2 :: Int] $ \_ -> forkIO $ do
+    replicateM_ 10000 $ atomically $ modifyTVar' counter (+ 1)
+    putMVar done ()
+
+  -- The first run of this transaction reads a before and b after another
+  -- thread has written both, so it throws; the exception must not escape.
+  a <- newTVarIO (0 :: Int)
+  b <- newTVarIO (0 :: Int)
+  first <- newIORef True
+  go <- newEmptyMVar
+  written <- newEmptyMVar
+  _ <- forkIO $ do
+    takeMVar go
+    atomically $ writeTVar a 1 >> writeTVar b 1
+    putMVar written ()
+  _ <- forkIO $ do
+    atomically $ do
+      x <- readTVar a
+      unsafeIOToSTM $ do
+        f <- atomicModifyIORef' first (\f -> (False, f))
+        when f $ putMVar go () >> takeMVar written
+      y <- readTVar b
+      when (x /= y) $ throwSTM (ErrorCall "inconsistent read")
+    putMVar done ()
+
+  -- Block in retry until the flag is set
+  flag <- newTVarIO False
+  waiting <- newEmptyMVar
+  _ <- forkIO $ do
+    atomically $ do
+      v <- readTVar flag
+      unless v $ do
+        _ <- unsafeIOToSTM (tryPutMVar waiting ())
+        retry
+    putMVar done ()
+  takeMVar waiting
+  atomically $ writeTVar flag True
+
+  private <- newTVarIO (0 :: Int)
+  replicateM_ 100 $ do
+    r <- try $ atomically $ do
+      x <- readTVar private
+      writeTVar private (x + 1)
+      throwSTM (ErrorCall "abandoned")
+    case r of
+      Left (ErrorCall _) -> return ()
+      Right _ -> return ()
+
+  replicateM_ 4 (takeMVar done)
+  readTVarIO counter >>= print
@@ -0,0 +1,31 @@
+{-# LANGUAGE BangPatterns #-}
+
+-- Keeps a large, pointer-heavy heap live across many collections, so that
+-- most of the run is spent copying it.  Run with and without
+-- +RTS --gc-prefetch and compare the GC times that +RTS -s reports; see
+-- Note [Prefetching in the scavenger] in rts/sm/Scav.c.
+
+import qualified Data.IntMap.Strict as IM
+import qualified Data.Map.Strict as M
+import Data.List (foldl')
+import System.Environment
+
+data Node = Node !Int [Int]
+
+step :: (M.Map Int Node, IM.IntMap [Int]) -> Int
+     -> (M.Map Int Node, IM.IntMap [Int])
+step (!m, !im) i = (m', im')
+  where
+    k   = (i * 7919) `mod` 100000
+    m'  = M.insert k (Node i [i, i + 1, i + 2]) m
+    im' = IM.insertWith (++) (k `mod` 5000) [i] (IM.delete (i `mod` 5000) im)
+
+main :: IO ()
+main = do
+  args <- getArgs
+  let n = case args of
+            [a] -> read a
+            _   -> 1000000
+      (m, im) = foldl' step (M.empty, IM.empty) [1 .. n]
+      total = M.foldl' (\acc (Node x ys) -> acc + toInteger (x + sum ys)) 0 m
+  print (M.size m, IM.size im, total)
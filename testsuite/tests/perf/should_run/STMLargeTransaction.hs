@@ -0,0 +1,24 @@
+-- A transaction that touches many TVars.  Each readTVar and writeTVar
+-- looks up the TVar in the transaction record, which used to be a linear
+-- search, so this took time quadratic in the number of TVars; see
+-- Note [TRec index] in rts/STM.c.  Run it with different sizes to see
+-- how it scales:
+--
+--   ./STMLargeTransaction <number of TVars> <number of transactions>
+
+import GHC.Conc
+import Control.Monad
+import System.Environment
+
+main :: IO ()
+main = do
+  args <- getArgs
+  let (n, rounds) = case args of
+        [a, b] -> (read a, read b)
+        _      -> (20000, 10)
+  tvars <- replicateM n (newTVarIO (0 :: Int))
+  replicateM_ rounds $ atomically $
+    forM_ tvars $ \tv -> readTVar tv >>= writeTVar tv . (+ 1)
+  -- and a read-only one over all of them
+  total <- atomically $ foldM (\s tv -> (s +) <$> readTVar tv) 0 tvars
+  print total
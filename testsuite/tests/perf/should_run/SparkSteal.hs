@@ -0,0 +1,25 @@
+-- Lots of small sparks: every call above the cutoff sparks one of its
+-- children, so the idle capabilities spend their time stealing.  See
+-- findSpark in rts/Capability.c, and the SPARKS line of +RTS -s.
+
+import GHC.Conc (par, pseq)
+import System.Environment
+
+nfib :: Int -> Int
+nfib n = if n < 2 then 1 else nfib (n - 1) + nfib (n - 2) + 1
+
+pfib :: Int -> Int -> Int
+pfib cutoff n
+  | n < cutoff = nfib n
+  | otherwise  = x `par` (y `pseq` x + y + 1)
+  where
+    x = pfib cutoff (n - 1)
+    y = pfib cutoff (n - 2)
+
+main :: IO ()
+main = do
+  args <- getArgs
+  let (n, cutoff) = case args of
+        [a, b] -> (read a, read b)
+        _      -> (30, 12)
+  print (pfib cutoff n)
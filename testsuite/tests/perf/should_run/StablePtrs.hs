@@ -0,0 +1,35 @@
+{-# LANGUAGE BangPatterns #-}
+
+-- Every capability creates and frees stable pointers as fast as it can, in
+-- batches, so that they go through its cache of free entries as well as
+-- the global free list.  See Note [Per-capability stable pointers] in
+-- rts/StablePtr.c.
+
+import Control.Concurrent
+import Control.Monad
+import Foreign.StablePtr
+import System.Environment
+
+worker :: Int -> Int -> IO Int
+worker rounds batch = go rounds 0
+  where
+    go 0 !acc = return acc
+    go r !acc = do
+      sps <- mapM newStablePtr [1 .. batch]
+      xs <- mapM deRefStablePtr sps
+      mapM_ freeStablePtr (reverse sps)
+      go (r - 1) (acc + sum xs)
+
+main :: IO ()
+main = do
+  args <- getArgs
+  let (rounds, batch) = case args of
+        [a, b] -> (read a, read b)
+        _      -> (2000, 500)
+  n <- getNumCapabilities
+  results <- forM [0 .. n - 1] $ \i -> do
+    v <- newEmptyMVar
+    _ <- forkOn i (worker rounds batch >>= putMVar v)
+    return v
+  total <- sum <$> mapM takeMVar results
+  print (total `div` n)
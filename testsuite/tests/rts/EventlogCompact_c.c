@@ -0,0 +1,100 @@
+/* Encode an ordinary eventlog as +RTS --eventlog-compact would, so that
+ * the result can be decoded again and compared with the original.  The
+ * header is one frame, the events another, and the end of data marker a
+ * third, like the buffers that EventLog.c hands to the EventLogWriter. */
+
+#include "Rts.h"
+#include "rts/EventLogFormat.h"
+#include "eventlog/EventLogCompact.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static StgInt32 event_sizes[NUM_GHC_EVENT_TAGS];
+
+static StgWord64 getBigEndian (const StgWord8 *p, size_t bytes)
+{
+    StgWord64 r = 0;
+
+    for (size_t i = 0; i < bytes; i++) {
+        r = (r << 8) | p[i];
+    }
+    return r;
+}
+
+/* Fill in event_sizes from the header, and return its size */
+static size_t readHeader (const StgWord8 *buf, size_t size)
+{
+    const StgWord8 *p = buf + 8, *end = buf + size;
+
+    for (int i = 0; i < NUM_GHC_EVENT_TAGS; i++) {
+        event_sizes[i] = -1;
+    }
+    while (p + 4 <= end && getBigEndian(p, 4) == EVENT_ET_BEGIN) {
+        StgWord16 tag = getBigEndian(p + 4, 2);
+        StgWord16 event_size = getBigEndian(p + 6, 2);
+        StgWord32 desc_len = getBigEndian(p + 8, 4);
+        StgWord32 ext_len = getBigEndian(p + 12 + desc_len, 4);
+
+        if (tag < NUM_GHC_EVENT_TAGS) {
+            event_sizes[tag] = event_size;
+        }
+        p += 12 + desc_len + 4 + ext_len + 4;
+    }
+    // EVENT_HET_END, EVENT_HEADER_END, EVENT_DATA_BEGIN
+    p += 12;
+    if (p > end || getBigEndian(p - 4, 4) != EVENT_DATA_BEGIN) {
+        fprintf(stderr, "bad eventlog header\n");
+        exit(1);
+    }
+    return p - buf;
+}
+
+static void writeFrame (FILE *out, StgWord8 *frame, size_t size)
+{
+    if (fwrite(frame, 1, size, out) != size) {
+        perror("fwrite");
+        exit(1);
+    }
+    free(frame);
+}
+
+int main (int argc, char *argv[])
+{
+    FILE *in, *out;
+    StgWord8 *buf;
+    long size;
+    size_t header_size, frame_size;
+
+    if (argc != 3 || (in = fopen(argv[1], "rb")) == NULL
+        || (out = fopen(argv[2], "wb")) == NULL) {
+        fprintf(stderr, "usage: EventlogCompact_c <eventlog> <ceventlog>\n");
+        exit(1);
+    }
+    fseek(in, 0, SEEK_END);
+    size = ftell(in);
+    rewind(in);
+    buf = malloc(size);
+    if (fread(buf, 1, size, in) != (size_t)size) {
+        perror("fread");
+        exit(1);
+    }
+    fclose(in);
+
+    header_size = readHeader(buf, size);
+    writeFrame(out, compactEventLogHeader(buf, header_size, &frame_size),
+               frame_size);
+    writeFrame(out, compactEventLogBlock(buf + header_size,
+                                         size - header_size - 2,
+                                         event_sizes, &frame_size),
+               frame_size);
+    // the events must have been encoded, not stored
+    printf("%s\n", frame_size < size - header_size - 2 ? "smaller" : "stored");
+    writeFrame(out, compactEventLogBlock(buf + size - 2, 2,
+                                         event_sizes, &frame_size),
+               frame_size);
+    fclose(out);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,50 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+
+import Control.Concurrent
+import Control.Monad
+import Foreign.C
+import Foreign.Marshal.Array
+import Foreign.Ptr
+import Foreign.Storable
+import qualified System.Posix.Internals as SPI
+import qualified System.Posix.Types as SPT
+
+-- Threads blocked on descriptors above FD_SETSIZE (1024), which the
+-- select() backend of awaitEvent can't wait for.
+
+foreign import ccall unsafe "raise_nofile" raiseNofile :: CInt -> IO CInt
+foreign import ccall unsafe "dup2" c_dup2 :: CInt -> CInt -> IO CInt
+
+pipe :: IO (CInt, CInt)
+pipe = allocaArray 2 $ \fds -> do
+    throwErrnoIfMinus1_ "pipe" $ SPI.c_pipe fds
+    rd <- peekElemOff fds 0
+    wr <- peekElemOff fds 1
+    return (rd, wr)
+
+-- Move a descriptor to 'to', if the limit on open files allows it
+moveTo :: CInt -> CInt -> CInt -> IO CInt
+moveTo limit fd to
+  | to >= limit = return fd
+  | otherwise = do
+      throwErrnoIfMinus1_ "dup2" $ c_dup2 fd to
+      _ <- SPI.c_close fd
+      return to
+
+main :: IO ()
+main = do
+  limit <- raiseNofile 4096
+  forM_ [0 .. 3] $ \i -> do
+    (r, w) <- pipe
+    r' <- moveTo limit r (1100 + 500 * i)
+    woken <- newEmptyMVar
+    _ <- forkIO $ do
+      threadWaitRead (SPT.Fd r')
+      putMVar woken ()
+    yield
+    _ <- withCString "x" $ \s -> SPI.c_write w (castPtr s) 1
+    takeMVar woken
+    putStrLn ("woken " ++ show i)
+    _ <- SPI.c_close r'
+    _ <- SPI.c_close w
+    return ()
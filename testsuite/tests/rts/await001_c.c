@@ -0,0 +1,19 @@
+#include <sys/resource.h>
+
+/* Raise the soft limit on open files as far as 'want', and return the
+ * new limit */
+int raise_nofile (int want)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) {
+        return 0;
+    }
+    if (rl.rlim_cur < (rlim_t)want) {
+        rl.rlim_cur = rl.rlim_max < (rlim_t)want ? rl.rlim_max : (rlim_t)want;
+        if (setrlimit(RLIMIT_NOFILE, &rl) != 0) {
+            return 0;
+        }
+    }
+    return rl.rlim_cur > (rlim_t)want ? want : (int)rl.rlim_cur;
+}
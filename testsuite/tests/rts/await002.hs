@@ -0,0 +1,46 @@
+import Control.Concurrent
+import Control.Exception
+import Foreign.C
+import Foreign.Marshal.Array
+import Foreign.Ptr
+import Foreign.Storable
+import qualified System.Posix.Internals as SPI
+import qualified System.Posix.Types as SPT
+
+-- A descriptor that a blocked thread waits for is closed by another
+-- thread.  The blocked thread must get blockedOnBadFD (#4934), as with
+-- select(), rather than hang; and if the descriptor is reused before the
+-- RTS goes to sleep, the thread waits for the new file.
+
+pipe :: IO (CInt, CInt)
+pipe = allocaArray 2 $ \fds -> do
+    throwErrnoIfMinus1_ "pipe" $ SPI.c_pipe fds
+    rd <- peekElemOff fds 0
+    wr <- peekElemOff fds 1
+    return (rd, wr)
+
+waiter :: CInt -> IO (MVar String)
+waiter fd = do
+  done <- newEmptyMVar
+  _ <- forkIO $ do
+    r <- try (threadWaitRead (SPT.Fd fd))
+    putMVar done (either (\e -> show (e :: IOException)) (const "ready") r)
+  threadDelay 100000
+  return done
+
+main :: IO ()
+main = do
+  -- closed
+  (r1, _w1) <- pipe
+  done1 <- waiter r1
+  _ <- SPI.c_close r1
+  takeMVar done1 >>= putStrLn
+
+  -- closed and reused: pipe() gets the lowest free descriptors
+  (r2, _w2) <- pipe
+  done2 <- waiter r2
+  _ <- SPI.c_close r2
+  (r3, w3) <- pipe
+  print (r3 == r2)
+  _ <- withCString "x" $ \s -> SPI.c_write w3 (castPtr s) 1
+  takeMVar done2 >>= putStrLn
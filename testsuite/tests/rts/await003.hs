@@ -0,0 +1,48 @@
+import Control.Concurrent
+import Control.Exception
+import Control.Monad
+import Foreign.C
+import Foreign.Marshal.Array
+import Foreign.Ptr
+import Foreign.Storable
+import qualified System.Posix.Internals as SPI
+import qualified System.Posix.Types as SPT
+
+-- Several threads waiting for the same descriptor share one
+-- registration with epoll.  A thread killed while it waits must leave
+-- the others waiting, and a descriptor that becomes ready must wake
+-- only its own waiters.
+
+pipe :: IO (CInt, CInt)
+pipe = allocaArray 2 $ \fds -> do
+    throwErrnoIfMinus1_ "pipe" $ SPI.c_pipe fds
+    rd <- peekElemOff fds 0
+    wr <- peekElemOff fds 1
+    return (rd, wr)
+
+waiter :: CInt -> IO (ThreadId, MVar String)
+waiter fd = do
+  done <- newEmptyMVar
+  t <- forkIO $ do
+    r <- try (threadWaitRead (SPT.Fd fd))
+    putMVar done (either (\e -> show (e :: AsyncException)) (const "ready") r)
+  return (t, done)
+
+main :: IO ()
+main = do
+  (r1, w1) <- pipe
+  (r2, w2) <- pipe
+  ws1 <- replicateM 3 (waiter r1)
+  ws2 <- replicateM 2 (waiter r2)
+  threadDelay 100000
+
+  let (t, done) = ws1 !! 1
+  killThread t
+  takeMVar done >>= putStrLn
+
+  _ <- withCString "x" $ \s -> SPI.c_write w1 (castPtr s) 1
+  forM_ [ws1 !! 0, ws1 !! 2] $ \(_, d) -> takeMVar d >>= putStrLn
+  forM_ ws2 $ \(_, d) -> tryTakeMVar d >>= print
+
+  _ <- withCString "x" $ \s -> SPI.c_write w2 (castPtr s) 1
+  forM_ ws2 $ \(_, d) -> takeMVar d >>= putStrLn
@@ -0,0 +1,58 @@
+{-# LANGUAGE MagicHash, UnboxedTuples #-}
+
+import Control.Monad
+import GHC.Exts
+import GHC.IO
+import System.Mem
+
+-- A large array that lives in the old generation is written to, frozen,
+-- and then survives minor GCs with its only pointers to the new values in
+-- a few marked cards (see Note [Scanning card tables] in rts/sm/Scav.c).
+
+data MArr = MArr (MutableArray# RealWorld (Maybe Int))
+data Arr  = Arr  (Array# (Maybe Int))
+
+size :: Int
+size = 1000000
+
+newArr :: IO MArr
+newArr = case size of
+  I# n -> IO $ \s -> case newArray# n Nothing s of
+                      (# s', a #) -> (# s', MArr a #)
+
+writeArr :: MArr -> Int -> Maybe Int -> IO ()
+writeArr (MArr a) (I# i) x = IO $ \s -> (# writeArray# a i x s, () #)
+
+freeze :: MArr -> IO Arr
+freeze (MArr a) = IO $ \s -> case unsafeFreezeArray# a s of
+                               (# s', b #) -> (# s', Arr b #)
+
+thaw :: Arr -> IO MArr
+thaw (Arr a) = IO $ \s -> case unsafeThawArray# a s of
+                            (# s', b #) -> (# s', MArr b #)
+
+index :: Arr -> Int -> Maybe Int
+index (Arr a) (I# i) = case indexArray# a i of (# x #) -> x
+
+total :: Arr -> Int
+total a = sum [ x | i <- [0, 7 .. size - 1], Just x <- [index a i] ]
+
+main :: IO ()
+main = do
+  ma <- newArr
+  performMajorGC
+  a0 <- freeze ma
+  a <- foldM step a0 [0, 7 .. 70]
+  performMajorGC
+  print (total a)
+ where
+  step a k = do
+    ma <- thaw a
+    forM_ [k, k + 7 * 9973 .. size - 1] $ \i ->
+      writeArr ma i (Just (i * k))
+    a' <- freeze ma
+    forM_ [1 .. 3 :: Int] $ \_ -> do
+      print (length (show [1 .. 10000 :: Int]))
+      performMinorGC
+    print (total a')
+    return a'
@@ -0,0 +1,14 @@
+{-# LANGUAGE MagicHash, UnboxedTuples #-}
+
+import GHC.Exts
+import GHC.IO
+
+-- Allocate a lot of large objects, which a sampling heap profile must
+-- see with any number of generations
+main :: IO ()
+main = do
+  mapM_ (\_ -> newArray) [1 .. 2000 :: Int]
+  print (length (filter even [1 .. 1000000 :: Int]))
+  where
+    newArray = IO $ \s -> case newByteArray# 65536# s of
+                            (# s', _ #) -> (# s', () #)
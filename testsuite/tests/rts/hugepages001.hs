@@ -0,0 +1,21 @@
+import qualified Data.Map as M
+
+-- Keeps a few hundred MB of heap alive across several major GCs, so that
+-- the block allocator commits, frees and recommits huge pages of the heap.
+-- While it is alive, /proc/self/smaps must show some of it in huge pages,
+-- transparent (AnonHugePages) or MAP_HUGETLB (*_Hugetlb).
+main = do
+  let m = M.fromList [ (i, show i) | i <- [1 .. 1000000 :: Int] ]
+  print (M.size m)
+  let m' = M.map reverse (M.filter ((== '7') . head) m)
+  print (M.size m', sum (map length (M.elems m')))
+  kb <- hugePageKB
+  putStrLn (if kb > 0 then "heap in huge pages" else "no huge pages")
+  print (M.foldl' (\n s -> n + length s) 0 m)
+
+hugePageKB :: IO Integer
+hugePageKB = do
+  smaps <- readFile "/proc/self/smaps"
+  return $ sum [ read kb | (field : kb : _) <- map words (lines smaps)
+                         , field `elem` [ "AnonHugePages:", "Shared_Hugetlb:"
+                                        , "Private_Hugetlb:" ] ]
@@ -0,0 +1,4 @@
+long answer(void)
+{
+    return 42;
+}
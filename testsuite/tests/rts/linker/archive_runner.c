@@ -0,0 +1,57 @@
+#include <Rts.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef long (*fun_t)(void);
+
+/* Load the archives and object files given on the command line, resolve
+ * them and call a function from one of them. */
+int main(int argc, char *argv[])
+{
+    fun_t f;
+    int i, ok;
+    char *symname;
+
+    hs_init(&argc, &argv);
+
+    initLinker();
+
+    if (argc < 3) {
+            errorBelch("usage: archive_runner <symname> <path>...");
+            exit(1);
+    }
+    symname = argv[1];
+
+    for (i = 2; i < argc; i++) {
+            size_t len = strlen(argv[i]);
+
+            if (len > 2 && strcmp(argv[i] + len - 2, ".a") == 0) {
+                    ok = loadArchive(argv[i]);
+            } else {
+                    ok = loadObj(argv[i]);
+            }
+            if (!ok) {
+                    errorBelch("loading %s failed", argv[i]);
+                    exit(1);
+            }
+    }
+
+    ok = resolveObjs();
+    if (!ok) {
+            errorBelch("resolveObjs failed");
+            exit(1);
+    }
+
+    f = lookupSymbol(symname);
+    if (!f) {
+            errorBelch("lookupSymbol failed");
+            exit(1);
+    }
+
+    printf("%s: %ld\n", symname, f());
+    fflush(stdout);
+
+    hs_exit();
+    return 0;
+}
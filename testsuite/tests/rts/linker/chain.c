@@ -0,0 +1,18 @@
+/* Compiled with -DN=<n> -DPREV=<n-1> into one link of a chain of objects
+ * that call each other */
+#define CAT(a,b) a##b
+#define XCAT(a,b) CAT(a,b)
+
+#if N > 0
+extern long XCAT(chain_, PREV)(void);
+
+long XCAT(chain_, N)(void)
+{
+    return XCAT(chain_, PREV)() + N;
+}
+#else
+long chain_0(void)
+{
+    return 0;
+}
+#endif
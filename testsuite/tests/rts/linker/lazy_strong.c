@@ -0,0 +1,4 @@
+long lazy_answer(void)
+{
+    return 42;
+}
@@ -0,0 +1,4 @@
+__attribute__((weak)) long lazy_answer(void)
+{
+    return 1;
+}
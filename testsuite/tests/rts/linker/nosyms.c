@@ -0,0 +1,2 @@
+/* An archive member that defines no symbols */
+typedef int nosyms_t;
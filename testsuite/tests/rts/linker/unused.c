@@ -0,0 +1,4 @@
+long unused(void)
+{
+    return 0;
+}
@@ -0,0 +1,26 @@
+import Control.Monad
+import Data.IORef
+import qualified Data.Map as M
+import System.Mem
+
+-- Enough old data that the compacting GC splits it up among several
+-- threads (see Note [Parallel compaction] in rts/sm/Compact.c), with
+-- pointers between the regions in both directions, from mutable
+-- objects, and to partial applications.
+main = do
+  let m0 = M.fromList [ (i, show i) | i <- [1 .. 200000 :: Int] ]
+  refs <- mapM (newIORef . (m0 M.!)) [1, 1001 .. 200000]
+  let fs = [ (+ i) | i <- [1 .. 10000 :: Int] ]
+  print (M.size m0, sum (map ($ 1) fs))
+  performMajorGC
+  m <- foldM (step refs) m0 [1 .. 5]
+  print (M.size m, M.foldl' (\n s -> n + length s) 0 m)
+  rs <- mapM readIORef refs
+  print (sum (map length rs), sum (map ($ 2) fs))
+ where
+  step refs m k = do
+    let m' = M.filterWithKey (\i _ -> i `mod` 7 /= k) m
+    print (M.size m')
+    forM_ (zip refs [k ..]) $ \(r, i) -> modifyIORef' r (take 6 . (++ show i))
+    performMajorGC
+    return m'
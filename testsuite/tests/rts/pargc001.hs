@@ -0,0 +1,33 @@
+import Control.Monad
+import Data.IORef
+import System.Mem
+
+-- Deep trees and a long list kept alive across parallel GCs with
+-- load-balancing in every generation, so that the GC threads share them
+-- out object by object (see Note [Sharing out objects] in rts/sm/Scav.c).
+-- Some of the objects are also reachable only from old mutable ones.
+
+data T = L | N T Int T
+
+build :: Int -> Int -> T
+build 0 _ = L
+build d i = N (build (d - 1) (2 * i)) i (build (d - 1) (2 * i + 1))
+
+total :: T -> Integer
+total L = 0
+total (N l i r) = total l + toInteger i + total r
+
+main :: IO ()
+main = do
+  let t = build 18 1
+      xs = [1 .. 300000 :: Int]
+  print (total t, sum (map toInteger xs))
+  refs <- mapM (newIORef . build 6) [1 .. 100]
+  performMajorGC
+  forM_ [1 .. 5] $ \k -> do
+    forM_ refs $ \r -> modifyIORef r (\u -> N u k (build 8 k))
+    performMinorGC
+    ts <- mapM readIORef refs
+    print (sum (map total ts))
+    performMajorGC
+  print (total t, sum (map toInteger xs), length xs)
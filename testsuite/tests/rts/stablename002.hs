@@ -0,0 +1,28 @@
+import Control.Monad
+import System.Mem
+import System.Mem.StableName
+
+-- Stable names must survive objects being promoted through the
+-- generations one minor GC at a time, since a minor GC only looks at the
+-- stable names of young objects (see Note [Generational stable names] in
+-- rts/StableName.c).
+
+main = do
+  let old = [ [i] | i <- [1..5000 :: Int] ]
+  sum (map sum old) `seq` return ()
+  ns1 <- mapM makeStableName old
+  performMajorGC
+
+  forM_ [1..3 :: Int] $ \round -> do
+    let young = [ [i, round] | i <- [1..5000 :: Int] ]
+    sum (map sum young) `seq` return ()
+    ys1 <- mapM makeStableName young
+    performMinorGC
+    ys2 <- mapM makeStableName young
+    performMinorGC
+    ys3 <- mapM makeStableName young
+    print (and (zipWith (==) ys1 ys2) && and (zipWith (==) ys2 ys3))
+
+  performMajorGC
+  ns2 <- mapM makeStableName old
+  print (and (zipWith (==) ns1 ns2))
@@ -0,0 +1,498 @@
+#include "Rts.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Test and microbenchmark for the RTS hash tables (rts/Hash.c).
+//
+// The workloads mimic the two heaviest users of the tables: the linker's
+// symbol table (string keys, many lookups, some of which miss), and the
+// StableName table (address keys, with entries moving to new addresses at
+// every GC).  Run with the argument "bench" to print timings to stderr, for
+// the RTS tables and for a copy of the chained tables that they replaced.
+
+typedef struct hashtable HashTable;
+
+extern HashTable *allocHashTable(void);
+extern HashTable *allocStrHashTable(void);
+extern void insertHashTable(HashTable *table, StgWord key, const void *data);
+extern void *lookupHashTable(const HashTable *table, StgWord key);
+extern void *removeHashTable(HashTable *table, StgWord key, const void *data);
+extern int keyCountHashTable(HashTable *table);
+extern int keysHashTable(HashTable *table, StgWord keys[], int szKeys);
+extern void freeHashTable(HashTable *table, void (*freeDataFun)(void *));
+
+#if defined(x86_64_HOST_ARCH)
+extern unsigned long long XXH64(const void *input, size_t length,
+                                unsigned long long seed);
+#else
+extern unsigned int XXH32(const void *input, size_t length, unsigned int seed);
+#endif
+
+#define NSYMS      200000
+#define NOBJS      100000
+#define GCS        20
+#define SEED       0xf00f00
+
+/* -----------------------------------------------------------------------------
+ * The dynamically expanding linear hash tables (separate chaining) that
+ * rts/Hash.c used before it switched to open addressing, kept here so that
+ * "bench" can compare the two on the same workloads.
+ * -------------------------------------------------------------------------- */
+
+#define HSEGSIZE    1024    /* Size of a single hash table segment */
+#define HDIRSIZE    1024    /* Size of the segment directory */
+#define HLOAD       5       /* Maximum average load of a single hash bucket */
+
+#define HCHUNK      (1024 * sizeof(W_) / sizeof(HashList))
+
+typedef struct hashlist {
+    StgWord key;
+    const void *data;
+    struct hashlist *next;
+} HashList;
+
+typedef struct chunklist {
+    HashList *chunk;
+    struct chunklist *next;
+} HashListChunk;
+
+typedef struct chainedtable ChainedTable;
+
+struct chainedtable {
+    int split;              /* Next bucket to split when expanding */
+    int max;                /* Max bucket of smaller table */
+    int mask1;              /* Mask for doing the mod of h_1 (smaller table) */
+    int mask2;              /* Mask for doing the mod of h_2 (larger table) */
+    int kcount;             /* Number of keys */
+    int bcount;             /* Number of buckets */
+    HashList **dir[HDIRSIZE];   /* Directory of segments */
+    HashList *freeList;
+    HashListChunk *chunks;
+    int (*hash)(const ChainedTable *table, StgWord key);
+    int (*compare)(StgWord key1, StgWord key2);
+};
+
+static int chainedBucket(const ChainedTable *table, StgWord h)
+{
+    int bucket = h & table->mask1;
+
+    if (bucket < table->split) {
+        bucket = h & table->mask2;
+    }
+    return bucket;
+}
+
+static int chainedHashWord(const ChainedTable *table, StgWord key)
+{
+    return chainedBucket(table, key / sizeof(StgWord));
+}
+
+static int chainedHashStr(const ChainedTable *table, StgWord w)
+{
+    const char *key = (char *)w;
+#if defined(x86_64_HOST_ARCH)
+    return chainedBucket(table, XXH64(key, strlen(key), 1048583));
+#else
+    return chainedBucket(table, XXH32(key, strlen(key), 1048583));
+#endif
+}
+
+static int chainedCompareWord(StgWord key1, StgWord key2)
+{
+    return key1 == key2;
+}
+
+static int chainedCompareStr(StgWord key1, StgWord key2)
+{
+    return strcmp((char *)key1, (char *)key2) == 0;
+}
+
+static void chainedExpand(ChainedTable *table)
+{
+    int oldsegment, oldindex, newbucket, newsegment, newindex;
+    HashList *hl, *next, *old, *new;
+
+    if (table->split + table->max >= HDIRSIZE * HSEGSIZE) return;
+
+    oldsegment = table->split / HSEGSIZE;
+    oldindex = table->split % HSEGSIZE;
+    newbucket = table->max + table->split;
+    newsegment = newbucket / HSEGSIZE;
+    newindex = newbucket % HSEGSIZE;
+
+    if (newindex == 0) {
+        table->dir[newsegment] = malloc(HSEGSIZE * sizeof(HashList *));
+    }
+
+    if (++table->split == table->max) {
+        table->split = 0;
+        table->max *= 2;
+        table->mask1 = table->mask2;
+        table->mask2 = table->mask2 << 1 | 1;
+    }
+    table->bcount++;
+
+    old = new = NULL;
+    for (hl = table->dir[oldsegment][oldindex]; hl != NULL; hl = next) {
+        next = hl->next;
+        if (table->hash(table, hl->key) == newbucket) {
+            hl->next = new;
+            new = hl;
+        } else {
+            hl->next = old;
+            old = hl;
+        }
+    }
+    table->dir[oldsegment][oldindex] = old;
+    table->dir[newsegment][newindex] = new;
+}
+
+static void *chainedLookup(void *t, StgWord key)
+{
+    ChainedTable *table = t;
+    int bucket = table->hash(table, key);
+    HashList *hl;
+
+    for (hl = table->dir[bucket / HSEGSIZE][bucket % HSEGSIZE]; hl != NULL;
+         hl = hl->next) {
+        if (table->compare(hl->key, key)) return (void *)hl->data;
+    }
+    return NULL;
+}
+
+static int chainedKeys(void *t, StgWord keys[], int szKeys)
+{
+    ChainedTable *table = t;
+    int segment = (table->max + table->split - 1) / HSEGSIZE;
+    int index = (table->max + table->split - 1) % HSEGSIZE;
+    int k = 0;
+    HashList *hl;
+
+    while (segment >= 0 && k < szKeys) {
+        while (index >= 0 && k < szKeys) {
+            for (hl = table->dir[segment][index]; hl && k < szKeys;
+                 hl = hl->next) {
+                keys[k++] = hl->key;
+            }
+            index--;
+        }
+        segment--;
+        index = HSEGSIZE - 1;
+    }
+    return k;
+}
+
+static void chainedInsert(void *t, StgWord key, const void *data)
+{
+    ChainedTable *table = t;
+    HashList *hl, *p;
+    HashListChunk *cl;
+    int bucket;
+
+    if (++table->kcount >= HLOAD * table->bcount) chainedExpand(table);
+
+    bucket = table->hash(table, key);
+
+    if ((hl = table->freeList) != NULL) {
+        table->freeList = hl->next;
+    } else {
+        hl = malloc(HCHUNK * sizeof(HashList));
+        cl = malloc(sizeof(*cl));
+        cl->chunk = hl;
+        cl->next = table->chunks;
+        table->chunks = cl;
+        table->freeList = hl + 1;
+        for (p = table->freeList; p < hl + HCHUNK - 1; p++) p->next = p + 1;
+        p->next = NULL;
+    }
+
+    hl->key = key;
+    hl->data = data;
+    hl->next = table->dir[bucket / HSEGSIZE][bucket % HSEGSIZE];
+    table->dir[bucket / HSEGSIZE][bucket % HSEGSIZE] = hl;
+}
+
+static void *chainedRemove(void *t, StgWord key, const void *data)
+{
+    ChainedTable *table = t;
+    int bucket = table->hash(table, key);
+    HashList **prev = &table->dir[bucket / HSEGSIZE][bucket % HSEGSIZE];
+    HashList *hl;
+
+    for (hl = *prev; hl != NULL; prev = &hl->next, hl = hl->next) {
+        if (table->compare(hl->key, key) && (data == NULL || hl->data == data)) {
+            *prev = hl->next;
+            hl->next = table->freeList;
+            table->freeList = hl;
+            table->kcount--;
+            return (void *)hl->data;
+        }
+    }
+    return NULL;
+}
+
+static int chainedKeyCount(void *t)
+{
+    return ((ChainedTable *)t)->kcount;
+}
+
+static void chainedFree(void *t)
+{
+    ChainedTable *table = t;
+    int segment = (table->max + table->split - 1) / HSEGSIZE;
+    HashListChunk *cl, *next;
+
+    for (; segment >= 0; segment--) {
+        free(table->dir[segment]);
+    }
+    for (cl = table->chunks; cl != NULL; cl = next) {
+        next = cl->next;
+        free(cl->chunk);
+        free(cl);
+    }
+    free(table);
+}
+
+static void *chainedAlloc(int (*hash)(const ChainedTable *, StgWord),
+                          int (*compare)(StgWord, StgWord))
+{
+    ChainedTable *table = malloc(sizeof(ChainedTable));
+    int i;
+
+    table->dir[0] = malloc(HSEGSIZE * sizeof(HashList *));
+    for (i = 0; i < HSEGSIZE; i++) table->dir[0][i] = NULL;
+    table->split = 0;
+    table->max = HSEGSIZE;
+    table->mask1 = HSEGSIZE - 1;
+    table->mask2 = 2 * HSEGSIZE - 1;
+    table->kcount = 0;
+    table->bcount = HSEGSIZE;
+    table->freeList = NULL;
+    table->chunks = NULL;
+    table->hash = hash;
+    table->compare = compare;
+    return table;
+}
+
+static void *chainedAllocWord(void)
+{
+    return chainedAlloc(chainedHashWord, chainedCompareWord);
+}
+
+static void *chainedAllocStr(void)
+{
+    return chainedAlloc(chainedHashStr, chainedCompareStr);
+}
+
+/* -----------------------------------------------------------------------------
+ * The workloads run on either implementation.
+ * -------------------------------------------------------------------------- */
+
+typedef struct {
+    const char *name;
+    void *(*allocWord)(void);
+    void *(*allocStr)(void);
+    void (*insert)(void *table, StgWord key, const void *data);
+    void *(*lookup)(void *table, StgWord key);
+    void *(*remove)(void *table, StgWord key, const void *data);
+    int (*keyCount)(void *table);
+    int (*keys)(void *table, StgWord keys[], int szKeys);
+    void (*free)(void *table);
+} HashImpl;
+
+static void *rtsAllocWord(void) { return allocHashTable(); }
+static void *rtsAllocStr(void) { return allocStrHashTable(); }
+static void rtsInsert(void *t, StgWord key, const void *data)
+    { insertHashTable(t, key, data); }
+static void *rtsLookup(void *t, StgWord key) { return lookupHashTable(t, key); }
+static void *rtsRemove(void *t, StgWord key, const void *data)
+    { return removeHashTable(t, key, data); }
+static int rtsKeyCount(void *t) { return keyCountHashTable(t); }
+static int rtsKeys(void *t, StgWord keys[], int szKeys)
+    { return keysHashTable(t, keys, szKeys); }
+static void rtsFree(void *t) { freeHashTable(t, NULL); }
+
+static const HashImpl rtsImpl = {
+    "rts", rtsAllocWord, rtsAllocStr, rtsInsert, rtsLookup, rtsRemove,
+    rtsKeyCount, rtsKeys, rtsFree
+};
+
+static const HashImpl chainedImpl = {
+    "chained", chainedAllocWord, chainedAllocStr, chainedInsert, chainedLookup,
+    chainedRemove, chainedKeyCount, chainedKeys, chainedFree
+};
+
+static int bench = 0;
+static const HashImpl *impl;
+static struct timespec start;
+
+static void startClock(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &start);
+}
+
+static void stopClock(const char *what, long ops)
+{
+    struct timespec end;
+    double ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    if (bench) {
+        fprintf(stderr, "%-8s %-24s %8.1f ns/op\n", impl->name, what,
+                ns / ops);
+    }
+}
+
+// The linker inserts every symbol it loads into a string table and looks
+// up every undefined symbol while resolving relocations.
+static void linkerWorkload(void)
+{
+    void *t = impl->allocStr();
+    char **names = malloc(NSYMS * sizeof(char *));
+    char buf[64];
+    long i, j, found = 0;
+
+    for (i = 0; i < NSYMS; i++) {
+        snprintf(buf, sizeof(buf), "base_GHCziBase_sym%ld_closure", i);
+        names[i] = strdup(buf);
+    }
+
+    startClock();
+    for (i = 0; i < NSYMS; i++) {
+        impl->insert(t, (StgWord)names[i], names[i]);
+    }
+    stopClock("linker: insert", NSYMS);
+    CHECK(impl->keyCount(t) == NSYMS);
+
+    startClock();
+    for (j = 0; j < 10; j++) {
+        for (i = 0; i < NSYMS; i++) {
+            // every fourth lookup misses
+            if (i % 4 == 0) {
+                snprintf(buf, sizeof(buf), "base_GHCziBase_sym%ld_info", i);
+                if (impl->lookup(t, (StgWord)buf) != NULL) found++;
+            } else {
+                if (impl->lookup(t, (StgWord)names[i]) == names[i]) found++;
+            }
+        }
+    }
+    stopClock("linker: lookup", 10 * NSYMS);
+    CHECK(found == 10 * (NSYMS - NSYMS / 4));
+
+    // a copy of a key finds the same entry
+    snprintf(buf, sizeof(buf), "base_GHCziBase_sym%d_closure", 42);
+    CHECK(impl->lookup(t, (StgWord)buf) == names[42]);
+
+    startClock();
+    for (i = 0; i < NSYMS; i += 2) {
+        CHECK(impl->remove(t, (StgWord)names[i], NULL) == names[i]);
+    }
+    stopClock("linker: remove", NSYMS / 2);
+    CHECK(impl->keyCount(t) == NSYMS / 2);
+    for (i = 0; i < NSYMS; i++) {
+        CHECK(impl->lookup(t, (StgWord)names[i]) ==
+              (i % 2 == 0 ? NULL : names[i]));
+    }
+
+    impl->free(t);
+    for (i = 0; i < NSYMS; i++) {
+        free(names[i]);
+    }
+    free(names);
+    printf("linker workload ok\n");
+}
+
+// lookupStableName maps the address of every object that has a StableName
+// to its index in the table, and updateStableNameTable moves the entries
+// of the objects that the GC moved.
+static void stableNameWorkload(void)
+{
+    void *t = impl->allocWord();
+    StgWord *addr = malloc(NOBJS * sizeof(StgWord));
+    StgWord *keys = malloc(NOBJS * sizeof(StgWord));
+    StgWord next = 0x42000000;
+    long i, g, found = 0;
+
+    startClock();
+    for (i = 0; i < NOBJS; i++) {
+        next += 8 * (1 + rand() % 8);
+        addr[i] = next;
+        impl->insert(t, addr[i], (void *)(i + 1));
+    }
+    stopClock("stablename: insert", NOBJS);
+
+    startClock();
+    for (g = 0; g < GCS; g++) {
+        // the GC moves about a third of the objects to fresh addresses
+        for (i = g % 3; i < NOBJS; i += 3) {
+            CHECK(impl->remove(t, addr[i], NULL) == (void *)(i + 1));
+            next += 8 * (1 + rand() % 8);
+            addr[i] = next;
+            impl->insert(t, addr[i], (void *)(i + 1));
+        }
+    }
+    stopClock("stablename: move", GCS * ((NOBJS + 2) / 3));
+    CHECK(impl->keyCount(t) == NOBJS);
+
+    startClock();
+    for (g = 0; g < 10; g++) {
+        for (i = 0; i < NOBJS; i++) {
+            if (impl->lookup(t, addr[i]) == (void *)(i + 1)) found++;
+            // an address that is not in the table
+            if (impl->lookup(t, addr[i] + 4) != NULL) found--;
+        }
+    }
+    stopClock("stablename: lookup", 20 * NOBJS);
+    CHECK(found == 10 * NOBJS);
+
+    CHECK(impl->keys(t, keys, NOBJS) == NOBJS);
+    for (i = 0; i < NOBJS; i++) {
+        CHECK(impl->lookup(t, keys[i]) != NULL);
+    }
+
+    // inserting a key that is already present replaces its data (the
+    // chained tables added a second entry instead)
+    if (impl == &rtsImpl) {
+        impl->insert(t, addr[0], (void *)42);
+        CHECK(impl->lookup(t, addr[0]) == (void *)42);
+        CHECK(impl->keyCount(t) == NOBJS);
+
+        CHECK(impl->remove(t, addr[1], NULL) == (void *)2);
+        CHECK(impl->keyCount(t) == NOBJS - 1);
+    }
+
+    impl->free(t);
+    free(addr);
+    free(keys);
+    printf("stablename workload ok\n");
+}
+
+int main (int argc, char *argv[])
+{
+    srand(SEED);
+
+    {
+        RtsConfig conf = defaultRtsConfig;
+        conf.rts_opts_enabled = RtsOptsAll;
+        hs_init_ghc(&argc, &argv, conf);
+    }
+
+    bench = argc > 1 && strcmp(argv[1], "bench") == 0;
+
+    impl = &rtsImpl;
+    linkerWorkload();
+    stableNameWorkload();
+
+    if (bench) {
+        impl = &chainedImpl;
+        srand(SEED);
+        linkerWorkload();
+        stableNameWorkload();
+    }
+
+    hs_exit();
+    return 0;
+}
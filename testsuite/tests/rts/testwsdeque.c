@@ -14,6 +14,7 @@ StgWord scratch[SCRATCH_SIZE];
 StgWord done;
 
 OSThreadId ids[THREADS];
+OSThreadId half_id;
 
 // -----------------------------------------------------------------------------
 // version of stealWSDeque() that logs its actions, for debugging
@@ -138,6 +139,20 @@ void OSThreadProcAttr thief(void *info)
     debugBelch("thread %ld finished, stole %d", n, count);
 }
 
+// A thief that takes up to half of the deque at a time, racing with the
+// single-element thieves and the owner
+void OSThreadProcAttr halfThief(void *info STG_UNUSED)
+{
+    void *ps[8];
+    uint32_t i, got, count = 0;
+
+    while (!done) {
+        got = stealHalfWSDeque_(q,ps,8);
+        for (i = 0; i < got; i++) { work(ps[i],THREADS+1); count++; }
+    }
+    debugBelch("half thief finished, stole %d", count);
+}
+
 int main(int argc, char*argv[])
 {
     int n;
@@ -154,6 +169,7 @@ int main(int argc, char*argv[])
     for (n=0; n < THREADS; n++) {
         createOSThread(&ids[n], "thief", thief, (void*)(StgWord)n);
     }
+    createOSThread(&half_id, "thief", halfThief, NULL);
 
     for (n=0; n < SCRATCH_SIZE; n++) {
         if (n % POP) {
@@ -0,0 +1,378 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2019
+ *
+ * eventlog-decode: turn a compact eventlog, written with +RTS
+ * --eventlog-compact, back into an ordinary eventlog that ghc-events and
+ * ThreadScope can read.
+ *
+ * The format is described in Note [Compact eventlog] in
+ * rts/eventlog/EventLogCompact.c; keep the two in sync.
+ *
+ * Usage: eventlog-decode [<input> [<output>]]
+ *
+ * reads standard input and writes standard output when a file is omitted
+ * or "-", so it can also decode an eventlog that is being streamed.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAGIC      "ghcevz01"
+#define MAGIC_SIZE 8
+
+#define FRAME_STORED 0
+#define FRAME_EVENTS 1
+
+#define LZ_MIN_MATCH 4
+
+/* from includes/rts/EventLogFormat.h */
+#define EVENT_HEADER_BEGIN 0x68647262 /* 'h' 'd' 'r' 'b' */
+#define EVENT_HET_BEGIN    0x68657462 /* 'h' 'e' 't' 'b' */
+#define EVENT_ET_BEGIN     0x65746200 /* 'e' 't' 'b' 0 */
+#define EVENT_ET_END       0x65746500 /* 'e' 't' 'e' 0 */
+#define VARIABLE_SIZE      0xffff
+
+static const char *prog = "eventlog-decode";
+static const char *input_name = "<stdin>";
+
+/* The payload size of each event in the header, -1 if it isn't there */
+static int32_t event_sizes[0x10000];
+static int have_header = 0;
+
+static void
+die (const char *msg)
+{
+    fprintf(stderr, "%s: %s: %s\n", prog, input_name, msg);
+    exit(1);
+}
+
+static void *
+xmalloc (size_t size)
+{
+    void *p = malloc(size > 0 ? size : 1);
+    if (p == NULL) {
+        die("out of memory");
+    }
+    return p;
+}
+
+/* -----------------------------------------------------------------------------
+   Reading the input
+   -------------------------------------------------------------------------- */
+
+static int
+readByte (FILE *in, int *eof_ok)
+{
+    int c = getc(in);
+    if (c == EOF) {
+        if (eof_ok != NULL) {
+            *eof_ok = 1;
+            return 0;
+        }
+        die("unexpected end of file");
+    }
+    return c;
+}
+
+static uint64_t
+readVarint (FILE *in)
+{
+    uint64_t v = 0;
+    int shift = 0, c;
+
+    do {
+        if (shift > 63) {
+            die("bad varint");
+        }
+        c = readByte(in, NULL);
+        v |= (uint64_t)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return v;
+}
+
+/* Decoding a buffer in memory */
+typedef struct {
+    const uint8_t *p, *end;
+} Cursor;
+
+static uint64_t
+getVarint (Cursor *c)
+{
+    uint64_t v = 0;
+    int shift = 0;
+    uint8_t b;
+
+    do {
+        if (c->p == c->end || shift > 63) {
+            die("bad varint in frame");
+        }
+        b = *c->p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return v;
+}
+
+static uint64_t
+getBigEndian (Cursor *c, size_t bytes)
+{
+    uint64_t r = 0;
+
+    if ((size_t)(c->end - c->p) < bytes) {
+        die("truncated header");
+    }
+    for (size_t i = 0; i < bytes; i++) {
+        r = (r << 8) | *c->p++;
+    }
+    return r;
+}
+
+static void
+putBigEndian (uint8_t **p, uint64_t v, size_t bytes)
+{
+    for (size_t i = bytes; i > 0; i--) {
+        (*p)[i-1] = (uint8_t)v;
+        v >>= 8;
+    }
+    *p += bytes;
+}
+
+/* -----------------------------------------------------------------------------
+   The header, which gives us the sizes of the events
+   -------------------------------------------------------------------------- */
+
+static void
+readHeader (const uint8_t *buf, size_t size)
+{
+    Cursor c = { buf, buf + size };
+
+    for (int i = 0; i < 0x10000; i++) {
+        event_sizes[i] = -1;
+    }
+    if (getBigEndian(&c, 4) != EVENT_HEADER_BEGIN
+        || getBigEndian(&c, 4) != EVENT_HET_BEGIN) {
+        die("the first frame is not an eventlog header");
+    }
+    while (getBigEndian(&c, 4) == EVENT_ET_BEGIN) {
+        uint16_t tag = getBigEndian(&c, 2);
+        uint16_t event_size = getBigEndian(&c, 2);
+        uint32_t desc_len = getBigEndian(&c, 4);
+        uint32_t ext_len;
+
+        if ((size_t)(c.end - c.p) < desc_len) {
+            die("truncated header");
+        }
+        c.p += desc_len;
+        ext_len = getBigEndian(&c, 4);
+        if ((size_t)(c.end - c.p) < ext_len) {
+            die("truncated header");
+        }
+        c.p += ext_len;
+        if (getBigEndian(&c, 4) != EVENT_ET_END) {
+            die("bad event type in header");
+        }
+        event_sizes[tag] = event_size;
+    }
+    have_header = 1;
+}
+
+/* -----------------------------------------------------------------------------
+   Frames
+   -------------------------------------------------------------------------- */
+
+/* Undo the LZ compression of a frame */
+static size_t
+lzDecompress (const uint8_t *in, size_t size, uint8_t *out, size_t out_size)
+{
+    Cursor c = { in, in + size };
+    uint8_t *op = out, *oend = out + out_size;
+
+    while (c.p < c.end) {
+        uint8_t token = *c.p++;
+        size_t n_literals = token >> 4;
+        size_t match_length = token & 0xf;
+        size_t offset;
+
+        if (n_literals == 15) {
+            n_literals += getVarint(&c);
+        }
+        if ((size_t)(c.end - c.p) < n_literals
+            || (size_t)(oend - op) < n_literals) {
+            die("corrupt frame (literals)");
+        }
+        memcpy(op, c.p, n_literals);
+        op += n_literals;
+        c.p += n_literals;
+
+        if (c.p == c.end) {
+            break; // the last sequence
+        }
+
+        if (c.end - c.p < 2) {
+            die("corrupt frame (offset)");
+        }
+        offset = c.p[0] | (c.p[1] << 8);
+        c.p += 2;
+        if (match_length == 15) {
+            match_length += getVarint(&c);
+        }
+        match_length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - out)
+            || (size_t)(oend - op) < match_length) {
+            die("corrupt frame (match)");
+        }
+        // byte by byte: the match may overlap what it produces
+        for (size_t i = 0; i < match_length; i++, op++) {
+            *op = *(op - offset);
+        }
+    }
+    return op - out;
+}
+
+/* Expand the varint tags and timestamp deltas of a block of events */
+static void
+decodeEvents (const uint8_t *in, size_t size, uint8_t *out, size_t raw_size)
+{
+    Cursor c = { in, in + size };
+    uint8_t *op = out, *oend = out + raw_size;
+    uint64_t prev = 0;
+
+    while (c.p < c.end) {
+        uint64_t tag = getVarint(&c);
+        uint64_t zz = getVarint(&c);
+        uint64_t delta = (zz >> 1) ^ (0 - (zz & 1));
+        size_t payload;
+        int variable;
+
+        if (tag > 0xffff || event_sizes[tag] < 0) {
+            die("unknown event in frame");
+        }
+        variable = event_sizes[tag] == VARIABLE_SIZE;
+        payload = variable ? getVarint(&c) : (size_t)event_sizes[tag];
+
+        if ((size_t)(oend - op) < 2 + 8 + (variable ? 2 : 0) + payload
+            || (size_t)(c.end - c.p) < payload) {
+            die("corrupt frame (events)");
+        }
+        prev += delta;
+        putBigEndian(&op, tag, 2);
+        putBigEndian(&op, prev, 8);
+        if (variable) {
+            putBigEndian(&op, payload, 2);
+        }
+        memcpy(op, c.p, payload);
+        op += payload;
+        c.p += payload;
+    }
+    if (op != oend) {
+        die("corrupt frame (size)");
+    }
+}
+
+static int
+decodeFrame (FILE *in, FILE *out)
+{
+    int eof = 0;
+    int kind = readByte(in, &eof);
+    uint64_t raw_size, data_size;
+    uint8_t *data, *raw;
+
+    if (eof) {
+        return 0;
+    }
+    raw_size = readVarint(in);
+    data_size = readVarint(in);
+    if (raw_size > (1 << 30) || data_size > (1 << 30)) {
+        die("frame too big");
+    }
+
+    data = xmalloc(data_size);
+    if (fread(data, 1, data_size, in) != data_size) {
+        die("unexpected end of file");
+    }
+
+    switch (kind) {
+    case FRAME_STORED:
+        if (data_size != raw_size) {
+            die("corrupt frame (stored)");
+        }
+        raw = data;
+        data = NULL;
+        break;
+
+    case FRAME_EVENTS: {
+        if (!have_header) {
+            die("events before the header");
+        }
+        // the events are never longer than 1.5 times the raw block
+        size_t bound = raw_size + raw_size / 2 + 16;
+        uint8_t *events = xmalloc(bound);
+        size_t n_events = lzDecompress(data, data_size, events, bound);
+        raw = xmalloc(raw_size);
+        decodeEvents(events, n_events, raw, raw_size);
+        free(events);
+        break;
+    }
+
+    default:
+        die("unknown kind of frame");
+    }
+
+    if (!have_header) {
+        readHeader(raw, raw_size);
+    }
+    if (fwrite(raw, 1, raw_size, out) != raw_size) {
+        fprintf(stderr, "%s: can't write output\n", prog);
+        exit(1);
+    }
+    free(raw);
+    free(data);
+    return 1;
+}
+
+int
+main (int argc, char *argv[])
+{
+    FILE *in = stdin, *out = stdout;
+    char magic[MAGIC_SIZE];
+
+    if (argc > 3 || (argc > 1 && strcmp(argv[1], "--help") == 0)) {
+        fprintf(stderr, "usage: %s [<input.ceventlog> [<output.eventlog>]]\n",
+                prog);
+        exit(argc > 3);
+    }
+    if (argc > 1 && strcmp(argv[1], "-") != 0) {
+        input_name = argv[1];
+        if ((in = fopen(input_name, "rb")) == NULL) {
+            perror(input_name);
+            exit(1);
+        }
+    }
+    if (argc > 2 && strcmp(argv[2], "-") != 0) {
+        if ((out = fopen(argv[2], "wb")) == NULL) {
+            perror(argv[2]);
+            exit(1);
+        }
+    }
+
+    if (fread(magic, 1, MAGIC_SIZE, in) != MAGIC_SIZE
+        || memcmp(magic, MAGIC, MAGIC_SIZE) != 0) {
+        die("not a compact eventlog (was it written with "
+            "+RTS --eventlog-compact?)");
+    }
+
+    while (decodeFrame(in, out)) {
+        // keep going
+    }
+
+    if (fclose(out) != 0) {
+        fprintf(stderr, "%s: can't write output\n", prog);
+        exit(1);
+    }
+    return 0;
+}
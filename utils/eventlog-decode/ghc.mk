@@ -0,0 +1,32 @@
+# -----------------------------------------------------------------------------
+#
+# (c) 2019 The University of Glasgow
+#
+# This file is part of the GHC build system.
+#
+# To understand how the build system works and how to modify it, see
+#      https://gitlab.haskell.org/ghc/ghc/wikis/building/architecture
+#      https://gitlab.haskell.org/ghc/ghc/wikis/building/modifying
+#
+# -----------------------------------------------------------------------------
+
+# stage0
+utils/eventlog-decode_dist_C_SRCS          = Main.c
+utils/eventlog-decode_dist_PROGNAME        = eventlog-decode
+utils/eventlog-decode_dist_INSTALL_INPLACE = YES
+
+# stage 1
+utils/eventlog-decode_dist-install_C_SRCS = $(utils/eventlog-decode_dist_C_SRCS)
+utils/eventlog-decode_dist-install_PROGNAME        = $(utils/eventlog-decode_dist_PROGNAME)
+utils/eventlog-decode_dist-install_INSTALL_INPLACE = NO
+
+ifeq "$(Stage1Only)" "YES"
+utils/eventlog-decode_dist_INSTALL         = YES
+utils/eventlog-decode_dist-install_INSTALL = NO
+else
+utils/eventlog-decode_dist_INSTALL         = NO
+utils/eventlog-decode_dist-install_INSTALL = YES
+endif
+
+$(eval $(call build-prog,utils/eventlog-decode,dist,0))
+$(eval $(call build-prog,utils/eventlog-decode,dist-install,1))